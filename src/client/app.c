@@ -66,7 +66,15 @@ void App_cleanup() {
     Debug("Cleaning up client success");
   }
 
-  if (messages != NULL) CQueue_free(&messages);
+  if (messages != NULL) {
+    // Free the messages that were never displayed
+    QueueData *item = NULL;
+    while ((item = CQueue_tryPop(messages)) != NULL) {
+      C2HMessage_free((C2HMessage **)item->content);
+      QueueData_free(&item);
+    }
+    CQueue_free(&messages);
+  }
 }
 
 /// Sets the termination flag on SIGINT or SIGTERM
@@ -223,9 +231,11 @@ void *App_listen(void *data) {
       while (true) {
         C2HMessage *response = C2HMessage_get(buffer);
         if (response == NULL) break;
-        // Push the message to be read by the main thread
-        CQueue_push(messages, response, sizeof(C2HMessage));
-        C2HMessage_free(&response);
+        // Push the message to be read by the main thread,
+        // which takes ownership of it
+        if (!CQueue_push(messages, &response, sizeof(C2HMessage *))) {
+          C2HMessage_free(&response);
+        }
       }
 
       // Alert the main thread that there are messages to read
@@ -254,11 +264,13 @@ void *App_listen(void *data) {
  */
 void App_updateHandler() {
   while (true) {
-    // Item content (void*) is actually a C2HMessage*,
-    // length is sizeof(C2HMessage)
+    // Item content (void*) is actually a C2HMessage**,
+    // length is sizeof(C2HMessage *)
     QueueData *item = CQueue_tryPop(messages);
     if (item == NULL) break;
-    UILogMessage(item->content);
+    C2HMessage *message = *(C2HMessage **)item->content;
+    UILogMessage(message);
+    C2HMessage_free(&message);
     QueueData_free(&item);
   }
 }
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <fcntl.h>
 
 #include <openssl/crypto.h>
 #include <openssl/x509.h>
@@ -57,12 +58,77 @@ typedef struct _C2HatClient {
   STACK_OF(X509) *chain;       ///< SSL certificate chain from the server
   MessageBuffer buffer;        ///< Data read from server connection
   char logFilePath[kMaxPath];  ///< Path to the log file
+  char sessionDirPath[kMaxPath]; ///< Directory of the cached TLS sessions
+  char sessionFilePath[kMaxPath]; ///< Cached TLS session of the current server
   unsigned int logLevel;       ///< Default log level
+  bool binaryProtocol;         ///< Offer the binary protocol during the handshake
 } C2HatClient;
 
 /// Keeps track of SSL initialisation that should happen only once
 static bool sslInit = false;
 
+/**
+ * Stores a new TLS session received from the server, so that the next
+ * connection can resume it without a full handshake. With TLS 1.3 the
+ * session tickets are sent after the handshake, when data is read.
+ * @param[in] ssl     The connection that received the session
+ * @param[in] session The new session
+ * @param[out] 0, the session is not kept by the caller
+ */
+static int Client_saveSession(SSL *ssl, SSL_SESSION *session) {
+  C2HatClient *this = (C2HatClient *)SSL_get_app_data(ssl);
+  if (this == NULL || this->sessionFilePath[0] == '\0') return 0;
+
+  // Replace the file atomically, other clients may be reading it
+  char temp[kMaxPath + 8] = {};
+  snprintf(temp, sizeof(temp), "%s.XXXXXX", this->sessionFilePath);
+  int fd = mkstemp(temp);
+  if (fd < 0) return 0;
+  FILE *file = fdopen(fd, "w");
+  if (file == NULL) {
+    close(fd);
+    unlink(temp);
+    return 0;
+  }
+  bool saved = PEM_write_SSL_SESSION(file, session);
+  if (fclose(file) != 0 || !saved || rename(temp, this->sessionFilePath) != 0) {
+    unlink(temp);
+    return 0;
+  }
+  Debug("TLS session saved to %s", this->sessionFilePath);
+  return 0;
+}
+
+/**
+ * Offers the cached TLS session for the given server, if any
+ * @param[in] this C2HatClient structure holding the connection information
+ * @param[in] host Remote server host name or IP address
+ * @param[in] port Remote server port
+ */
+static void Client_loadSession(C2HatClient *this, const char *host, const char *port) {
+  this->sessionFilePath[0] = '\0';
+  if (this->sessionDirPath[0] == '\0') return;
+  int length = snprintf(
+    this->sessionFilePath, sizeof(this->sessionFilePath),
+    "%s/%s_%s.pem", this->sessionDirPath, host, port
+  );
+  if (length < 0 || (size_t)length >= sizeof(this->sessionFilePath)
+    || strchr(host, '/') != NULL || strchr(port, '/') != NULL) {
+    this->sessionFilePath[0] = '\0';
+    return;
+  }
+  SSL_set_app_data(this->ssl, this);
+
+  FILE *file = fopen(this->sessionFilePath, "r");
+  if (file == NULL) return;
+  SSL_SESSION *session = PEM_read_SSL_SESSION(file, NULL, NULL, NULL);
+  fclose(file);
+  if (session == NULL) return;
+  // An expired or unusable session would be ignored by the server anyway
+  if (SSL_SESSION_is_resumable(session)) SSL_set_session(this->ssl, session);
+  SSL_SESSION_free(session);
+}
+
 /**
  * Initialises the OpenSSL library functions
  */
@@ -123,6 +189,13 @@ SSL_CTX *Client_ssl_init(const char *caCert, const char *caPath, char *error, si
   }
   // Tell OpenSSL to automatically check the server certificate or fail
   SSL_CTX_set_verify(context, SSL_VERIFY_PEER, NULL);
+
+  // Sessions are cached on disk to be resumed after a restart or reconnection
+  // See https://www.openssl.org/docs/man3.0/man3/SSL_CTX_sess_set_new_cb.html
+  SSL_CTX_set_session_cache_mode(
+    context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE
+  );
+  SSL_CTX_sess_set_new_cb(context, Client_saveSession);
   return context;
 }
 
@@ -145,6 +218,8 @@ C2HatClient *Client_create(ClientOptions *options) {
   client->out = stdout;
   client->err = stderr;
   client->logLevel = options->logLevel;
+  client->binaryProtocol = options->binaryProtocol;
+  memcpy(client->sessionDirPath, options->sessionDirPath, sizeof(client->sessionDirPath));
   // Create the log file path, doing it in 2 steps because snprintf() complains
   // about a possible format overflow
   strncpy(client->logFilePath, options->logDirPath, sizeof(client->logFilePath));
@@ -246,6 +321,16 @@ bool Client_connect(C2HatClient *this, const char *host, const char *port) {
       return false;
     }
   }
+  // Offer the binary protocols with ALPN, the server may still choose the text one
+  // See https://www.openssl.org/docs/man3.0/man3/SSL_set_alpn_protos.html
+  if (this->binaryProtocol) {
+    static const unsigned char kProtocols[] = kMessageProtocolList;
+    if (SSL_set_alpn_protos(this->ssl, kProtocols, sizeof(kProtocols) - 1) != 0) {
+      fprintf(this->err, "❌ Error: SSL_set_alpn_protos() failed.\n");
+      return false;
+    }
+  }
+  Client_loadSession(this, host, port);
   SSL_set_fd(this->ssl, this->server);
   int connected;
   while (true) {
@@ -272,7 +357,21 @@ bool Client_connect(C2HatClient *this, const char *host, const char *port) {
     break; // out of the SSL_connect() loop
   }
   fprintf(this->err, "OK!\n\n");
-  fprintf(this->err, "🔐 SSL/TLS using %s\n", SSL_get_cipher(this->ssl));
+  fprintf(
+    this->err, "🔐 SSL/TLS using %s%s\n", SSL_get_cipher(this->ssl),
+    SSL_session_reused(this->ssl) ? " (resumed session)" : ""
+  );
+
+  // Servers that don't support the binary protocol don't select any
+  const unsigned char *selected = NULL;
+  unsigned int selectedLength = 0;
+  SSL_get0_alpn_selected(this->ssl, &selected, &selectedLength);
+  MessageProtocol protocol = MessageProtocol_parse(selected, selectedLength);
+  MessageBuffer_clear(&(this->buffer));
+  MessageBuffer_setProtocol(&(this->buffer), protocol);
+  if (this->binaryProtocol) {
+    fprintf(this->err, "📦 Protocol %s\n", MESSAGE_PROTOCOL_NAME(protocol));
+  }
 
   // Download certificate
   X509 *cert = SSL_get_peer_certificate(this->ssl);
@@ -381,40 +480,14 @@ void *Client_getBuffer(C2HatClient *this) {
  * @param[out] The number of bytes received
  */
 int Client_receive(C2HatClient *this) {
-  // Max length of data we can read into the buffer
-  size_t length = sizeof(this->buffer.data);
-  Debug("Client_receive - max buffer size: %zu", length);
-
-  // Pointer to the end of the buffer, to prevent overflow
-  char *eob = this->buffer.data + length -1;
-
-  // Manage buffer status
-  if (this->buffer.start != this->buffer.data && *eob != 0) {
-    // There is leftover data from a previous read
-    size_t remainingTextSize = eob - this->buffer.start + 1;
-    // Move the leftover data at the beginning of the buffer...
-    memcpy(this->buffer.data, this->buffer.start, remainingTextSize);
-    // ...and pad the rest with NULL terminators
-    for (size_t i = length; i >= remainingTextSize; i--) {
-      *(this->buffer.data + i) = 0;
-    }
-    // Set the buffer to start reading at the end of the leftover data
-    this->buffer.start = this->buffer.data + remainingTextSize + 1;
-    length = eob - this->buffer.start + 1; // new buffer start
-    Debug("Client_receive - remaining text size: %zu", remainingTextSize);
-    Debug("Client_receive - new max buffer size: %zu", length);
-  } else {
-    // buffer.start != NULL: all data has been already read, no leftover
-    // buffer.start == NULL: newly created buffer
-    // In either case, reset everything
-    this->buffer.start = this->buffer.data;
-    memset(this->buffer.data, 0, length); // Reset buffer
-  }
+  // Read into the free space of the ring buffer, without moving the leftover data
+  size_t length = 0;
+  char *space = MessageBuffer_reserve(&(this->buffer), &length);
+  Debug("Client_receive - max read size: %zu", length);
 
-  Debug("Client_receive - starting at: %zu", this->buffer.start - this->buffer.data);
   while (true) {
-    int bytesReceived = SSL_read(this->ssl, this->buffer.start, length);
-    Debug("Client_receive - received (%d bytes): %.*s", bytesReceived, bytesReceived, this->buffer.start);
+    int bytesReceived = SSL_read(this->ssl, space, length);
+    Debug("Client_receive - received (%d bytes): %.*s", bytesReceived, bytesReceived, space);
 
     if (bytesReceived == 0) {
       fprintf(this->err, "Client_receive - Connection closed by remote server\n");
@@ -433,11 +506,27 @@ int Client_receive(C2HatClient *this) {
     }
     // Got data
     if (bytesReceived > 0 ) {
+      MessageBuffer_commit(&(this->buffer), bytesReceived);
       return bytesReceived;
     }
   }
 }
 
+/**
+ * Returns the next message from the server, the messages already
+ * in the buffer are returned first, otherwise it waits for more data
+ * The returned message needs to be freed with C2HMessage_free()
+ * @param[in] this C2HatClient structure holding the connection information
+ * @param[out] The received message, or NULL if the connection failed
+ */
+static C2HMessage *Client_receiveMessage(C2HatClient *this) {
+  C2HMessage *message = NULL;
+  while ((message = C2HMessage_get(&(this->buffer))) == NULL) {
+    if (Client_receive(this) < 0) return NULL;
+  }
+  return message;
+}
+
 /**
  * Sends data through the client's socket using a loop
  * to ensure all the given data is sent
@@ -459,12 +548,29 @@ int Client_send(const C2HatClient *this, const C2HMessage *message) {
   size_t total = 0;
 
   char buffer[kBufferSize] = {};
-  size_t length = C2HMessage_format(message, buffer, sizeof(buffer));
+  char *frame = buffer;
+  size_t length = 0;
+  if (this->buffer.protocol != kMessageProtocolText) {
+    // Binary frames can be larger than the text buffer
+    size_t size = C2HMessage_binarySize(message);
+    if (size > sizeof(buffer) && (frame = malloc(size)) == NULL) {
+      Error("Unable to allocate %zu bytes for message", size);
+      return -1;
+    }
+    length = C2HMessage_encode(message, frame, size);
+    if (length == 0) {
+      Error("Unable to encode message");
+      if (frame != buffer) free(frame);
+      return -1;
+    }
+    Debug("Client_send - about to send (%zu): binary", length);
+  } else {
+    length = C2HMessage_format(message, buffer, sizeof(buffer));
+    Debug("Client_send - about to send (%zu): %s", length, buffer);
+  }
 
   // Cursor pointing to the beginning of the message
-  char *data = (char*)buffer;
-
-  Debug("Client_send - about to send (%zu): %s", length, data);
+  char *data = frame;
 
   // Keep sending data until the buffer is empty
   do {
@@ -474,6 +580,7 @@ int Client_send(const C2HatClient *this, const C2HMessage *message) {
         this->err, "send() failed. (%d): %s\n",
         SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
       );
+      if (frame != buffer) free(frame);
       return -1;
     }
     // Ignoring socket closed (byteSent == 0) on send, will be caught by recv()
@@ -482,6 +589,7 @@ int Client_send(const C2HatClient *this, const C2HMessage *message) {
     data += bytesSent;
     total += bytesSent;
   } while (total < length);
+  if (frame != buffer) free(frame);
   Debug("Client_send - sent %zu bytes", total);
   return total;
 }
@@ -510,13 +618,11 @@ bool Client_authenticate(C2HatClient *this, const char *username) {
   // Wait for the AUTH signal from the server,
   // we are ok for this to be blocking because
   // the server won't sent any data to unauthenticated clients
-  int received = Client_receive(this);
-  if (received < 0) {
+  C2HMessage *response = Client_receiveMessage(this);
+  if (response == NULL) {
     Client_disconnect(this);
     return false;
   }
-  C2HMessage *response = C2HMessage_get(&(this->buffer));
-  if (response == NULL) return false;
 
   if (response->type != kMessageTypeNick) {
     C2HMessage_free(&response);
@@ -551,8 +657,8 @@ bool Client_authenticate(C2HatClient *this, const char *username) {
   }
 
   // Wait for OK/ERR
-  received = Client_receive(this);
-  if (received < 0) {
+  response = Client_receiveMessage(this);
+  if (response == NULL) {
     fprintf(
       this->out,
       "❌ Error: Authentication failed\nCannot receive a response from the server\n"
@@ -561,9 +667,6 @@ bool Client_authenticate(C2HatClient *this, const char *username) {
     return false;
   }
 
-  response = C2HMessage_get(&(this->buffer));
-  if (response == NULL) return false;
-
   if (response->type != kMessageTypeOk) {
     if (response->type == kMessageTypeErr) {
       fprintf(
@@ -592,6 +695,7 @@ void Client_disconnect(C2HatClient *this) {
     SSL_free(this->ssl);
     this->ssl = NULL;
   }
+  MessageBuffer_clear(&(this->buffer));
 }
 
 /**
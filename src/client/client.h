@@ -42,7 +42,9 @@
     char caCertFilePath[kMaxPath];
     char caCertDirPath[kMaxPath];
     char logDirPath[kMaxPath];
+    char sessionDirPath[kMaxPath]; ///< Where TLS sessions are cached, empty to disable
     unsigned int logLevel;
+    bool binaryProtocol; ///< Offer the binary protocol (v2) to the server
   } ClientOptions;
 
   // Opaque structure that contains client connection details
@@ -30,6 +30,7 @@
 static const char *kC2HatClientVersion = "1.0";
 static const char *kDefaultCACertFilePath = ".local/share/c2hat/ssl/cacert.pem";
 static const char *kDefaultCACertDirPath = ".local/share/c2hat/ssl";
+static const char *kDefaultSessionDirPath = ".local/share/c2hat/sessions";
 
 /**
  * Displays program version
@@ -82,6 +83,8 @@ void help(const char *program) {
     "                   are stored; if neither cacert and capath are\n"
     "                   specified, the default path will be used:\n"
     "                   $HOME/.local/share/c2hat/ssl\n"
+    "       --binary    use the binary protocol (v2) if the server\n"
+    "                   supports it;\n"
     "   -v, --version   display the current program version;\n"
     "   -h, --help      display this help message;\n"
     "       --debug     enable verbose logging;\n"
@@ -104,6 +107,7 @@ void parseOptions(int argc, ARGV argv, ClientOptions *params) {
 
   // Build the options list
   int debug = 0;
+  int binary = 0;
   struct option options[] = {
     {"user", required_argument, NULL, 'u'},
     {"cacert", required_argument, NULL, 'f'},
@@ -111,6 +115,7 @@ void parseOptions(int argc, ARGV argv, ClientOptions *params) {
     {"help", no_argument, NULL, 'h'},
     {"version", no_argument, NULL, 'v'},
     {"debug", no_argument, &debug, 1},
+    {"binary", no_argument, &binary, 1},
     { NULL, 0, NULL, 0}
   };
 
@@ -124,6 +129,15 @@ void parseOptions(int argc, ARGV argv, ClientOptions *params) {
     "%s/%s",getenv("HOME"), kDefaultCACertDirPath
   );
 
+  // Setup the TLS session cache, reconnecting without it only takes longer
+  snprintf(
+    params->sessionDirPath, kMaxPath - 1,
+    "%s/%s", getenv("HOME"), kDefaultSessionDirPath
+  );
+  if (!TouchDir(params->sessionDirPath, 0700)) {
+    params->sessionDirPath[0] = '\0';
+  }
+
   // Setup log directory
   snprintf(
     params->logDirPath, sizeof(params->logDirPath),
@@ -159,6 +173,7 @@ void parseOptions(int argc, ARGV argv, ClientOptions *params) {
       break;
       case 0:
         if (debug) params->logLevel = LOG_DEBUG;
+        if (binary) params->binaryProtocol = true;
       break;
     }
   }
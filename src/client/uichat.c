@@ -105,9 +105,9 @@ void UIChatWin_updateContent(bool refresh) {
     start = chatlog->length - this.pageSize;
     if (start < 0) start = 0;
     for (int line = start; line < chatlog->length; line++) {
-      ChatLogEntry *entry = (ChatLogEntry *) List_item(chatlog, line);
+      ChatLogEntry **entry = (ChatLogEntry **) List_item(chatlog, line);
       if (entry != NULL) {
-        UIChatWin_write(entry, false);
+        UIChatWin_write(*entry, false);
       }
     }
   } else if (this.mode == kChatWinModeBrowse) {
@@ -117,9 +117,9 @@ void UIChatWin_updateContent(bool refresh) {
     if (end >= chatlog->length) end = chatlog->length;
     int line = start;
     while (line < end) {
-      ChatLogEntry *entry = (ChatLogEntry *) List_item(chatlog, line);
+      ChatLogEntry **entry = (ChatLogEntry **) List_item(chatlog, line);
       if (entry != NULL) {
-        UIChatWin_write(entry, false);
+        UIChatWin_write(*entry, false);
       }
       line++;
     }
@@ -236,6 +236,7 @@ void UIChatWin_write(ChatLogEntry *entry, bool refresh) {
       );
     break;
     case kMessageTypeOk:
+    case kMessageTypeList:
       WRITE(
         kColorPairRedOnDefault,
         "[%s] [SERVER] %s\n", entry->timestamp, entry->content
@@ -256,6 +257,15 @@ void UIChatWin_write(ChatLogEntry *entry, bool refresh) {
         );
       }
     break;
+    case kMessageTypeDirect:
+      {
+        int userColor = (strlen(entry->username)) ? GetUserColor(entry->username) : kColorPairDefault;
+        WRITE(
+          userColor,
+          "[%s] [%s] (private) %s\n", entry->timestamp, entry->username, entry->content
+        );
+      }
+    break;
     default:
       // Print up to byte_received from the server
       wprintw(
@@ -267,6 +277,13 @@ void UIChatWin_write(ChatLogEntry *entry, bool refresh) {
   if (refresh) wrefresh(this.handle);
 }
 
+/// Removes an entry from the chat log and frees it
+static void UIChatWin_deleteEntry(int line) {
+  ChatLogEntry **entry = (ChatLogEntry **) List_item(chatlog, line);
+  if (entry != NULL) ChatLogEntry_free(entry);
+  List_delete(chatlog, line);
+}
+
 /// Adds a message/entry in the data/log buffer
 void UIChatWin_logMessage(const C2HMessage *buffer) {
   if (buffer->type == kMessageTypeQuit) return;
@@ -275,11 +292,14 @@ void UIChatWin_logMessage(const C2HMessage *buffer) {
   ChatLogEntry *entry = ChatLogEntry_create(buffer);
   if (entry == NULL) return;
 
-  // Append the entry to the buffer list...
-  List_append(chatlog, entry, sizeof(ChatLogEntry));
+  // Append the entry to the buffer list, which owns it from now on...
+  if (!List_append(chatlog, &entry, sizeof(ChatLogEntry *))) {
+    ChatLogEntry_free(&entry);
+    return;
+  }
   // ...and delete the oldest node if we reach the max allowed buffer
   if (chatlog->length > kMaxCachedLines) {
-    List_delete(chatlog, 0);
+    UIChatWin_deleteEntry(0);
   }
 
   // Do some other actions based on entry content...
@@ -298,9 +318,6 @@ void UIChatWin_logMessage(const C2HMessage *buffer) {
 
   // Display the message on the log window if in 'follow' mode
   if (this.mode == kChatWinModeLive) UIChatWin_write(entry, true);
-
-  // Destroy the temporary entry
-  ChatLogEntry_free(&entry);
 }
 
 /// Cleanup and free resources
@@ -312,7 +329,10 @@ void UIChatWin_destroy() {
   memset(&wrapper, 0, sizeof(UIChatWinBox));
 
   if (users != NULL) Hash_free(&users);
-  if (chatlog != NULL) List_free(&chatlog);
+  if (chatlog != NULL) {
+    while (chatlog->length > 0) UIChatWin_deleteEntry(chatlog->length - 1);
+    List_free(&chatlog);
+  }
 }
 
 /// Returns the current display mode of the chatlog window
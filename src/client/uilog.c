@@ -35,10 +35,19 @@
 #include <time.h>
 
 /**
- * Creates a new log entry from the given data
+ * Creates a new log entry from the given message, sized for its content
  */
 ChatLogEntry *ChatLogEntry_create(const C2HMessage *buffer) {
-  ChatLogEntry *entry = calloc(sizeof(ChatLogEntry), 1);
+  // Messages initialised in place may have no user or content
+  const char *content = (buffer->content != NULL) ? buffer->content : "";
+  const char *username = (buffer->user != NULL) ? buffer->user : "";
+  size_t length = strlen(content);
+
+  // If the message is empty (e.g /ok with no detail), there is nothing to log
+  if (length == 0) return NULL;
+
+  size_t usernameLength = strnlen(username, kMaxNicknameSize);
+  ChatLogEntry *entry = calloc(sizeof(ChatLogEntry) + length + 1 + usernameLength + 1, 1);
   if (entry != NULL) {
     // Get local time
     time_t now = time(NULL);
@@ -48,20 +57,11 @@ ChatLogEntry *ChatLogEntry_create(const C2HMessage *buffer) {
     // Get entry type
     entry->type = buffer->type;
 
-    // Get message content and length
-    strncpy(entry->content, buffer->content, kBroadcastBufferSize - 1);
-    entry->length = strlen(entry->content);
-
-    // If the message is empty (e.g /ok with no detail), cleanup and return NULL
-    if (entry->length == 0) {
-      // Paranoid free
-      memset_s(entry->content, kBroadcastBufferSize, 0, kBroadcastBufferSize);
-      ChatLogEntry_free(&entry);
-      return NULL;
-    }
-
-    // Extract the user name
-    strncpy(entry->username, buffer->user, kMaxNicknameSize);
+    // Copy message content and user name
+    entry->length = length;
+    memcpy(entry->content, content, length);
+    entry->username = entry->content + length + 1;
+    memcpy(entry->username, username, usernameLength);
     return entry;
   }
   return NULL;
@@ -71,13 +71,13 @@ ChatLogEntry *ChatLogEntry_create(const C2HMessage *buffer) {
  * Cleanup memory for a log entry
  */
 void ChatLogEntry_free(ChatLogEntry **entry) {
-  if (entry != NULL) {
-    // Erase the item
-    memset_s(*entry, sizeof(ChatLogEntry), 0, sizeof(ChatLogEntry));
+  if (entry != NULL && *entry != NULL) {
+    // Erase the item, including the content
+    size_t size = sizeof(ChatLogEntry) + (*entry)->length + 1 + strlen((*entry)->username) + 1;
+    memset_s(*entry, size, 0, size);
     // Free the pointer to which entry is pointing
     // which is the actual pointer to the object
     free(*entry);
     *entry = NULL;
   }
 }
-
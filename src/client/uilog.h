@@ -25,13 +25,16 @@
   #include "../c2hat.h"
   #include "message/message.h"
 
-  /// Represents a single message in the chat log
+  /**
+   * Represents a single message in the chat log. The entry is allocated
+   * with the exact room for its content, followed by the user name.
+   */
   typedef struct {
     char timestamp[15];
     int type;
-    char content[kBroadcastBufferSize];
     size_t length;
-    char username[kMaxNicknameSize + 1];
+    char *username; ///< NULL terminated user name, stored after the content
+    char content[]; ///< NULL terminated message content
   } ChatLogEntry;
 
   // Creates a log entry from a raw server message
@@ -23,6 +23,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
 
 /**
  * Creates a new Concurrent Queue and returns its pointer
@@ -116,3 +117,47 @@ QueueData *CQueue_tryPop(CQueue *this) {
   pthread_mutex_unlock(&(this->lock));
   return item;
 }
+
+/**
+ * Waits for the queue to contain data, or for the
+ * given number of milliseconds to elapse
+ */
+bool CQueue_wait(CQueue *this, int timeout) {
+  struct timespec deadline = {};
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout / 1000;
+  deadline.tv_nsec += (timeout % 1000) * 1000000L;
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&(this->lock));
+  // Guard against spurious wake ups
+  while (Queue_empty(this->queue)) {
+    if (pthread_cond_timedwait(&(this->condition), &(this->lock), &deadline)) break;
+  }
+  bool ready = !Queue_empty(this->queue);
+  pthread_mutex_unlock(&(this->lock));
+  return ready;
+}
+
+/**
+ * Swaps the internal queue with an empty one, so that the
+ * lock is held only for the time of a pointer exchange
+ */
+Queue *CQueue_popAll(CQueue *this) {
+  Queue *empty = Queue_new();
+  if (empty == NULL) return NULL;
+
+  pthread_mutex_lock(&(this->lock));
+  if (Queue_empty(this->queue)) {
+    pthread_mutex_unlock(&(this->lock));
+    Queue_free(&empty);
+    return NULL;
+  }
+  Queue *items = this->queue;
+  this->queue = empty;
+  pthread_mutex_unlock(&(this->lock));
+  return items;
+}
@@ -69,4 +69,18 @@
    * in order to cast it and use it
    */
   QueueData *CQueue_tryPop(CQueue *this);
+
+  /**
+   * Waits up to timeout milliseconds for data to be present
+   * in the queue, returns true if the queue is not empty
+   */
+  bool CQueue_wait(CQueue *this, int timeout);
+
+  /**
+   * Detaches all the queued objects in one go and returns them
+   * as a standard queue, or NULL if the concurrent queue is empty
+   *
+   * The returned queue needs to be freed with Queue_free
+   */
+  Queue *CQueue_popAll(CQueue *this);
 #endif
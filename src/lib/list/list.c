@@ -24,6 +24,48 @@
 #include <stdio.h>
 
 #include "list.h"
+#include "pool/pool.h"
+
+enum {
+  /// Size of the pooled objects, payloads up to this size are pooled too
+  kListSmallSize = 32
+};
+
+/// Shared pool of nodes and small payloads, NULL if not initialised
+static Pool *pool = NULL;
+
+// Preallocates nodes and small payloads for all the lists
+bool List_initPool(size_t capacity) {
+  if (pool == NULL) pool = Pool_new(kListSmallSize, capacity);
+  return (pool != NULL);
+}
+
+// Destroys the node pool, no list must be in use
+void List_freePool() {
+  Pool_free(&pool);
+}
+
+// Returns the node pool or NULL
+Pool *List_pool() {
+  return pool;
+}
+
+// Allocates a node or a payload, from the pool when possible
+// Small objects always have the pooled size, so they can be
+// released to the pool even if allocated before its creation
+static void *List_alloc(size_t size) {
+  if (size > kListSmallSize) return malloc(size);
+  return (pool != NULL) ? Pool_alloc(pool) : malloc(kListSmallSize);
+}
+
+// Releases an object allocated with List_alloc
+static void List_release(void *item, size_t size) {
+  if (pool != NULL && size <= kListSmallSize) {
+    Pool_release(pool, item);
+  } else {
+    free(item);
+  }
+}
 
 // Creates a new empty List and returns its pointer
 List *List_new() {
@@ -60,34 +102,32 @@ bool List_empty(const List *this) {
   return (this->length == 0 || this->first == NULL);
 }
 
-// Creates a new empty ListNode and returns its pointer
-// The data container is allocated from the heap, and
-// the content of the value is duplicated
+// Creates a new ListNode and returns its pointer
+// The node and its data container are allocated from the pool
+// or the heap, and the content of the value is duplicated
 ListNode *ListNode_new(ListData *value, size_t valueSize) {
-  ListNode *this = (ListNode *)calloc(sizeof(ListNode), 1);
+  ListNode *this = (ListNode *)List_alloc(sizeof(ListNode));
   if (this == NULL) return NULL;
   // Allocating memory for the node data
-  this->data = calloc(valueSize, 1);
-  if (this->data == NULL) return NULL;
+  this->data = List_alloc(valueSize);
+  if (this->data == NULL) {
+    List_release(this, sizeof(ListNode));
+    return NULL;
+  }
   memcpy(this->data, value, valueSize);
   this->dataSize = valueSize;
+  this->prev = NULL;
+  this->next = NULL;
   return this;
 }
 
 // Destroys a ListNode
 void ListNode_free(ListNode **this) {
   // Free the node
-  if (this != NULL) {
-    // Cleanup the memory for the data
-    memset((*this)->data, 0, (*this)->dataSize);
-    // Free the data pointer BEFORE cleaning up the node
-    free((*this)->data);
-
-    // Cleanup the memory for the node
-    memset(*this, 0, sizeof(ListNode)); // Also '\0' is fine
-    // Free the pointer to which this is pointing
-    // which is the actual pointer to the node
-    free(*this);
+  if (this != NULL && *this != NULL) {
+    // Free the data pointer BEFORE releasing the node
+    List_release((*this)->data, (*this)->dataSize);
+    List_release(*this, sizeof(ListNode));
     *this = NULL;
   }
 }
@@ -108,6 +148,7 @@ bool List_insert(List *this, ListData *value, size_t valueSize, int pos) {
   if (pos >= 0 && pos <= this->length) {
     // Create the new node
     ListNode *item = ListNode_new(value, valueSize);
+    if (item == NULL) return false;
 
     // Get a handle to the first node to walk the list
     ListNode *cursor = this->first;
@@ -217,14 +258,14 @@ bool List_update(List *this, ListData *value, size_t valueSize, int pos) {
       i++;
     }
 
-    // Cleanup and free the old data pointer
-    memset(n->data, 0, n->dataSize);
-    free(n->data);
-
     // Allocating memory for the new node data
-    n->data = calloc(valueSize, 1);
-    if (n->data == NULL) return false;
-    memcpy(n->data, value, valueSize);
+    ListData *data = List_alloc(valueSize);
+    if (data == NULL) return false;
+    memcpy(data, value, valueSize);
+
+    // Free the old data pointer
+    List_release(n->data, n->dataSize);
+    n->data = data;
     n->dataSize = valueSize;
     return true;
   }
@@ -23,6 +23,9 @@
 #define LISTS_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "pool/pool.h"
 
 /**
  * Generic data type. We can redefine list data to
@@ -69,6 +72,20 @@ List *List_new();
 void List_free(List **);
 
 
+/// Pool management
+
+
+// Preallocates nodes for all the lists, without a pool
+// nodes are allocated from the heap
+bool List_initPool(size_t capacity);
+
+// Destroys the node pool, no list must be in use
+void List_freePool();
+
+// Returns the node pool or NULL
+Pool *List_pool();
+
+
 /// Utility
 
 
@@ -25,8 +25,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <zlib.h>
 
 #include "trim/trim.h"
+#include "pool/pool.h"
 
 static const char kMessageTypePrefixMsg[]  = "/msg";
 static const char kMessageTypePrefixNick[] = "/nick";
@@ -34,22 +36,50 @@ static const char kMessageTypePrefixQuit[] = "/quit"; // Optional trailing space
 static const char kMessageTypePrefixLog[]  = "/log";
 static const char kMessageTypePrefixErr[]  = "/err";
 static const char kMessageTypePrefixOk[]   = "/ok";   // Optional trailing space/content
+static const char kMessageTypePrefixJoin[] = "/join";
+static const char kMessageTypePrefixLeave[] = "/leave"; // Optional trailing space/content
+static const char kMessageTypePrefixDirect[] = "/dm";
+static const char kMessageTypePrefixList[] = "/list"; // Optional trailing space/content
+static const char kMessageTypePrefixHistory[] = "/history"; // Optional trailing space/content
+
+/// Shared pool of message objects, NULL if not initialised
+static Pool *messagePool = NULL;
 
 /**
- * Frees memory space for a message allocated by Message_getContent()
- * @param[in] message
+ * Preallocates message objects, without a pool
+ * messages are allocated from the heap
+ * @param[in] capacity The number of messages to preallocate
+ * @param[out] true on success
  */
-static void Message_free(char **message) {
-  if (message != NULL && *message != NULL) {
-    memset(*message, 0, strlen(*message));
-    free(*message);
-    *message = NULL;
-  }
+bool C2HMessage_initPool(size_t capacity) {
+  if (messagePool == NULL) messagePool = Pool_new(sizeof(C2HMessage), capacity);
+  return (messagePool != NULL);
+}
+
+/**
+ * Destroys the message pool, no pooled message must be in use
+ */
+void C2HMessage_freePool() {
+  Pool_free(&messagePool);
+}
+
+/**
+ * Returns the message pool, or NULL if not initialised
+ */
+Pool *C2HMessage_pool() {
+  return messagePool;
+}
+
+/**
+ * Allocates an uninitialised message, from the pool when available
+ */
+static C2HMessage *Message_alloc() {
+  return (messagePool != NULL) ? Pool_alloc(messagePool) : malloc(sizeof(C2HMessage));
 }
 
 /**
  * Finds the user name of a given message
- * The message type must be /msg or /log
+ * The message type must be /msg, /log or /dm
  * @param[in] message The server or client message content
  * @param[in] user    Contains the extracted user name
  * @param[in] length The maximum length of the returned content
@@ -57,7 +87,7 @@ static void Message_free(char **message) {
 static bool Message_getUser(const char *message, C2HMessageType type, char *user, size_t length) {
   const char kUserNameStartTag  = '[';
   const char kUserNameEndTag  = ']';
-  if (type == kMessageTypeMsg || type == kMessageTypeLog) {
+  if (type == kMessageTypeMsg || type == kMessageTypeLog || type == kMessageTypeDirect) {
     char *start = strchr(message, kUserNameStartTag); // Normally message[5]
     if (start != NULL) {
       // We have a starting point
@@ -107,6 +137,21 @@ static void Message_format(unsigned int type, char *dest, size_t size, const cha
     case kMessageTypeQuit:
       commandPrefix = kMessageTypePrefixQuit;
     break;
+    case kMessageTypeJoin:
+      commandPrefix = kMessageTypePrefixJoin;
+    break;
+    case kMessageTypeLeave:
+      commandPrefix = kMessageTypePrefixLeave;
+    break;
+    case kMessageTypeDirect:
+      commandPrefix = kMessageTypePrefixDirect;
+    break;
+    case kMessageTypeList:
+      commandPrefix = kMessageTypePrefixList;
+    break;
+    case kMessageTypeHistory:
+      commandPrefix = kMessageTypePrefixHistory;
+    break;
     default:
       return; // Unknown message type
   }
@@ -137,70 +182,413 @@ static void Message_format(unsigned int type, char *dest, size_t size, const cha
  * @param[in] size    Maximum size of the message to generate (including null-term)
  */
 size_t C2HMessage_format(const C2HMessage *message, char *dest, size_t size) {
-  if (strlen(message->user) > 0) {
-    Message_format(message->type, dest, size, "[%s] %s", message->user, message->content);
+  // Messages initialised in place may have no user or content
+  const char *content = (message->content != NULL) ? message->content : "";
+  if (message->user != NULL && message->user[0] != '\0') {
+    Message_format(message->type, dest, size, "[%s] %s", message->user, content);
   } else {
-    Message_format(message->type, dest, size, "%s", message->content);
+    Message_format(message->type, dest, size, "%s", content);
   }
   return strlen(dest) + 1;
 }
 
 /**
- * Extracts raw message data from a buffer of bytes received by the server
- * After every read, the buffer is updated to point to the next message
- * The returned string needs to be freed with Message_free()
- * @param[in] buffer
+ * Reads a 32 bit big endian length from a binary frame
+ * @param[in] data Pointer to the first byte of the length
  */
-static char *Message_get(MessageBuffer *buffer) {
-  // Start of message
-  if (buffer->start == NULL) {
-    // Newly created buffer or result of invalid read
-    buffer->start = buffer->data;
-  }
-  // How much we can read from start till the end of the buffer
-  size_t size = sizeof(buffer->data) - (buffer->start - buffer->data);
-  // Identify the start of a valid message
-  buffer->start = memchr(buffer->start, '/', size);
-  if (buffer->start == NULL) {
-    // No valid data available ahead, already read data behind,
-    // a good occasion to cleanup
-    memset(buffer->data, 0, sizeof(buffer->data));
-    return NULL;
+static size_t Message_readLength(const unsigned char *data) {
+  return ((size_t)data[0] << 24) | ((size_t)data[1] << 16) | ((size_t)data[2] << 8) | (size_t)data[3];
+}
+
+/**
+ * Writes a 32 bit big endian length into a binary frame
+ * @param[in] data   Pointer to the first byte of the length
+ * @param[in] length The length to write
+ */
+static void Message_writeLength(unsigned char *data, size_t length) {
+  data[0] = (length >> 24) & 0xFF;
+  data[1] = (length >> 16) & 0xFF;
+  data[2] = (length >> 8) & 0xFF;
+  data[3] = length & 0xFF;
+}
+
+/**
+ * Returns the size of a message encoded as a binary frame, including the header
+ * @param[in] message Source message object
+ */
+size_t C2HMessage_binarySize(const C2HMessage *message) {
+  size_t userLength = (message->user != NULL) ? strlen(message->user) : 0;
+  size_t length = (message->content != NULL) ? message->length : 0;
+  return kMessageHeaderSize + userLength + 1 + length + 1;
+}
+
+/**
+ * Encodes a C2Message into a binary frame ready for transmission
+ * Returns the number of bytes written, or 0 if the destination is too short
+ * or the message can't be represented
+ * @param[in] message Source message object
+ * @param[in] dest    Destination char array
+ * @param[in] size    Size of the destination
+ */
+size_t C2HMessage_encode(const C2HMessage *message, char *dest, size_t size) {
+  const char *user = (message->user != NULL) ? message->user : "";
+  const char *content = (message->content != NULL) ? message->content : "";
+  size_t userLength = strlen(user);
+  size_t length = (message->content != NULL) ? message->length : 0;
+  if (userLength >= kMaxNicknameSize || length >= kMaxContentSize) return 0;
+
+  size_t frameSize = C2HMessage_binarySize(message);
+  if (dest == NULL || size < frameSize) return 0;
+  size_t payload = frameSize - kMessageHeaderSize;
+  unsigned char *header = (unsigned char *)dest;
+  header[0] = kMessageMagic;
+  header[1] = 0; // Flags
+  header[2] = (message->type >> 8) & 0xFF;
+  header[3] = message->type & 0xFF;
+  Message_writeLength(header + 4, payload);
+
+  char *data = dest + kMessageHeaderSize;
+  memcpy(data, user, userLength);
+  data[userLength] = '\0';
+  memcpy(data + userLength + 1, content, length);
+  data[userLength + 1 + length] = '\0';
+  return frameSize;
+}
+
+/**
+ * Returns the max size of a binary frame after compression,
+ * to be used as the size of the destination of C2HMessage_deflate()
+ * @param[in] length The size of the uncompressed frame
+ */
+size_t C2HMessage_deflateBound(size_t length) {
+  size_t payload = (length > kMessageHeaderSize) ? length - kMessageHeaderSize : 0;
+  return kMessageHeaderSize + 4 + compressBound(payload);
+}
+
+/**
+ * Compresses the payload of a binary frame, the compressed frame has the
+ * same type and the deflate flag set. Small or incompressible payloads
+ * should be sent as they are.
+ * @param[in] frame  The binary frame, not compressed
+ * @param[in] length The size of the frame
+ * @param[in] dest   Destination of the compressed frame
+ * @param[in] size   Size of the destination, see C2HMessage_deflateBound()
+ * @param[out] The size of the compressed frame, or 0 if it's not smaller than the original
+ */
+size_t C2HMessage_deflate(const char *frame, size_t length, char *dest, size_t size) {
+  const unsigned char *header = (const unsigned char *)frame;
+  if (length <= kMessageHeaderSize || size <= kMessageHeaderSize + 4) return 0;
+  if (header[0] != kMessageMagic || header[1] != 0) return 0;
+
+  size_t payload = length - kMessageHeaderSize;
+  uLongf compressed = size - kMessageHeaderSize - 4;
+  int result = compress2(
+    (Bytef *)dest + kMessageHeaderSize + 4, &compressed,
+    (const Bytef *)frame + kMessageHeaderSize, payload, Z_DEFAULT_COMPRESSION
+  );
+  size_t total = kMessageHeaderSize + 4 + compressed;
+  if (result != Z_OK || total >= length) return 0;
+
+  memcpy(dest, frame, kMessageHeaderSize);
+  dest[1] = kMessageFlagDeflate;
+  Message_writeLength((unsigned char *)dest + 4, 4 + compressed);
+  Message_writeLength((unsigned char *)dest + kMessageHeaderSize, payload);
+  return total;
+}
+
+/**
+ * Finds the first occurrence of a character in the unread data
+ * @param[in] buffer The message buffer
+ * @param[in] from   Position to start searching from
+ * @param[in] c      The character to find
+ * @param[out] The position of the character, or the buffer tail if not found
+ */
+static size_t MessageBuffer_find(const MessageBuffer *buffer, size_t from, char c) {
+  while (from < buffer->tail) {
+    // Search the contiguous part of the ring
+    size_t offset = from & (kMessageBufferSize - 1);
+    size_t span = kMessageBufferSize - offset;
+    if (span > buffer->tail - from) span = buffer->tail - from;
+    const char *found = memchr(buffer->data + offset, c, span);
+    if (found != NULL) return from + (found - (buffer->data + offset));
+    from += span;
+  }
+  return buffer->tail;
+}
+
+/**
+ * Copies unread data out of the ring, the data may wrap around its end
+ * @param[in] buffer The message buffer
+ * @param[in] from   Position of the first byte to copy
+ * @param[in] dest   Destination of the copy
+ * @param[in] length Number of bytes to copy
+ */
+static void MessageBuffer_copy(const MessageBuffer *buffer, size_t from, char *dest, size_t length) {
+  size_t offset = from & (kMessageBufferSize - 1);
+  size_t contiguous = kMessageBufferSize - offset;
+  if (length <= contiguous) {
+    memcpy(dest, buffer->data + offset, length);
+  } else {
+    memcpy(dest, buffer->data + offset, contiguous);
+    memcpy(dest + contiguous, buffer->data, length - contiguous);
+  }
+}
+
+/**
+ * Checks if a large binary frame is waiting for more data
+ * @param[in] buffer The message buffer
+ */
+static bool MessageBuffer_receivingLarge(const MessageBuffer *buffer) {
+  return buffer->large != NULL && buffer->largeLength < buffer->largeSize;
+}
+
+/**
+ * Returns the free space where the next read can be stored,
+ * the space is contiguous but may be shorter than the total free space.
+ * While a large binary frame is being received the space is in the frame itself.
+ * If the buffer is full and contains no complete frames,
+ * the unparsable data is discarded.
+ * @param[in]  buffer The message buffer
+ * @param[out] length The number of bytes that can be stored
+ * @param[out] Pointer to the free space
+ */
+char *MessageBuffer_reserve(MessageBuffer *buffer, size_t *length) {
+  if (MessageBuffer_receivingLarge(buffer)) {
+    *length = buffer->largeSize - buffer->largeLength;
+    return buffer->large + buffer->largeLength;
+  }
+  if (buffer->tail - buffer->head == kMessageBufferSize) {
+    buffer->head = buffer->scan = buffer->tail;
+  }
+  size_t offset = buffer->tail & (kMessageBufferSize - 1);
+  size_t available = kMessageBufferSize - (buffer->tail - buffer->head);
+  size_t contiguous = kMessageBufferSize - offset;
+  *length = (available < contiguous) ? available : contiguous;
+  return buffer->data + offset;
+}
+
+/**
+ * Marks the data stored in the space returned by MessageBuffer_reserve() as received
+ * @param[in] buffer The message buffer
+ * @param[in] length The number of bytes received
+ */
+void MessageBuffer_commit(MessageBuffer *buffer, size_t length) {
+  if (MessageBuffer_receivingLarge(buffer)) {
+    buffer->largeLength += length;
+  } else {
+    buffer->tail += length;
   }
+}
+
+/**
+ * Extracts the next NULL terminated text frame (protocol v1).
+ * A frame starts with '/' and ends with a NULL terminator, any data before
+ * the start is skipped and frames longer than kBufferSize are discarded.
+ * @param[in]  buffer The message buffer
+ * @param[out] length The length of the frame, not including the NULL terminator
+ * @param[out] Pointer to the NULL terminated frame, or NULL if no complete frame is available
+ */
+static char *MessageBuffer_nextText(MessageBuffer *buffer, size_t *length) {
+  while (true) {
+    // Identify the start of a valid frame
+    buffer->head = MessageBuffer_find(buffer, buffer->head, '/');
+    if (buffer->scan < buffer->head) buffer->scan = buffer->head;
+
+    // Data already scanned in previous calls is not scanned again
+    buffer->scan = MessageBuffer_find(buffer, buffer->scan, '\0');
+    if (buffer->scan == buffer->tail) {
+      // Partial frame, wait for more data unless it's already too long
+      if (buffer->tail - buffer->head >= kBufferSize) {
+        buffer->head = buffer->tail;
+      }
+      if (buffer->head == buffer->tail) {
+        // Empty, start again from the beginning of the ring
+        buffer->head = buffer->tail = buffer->scan = 0;
+      }
+      return NULL;
+    }
 
-  // Pointer to end of buffer
-  char *end = buffer->start + size -1;
+    size_t size = buffer->scan - buffer->head + 1; // Including the NULL terminator
+    char *frame = buffer->data + (buffer->head & (kMessageBufferSize - 1));
+    buffer->head += size;
+    buffer->scan = buffer->head;
+    if (size > kBufferSize) continue;
 
-  for (char *cursor = buffer->start;; cursor++) {
-    if (cursor == end && *cursor != 0 ) {
-      return NULL; // No null terminator, partial message
+    // Copy the part that wrapped around after the end of the ring
+    size_t contiguous = kMessageBufferSize - (frame - buffer->data);
+    if (size > contiguous) {
+      memcpy(buffer->data + kMessageBufferSize, buffer->data, size - contiguous);
     }
-    if (*cursor == 0) {
-      end = cursor; // Now points to end of message
-      break;
+    *length = size - 1;
+    return frame;
+  }
+}
+
+/**
+ * Extracts the next length-prefixed binary frame (protocol v2).
+ * The frame boundary is known as soon as the header is received,
+ * frames that don't fit the ring are received directly into a heap
+ * block that is released on the following call.
+ * @param[in]  buffer The message buffer
+ * @param[out] length The size of the frame, including the header
+ * @param[out] Pointer to the frame, or NULL if no complete frame is available
+ */
+static char *MessageBuffer_nextBinary(MessageBuffer *buffer, size_t *length) {
+  if (buffer->large != NULL) {
+    if (!buffer->largeTaken) {
+      if (buffer->largeLength < buffer->largeSize) return NULL;
+      buffer->largeTaken = true;
+      *length = buffer->largeSize;
+      return buffer->large;
     }
+    free(buffer->large);
+    buffer->large = NULL;
+    buffer->largeSize = buffer->largeLength = 0;
+    buffer->largeTaken = false;
   }
-  // Length of message data to process, including the NULL terminator
-  size_t length = end - buffer->start + 1;
-  if (length <= 1) return NULL; // no more data
 
-  // Copy the message data
-  char *message = calloc(1, length);
-  if (!message) return NULL;
-  memcpy(message, buffer->start, length);
+  while (true) {
+    // Skip to the start of a frame
+    buffer->head = MessageBuffer_find(buffer, buffer->head, (char)kMessageMagic);
+    size_t available = buffer->tail - buffer->head;
+    if (available == 0) {
+      // Empty, start again from the beginning of the ring
+      buffer->head = buffer->tail = buffer->scan = 0;
+      return NULL;
+    }
+    if (available < kMessageHeaderSize) return NULL;
+
+    unsigned char header[kMessageHeaderSize];
+    MessageBuffer_copy(buffer, buffer->head, (char *)header, kMessageHeaderSize);
+    size_t payload = Message_readLength(header + 4);
+    if (payload < 2 || payload > kMaxNicknameSize + kMaxContentSize) {
+      // Not a valid header, look for the next one
+      buffer->head++;
+      continue;
+    }
 
-  // Update cursor for next reading
-  if (length < size) {
-    buffer->start += length;
+    size_t size = kMessageHeaderSize + payload;
+    if (size > kBufferSize) {
+      // Move what we have to a dedicated block, the rest will be received there
+      char *large = malloc(size);
+      if (large == NULL) {
+        buffer->head++;
+        continue;
+      }
+      size_t received = (available < size) ? available : size;
+      MessageBuffer_copy(buffer, buffer->head, large, received);
+      buffer->head += received;
+      buffer->large = large;
+      buffer->largeSize = size;
+      buffer->largeLength = received;
+      buffer->largeTaken = false;
+      return MessageBuffer_nextBinary(buffer, length);
+    }
+    if (available < size) return NULL;
+
+    char *frame = buffer->data + (buffer->head & (kMessageBufferSize - 1));
+    buffer->head += size;
+
+    // Copy the part that wrapped around after the end of the ring
+    size_t contiguous = kMessageBufferSize - (frame - buffer->data);
+    if (size > contiguous) {
+      memcpy(buffer->data + kMessageBufferSize, buffer->data, size - contiguous);
+    }
+    *length = size;
+    return frame;
   }
-  if (length == size) {
-    // No more to parse, reset
-    // Note: this may never happen, unless the data fits perfectly
-    // in our buffer, which is very rare
-    buffer->start = NULL;
-    memset(buffer->data, 0, sizeof(buffer->data));
+}
+
+/**
+ * Extracts the next complete frame from a buffer of bytes received from a connection.
+ * The frame is not copied, it's valid until more data is received.
+ * @param[in]  buffer The message buffer
+ * @param[out] length The length of a text frame, not including the NULL terminator,
+ *                    or the size of a binary frame
+ * @param[out] Pointer to the frame, or NULL if no complete frame is available
+ */
+char *MessageBuffer_next(MessageBuffer *buffer, size_t *length) {
+  if (buffer->protocol == kMessageProtocolText) {
+    return MessageBuffer_nextText(buffer, length);
+  }
+  return MessageBuffer_nextBinary(buffer, length);
+}
+
+/**
+ * Finds the protocol selected during the TLS handshake
+ * @param[in] name   The ALPN identifier, not NULL terminated
+ * @param[in] length The length of the identifier
+ * @param[out] The selected protocol, the text protocol if none or unknown
+ */
+MessageProtocol MessageProtocol_parse(const unsigned char *name, size_t length) {
+  #define PMATCH(id) (length == sizeof(id) - 1 && memcmp(name, id, length) == 0)
+  if (name == NULL) return kMessageProtocolText;
+  if (PMATCH(kMessageProtocolCompressedName)) return kMessageProtocolCompressed;
+  if (PMATCH(kMessageProtocolBinaryName)) return kMessageProtocolBinary;
+  return kMessageProtocolText;
+}
+
+/**
+ * Sets the wire format of the data received into a buffer
+ * @param[in] buffer   The message buffer, still empty
+ * @param[in] protocol The negotiated protocol
+ */
+void MessageBuffer_setProtocol(MessageBuffer *buffer, MessageProtocol protocol) {
+  buffer->protocol = protocol;
+}
+
+/**
+ * Discards any data received into a buffer and frees the blocks
+ * of large and compressed frames, the protocol is kept
+ * @param[in] buffer The message buffer
+ */
+void MessageBuffer_clear(MessageBuffer *buffer) {
+  free(buffer->inflated);
+  buffer->inflated = NULL;
+  buffer->inflatedSize = 0;
+  free(buffer->large);
+  buffer->large = NULL;
+  buffer->largeSize = buffer->largeLength = 0;
+  buffer->largeTaken = false;
+  buffer->head = buffer->tail = buffer->scan = 0;
+}
+
+/**
+ * Stores the user name and the content of a message, inside
+ * the message if they fit or in a new heap block otherwise
+ * @param[in] message    The message, with no data
+ * @param[in] user       The user name
+ * @param[in] userLength The length of the user name
+ * @param[in] content    The message content
+ * @param[in] length     The length of the content
+ * @param[out] true on success
+ */
+static bool Message_setData(
+  C2HMessage *message, const char *user, size_t userLength, const char *content, size_t length
+) {
+  size_t size = userLength + 1 + length + 1;
+  char *data = (size <= kMessageInlineSize) ? message->storage : malloc(size);
+  if (data == NULL) return false;
+  memcpy(data, user, userLength);
+  data[userLength] = '\0';
+  memcpy(data + userLength + 1, content, length);
+  data[userLength + 1 + length] = '\0';
+  message->user = data;
+  message->content = data + userLength + 1;
+  message->length = length;
+  return true;
+}
+
+/**
+ * Releases a message object allocated by Message_alloc()
+ * @param[in] message The message to release
+ */
+static void Message_release(C2HMessage *message) {
+  if (messagePool != NULL) {
+    Pool_release(messagePool, message);
+  } else {
+    free(message);
   }
-  return message;
 }
 
 /**
@@ -208,28 +596,54 @@ static char *Message_get(MessageBuffer *buffer) {
  * The returned structure needs to be freed with C2HMessage_free()
  */
 C2HMessage *C2HMessage_create(C2HMessageType type, const char *format, ...) {
-  C2HMessage *message = calloc(1, sizeof(C2HMessage));
+  C2HMessage *message = Message_alloc();
   if (message == NULL) return NULL;
-
   message->type = type;
 
-  char buffer[kBufferSize] = {};
-  char *start = buffer;
-  char *end = buffer + kBufferSize -1;
-
+  char buffer[kBufferSize] = "";
   va_list args;
   va_start(args, format);
   vsnprintf(buffer, kBufferSize, format, args);
   va_end(args);
 
-  if (message->type == kMessageTypeMsg || message->type == kMessageTypeLog) {
-    Message_getUser(buffer, type, message->user, kMaxNicknameSize);
+  char user[kMaxNicknameSize] = "";
+  if (type == kMessageTypeMsg || type == kMessageTypeLog || type == kMessageTypeDirect) {
+    Message_getUser(buffer, type, user, kMaxNicknameSize - 1);
   }
   // Remove user from message body
-  int userLength = strlen(message->user);
-  if (userLength > 0) start += userLength + 3; // Add [] and trailing space
-  memcpy(message->content, start, end - start);
+  size_t userLength = strlen(user);
+  size_t length = strlen(buffer);
+  size_t start = 0;
+  if (userLength > 0) {
+    start = userLength + 3; // Add [] and trailing space
+    if (start > length) start = length;
+  }
+  if (!Message_setData(message, user, userLength, buffer + start, length - start)) {
+    Message_release(message);
+    return NULL;
+  }
+  return message;
+}
 
+/**
+ * Creates a C2HMessage structure from a user name and a content,
+ * the content is not formatted and may be longer than kBufferSize
+ * The returned structure needs to be freed with C2HMessage_free()
+ * @param[in] type    The message type
+ * @param[in] user    The user name, may be NULL
+ * @param[in] content The message content, may be NULL
+ * @param[in] length  The length of the content
+ */
+C2HMessage *C2HMessage_new(C2HMessageType type, const char *user, const char *content, size_t length) {
+  C2HMessage *message = Message_alloc();
+  if (message == NULL) return NULL;
+  message->type = type;
+  if (user == NULL) user = "";
+  if (content == NULL) length = 0;
+  if (!Message_setData(message, user, strlen(user), (content != NULL) ? content : "", length)) {
+    Message_release(message);
+    return NULL;
+  }
   return message;
 }
 
@@ -272,6 +686,26 @@ static C2HMessageType Message_getType(char **message) {
       *message += (sizeof(kMessageTypePrefixNick) - 1);
       if (strlen(*message) > 0) return kMessageTypeNick;
     }
+    if (RMATCH(kMessageTypePrefixJoin)) {
+      *message += (sizeof(kMessageTypePrefixJoin) - 1);
+      if (strlen(*message) > 0) return kMessageTypeJoin;
+    }
+    if (RMATCH(kMessageTypePrefixLeave)) {
+      *message += (sizeof(kMessageTypePrefixLeave) - 1);
+      return kMessageTypeLeave;
+    }
+    if (RMATCH(kMessageTypePrefixDirect)) {
+      *message += (sizeof(kMessageTypePrefixDirect) - 1);
+      if (strlen(*message) > 0) return kMessageTypeDirect;
+    }
+    if (RMATCH(kMessageTypePrefixList)) {
+      *message += (sizeof(kMessageTypePrefixList) - 1);
+      return kMessageTypeList;
+    }
+    if (RMATCH(kMessageTypePrefixHistory)) {
+      *message += (sizeof(kMessageTypePrefixHistory) - 1);
+      return kMessageTypeHistory;
+    }
   }
   return kMessageTypeNull;
 }
@@ -296,7 +730,9 @@ C2HMessage *C2HMessage_createFromString(char *buffer, size_t size) {
   }
 
   // Limiting user-created messages to available types
-  if (type == kMessageTypeMsg || type == kMessageTypeNick || type == kMessageTypeQuit) {
+  if (type == kMessageTypeMsg || type == kMessageTypeNick || type == kMessageTypeQuit
+    || type == kMessageTypeJoin || type == kMessageTypeLeave || type == kMessageTypeDirect
+    || type == kMessageTypeList || type == kMessageTypeHistory) {
 
     // Buffer has now been advanced by the length of the type prefix
     char *copyOfBuffer = strdup(buffer); // Or trim will crash
@@ -310,56 +746,217 @@ C2HMessage *C2HMessage_createFromString(char *buffer, size_t size) {
   return NULL;
 }
 
+/**
+ * Parses a frame in place, the frame is modified to
+ * terminate the user and content strings
+ * @param[in] frame The NULL terminated frame
+ * @param[in] view  Receives the parsed message
+ * @param[out] false if the frame is not a valid message
+ */
+static bool Message_parse(char *frame, C2HMessageView *view) {
+  char *cursor = frame;
+  C2HMessageType type = Message_getType(&cursor);
+  // cursor has now been advanced by the length of the type prefix
+  if (type == kMessageTypeNull) return false;
+
+  // Trim without moving the content
+  cursor += strspn(cursor, "\t\n\v\f\r ");
+  rtrim(cursor, NULL);
+
+  view->type = type;
+  view->user = "";
+  if ((type == kMessageTypeMsg || type == kMessageTypeLog || type == kMessageTypeDirect)
+    && *cursor == '[') {
+    // Messages relayed by the server start with the [user] tag
+    char *end = strchr(cursor + 1, ']');
+    size_t userLength = (end != NULL) ? (size_t)(end - cursor - 1) : 0;
+    if (userLength > 0 && userLength < kMaxNicknameSize) {
+      *end = '\0';
+      view->user = cursor + 1;
+      cursor = end + 1;
+      if (*cursor == ' ') cursor++;
+    }
+  }
+  view->content = cursor;
+  view->length = strlen(cursor);
+  return true;
+}
+
+/**
+ * Decodes the payload of a binary frame in place, the user name
+ * and the content are already NULL terminated so the payload is not modified
+ * @param[in] type    The message type, from the frame header
+ * @param[in] payload The user name and the content
+ * @param[in] size    The size of the payload
+ * @param[in] view    Receives the decoded message
+ * @param[out] false if the payload is not a valid message
+ */
+static bool Message_decodePayload(
+  C2HMessageType type, const char *payload, size_t size, C2HMessageView *view
+) {
+  // Both strings must be terminated within the payload
+  if (size < 2 || payload[size - 1] != '\0') return false;
+  size_t userLength = strnlen(payload, (size < kMaxNicknameSize) ? size : kMaxNicknameSize);
+  if (userLength >= kMaxNicknameSize || userLength + 1 >= size) return false;
+  const char *content = payload + userLength + 1;
+  size_t length = strlen(content);
+
+  switch (type) {
+    case kMessageTypeOk:
+    case kMessageTypeQuit:
+    case kMessageTypeLeave:
+    case kMessageTypeList:
+    case kMessageTypeHistory:
+    break;
+    case kMessageTypeMsg:
+    case kMessageTypeLog:
+    case kMessageTypeErr:
+    case kMessageTypeNick:
+    case kMessageTypeJoin:
+    case kMessageTypeDirect:
+      if (length == 0) return false;
+    break;
+    default:
+      return false; // Unknown message type
+  }
+
+  view->type = type;
+  view->user = payload;
+  view->content = content;
+  view->length = length;
+  return true;
+}
+
+/**
+ * Decompresses the payload of a binary frame into the buffer's
+ * inflate block, which is reused by the following frames
+ * @param[in]  buffer The message buffer that received the frame
+ * @param[in]  data   The compressed payload, prefixed by its original size
+ * @param[in]  length The size of the compressed payload
+ * @param[out] size   The size of the original payload
+ * @param[out] Pointer to the original payload, or NULL if it's not valid
+ */
+static const char *Message_inflate(MessageBuffer *buffer, const char *data, size_t length, size_t *size) {
+  if (length <= 4) return NULL;
+  size_t original = Message_readLength((const unsigned char *)data);
+  if (original < 2 || original > kMaxNicknameSize + kMaxContentSize) return NULL;
+  if (buffer->inflatedSize < original) {
+    char *inflated = realloc(buffer->inflated, original);
+    if (inflated == NULL) return NULL;
+    buffer->inflated = inflated;
+    buffer->inflatedSize = original;
+  }
+  uLongf inflatedLength = original;
+  int result = uncompress(
+    (Bytef *)buffer->inflated, &inflatedLength, (const Bytef *)data + 4, length - 4
+  );
+  if (result != Z_OK || inflatedLength != original) return NULL;
+  *size = original;
+  return buffer->inflated;
+}
+
+/**
+ * Decodes a binary frame, uncompressed frames are decoded in place
+ * @param[in] buffer The message buffer that received the frame
+ * @param[in] frame  The frame, including the header
+ * @param[in] size   The size of the frame
+ * @param[in] view   Receives the decoded message
+ * @param[out] false if the frame is not a valid message
+ */
+static bool Message_decode(MessageBuffer *buffer, const char *frame, size_t size, C2HMessageView *view) {
+  const unsigned char *header = (const unsigned char *)frame;
+  if (size < kMessageHeaderSize + 2 || header[0] != kMessageMagic) return false;
+  if ((header[1] & ~kMessageFlagDeflate) != 0) return false; // Unknown flags
+  C2HMessageType type = ((unsigned int)header[2] << 8) | header[3];
+
+  const char *payload = frame + kMessageHeaderSize;
+  size_t payloadSize = size - kMessageHeaderSize;
+  if (header[1] & kMessageFlagDeflate) {
+    payload = Message_inflate(buffer, payload, payloadSize, &payloadSize);
+    if (payload == NULL) return false;
+  }
+  return Message_decodePayload(type, payload, payloadSize, view);
+}
+
+/**
+ * Parses the next message available in a buffer without copying it,
+ * invalid frames are skipped
+ * @param[in] buffer The message buffer
+ * @param[in] view   Receives the parsed message, valid until more data is received
+ * @param[out] false if no complete message is available
+ */
+bool C2HMessage_next(MessageBuffer *buffer, C2HMessageView *view) {
+  size_t length = 0;
+  char *frame = NULL;
+  while ((frame = MessageBuffer_next(buffer, &length)) != NULL) {
+    if (buffer->protocol != kMessageProtocolText) {
+      if (Message_decode(buffer, frame, length, view)) return true;
+    } else if (Message_parse(frame, view)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 /**
  * Extracts a message's content into a C2HMessage structure
  * The returned structure needs to be freed with C2HMessage_free()
  * @param[in] buffer
  */
 C2HMessage *C2HMessage_get(MessageBuffer *buffer) {
-  char *messageData = Message_get(buffer);
-  if (messageData == NULL) return NULL;
-
-  C2HMessage *message = calloc(1, sizeof(C2HMessage));
-  char *cursor = messageData;
-  size_t messageDataLength = strlen(messageData);
-  char *end = messageData + messageDataLength;
+  C2HMessageView view = {};
+  if (!C2HMessage_next(buffer, &view)) return NULL;
 
-  message->type = Message_getType(&cursor);
-  // cursor has now been advanced by the length of the type prefix
-  if (message->type == kMessageTypeNull) {
-    C2HMessage_free(&message);
-    Message_free(&messageData);
+  C2HMessage *message = Message_alloc();
+  if (message == NULL) return NULL;
+  message->type = view.type;
+  if (!Message_setData(message, view.user, strlen(view.user), view.content, view.length)) {
+    Message_release(message);
     return NULL;
   }
-  cursor = trim(cursor, NULL);
+  return message;
+}
 
-  // Dealing with optional content
-  if (message->type == kMessageTypeOk || message->type == kMessageTypeQuit) {
-    if (strlen(cursor) == 0) {
-      // No content
-      Message_free(&messageData);
-      return message;
-    }
+/**
+ * Decodes a stored binary frame, e.g. one produced by C2HMessage_encode(),
+ * compressed frames are not supported.
+ * The returned structure needs to be freed with C2HMessage_free()
+ * @param[in] frame The frame, including the header
+ * @param[in] size  The size of the frame
+ * @param[out] The decoded message, or NULL if the frame is not valid
+ */
+C2HMessage *C2HMessage_decode(const char *frame, size_t size) {
+  const unsigned char *header = (const unsigned char *)frame;
+  if (frame == NULL || size < kMessageHeaderSize + 2 || header[0] != kMessageMagic) return NULL;
+  if (header[1] != 0 || Message_readLength(header + 4) != size - kMessageHeaderSize) return NULL;
+  C2HMessageType type = ((unsigned int)header[2] << 8) | header[3];
+
+  C2HMessageView view = {};
+  if (!Message_decodePayload(type, frame + kMessageHeaderSize, size - kMessageHeaderSize, &view)) {
+    return NULL;
   }
-
-  if (message->type == kMessageTypeMsg || message->type == kMessageTypeLog) {
-    Message_getUser(messageData, message->type, message->user, kMaxNicknameSize);
+  C2HMessage *message = Message_alloc();
+  if (message == NULL) return NULL;
+  message->type = view.type;
+  if (!Message_setData(message, view.user, strlen(view.user), view.content, view.length)) {
+    Message_release(message);
+    return NULL;
   }
-  int userLength = strlen(message->user);
-  if (userLength > 0) cursor += userLength + 3; // Add [] and trailing space
-  memcpy(message->content, cursor, end - cursor);
-  Message_free(&messageData);
   return message;
 }
 
 /**
  * Frees memory space for a message allocated by C2HMessage_get()
+ * or C2HMessage_create()
  * @param[in] message
  */
 void C2HMessage_free(C2HMessage **message) {
   if (message != NULL && *message != NULL) {
-    memset(*message, 0, sizeof(C2HMessage));
-    free(*message);
+    // Long messages keep their data in a separate block
+    if ((*message)->user != NULL && (*message)->user != (*message)->storage) {
+      free((*message)->user);
+    }
+    Message_release(*message);
     *message = NULL;
   }
 }
@@ -371,10 +968,17 @@ void C2HMessage_free(C2HMessage **message) {
   void TestMessage_getContent();
   void TestMessage_format();
   void TestMessage_getUser();
-  void TestMessage_get();
+  void TestMessageBuffer_next();
+  void TestC2HMessage_next();
   void TestC2HMessage_get();
   void TestC2HMessage_create();
   void TestC2HMessage_createFromString();
+  void TestC2HMessage_storage();
+  void TestC2HMessage_pool();
+  void TestC2HMessage_encode();
+  void TestC2HMessage_decode();
+  void TestC2HMessage_nextBinary();
+  void TestC2HMessage_deflate();
 
   int main(/*int argc, char const *argv[]*/) {
     printf("\n[C2HMessages] Running tests ");
@@ -382,10 +986,17 @@ void C2HMessage_free(C2HMessage **message) {
     TestMessage_getType();
     TestMessage_format();
     TestMessage_getUser();
-    TestMessage_get();
+    TestMessageBuffer_next();
+    TestC2HMessage_next();
     TestC2HMessage_get();
     TestC2HMessage_create();
     TestC2HMessage_createFromString();
+    TestC2HMessage_storage();
+    TestC2HMessage_pool();
+    TestC2HMessage_encode();
+    TestC2HMessage_decode();
+    TestC2HMessage_nextBinary();
+    TestC2HMessage_deflate();
 
     printf("DONE!\n\n");
     return EXIT_SUCCESS;
@@ -453,6 +1064,46 @@ void C2HMessage_free(C2HMessage **message) {
     char *logMessageWithNoContent = "/log";
     assert(Message_getType(&logMessageWithNoContent) == kMessageTypeNull);
     printf(".");
+
+    // Testing JOIN type messages: must have a content
+    char *joinMessageWithRoom = "/join books";
+    assert(Message_getType(&joinMessageWithRoom) == kMessageTypeJoin);
+    printf(".");
+    char *joinMessageWithNoRoom = "/join";
+    assert(Message_getType(&joinMessageWithNoRoom) == kMessageTypeNull);
+    printf(".");
+
+    // Testing LEAVE type messages: may have an optional (ignored) content
+    char *leaveMessageWithContent = "/leave now";
+    assert(Message_getType(&leaveMessageWithContent) == kMessageTypeLeave);
+    printf(".");
+    char *leaveMessageWithNoContent = "/leave";
+    assert(Message_getType(&leaveMessageWithNoContent) == kMessageTypeLeave);
+    printf(".");
+
+    // Testing DM type messages: must have a content
+    char *directMessageWithContent = "/dm Joe24 Hello";
+    assert(Message_getType(&directMessageWithContent) == kMessageTypeDirect);
+    printf(".");
+    char *directMessageWithNoContent = "/dm";
+    assert(Message_getType(&directMessageWithNoContent) == kMessageTypeNull);
+    printf(".");
+
+    // Testing LIST type messages: may have an optional content
+    char *listMessageWithPage = "/list 2";
+    assert(Message_getType(&listMessageWithPage) == kMessageTypeList);
+    printf(".");
+    char *listMessageWithNoPage = "/list";
+    assert(Message_getType(&listMessageWithNoPage) == kMessageTypeList);
+    printf(".");
+
+    // Testing HISTORY type messages: may have an optional content
+    char *historyMessageWithCursor = "/history 120 20";
+    assert(Message_getType(&historyMessageWithCursor) == kMessageTypeHistory);
+    printf(".");
+    char *historyMessageWithNoCursor = "/history";
+    assert(Message_getType(&historyMessageWithNoCursor) == kMessageTypeHistory);
+    printf(".");
   }
 
   void TestMessage_format() {
@@ -588,69 +1239,130 @@ void C2HMessage_free(C2HMessage **message) {
     printf(".");
   }
 
-  void TestMessage_get() {
-    MessageBuffer buffer = {
-      .data = {
-        '/', 'm', 's', 'g', ' ', 'H', 'e', 'l', 'l', 'o', 0, // 0-10 = 11 chars
-        '/', 'm', 's', 'g', ' ', 'C', 'o', 'm', 'o', ' ', 'e', 's', 't', 'a', 's', '?', 0, // 11-27 = 17 chars
-        '/', 'm', 's', 'g', // 28-31 = 4 chars
-        ' ', 'M', 'y', ' ', 'n', 'a', 'm', 'e', ' ', 'i', 's', ' ', 'J', 'o', 'h', 'n', 0, // 32-48 = 17 chars
-      }
-    };
-    char *message = NULL;
+  // Simulates a read of the given bytes into the buffer
+  void TestMessageBuffer_receive(MessageBuffer *buffer, const char *data, size_t size) {
+    while (size > 0) {
+      size_t length = 0;
+      char *space = MessageBuffer_reserve(buffer, &length);
+      if (length > size) length = size;
+      memcpy(space, data, length);
+      MessageBuffer_commit(buffer, length);
+      data += length;
+      size -= length;
+    }
+  }
 
-    // Test that the first message is read...
-    message = Message_get(&buffer);
-    assert(message != NULL);
-    printf(".");
+  void TestMessageBuffer_next() {
+    MessageBuffer buffer = {};
+    size_t length = 0;
+    char *frame = NULL;
 
-    assert(strncmp(message, "/msg Hello", strlen(message)) == 0);
+    // A new buffer is empty
+    assert(MessageBuffer_next(&buffer, &length) == NULL);
     printf(".");
 
-    assert(*buffer.start == '/');
+    // Frames are returned in place, in order
+    const char data[] = "/msg Hello\0/msg Como estas?\0/msg My name is John";
+    TestMessageBuffer_receive(&buffer, data, sizeof(data));
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(frame == buffer.data);
+    assert(length == strlen("/msg Hello"));
+    assert(strcmp(frame, "/msg Hello") == 0);
     printf(".");
 
-    // ...and properly cleaned
-    Message_free(&message);
-    assert(message == NULL);
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(frame == buffer.data + 11);
+    assert(strcmp(frame, "/msg Como estas?") == 0);
     printf(".");
 
-    // Test that the second message is read
-    message = Message_get(&buffer);
-    assert(message != NULL);
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(strcmp(frame, "/msg My name is John") == 0);
+    assert(MessageBuffer_next(&buffer, &length) == NULL);
     printf(".");
 
-    assert(strncmp(message, "/msg Como estas?", strlen(message)) == 0);
+    // Partial frames are completed by the following reads
+    TestMessageBuffer_receive(&buffer, "/msg Hel", 8);
+    assert(MessageBuffer_next(&buffer, &length) == NULL);
+    TestMessageBuffer_receive(&buffer, "lo\0", 3);
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(frame != NULL && strcmp(frame, "/msg Hello") == 0);
     printf(".");
 
-    assert(*buffer.start == '/');
+    // Data before the start of a frame is skipped
+    TestMessageBuffer_receive(&buffer, "\0\0garbage/ok", 13);
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(frame != NULL && strcmp(frame, "/ok") == 0);
+    assert(MessageBuffer_next(&buffer, &length) == NULL);
     printf(".");
 
-    Message_free(&message);
-    assert(message == NULL);
+    // Frames that wrap around the end of the ring are contiguous
+    char message[kBufferSize] = {};
+    for (int i = 0; i < 10; i++) {
+      int size = snprintf(message, sizeof(message), "/msg %d %0300d", i, i);
+      TestMessageBuffer_receive(&buffer, message, size + 1);
+      frame = MessageBuffer_next(&buffer, &length);
+      assert(frame != NULL && length == (size_t)size);
+      assert(strcmp(frame, message) == 0);
+    }
+    assert(buffer.head > kMessageBufferSize);
     printf(".");
 
-    // Test that the third message is read
-    message = Message_get(&buffer);
-    assert(message != NULL);
+    // Frames longer than kBufferSize are discarded
+    memset(message, 'x', sizeof(message));
+    message[0] = '/';
+    TestMessageBuffer_receive(&buffer, message, sizeof(message));
+    TestMessageBuffer_receive(&buffer, "xx\0/ok\0", 7);
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(frame != NULL && strcmp(frame, "/ok") == 0);
     printf(".");
 
-    assert(strncmp(message, "/msg My name is John", strlen(message)) == 0);
+    // A full buffer without complete frames is reset
+    for (int i = 0; i < 3; i++) {
+      TestMessageBuffer_receive(&buffer, message, sizeof(message));
+      assert(MessageBuffer_next(&buffer, &length) == NULL);
+    }
+    TestMessageBuffer_receive(&buffer, "\0/ok\0", 5);
+    frame = MessageBuffer_next(&buffer, &length);
+    assert(frame != NULL && strcmp(frame, "/ok") == 0);
     printf(".");
+  }
+
+  void TestC2HMessage_next() {
+    MessageBuffer buffer = {};
+    C2HMessageView view = {};
+    const char data[] = "/msg  [Joe] I am John  \0/unknown\0/log [Joe] left\0/msg [] empty\0";
+    TestMessageBuffer_receive(&buffer, data, sizeof(data));
 
-    assert(*buffer.start == 0);
+    // Messages are parsed in place
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeMsg);
+    assert(strcmp(view.user, "Joe") == 0);
+    assert(strcmp(view.content, "I am John") == 0);
+    assert(view.length == strlen("I am John"));
+    assert(view.content > buffer.data && view.content < buffer.data + sizeof(data));
     printf(".");
 
-    Message_free(&message);
-    assert(message == NULL);
+    // Invalid frames are skipped
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeLog);
+    assert(strcmp(view.user, "Joe") == 0);
+    assert(strcmp(view.content, "left") == 0);
     printf(".");
 
-    // Test that the no more messages are read
-    message = Message_get(&buffer);
-    assert(message == NULL);
+    // Empty user tags are part of the content
+    assert(C2HMessage_next(&buffer, &view));
+    assert(strlen(view.user) == 0);
+    assert(strcmp(view.content, "[] empty") == 0);
+    assert(!C2HMessage_next(&buffer, &view));
     printf(".");
 
-    assert(buffer.start == NULL);
+    // Direct messages relayed by the server carry the sender
+    const char direct[] = "/dm [Joe] just for you\0";
+    TestMessageBuffer_receive(&buffer, direct, sizeof(direct));
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeDirect);
+    assert(strcmp(view.user, "Joe") == 0);
+    assert(strcmp(view.content, "just for you") == 0);
     printf(".");
   }
 
@@ -661,7 +1373,8 @@ void C2HMessage_free(C2HMessage **message) {
         '/', 'm', 's', 'g', ' ', 'C', 'o', 'm', 'o', ' ', 'e', 's', 't', 'a', 's', '?', 0, // 11-27 = 17 chars
         '/', 'm', 's', 'g', // 28-31 = 4 chars
         ' ', '[', 'J', 'o', 'e', ']', ' ', 'I', ' ', 'a', 'm', ' ', 'J', 'o', 'h', 'n', 0, // 32-48 = 17 chars
-      }
+      },
+      .tail = 49
     };
     C2HMessage *message = NULL;
 
@@ -699,7 +1412,8 @@ void C2HMessage_free(C2HMessage **message) {
         '/', 'o', 'k', ' ', 'H', 'e', 'l', 'l', 'o', 0, // 0-9 = 10 chars
         '/', 'o', 'k', ' ', 0, // 10-14 = 5 chars
         '/', 'o', 'k', 0, // 15-18 = 4 chars
-      }
+      },
+      .tail = 19
     };
 
     message = C2HMessage_get(&buf2);
@@ -738,7 +1452,8 @@ void C2HMessage_free(C2HMessage **message) {
         '/', 'q', 'u', 'i', 't', ' ', 'B', 'y', 'e', 0, // 0-9 = 10 chars
         '/', 'q', 'u', 'i', 't', ' ', 0, // 10-16 = 7 chars
         '/', 'q', 'u', 'i', 't', 0, // 17-22 = 6 chars
-      }
+      },
+      .tail = 23
     };
 
     message = C2HMessage_get(&buf3);
@@ -925,6 +1640,22 @@ void C2HMessage_free(C2HMessage **message) {
     printf(".");
     C2HMessage_free(&message);
 
+    // in join out join, the room name is trimmed
+    message = C2HMessage_createFromString("/join  books ", strlen("/join  books "));
+    assert(message->type == kMessageTypeJoin);
+    printf(".");
+    assert(strcmp(message->content, "books") == 0);
+    printf(".");
+    C2HMessage_free(&message);
+
+    // in leave out leave
+    message = C2HMessage_createFromString("/leave", strlen("/leave"));
+    assert(message->type == kMessageTypeLeave);
+    printf(".");
+    assert(strlen(message->content) == 0);
+    printf(".");
+    C2HMessage_free(&message);
+
     // in nick out nick
     message = C2HMessage_createFromString("/nick Joe24", strlen("/nick Joe24"));
     assert(message->type == kMessageTypeNick);
@@ -966,4 +1697,313 @@ void C2HMessage_free(C2HMessage **message) {
 
     message = C2HMessage_createFromString("", 0);
   }
+  void TestC2HMessage_storage() {
+    // Short messages are stored inline
+    C2HMessage *message = C2HMessage_create(kMessageTypeMsg, "[%s] %s", "Joe", "hi");
+    assert(message->length == 2);
+    assert(message->user == message->storage);
+    assert(message->content == message->storage + 4);
+    assert(strcmp(message->user, "Joe") == 0 && strcmp(message->content, "hi") == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // Long messages are stored in a block of the exact size
+    char content[kBufferSize] = {};
+    memset(content, 'x', kBufferSize - 1);
+    message = C2HMessage_create(kMessageTypeMsg, "%s", content);
+    assert(message->user != message->storage);
+    assert(message->length == kBufferSize - 1);
+    assert(strlen(message->user) == 0);
+    assert(strcmp(message->content, content) == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // Messages received from the network
+    MessageBuffer buffer = {};
+    char frame[] = "/log [Server] The quick brown fox jumps over the lazy dog";
+    TestMessageBuffer_receive(&buffer, frame, sizeof(frame));
+    message = C2HMessage_get(&buffer);
+    assert(message->type == kMessageTypeLog);
+    assert(message->user != message->storage);
+    assert(strcmp(message->user, "Server") == 0);
+    assert(message->length == strlen("The quick brown fox jumps over the lazy dog"));
+    assert(strcmp(message->content, "The quick brown fox jumps over the lazy dog") == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // Messages initialised in place
+    C2HMessage quit = { .type = kMessageTypeQuit };
+    char formatted[kBroadcastBufferSize] = {};
+    assert(C2HMessage_format(&quit, formatted, sizeof(formatted)) == sizeof("/quit"));
+    assert(strcmp(formatted, "/quit") == 0);
+    printf(".");
+  }
+
+  void TestC2HMessage_pool() {
+    assert(C2HMessage_pool() == NULL);
+    assert(C2HMessage_initPool(4));
+    printf(".");
+
+    // Released messages are reused by the same thread
+    C2HMessage *message = C2HMessage_create(kMessageTypeMsg, "[%s] %s", "JoePerry", "Hello");
+    assert(strcmp(message->user, "JoePerry") == 0);
+    assert(strcmp(message->content, "Hello") == 0);
+    C2HMessage *first = message;
+    C2HMessage_free(&message);
+    message = C2HMessage_create(kMessageTypeLog, "%s", "No user");
+    assert(message == first);
+    assert(strlen(message->user) == 0);
+    assert(strcmp(message->content, "No user") == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // The pool grows when all the messages are in use
+    C2HMessage *messages[10] = {};
+    for (size_t i = 0; i < 10; i++) {
+      messages[i] = C2HMessage_create(kMessageTypeOk, "%zu", i);
+      assert(messages[i] != NULL);
+    }
+    for (size_t i = 0; i < 10; i++) C2HMessage_free(&messages[i]);
+    PoolCounters counters = {};
+    Pool_getCounters(C2HMessage_pool(), &counters);
+    assert(counters.allocations == 12 && counters.releases == 12);
+    assert(counters.slabs > 1 && counters.capacity >= 10);
+    printf(".");
+
+    C2HMessage_freePool();
+    assert(C2HMessage_pool() == NULL);
+    printf(".");
+  }
+  void TestC2HMessage_encode() {
+    char frame[kBufferSize] = {};
+
+    // The header carries the type and the payload length
+    C2HMessage *message = C2HMessage_new(kMessageTypeMsg, "Joe", "Hello", 5);
+    assert(C2HMessage_binarySize(message) == kMessageHeaderSize + 4 + 6);
+    assert(C2HMessage_encode(message, frame, sizeof(frame)) == kMessageHeaderSize + 10);
+    assert(memcmp(frame, "\xC2\0\0\x82\0\0\0\x0AJoe\0Hello\0", kMessageHeaderSize + 10) == 0);
+    printf(".");
+
+    // The destination must hold the whole frame
+    assert(C2HMessage_encode(message, frame, kMessageHeaderSize + 9) == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // Messages without user or content
+    C2HMessage quit = { .type = kMessageTypeQuit };
+    assert(C2HMessage_encode(&quit, frame, sizeof(frame)) == kMessageHeaderSize + 2);
+    printf(".");
+
+    // Content longer than kMaxContentSize can't be encoded
+    char *content = calloc(kMaxContentSize + 1, 1);
+    memset(content, 'x', kMaxContentSize);
+    message = C2HMessage_new(kMessageTypeMsg, NULL, content, kMaxContentSize);
+    assert(C2HMessage_encode(message, frame, sizeof(frame)) == 0);
+    C2HMessage_free(&message);
+    free(content);
+    printf(".");
+  }
+
+  void TestC2HMessage_decode() {
+    char frame[kBufferSize] = {};
+
+    // Stored frames decode back into the same message
+    C2HMessage *message = C2HMessage_new(kMessageTypeLog, "Joe", "Hello", 5);
+    size_t size = C2HMessage_encode(message, frame, sizeof(frame));
+    C2HMessage_free(&message);
+    message = C2HMessage_decode(frame, size);
+    assert(message != NULL);
+    assert(message->type == kMessageTypeLog);
+    assert(strcmp(message->user, "Joe") == 0);
+    assert(strcmp(message->content, "Hello") == 0 && message->length == 5);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // The size must match the header
+    assert(C2HMessage_decode(frame, size - 1) == NULL);
+    assert(C2HMessage_decode(frame, kMessageHeaderSize) == NULL);
+    printf(".");
+
+    // Compressed frames are rejected
+    frame[1] = kMessageFlagDeflate;
+    assert(C2HMessage_decode(frame, size) == NULL);
+    printf(".");
+  }
+
+  // Encodes a message into the buffer, one byte per read if requested
+  void TestC2HMessage_send(
+    MessageBuffer *buffer, C2HMessageType type, const char *user, const char *content, bool slow
+  ) {
+    C2HMessage *message = C2HMessage_new(type, user, content, strlen(content));
+    size_t size = C2HMessage_binarySize(message);
+    char *frame = malloc(size);
+    assert(C2HMessage_encode(message, frame, size) == size);
+    if (slow) {
+      for (size_t i = 0; i < size; i++) TestMessageBuffer_receive(buffer, frame + i, 1);
+    } else {
+      TestMessageBuffer_receive(buffer, frame, size);
+    }
+    free(frame);
+    C2HMessage_free(&message);
+  }
+
+  // Receives data in chunks like a connection would, parsing after each read
+  size_t TestC2HMessage_receive(
+    MessageBuffer *buffer, const char *data, size_t size, size_t step,
+    C2HMessage **messages, size_t count
+  ) {
+    size_t received = 0;
+    while (size > 0) {
+      size_t length = 0;
+      char *space = MessageBuffer_reserve(buffer, &length);
+      if (length > size) length = size;
+      if (length > step) length = step;
+      memcpy(space, data, length);
+      MessageBuffer_commit(buffer, length);
+      data += length;
+      size -= length;
+      C2HMessageView view = {};
+      while (C2HMessage_next(buffer, &view)) {
+        assert(received < count);
+        messages[received++] = C2HMessage_new(view.type, view.user, view.content, view.length);
+      }
+    }
+    return received;
+  }
+
+  void TestC2HMessage_nextBinary() {
+    MessageBuffer buffer = {};
+    MessageBuffer_setProtocol(&buffer, kMessageProtocolBinary);
+    C2HMessageView view = {};
+
+    // Messages are decoded in place
+    TestC2HMessage_send(&buffer, kMessageTypeMsg, "Joe", "I am John", false);
+    TestC2HMessage_send(&buffer, kMessageTypeOk, "", "", false);
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeMsg);
+    assert(strcmp(view.user, "Joe") == 0 && strcmp(view.content, "I am John") == 0);
+    assert(view.length == strlen("I am John"));
+    assert(view.user == buffer.data + kMessageHeaderSize);
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeOk && view.length == 0);
+    assert(!C2HMessage_next(&buffer, &view));
+    printf(".");
+
+    // Partial frames are completed by the following reads
+    TestC2HMessage_send(&buffer, kMessageTypeLog, "Server", "Joe joined", true);
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeLog && strcmp(view.content, "Joe joined") == 0);
+    printf(".");
+
+    // Frames that wrap around the end of the ring are contiguous
+    char content[kMaxContentSize] = {};
+    for (int i = 0; i < 10; i++) {
+      snprintf(content, kBufferSize / 2, "%d %0300d", i, i);
+      TestC2HMessage_send(&buffer, kMessageTypeMsg, "Joe", content, false);
+      assert(C2HMessage_next(&buffer, &view));
+      assert(strcmp(view.content, content) == 0);
+    }
+    assert(buffer.head > kMessageBufferSize);
+    printf(".");
+
+    // Frames larger than kBufferSize are received in a separate block
+    memset(content, 'x', kMaxContentSize - 1);
+    C2HMessage *messages[3] = {};
+    messages[0] = C2HMessage_new(kMessageTypeMsg, "Joe", content, kMaxContentSize - 1);
+    messages[1] = C2HMessage_new(kMessageTypeMsg, "Joe", "after", 5);
+    size_t size = C2HMessage_binarySize(messages[0]) + C2HMessage_binarySize(messages[1]);
+    char *data = malloc(size);
+    size_t first = C2HMessage_encode(messages[0], data, size);
+    assert(C2HMessage_encode(messages[1], data + first, size - first) > 0);
+    C2HMessage_free(&messages[0]);
+    C2HMessage_free(&messages[1]);
+    assert(TestC2HMessage_receive(&buffer, data, size, kMessageBufferSize, messages, 3) == 2);
+    assert(messages[0]->length == kMaxContentSize - 1 && strcmp(messages[0]->content, content) == 0);
+    assert(strcmp(messages[1]->content, "after") == 0);
+    assert(buffer.large == NULL);
+    C2HMessage_free(&messages[0]);
+    C2HMessage_free(&messages[1]);
+    printf(".");
+
+    // Also when they are received a few bytes at a time
+    assert(TestC2HMessage_receive(&buffer, data, size, 7, messages, 3) == 2);
+    assert(strcmp(messages[0]->content, content) == 0);
+    assert(strcmp(messages[1]->content, "after") == 0);
+    C2HMessage_free(&messages[0]);
+    C2HMessage_free(&messages[1]);
+    printf(".");
+
+    // Garbage and invalid frames are skipped
+    TestMessageBuffer_receive(&buffer, "garbage\xC2\0\0\x82\xFF\xFF\xFF\xFF", 16);
+    TestMessageBuffer_receive(&buffer, "\xC2\0\0\x82\0\0\0\x04Joe\0", 12); // No content
+    TestMessageBuffer_receive(&buffer, "\xC2\x02\0\x82\0\0\0\x04J\0x\0", 12); // Flags
+    TestC2HMessage_send(&buffer, kMessageTypeMsg, "Joe", "valid", false);
+    C2HMessage *message = C2HMessage_get(&buffer);
+    assert(message != NULL && strcmp(message->user, "Joe") == 0);
+    assert(strcmp(message->content, "valid") == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    // Clearing releases a partial large frame
+    assert(TestC2HMessage_receive(&buffer, data, first / 2, 100, messages, 3) == 0);
+    assert(buffer.large != NULL);
+    MessageBuffer_clear(&buffer);
+    assert(buffer.large == NULL && buffer.tail == 0);
+    assert(buffer.protocol == kMessageProtocolBinary);
+    free(data);
+    printf(".");
+  }
+  void TestC2HMessage_deflate() {
+    char content[kBufferSize * 4] = {};
+    for (size_t i = 0; i + 1 < sizeof(content); i++) content[i] = 'a' + (i % 7);
+    C2HMessage *message = C2HMessage_new(kMessageTypeMsg, "Joe", content, strlen(content));
+    size_t length = C2HMessage_binarySize(message);
+    char *frame = malloc(length);
+    assert(C2HMessage_encode(message, frame, length) == length);
+    C2HMessage_free(&message);
+
+    // Repetitive content is compressed, the header keeps the type
+    size_t bound = C2HMessage_deflateBound(length);
+    char *compressed = malloc(bound);
+    size_t size = C2HMessage_deflate(frame, length, compressed, bound);
+    assert(size > 0 && size < length / 10);
+    assert(memcmp(compressed, "\xC2\x01\0\x82", 4) == 0);
+    printf(".");
+
+    // Compressed frames can't be compressed again
+    assert(C2HMessage_deflate(compressed, size, frame, length) == 0);
+    printf(".");
+
+    // Compressed frames are inflated by the receiver, also when the
+    // protocol doesn't allow compression
+    MessageBuffer buffer = {};
+    MessageBuffer_setProtocol(&buffer, kMessageProtocolBinary);
+    TestMessageBuffer_receive(&buffer, compressed, size);
+    C2HMessageView view = {};
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeMsg && strcmp(view.user, "Joe") == 0);
+    assert(view.length == strlen(content) && strcmp(view.content, content) == 0);
+    assert(view.user == buffer.inflated);
+    printf(".");
+
+    // Corrupted streams are skipped
+    compressed[size - 3] ^= 0x5A;
+    TestMessageBuffer_receive(&buffer, compressed, size);
+    TestC2HMessage_send(&buffer, kMessageTypeOk, "", "", false);
+    assert(C2HMessage_next(&buffer, &view));
+    assert(view.type == kMessageTypeOk);
+    MessageBuffer_clear(&buffer);
+    assert(buffer.inflated == NULL);
+    printf(".");
+
+    // Small messages are not worth compressing
+    message = C2HMessage_new(kMessageTypeMsg, "Joe", "Hello", 5);
+    length = C2HMessage_encode(message, frame, length);
+    assert(C2HMessage_deflate(frame, length, compressed, bound) == 0);
+    C2HMessage_free(&message);
+    printf(".");
+
+    free(compressed);
+    free(frame);
+  }
 #endif
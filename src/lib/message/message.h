@@ -24,6 +24,9 @@
   #include "../c2hat.h"
   #include <stddef.h>
   #include <stdbool.h>
+  #include <stdint.h>
+
+  #include "pool/pool.h"
 
   enum MessageType {
     kMessageTypeNull = 0,
@@ -36,26 +39,122 @@
     kMessageTypeOk = 160,
     kMessageTypeErr = 170,
     kMessageTypeLog = 180,
+    kMessageTypeJoin = 190,
+    kMessageTypeLeave = 200,
+    kMessageTypeDirect = 210,
+    kMessageTypeHistory = 220,
     kMessageTypeAdmin = 300
   };
 
   enum {
-    kMessageBufferSize = 2048
+    kMessageBufferSize = 2048, ///< Ring capacity, must be a power of 2
+    kMessageHeaderSize = 8, ///< Size of the header of a binary frame
+    kMessageMagic = 0xC2, ///< First byte of every binary frame
+    kMaxContentSize = 16 * 1024, ///< Max content of a binary frame, including the NULL terminator
+    kMessageFlagDeflate = 0x01 ///< The payload of a binary frame is compressed with zlib
   };
 
+  /// ALPN identifiers of the wire formats, offered during the TLS handshake
+  #define kMessageProtocolTextName "c2hat/1"
+  #define kMessageProtocolBinaryName "c2hat/2"
+  #define kMessageProtocolCompressedName "c2hat/2+deflate"
+
   typedef enum MessageType C2HMessageType;
 
-  /// Holds data read from a client's connection
+  /**
+   * Wire formats. Text frames are NULL terminated commands like
+   * "/msg [user] content" up to kBufferSize bytes. Binary frames (v2)
+   * have a fixed header with the magic byte, flags, type (16 bit) and
+   * payload length (32 bit), all big endian, followed by the NULL
+   * terminated user name and content. Compressed frames have the deflate
+   * flag set and their payload is the size of the original payload
+   * (32 bit) followed by the zlib stream.
+   */
+  typedef enum {
+    kMessageProtocolText = 0, ///< Protocol v1, the default
+    kMessageProtocolBinary, ///< Protocol v2, negotiated with ALPN
+    kMessageProtocolCompressed ///< Protocol v2 with compressed frames, negotiated with ALPN
+  } MessageProtocol;
+
+  /// Returns the ALPN identifier of the given protocol
+  #define MESSAGE_PROTOCOL_NAME(protocol) ( \
+    (protocol) == kMessageProtocolCompressed ? kMessageProtocolCompressedName : \
+    (protocol) == kMessageProtocolBinary ? kMessageProtocolBinaryName : kMessageProtocolTextName \
+  )
+
+  /// ALPN protocol list in wire format, in order of preference
+  #define kMessageProtocolList \
+    "\x0F" kMessageProtocolCompressedName "\x07" kMessageProtocolBinaryName "\x07" kMessageProtocolTextName
+
+  /**
+   * Ring buffer that holds data read from a connection. Received data is
+   * written in place and complete frames are returned as views into the
+   * buffer. The extra space after the ring keeps frames that wrap around
+   * its end contiguous, so text frames can't be longer than kBufferSize.
+   * Larger binary frames are received directly into a heap block.
+   * A zero-filled buffer is empty and ready to use with the text protocol.
+   */
   typedef struct {
-    char data[kMessageBufferSize];
-    char *start;
+    char data[kMessageBufferSize + kBufferSize]; ///< Ring + room for a wrapped frame
+    size_t head; ///< Position of the first unread byte
+    size_t tail; ///< Position after the last received byte
+    size_t scan; ///< Position up to which no frame terminator was found
+    MessageProtocol protocol; ///< Wire format of the received data
+    char *large; ///< Binary frame too large for the ring, or NULL
+    size_t largeSize; ///< Size of the large frame
+    size_t largeLength; ///< Bytes of the large frame received so far
+    bool largeTaken; ///< The large frame has been returned and can be freed
+    char *inflated; ///< Payload of the last compressed frame, or NULL
+    size_t inflatedSize; ///< Capacity of the inflated payload
   } MessageBuffer;
 
-  /// Represents a chat message object
+  /// A message parsed in place, it's valid until more data is received into the buffer
+  /// or the next message is parsed
   typedef struct {
     C2HMessageType type;
-    char content[kBufferSize];
-    char user[kMaxNicknameSize];
+    const char *user; ///< Sender nickname, empty if not available
+    const char *content; ///< Message text, NULL terminated
+    size_t length; ///< Length of the content
+  } C2HMessageView;
+
+  // Returns the contiguous free space where the next read can be stored
+  char *MessageBuffer_reserve(MessageBuffer *buffer, size_t *length);
+
+  // Marks the given number of bytes as received
+  void MessageBuffer_commit(MessageBuffer *buffer, size_t length);
+
+  // Returns the next complete frame, in place
+  char *MessageBuffer_next(MessageBuffer *buffer, size_t *length);
+
+  // Returns the protocol for an ALPN identifier, the text protocol if unknown
+  MessageProtocol MessageProtocol_parse(const unsigned char *name, size_t length);
+
+  // Sets the wire format, must be called before any data is received
+  void MessageBuffer_setProtocol(MessageBuffer *buffer, MessageProtocol protocol);
+
+  // Frees the memory held by a buffer, which is left empty
+  void MessageBuffer_clear(MessageBuffer *buffer);
+
+  // Parses the next available message in place, without allocating memory
+  bool C2HMessage_next(MessageBuffer *buffer, C2HMessageView *view);
+
+  enum {
+    /// Bytes of user name and content stored inside the message object
+    kMessageInlineSize = 40
+  };
+
+  /**
+   * Represents a chat message object. The user name and the content are
+   * stored one after the other, with their NULL terminators, inside the
+   * object when they fit in kMessageInlineSize bytes, or in a heap block
+   * of the exact size otherwise. Messages must not be copied by value.
+   */
+  typedef struct {
+    C2HMessageType type; ///< Message type
+    uint32_t length; ///< Length of the content, without the NULL terminator
+    char *user; ///< NULL terminated user name, empty if not set
+    char *content; ///< NULL terminated message content
+    char storage[kMessageInlineSize]; ///< Inline storage for short messages
   } C2HMessage;
 
   // Gets the next available message from a message buffer
@@ -68,10 +167,38 @@
   // Creates a new message given a raw string (e.g. '/msg Hello World!')
   C2HMessage *C2HMessage_createFromString(char *buffer, size_t size);
 
+  // Creates a new message from its user name and content, without formatting
+  C2HMessage *C2HMessage_new(C2HMessageType type, const char *user, const char *content, size_t length);
+
+  // Decodes a stored, uncompressed binary frame into a new message
+  C2HMessage *C2HMessage_decode(const char *frame, size_t size);
+
   // Converts a C2HMessage into a formatted string
   size_t C2HMessage_format(const C2HMessage *message, char *dest, size_t size);
 
+  // Returns the size of a message encoded as a binary frame
+  size_t C2HMessage_binarySize(const C2HMessage *message);
+
+  // Encodes a message as a binary frame, returns the frame size or 0 on failure
+  size_t C2HMessage_encode(const C2HMessage *message, char *dest, size_t size);
+
+  // Returns the max size of a binary frame once compressed
+  size_t C2HMessage_deflateBound(size_t length);
+
+  // Compresses a binary frame, returns the new size or 0 if it's not smaller
+  size_t C2HMessage_deflate(const char *frame, size_t length, char *dest, size_t size);
+
   // Frees memory space for a parsed message
   void C2HMessage_free(C2HMessage **);
 
+  // Preallocates message objects, must be called before any message is created
+  // Without a pool messages are allocated from the heap
+  bool C2HMessage_initPool(size_t capacity);
+
+  // Destroys the message pool, no pooled message must be in use
+  void C2HMessage_freePool();
+
+  // Returns the message pool, or NULL if not initialised
+  Pool *C2HMessage_pool();
+
 #endif
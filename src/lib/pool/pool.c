@@ -0,0 +1,328 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file pool.c
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+
+enum {
+  kPoolMaxPools = 16, ///< Pools that can exist at the same time
+  kPoolCacheSize = 32, ///< Free objects cached by each thread for each pool
+  kPoolBatchSize = kPoolCacheSize / 2, ///< Objects moved at once between a thread cache and its pool
+  kPoolMinGrowth = 32 ///< Minimum number of objects added when a pool is exhausted
+};
+
+typedef struct PoolCache PoolCache;
+typedef struct PoolSlab PoolSlab;
+
+/// Free objects of a pool owned by a single thread
+struct PoolCache {
+  Pool *pool; ///< Owner pool, may be stale if the pool was destroyed
+  uint64_t generation; ///< Generation of the owner pool
+  PoolCache *prev; ///< Previous cache of the same pool
+  PoolCache *next; ///< Next cache of the same pool
+  size_t length; ///< Number of cached objects
+  void *items[kPoolCacheSize]; ///< Cached objects
+  atomic_uint_least64_t allocations; ///< Updated by the owner thread only
+  atomic_uint_least64_t releases; ///< Updated by the owner thread only
+};
+
+/// A block of objects allocated at once
+struct PoolSlab {
+  PoolSlab *next; ///< Next slab of the same pool
+  max_align_t items[]; ///< Objects
+};
+
+struct Pool {
+  size_t id; ///< Index of the pool thread caches
+  uint64_t generation; ///< Tells apart pools that reuse the same index
+  size_t size; ///< Object size, rounded up for alignment
+  size_t growth; ///< Objects added when the pool is exhausted
+  pthread_mutex_t lock; ///< Protects the fields below
+  void *available; ///< Shared free list, linked through the first word of each object
+  PoolSlab *slabs; ///< Allocated slabs
+  PoolCache *caches; ///< Caches of the threads using the pool
+  PoolCounters counters; ///< Includes the allocations and releases of the exited threads
+};
+
+/// Active pools, protected by poolsLock
+static Pool *pools[kPoolMaxPools] = {};
+static uint64_t lastGeneration = 0;
+static pthread_mutex_t poolsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/// Thread caches, indexed by pool ID
+static _Thread_local PoolCache caches[kPoolMaxPools];
+
+/// Key used to give the cached objects back when a thread exits
+static pthread_key_t cacheKey;
+static pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * Increments a counter owned by the current thread, other
+ * threads may read it at any time
+ * @param[in] counter The counter to increment
+ */
+static void Pool_count(atomic_uint_least64_t *counter) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+/**
+ * Allocates a new slab and adds its objects to the shared free list,
+ * the pool must be locked
+ * @param[in] this  The pool
+ * @param[in] count Number of objects in the slab
+ * @param[out] true on success
+ */
+static bool Pool_grow(Pool *this, size_t count) {
+  PoolSlab *slab = malloc(sizeof(PoolSlab) + count * this->size);
+  if (slab == NULL) return false;
+  slab->next = this->slabs;
+  this->slabs = slab;
+  char *items = (char *)slab->items;
+  for (size_t i = count; i > 0; i--) {
+    void **item = (void **)(items + (i - 1) * this->size);
+    *item = this->available;
+    this->available = item;
+  }
+  this->counters.slabs++;
+  this->counters.capacity += count;
+  return true;
+}
+
+/**
+ * Moves objects from a thread cache to the shared free list,
+ * the pool must be locked
+ * @param[in] this  The pool
+ * @param[in] cache The thread cache
+ * @param[in] count Number of objects to move
+ */
+static void Pool_flush(Pool *this, PoolCache *cache, size_t count) {
+  while (count-- > 0 && cache->length > 0) {
+    void **item = (void **)cache->items[--cache->length];
+    *item = this->available;
+    this->available = item;
+  }
+  this->counters.flushes++;
+}
+
+/**
+ * Moves a batch of objects from the shared free list to a thread cache,
+ * the pool grows if the list is empty
+ * @param[in] this  The pool
+ * @param[in] cache The thread cache
+ * @param[out] false if no objects are available
+ */
+static bool Pool_refill(Pool *this, PoolCache *cache) {
+  pthread_mutex_lock(&(this->lock));
+  if (this->available == NULL) Pool_grow(this, this->growth);
+  while (this->available != NULL && cache->length < kPoolBatchSize) {
+    void **item = (void **)this->available;
+    this->available = *item;
+    cache->items[cache->length++] = item;
+  }
+  this->counters.refills++;
+  pthread_mutex_unlock(&(this->lock));
+  return cache->length > 0;
+}
+
+/**
+ * Gives the cached objects back to their pools when a thread exits
+ * @param[in] data Unused, the thread caches are thread local
+ */
+static void Pool_exitThread(void *data) {
+  (void)data;
+  pthread_mutex_lock(&poolsLock);
+  for (size_t id = 0; id < kPoolMaxPools; id++) {
+    PoolCache *cache = &caches[id];
+    Pool *pool = pools[id];
+    if (cache->pool != NULL && pool == cache->pool && pool->generation == cache->generation) {
+      pthread_mutex_lock(&(pool->lock));
+      Pool_flush(pool, cache, cache->length);
+      pool->counters.allocations += atomic_load(&(cache->allocations));
+      pool->counters.releases += atomic_load(&(cache->releases));
+      if (cache->prev != NULL) cache->prev->next = cache->next;
+      if (cache->next != NULL) cache->next->prev = cache->prev;
+      if (pool->caches == cache) pool->caches = cache->next;
+      pthread_mutex_unlock(&(pool->lock));
+    }
+    cache->pool = NULL;
+  }
+  pthread_mutex_unlock(&poolsLock);
+}
+
+/**
+ * Creates the key used to detect the exit of a thread
+ */
+static void Pool_initKey() {
+  pthread_key_create(&cacheKey, Pool_exitThread);
+}
+
+/**
+ * Returns the cache of the current thread for a pool,
+ * the cache is initialised the first time it's used
+ * @param[in] this The pool
+ */
+static PoolCache *Pool_getCache(Pool *this) {
+  PoolCache *cache = &caches[this->id];
+  if (cache->pool == this && cache->generation == this->generation) return cache;
+
+  // First use from this thread, any stale content belongs to a destroyed pool
+  pthread_setspecific(cacheKey, caches);
+  cache->pool = this;
+  cache->generation = this->generation;
+  cache->length = 0;
+  atomic_store(&(cache->allocations), 0);
+  atomic_store(&(cache->releases), 0);
+  pthread_mutex_lock(&(this->lock));
+  cache->prev = NULL;
+  cache->next = this->caches;
+  if (this->caches != NULL) this->caches->prev = cache;
+  this->caches = cache;
+  pthread_mutex_unlock(&(this->lock));
+  return cache;
+}
+
+/**
+ * Creates a new pool
+ * @param[in] size     The size of each object
+ * @param[in] capacity The number of objects to allocate immediately
+ * @param[out] The new pool, or NULL on failure
+ */
+Pool *Pool_new(size_t size, size_t capacity) {
+  pthread_once(&cacheKeyOnce, Pool_initKey);
+  Pool *this = calloc(1, sizeof(Pool));
+  if (this == NULL) return NULL;
+
+  // Free objects store the free list link in place
+  if (size < sizeof(void *)) size = sizeof(void *);
+  this->size = (size + alignof(max_align_t) - 1) / alignof(max_align_t) * alignof(max_align_t);
+  this->growth = (capacity / 2 > kPoolMinGrowth) ? capacity / 2 : kPoolMinGrowth;
+  if (pthread_mutex_init(&(this->lock), NULL)) {
+    free(this);
+    return NULL;
+  }
+  if (capacity > 0 && !Pool_grow(this, capacity)) {
+    Pool_free(&this);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&poolsLock);
+  this->id = kPoolMaxPools;
+  for (size_t id = 0; id < kPoolMaxPools; id++) {
+    if (pools[id] == NULL) {
+      this->id = id;
+      this->generation = ++lastGeneration;
+      pools[id] = this;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&poolsLock);
+  if (this->id == kPoolMaxPools) Pool_free(&this);
+  return this;
+}
+
+/**
+ * Destroys a pool, the objects allocated from it become invalid
+ * @param[in] this Double pointer to a pool
+ */
+void Pool_free(Pool **this) {
+  if (this != NULL && *this != NULL) {
+    // The thread caches that still point to the pool are recognised as stale
+    pthread_mutex_lock(&poolsLock);
+    if ((*this)->id < kPoolMaxPools && pools[(*this)->id] == *this) {
+      pools[(*this)->id] = NULL;
+    }
+    pthread_mutex_unlock(&poolsLock);
+
+    PoolSlab *slab = (*this)->slabs;
+    while (slab != NULL) {
+      PoolSlab *next = slab->next;
+      free(slab);
+      slab = next;
+    }
+    pthread_mutex_destroy(&((*this)->lock));
+    memset(*this, 0, sizeof(Pool));
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Takes an object from the thread cache, refilling it from the pool if empty
+ * @param[in] this The pool
+ * @param[out] An uninitialised object, or NULL on failure
+ */
+void *Pool_alloc(Pool *this) {
+  PoolCache *cache = Pool_getCache(this);
+  if (cache->length == 0 && !Pool_refill(this, cache)) return NULL;
+  Pool_count(&(cache->allocations));
+  return cache->items[--cache->length];
+}
+
+/**
+ * Takes an object from the pool and fills it with zeros
+ * @param[in] this The pool
+ * @param[out] A zero-filled object, or NULL on failure
+ */
+void *Pool_calloc(Pool *this) {
+  void *item = Pool_alloc(this);
+  if (item != NULL) memset(item, 0, this->size);
+  return item;
+}
+
+/**
+ * Puts an object in the thread cache, half of the cache
+ * is given back to the pool when full
+ * @param[in] this The pool the object was allocated from
+ * @param[in] item The object to release
+ */
+void Pool_release(Pool *this, void *item) {
+  if (item == NULL) return;
+  PoolCache *cache = Pool_getCache(this);
+  if (cache->length == kPoolCacheSize) {
+    pthread_mutex_lock(&(this->lock));
+    Pool_flush(this, cache, kPoolBatchSize);
+    pthread_mutex_unlock(&(this->lock));
+  }
+  cache->items[cache->length++] = item;
+  Pool_count(&(cache->releases));
+}
+
+/**
+ * Reads the usage counters of a pool, including the ones
+ * of the threads that are still running
+ * @param[in]  this     The pool
+ * @param[out] counters The current counters
+ */
+void Pool_getCounters(Pool *this, PoolCounters *counters) {
+  pthread_mutex_lock(&(this->lock));
+  *counters = this->counters;
+  for (PoolCache *cache = this->caches; cache != NULL; cache = cache->next) {
+    counters->allocations += atomic_load_explicit(&(cache->allocations), memory_order_relaxed);
+    counters->releases += atomic_load_explicit(&(cache->releases), memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&(this->lock));
+}
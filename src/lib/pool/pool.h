@@ -0,0 +1,77 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  /**
+   * A pool of fixed-size objects allocated in slabs. Each thread keeps
+   * a small cache of free objects, so most allocations and releases
+   * don't need any locking. The pool grows when all the objects are in use.
+   */
+  typedef struct Pool Pool;
+
+  /// Pool usage counters
+  typedef struct {
+    uint64_t allocations; ///< Objects handed out
+    uint64_t releases; ///< Objects given back
+    uint64_t refills; ///< Batches moved from the shared free list to a thread cache
+    uint64_t flushes; ///< Batches moved from a thread cache to the shared free list
+    uint64_t slabs; ///< Blocks of objects allocated, including the initial one
+    uint64_t capacity; ///< Total number of objects
+  } PoolCounters;
+
+  /**
+   * Creates a new pool with room for at least the given number of objects
+   */
+  Pool *Pool_new(size_t size, size_t capacity);
+
+  /**
+   * Destroys a pool and all its objects, the pool must not be
+   * in use by other threads
+   */
+  void Pool_free(Pool **this);
+
+  /**
+   * Returns an uninitialised object, or NULL if the pool can't grow
+   */
+  void *Pool_alloc(Pool *this);
+
+  /**
+   * Returns a zero-filled object, or NULL if the pool can't grow
+   */
+  void *Pool_calloc(Pool *this);
+
+  /**
+   * Gives an object back to the pool it was allocated from
+   */
+  void Pool_release(Pool *this, void *item);
+
+  /**
+   * Reads the usage counters of a pool
+   */
+  void Pool_getCounters(Pool *this, PoolCounters *counters);
+
+#endif
@@ -19,10 +19,17 @@
  * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "queue.h"
+#include "pool/pool.h"
+
+enum {
+  /// Size of the pooled objects, payloads up to this size are pooled too
+  kQueueSmallSize = 32
+};
 
 /**
  * A QueueNode is a generic struct with a void pointer
@@ -45,6 +52,45 @@ typedef struct _Queue {
   int length; ///< Length of the queue
 } Queue;
 
+/// Shared pool of nodes and small payloads, NULL if not initialised
+static Pool *pool = NULL;
+
+/// Pool management
+
+
+// Preallocates nodes and small payloads for all the queues
+bool Queue_initPool(size_t capacity) {
+  if (pool == NULL) pool = Pool_new(kQueueSmallSize, capacity);
+  return (pool != NULL);
+}
+
+// Destroys the node pool, no queue must be in use
+void Queue_freePool() {
+  Pool_free(&pool);
+}
+
+// Returns the node pool or NULL
+Pool *Queue_pool() {
+  return pool;
+}
+
+// Allocates a node or a payload, from the pool when possible
+// Small objects always have the pooled size, so they can be
+// released to the pool even if allocated before its creation
+static void *Queue_alloc(size_t size) {
+  if (size > kQueueSmallSize) return malloc(size);
+  return (pool != NULL) ? Pool_alloc(pool) : malloc(kQueueSmallSize);
+}
+
+// Releases an object allocated with Queue_alloc
+static void Queue_release(void *item, size_t size) {
+  if (pool != NULL && size <= kQueueSmallSize) {
+    Pool_release(pool, item);
+  } else {
+    free(item);
+  }
+}
+
 /// Creation and disposal
 
 
@@ -81,13 +127,17 @@ bool Queue_empty(const Queue *this) {
 
 // Node management
 
-// Creates a new empty QueueNode and returns its pointer
+// Creates a new QueueNode with a copy of the content and returns its pointer
 QueueNode *QueueNode_new(void *content, size_t length) {
-  QueueNode *this = (QueueNode *)calloc(sizeof(QueueNode), 1);
+  QueueNode *this = (QueueNode *)Queue_alloc(sizeof(QueueNode));
   if (this == NULL) return NULL;
   // Allocating memory for the node data
-  this->data.content = calloc(length, 1);
-  if (this->data.content == NULL) return NULL;
+  this->data.content = Queue_alloc(length);
+  if (this->data.content == NULL) {
+    Queue_release(this, sizeof(QueueNode));
+    return NULL;
+  }
+  this->next = NULL;
   this->data.length = length;
   memcpy(this->data.content, content, this->data.length);
   return this;
@@ -96,33 +146,20 @@ QueueNode *QueueNode_new(void *content, size_t length) {
 // Destroys a QueueNode
 void QueueNode_free(QueueNode **this) {
   // Free the node
-  if (this != NULL) {
-    // Cleanup the memory for the data
-    memset((*this)->data.content, 0, (*this)->data.length);
-    // Free the data pointer BEFORE cleaning up the node
-    free((*this)->data.content);
-
-    memset(*this, 0, sizeof(QueueNode)); // Also '\0' is fine
-    // Free the pointer to which this is pointing
-    // which is the actual pointer to the node
-    free(*this);
+  if (this != NULL && *this != NULL) {
+    // Free the data pointer BEFORE releasing the node
+    Queue_release((*this)->data.content, (*this)->data.length);
+    Queue_release(*this, sizeof(QueueNode));
     *this = NULL;
   }
 }
 
-// Destroys a QueueData object
+// Destroys a QueueData object returned by Queue_dequeue,
+// which is embedded in its detached node
 void QueueData_free(QueueData **this) {
-  // Free the data
-  if (this != NULL) {
-    // Cleanup the memory for the content
-    memset((*this)->content, 0, (*this)->length);
-    // Free the content pointer BEFORE cleaning up the object
-    free((*this)->content);
-
-    memset(*this, 0, sizeof(QueueData)); // Also '\0' is fine
-    // Free the pointer to which this is pointing
-    // which is the actual pointer to the node
-    free(*this);
+  if (this != NULL && *this != NULL) {
+    QueueNode *node = (QueueNode *)((char *)*this - offsetof(QueueNode, data));
+    QueueNode_free(&node);
     *this = NULL;
   }
 }
@@ -132,6 +169,7 @@ void QueueData_free(QueueData **this) {
 // Add an element at the end of the queue (Last IN)
 bool Queue_enqueue(Queue *this, void *data, size_t length) {
   QueueNode *item = QueueNode_new(data, length);
+  if (item == NULL) return false;
 
   // Inserting the first item
   if (Queue_empty(this)) {
@@ -160,25 +198,12 @@ QueueData *Queue_dequeue(Queue *this) {
     // Detach it from the queue
     this->first = this->first->next; // which can be null
 
-    // Copy node data
-    // NOTE: memory is copied, it needs to be freed somewhere
-    // First, allocate memory for the QueueData structure pointer
-    QueueData *data = (QueueData *)calloc(sizeof(QueueData), 1);
-    if (!data) return NULL;
-    data->length = item->data.length;
-    // Then, allocate memory for the QueueData content
-    data->content = calloc(data->length, 1);
-    if (!data->content) return NULL;
-    // Copy the node data
-    memcpy(data->content, item->data.content, item->data.length);
-
-    // Deletes the node
-    QueueNode_free(&item);
-
+    // The detached node is handed over to the caller,
+    // QueueData_free() releases the whole node
     this->length -= 1;
 
     // Return its data
-    return data;
+    return &(item->data);
   }
   return NULL;
 }
@@ -23,6 +23,9 @@
 #define QUEUES_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "pool/pool.h"
 
 /**
  * A queue is a minimal struct that keeps information
@@ -59,6 +62,19 @@ void Queue_free(Queue **);
 // It DOES NOT need to be used after Queue_peak and Queue_lpeak
 void QueueData_free(QueueData **);
 
+/// Pool management
+
+
+// Preallocates nodes for all the queues, without a pool
+// nodes are allocated from the heap
+bool Queue_initPool(size_t capacity);
+
+// Destroys the node pool, no queue must be in use
+void Queue_freePool();
+
+// Returns the node pool or NULL
+Pool *Queue_pool();
+
 /// Utility
 
 
@@ -72,7 +88,7 @@ bool Queue_empty(const Queue *);
 bool Queue_enqueue(Queue *, void*, size_t);
 
 // Returns and remove the first element of the queue
-// The QueueData item returned is a copy and NEEDS to be freed with QueueData_free
+// The QueueData item returned is detached and NEEDS to be freed with QueueData_free
 QueueData *Queue_dequeue(Queue *);
 
 // Returns the first element of the queue without removing it
@@ -55,6 +55,23 @@ void Socket_setReusableAddress(SOCKET this) {
   }
 }
 
+// Allow multiple sockets to bind the same address/port combination,
+// the kernel will balance incoming connections between them
+void Socket_setReusablePort(SOCKET this) {
+#if defined(SO_REUSEPORT)
+  int optReusePort = 1;
+  if (setsockopt(this, SOL_SOCKET, SO_REUSEPORT, (const void *)&optReusePort , sizeof(int))) {
+    Error(
+      "Unable to set reusable port (%d): %s\n",
+      SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
+    );
+  }
+#else
+  (void)this;
+  Warn("Reusable ports are not supported on this system");
+#endif
+}
+
 // Set the given socket to be non-blocking using ioctl()
 void Socket_setNonBlocking(SOCKET this) {
   int optNonBlocking = 1;
@@ -79,6 +79,9 @@
   // Allow the given socket to reuse the same address without waiting 20 seconds
   void Socket_setReusableAddress(SOCKET);
 
+  // Allow multiple sockets to listen on the same address and port
+  void Socket_setReusablePort(SOCKET);
+
   // Set the given socket to be non-blocking
   void Socket_setNonBlocking(SOCKET this);
 
@@ -21,25 +21,107 @@
 
 #include "validate.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <wchar.h>
+#include <wctype.h>
+
+enum {
+  kRegexCacheSize = 16 // Max number of compiled patterns kept in memory
+};
+
+/// A compiled pattern, ready to be executed
+typedef struct {
+  char *pattern; ///< The source pattern, used as key
+  regex_t regex; ///< The compiled regular expression
+} RegexCacheEntry;
+
+/// Compiled patterns, entries are only appended and never change once published
+static RegexCacheEntry cache[kRegexCacheSize];
+
+/// Number of published entries, readers don't need a lock
+static atomic_size_t cacheLength = 0;
+
+/// Serialises the compilation of new entries
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Looks up a compiled pattern in the cache
+ * @param[in]  pattern The regular expression pattern
+ * @param[out]         The compiled regex or NULL
+ */
+static regex_t *Regex_lookup(const char *pattern) {
+  size_t length = atomic_load_explicit(&cacheLength, memory_order_acquire);
+  for (size_t i = 0; i < length; i++) {
+    if (strcmp(cache[i].pattern, pattern) == 0) return &(cache[i].regex);
+  }
+  return NULL;
+}
+
+/**
+ * Returns the compiled version of a pattern, compiling and caching it
+ * on first use. A compiled regex can be executed by many threads at once.
+ * @param[in]  pattern   The regular expression pattern
+ * @param[in]  error     Pointer to a buffer where to store the error
+ * @param[in]  errorSize Length of the error buffer
+ * @param[in]  failed    Set to true if the pattern can't be compiled
+ * @param[out]           The compiled regex, or NULL if it's not cached
+ */
+static regex_t *Regex_cached(
+  const char *pattern, char *error, const size_t errorSize, bool *failed
+) {
+  *failed = false;
+  regex_t *regex = Regex_lookup(pattern);
+  if (regex != NULL) return regex;
+
+  pthread_mutex_lock(&cacheLock);
+  // Another thread may have compiled the same pattern in the meantime
+  regex = Regex_lookup(pattern);
+  size_t length = atomic_load_explicit(&cacheLength, memory_order_relaxed);
+  if (regex == NULL && length < kRegexCacheSize) {
+    RegexCacheEntry *entry = &(cache[length]);
+    int compErrorCode = regcomp(&(entry->regex), pattern, REG_ICASE);
+    if (compErrorCode) {
+      regerror(compErrorCode, &(entry->regex), error, errorSize);
+      *failed = true;
+    } else if ((entry->pattern = strdup(pattern)) == NULL) {
+      regfree(&(entry->regex));
+    } else {
+      regex = &(entry->regex);
+      atomic_store_explicit(&cacheLength, length + 1, memory_order_release);
+    }
+  }
+  pthread_mutex_unlock(&cacheLock);
+  return regex;
+}
 
 int Regex_match(
   const char *subject, const char *pattern, char *error, const size_t errorSize
 ) {
-  regex_t regex;
   int success = -1;
 
-  // Compile the regex
-  // int regcomp(regex_t *preg, const char *regex, int cflags);
-  int compErrorCode = regcomp(&regex, pattern, REG_ICASE);
-  if (compErrorCode) {
-    // regerror() checks if buffer and buffer size are non-zero
-    regerror(compErrorCode, &regex, error, errorSize);
-    return success;
+  // Patterns are compiled once, unless the cache is full
+  bool failed = false;
+  regex_t *regex = Regex_cached(pattern, error, errorSize, &failed);
+  if (failed) return success;
+
+  regex_t local;
+  if (regex == NULL) {
+    // int regcomp(regex_t *preg, const char *regex, int cflags);
+    int compErrorCode = regcomp(&local, pattern, REG_ICASE);
+    if (compErrorCode) {
+      // regerror() checks if buffer and buffer size are non-zero
+      regerror(compErrorCode, &local, error, errorSize);
+      return success;
+    }
   }
 
   // Execute the regex
   // int regexec(const regex_t *preg, const char *string, size_t nmatch, regmatch_t pmatch[], int eflags);
-  int execErrorCode = regexec(&regex, subject, 0, NULL, 0);
+  const regex_t *compiled = (regex != NULL) ? regex : &local;
+  int execErrorCode = regexec(compiled, subject, 0, NULL, 0);
   switch (execErrorCode) {
     case 0: // Match
       success = 1;
@@ -48,11 +130,80 @@ int Regex_match(
       success = 0;
       break;
     default:
-      regerror(execErrorCode, &regex, error, errorSize);
+      regerror(execErrorCode, compiled, error, errorSize);
   }
 
-  // Free memory
-  regfree(&regex);
+  // Free memory, cached patterns are kept
+  if (regex == NULL) regfree(&local);
   return success;
 }
 
+void Regex_clearCache() {
+  pthread_mutex_lock(&cacheLock);
+  size_t length = atomic_load(&cacheLength);
+  atomic_store(&cacheLength, 0);
+  for (size_t i = 0; i < length; i++) {
+    regfree(&(cache[i].regex));
+    free(cache[i].pattern);
+    cache[i].pattern = NULL;
+  }
+  pthread_mutex_unlock(&cacheLock);
+}
+
+/// Character classes of the nickname state machine
+typedef enum {
+  kNicknameOther = 0, ///< Not allowed anywhere
+  kNicknameLetter, ///< [[:alpha:]], allowed anywhere
+  kNicknameDigit, ///< [[:alnum:]] but not a letter, not allowed as the first character
+  kNicknameSymbol ///< [!@#$%&], not allowed as the first character
+} NicknameClass;
+
+/**
+ * Returns the class of a nickname character in the current locale,
+ * like the [[:alpha:]] and [[:alnum:]] classes of the regex.
+ * ASCII characters are classified without calling the locale.
+ * @param[in] c The wide character to classify
+ */
+static NicknameClass Nickname_class(wchar_t c) {
+  if (c >= 0 && c < 0x80) {
+    if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) return kNicknameLetter;
+    if (c >= '0' && c <= '9') return kNicknameDigit;
+    if (c != L'\0' && wcschr(L"!@#$%&", c) != NULL) return kNicknameSymbol;
+    return kNicknameOther;
+  }
+  if (iswalpha((wint_t)c)) return kNicknameLetter;
+  if (iswalnum((wint_t)c)) return kNicknameDigit;
+  return kNicknameOther;
+}
+
+enum {
+  kNicknameMinLength = 2,
+  kNicknameMaxLength = 15
+};
+
+bool Validate_nickname(const char *subject) {
+  // The state is the number of accepted characters, any invalid
+  // character or a nickname longer than the max moves to the reject state.
+  // Characters are decoded with the current locale, like the regex does.
+  mbstate_t decoder = {0};
+  const char *c = subject;
+  size_t remaining = strlen(subject);
+  size_t state = 0;
+  while (remaining > 0) {
+    wchar_t character = 0;
+    size_t length = 1;
+    if ((unsigned char)*c < 0x80) {
+      character = (unsigned char)*c;
+    } else {
+      length = mbrtowc(&character, c, remaining, &decoder);
+      if (length == (size_t)-1 || length == (size_t)-2 || length == 0) return false;
+    }
+    NicknameClass class = Nickname_class(character);
+    if (state == 0 && class != kNicknameLetter) return false;
+    if (class == kNicknameOther || state == kNicknameMaxLength) return false;
+    state++;
+    c += length;
+    remaining -= length;
+  }
+  return state >= kNicknameMinLength;
+}
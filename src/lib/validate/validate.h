@@ -39,5 +39,23 @@
     const char *subject, const char *pattern, char *error, const size_t errorSize
   );
 
+  /**
+   * Frees the compiled patterns cached by Regex_match()
+   * Must not be called while other threads are matching
+   */
+  void Regex_clearCache();
+
+  /**
+   * Hand-written validator for nicknames, equivalent to the pattern
+   * "^[[:alpha:]][[:alnum:]!@#$%&]\\{1,14\\}$" in the current locale:
+   *  - must start with a letter
+   *  - min 2 max 15 characters, not bytes
+   *  - only letters, digits and !@#$%&, letters and digits of any
+   *    script are accepted if the locale is UTF-8
+   * @param[in]  subject The string to check
+   * @param[out]         true if the nickname is valid
+   */
+  bool Validate_nickname(const char *subject);
+
 #endif
 
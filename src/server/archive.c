@@ -0,0 +1,967 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file archive.c
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "archive.h"
+#include "rooms.h"
+#include "stats.h"
+#include "cqueue/cqueue.h"
+#include "fsutil/fsutil.h"
+#include "logger/logger.h"
+#include "../c2hat.h"
+
+enum {
+  /// Size of the segment file names, e.g. "/00000000000000000001.log"
+  kArchiveFileNameSize = 32
+};
+
+/// A frame waiting for the writer thread
+typedef struct {
+  Frame *frame; ///< The frame to write, the entry owns one reference
+  int64_t timestamp; ///< When the frame was queued
+  char room[kMaxRoomNameSize]; ///< Name of the room that received the frame
+} ArchiveEntry;
+
+/// A segment file and its sparse index
+typedef struct {
+  uint64_t first; ///< Sequence number of the first record, also the file name
+  uint64_t last; ///< Sequence number of the last record
+  int64_t lastTime; ///< Timestamp of the last record
+  size_t length; ///< Size of the records
+  ArchiveIndexEntry *index; ///< The sparse index
+  size_t indexLength; ///< Number of index entries
+  size_t indexCapacity; ///< Allocated index entries
+} ArchiveSegment;
+
+/// The records between two entries of the sparse index of a segment
+typedef struct {
+  uint64_t segment; ///< Sequence number of the first record of the segment
+  uint64_t sequence; ///< Sequence number of the first record of the block
+  size_t start; ///< Position of the first record of the block
+  size_t end; ///< Position after the last record of the block
+} ArchiveBlock;
+
+/// A segment file mapped by a reader
+typedef struct {
+  uint64_t first; ///< Sequence number of the first record of the segment
+  char *data; ///< Mapping of the segment file
+  size_t size; ///< Size of the mapping
+} ArchiveMapping;
+
+struct Archive {
+  char path[kMaxPath - kArchiveFileNameSize]; ///< Directory of the segment files
+  size_t maxSize; ///< Max size of all the segments, the active one can't be removed
+  size_t segmentSize; ///< Size of each segment file
+  int64_t maxAge; ///< Milliseconds after which a segment is removed, 0 = never
+  pthread_mutex_t lock; ///< Protects the segment list
+  ArchiveSegment *segments; ///< The segments, oldest first
+  size_t segmentCount; ///< Number of segments
+  size_t segmentCapacity; ///< Allocated segments
+  size_t size; ///< Size of the records in all the segments
+  uint64_t sequence; ///< Sequence number of the last written record
+  atomic_uint_least64_t committed; ///< Sequence number of the last record flushed to disk
+  // The active segment is only accessed by the writer thread
+  bool active; ///< The last segment is open for writing
+  int file; ///< Descriptor of the active segment file
+  int indexFile; ///< Descriptor of the active index file
+  char *map; ///< Mapping of the active segment file
+  bool indexStale; ///< An index entry of the active segment couldn't be written
+  size_t synced; ///< Bytes of the active segment already flushed to disk
+  CQueue *queue; ///< Frames waiting for the writer thread
+  atomic_size_t pending; ///< Number of frames in the queue
+  atomic_bool stop; ///< Tells the writer thread to exit
+  pthread_t writer; ///< The writer thread
+};
+
+/**
+ * Returns the current time in milliseconds since the Epoch
+ */
+static int64_t Archive_now() {
+  struct timespec now = {};
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**
+ * Returns the size of a record with the given room name and encoding, padding included
+ * @param[in] roomLength The size of the room name
+ * @param[in] length     The size of the binary encoding
+ */
+static size_t Archive_recordSize(size_t roomLength, size_t length) {
+  return (sizeof(ArchiveRecord) + roomLength + length + 7) & ~(size_t)7;
+}
+
+/**
+ * Builds the path of a segment file or of its index
+ * @param[in]  this      The archive
+ * @param[in]  first     The sequence number of the first record of the segment
+ * @param[in]  extension Either "log" or "idx"
+ * @param[out] path      Receives the path, kMaxPath bytes
+ */
+static void Archive_path(const Archive *this, uint64_t first, const char *extension, char *path) {
+  snprintf(path, kMaxPath, "%s/%020" PRIu64 ".%s", this->path, first, extension);
+}
+
+/**
+ * Adds an entry to the sparse index of a segment, if the record
+ * is the first one or far enough from the last indexed one
+ * @param[in] segment The segment
+ * @param[in] record  The record header
+ * @param[in] offset  The position of the record in the segment
+ * @param[out] The new entry, or NULL if the record is not indexed
+ */
+static ArchiveIndexEntry *Archive_index(ArchiveSegment *segment, const ArchiveRecord *record, size_t offset) {
+  if (segment->indexLength > 0
+    && offset - segment->index[segment->indexLength - 1].offset < kArchiveIndexInterval) {
+    return NULL;
+  }
+  if (segment->indexLength == segment->indexCapacity) {
+    size_t capacity = (segment->indexCapacity > 0) ? segment->indexCapacity * 2 : 16;
+    ArchiveIndexEntry *index = realloc(segment->index, capacity * sizeof(ArchiveIndexEntry));
+    if (index == NULL) return NULL;
+    segment->index = index;
+    segment->indexCapacity = capacity;
+  }
+  ArchiveIndexEntry *entry = &(segment->index[segment->indexLength++]);
+  entry->sequence = record->sequence;
+  entry->timestamp = record->timestamp;
+  entry->offset = offset;
+  return entry;
+}
+
+/**
+ * Checks the record at the given position of a segment file
+ * @param[in] data     The segment content
+ * @param[in] size     The segment size
+ * @param[in] offset   The position of the record
+ * @param[in] sequence The expected sequence number
+ * @param[out] The size of the record, 0 if it's missing or corrupted
+ */
+static size_t Archive_check(const char *data, size_t size, size_t offset, uint64_t sequence) {
+  if (offset + sizeof(ArchiveRecord) > size) return 0;
+  const ArchiveRecord *record = (const ArchiveRecord *)(data + offset);
+  if (record->sequence != sequence || record->roomLength >= kMaxRoomNameSize) return 0;
+  size_t length = Archive_recordSize(record->roomLength, record->length);
+  if (offset + length > size) return 0;
+  const Bytef *payload = (const Bytef *)(record + 1);
+  uLong checksum = crc32(0L, payload, record->roomLength + record->length);
+  return (checksum == record->checksum) ? length : 0;
+}
+
+/**
+ * Replaces the index file of a segment with its index in memory
+ * @param[in] this    The archive
+ * @param[in] segment The segment
+ * @param[out] false if the file can't be written
+ */
+static bool Archive_saveIndex(const Archive *this, const ArchiveSegment *segment) {
+  char path[kMaxPath] = "";
+  Archive_path(this, segment->first, "idx", path);
+  int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (file < 0) return false;
+  size_t bytes = segment->indexLength * sizeof(ArchiveIndexEntry);
+  bool saved = (write(file, segment->index, bytes) == (ssize_t)bytes);
+  close(file);
+  return saved;
+}
+
+/**
+ * Loads the index of a segment and finds its last valid record,
+ * starting from the last indexed one. Only the records before the first
+ * invalid one are used. The unused space of a preallocated file and the
+ * records torn by a crash in the newest segment are truncated, the bytes
+ * after a damaged record of an older segment are kept on disk.
+ * Missing index entries are rebuilt.
+ * @param[in] this    The archive
+ * @param[in] segment The segment, with the first sequence number set
+ * @param[in] newest  The segment is the last one, written when the server stopped
+ * @param[out] false if the segment can't be read or has no valid records
+ */
+static bool Archive_loadSegment(Archive *this, ArchiveSegment *segment, bool newest) {
+  char path[kMaxPath] = "";
+  char indexPath[kMaxPath] = "";
+  Archive_path(this, segment->first, "log", path);
+  Archive_path(this, segment->first, "idx", indexPath);
+  int file = open(path, O_RDONLY);
+  if (file < 0) return false;
+  struct stat info = {};
+  char *data = MAP_FAILED;
+  if (fstat(file, &info) == 0 && info.st_size >= (off_t)sizeof(ArchiveRecord)) {
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+  }
+  close(file);
+  if (data == MAP_FAILED) return false;
+  size_t size = (size_t)info.st_size;
+
+  // Only the index entries that point to valid records are kept
+  size_t stored = 0;
+  int indexFile = open(indexPath, O_RDONLY);
+  if (indexFile >= 0) {
+    ArchiveIndexEntry entry = {};
+    while (read(indexFile, &entry, sizeof(entry)) == (ssize_t)sizeof(entry)) {
+      if (Archive_check(data, size, entry.offset, entry.sequence) == 0) break;
+      if (stored > 0 && entry.offset <= segment->index[stored - 1].offset) break;
+      if (stored == 0 && (entry.offset != 0 || entry.sequence != segment->first)) break;
+      if (stored == segment->indexCapacity) {
+        size_t capacity = (stored > 0) ? stored * 2 : 16;
+        ArchiveIndexEntry *index = realloc(segment->index, capacity * sizeof(ArchiveIndexEntry));
+        if (index == NULL) break;
+        segment->index = index;
+        segment->indexCapacity = capacity;
+      }
+      segment->index[stored++] = entry;
+    }
+    close(indexFile);
+  }
+  segment->indexLength = stored;
+
+  // Walk the records after the last indexed one
+  size_t offset = 0;
+  uint64_t sequence = segment->first;
+  if (stored > 0) {
+    offset = segment->index[stored - 1].offset;
+    sequence = segment->index[stored - 1].sequence;
+  }
+  size_t length = 0;
+  while ((length = Archive_check(data, size, offset, sequence)) > 0) {
+    const ArchiveRecord *record = (const ArchiveRecord *)(data + offset);
+    Archive_index(segment, record, offset);
+    segment->last = sequence++;
+    segment->lastTime = record->timestamp;
+    offset += length;
+  }
+  segment->length = offset;
+  bool unused = newest;
+  while (!unused && offset < size && data[offset] == 0) offset++;
+  unused = unused || (offset == size);
+  munmap(data, size);
+  if (segment->length == 0) return false;
+
+  // The next segments don't depend on the size of the file or on its index,
+  // so failing to truncate or rewrite them leaves the segment usable
+  if (segment->length < size && unused) truncate(path, segment->length);
+  if (segment->indexLength != stored) Archive_saveIndex(this, segment);
+  return true;
+}
+
+/**
+ * Deletes the files of a segment and frees its index
+ * @param[in] this    The archive
+ * @param[in] segment The segment to delete
+ */
+static void Archive_deleteSegment(Archive *this, ArchiveSegment *segment) {
+  char path[kMaxPath] = "";
+  Archive_path(this, segment->first, "log", path);
+  unlink(path);
+  Archive_path(this, segment->first, "idx", path);
+  unlink(path);
+  free(segment->index);
+  memset(segment, 0, sizeof(ArchiveSegment));
+}
+
+/**
+ * Compares two sequence numbers, for qsort()
+ */
+static int Archive_compare(const void *a, const void *b) {
+  uint64_t first = *(const uint64_t *)a;
+  uint64_t second = *(const uint64_t *)b;
+  return (first > second) - (first < second);
+}
+
+/**
+ * Finds the existing segment files and loads their indexes. A segment
+ * that can't be read, or that overlaps the previous one, is left on disk
+ * and skipped, and the next segments are still loaded, so the sequence
+ * can have gaps. The sequence continues after the highest record found,
+ * and after the first record of any skipped segment, so that a new segment
+ * never replaces an existing file.
+ * @param[in] this The archive
+ * @param[out] false if the directory can't be read
+ */
+static bool Archive_recover(Archive *this) {
+  DIR *directory = opendir(this->path);
+  if (directory == NULL) return false;
+  uint64_t *firsts = NULL;
+  size_t count = 0;
+  size_t capacity = 0;
+  struct dirent *item = NULL;
+  while ((item = readdir(directory)) != NULL) {
+    uint64_t first = 0;
+    char extension[4] = "";
+    if (strlen(item->d_name) != 24) continue;
+    if (sscanf(item->d_name, "%20" SCNu64 ".%3s", &first, extension) != 2) continue;
+    if (strcmp(extension, "log") != 0 || first == 0) continue;
+    if (count == capacity) {
+      capacity = (capacity > 0) ? capacity * 2 : 16;
+      uint64_t *grown = realloc(firsts, capacity * sizeof(uint64_t));
+      if (grown == NULL) {
+        // A missing segment could be replaced by a new one
+        closedir(directory);
+        free(firsts);
+        return false;
+      }
+      firsts = grown;
+    }
+    firsts[count++] = first;
+  }
+  closedir(directory);
+  if (count > 0) qsort(firsts, count, sizeof(uint64_t), Archive_compare);
+
+  this->segments = calloc((count > 0) ? count : 1, sizeof(ArchiveSegment));
+  this->segmentCapacity = (count > 0) ? count : 1;
+  if (this->segments == NULL) {
+    free(firsts);
+    return false;
+  }
+  uint64_t skipped = 0;
+  for (size_t i = 0; i < count; i++) {
+    ArchiveSegment *segment = &(this->segments[this->segmentCount]);
+    segment->first = firsts[i];
+    bool loaded = Archive_loadSegment(this, segment, i == count - 1);
+    bool follows = (this->segmentCount == 0) || (segment->first > this->sequence);
+    if (loaded && follows) {
+      this->sequence = segment->last;
+      this->size += segment->length;
+      this->segmentCount++;
+      continue;
+    }
+    char path[kMaxPath] = "";
+    Archive_path(this, segment->first, "log", path);
+    Error(
+      "Unable to load the archive segment %s, %s: the file is kept but not read", path,
+      loaded ? "it overlaps the previous one" : "it can't be read or has no valid records"
+    );
+    uint64_t highest = loaded ? segment->last : segment->first;
+    if (highest > skipped) skipped = highest;
+    free(segment->index);
+    memset(segment, 0, sizeof(ArchiveSegment));
+  }
+  free(firsts);
+  if (skipped > this->sequence) this->sequence = skipped;
+  atomic_store(&(this->committed), this->sequence);
+  return true;
+}
+
+/**
+ * Flushes the records written to the active segment and its index
+ * to disk, then makes them visible to the readers. If the flush fails
+ * the records stay invisible and the next commit retries them.
+ * @param[in] this The archive
+ * @param[out] false if the data can't be flushed
+ */
+static bool Archive_commit(Archive *this) {
+  if (!this->active) return true;
+  ArchiveSegment *segment = &(this->segments[this->segmentCount - 1]);
+  if (segment->length == this->synced) return true;
+  // msync() needs a page aligned address
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t start = this->synced - this->synced % page;
+  if (msync(this->map + start, segment->length - start, MS_SYNC) != 0
+    || fdatasync(this->indexFile) != 0) {
+    return false;
+  }
+  this->synced = segment->length;
+  atomic_store(&(this->committed), this->sequence);
+  return true;
+}
+
+/**
+ * Flushes and closes the active segment, the file is truncated to the
+ * size of its records. If the truncation fails, the unused space is
+ * discarded when the archive is opened again.
+ * @param[in] this The archive
+ * @param[out] false if the segment keeps its preallocated size
+ */
+static bool Archive_finish(Archive *this) {
+  if (!this->active) return true;
+  Archive_commit(this);
+  ArchiveSegment *segment = &(this->segments[this->segmentCount - 1]);
+  munmap(this->map, this->segmentSize);
+  bool truncated = (ftruncate(this->file, segment->length) == 0);
+  close(this->file);
+  close(this->indexFile);
+  if (this->indexStale) Archive_saveIndex(this, segment);
+  this->map = NULL;
+  this->synced = 0;
+  this->indexStale = false;
+  this->active = false;
+  return truncated;
+}
+
+/**
+ * Creates a new segment for the next record, preallocated and mapped
+ * @param[in] this The archive
+ * @param[out] false if the segment can't be created
+ */
+static bool Archive_roll(Archive *this) {
+  // A segment is closed only once its records are on disk,
+  // otherwise it stays active and the flush is retried
+  if (!Archive_commit(this)) return false;
+  Archive_finish(this);
+  pthread_mutex_lock(&(this->lock));
+  if (this->segmentCount == this->segmentCapacity) {
+    size_t capacity = this->segmentCapacity * 2;
+    ArchiveSegment *segments = realloc(this->segments, capacity * sizeof(ArchiveSegment));
+    if (segments == NULL) {
+      pthread_mutex_unlock(&(this->lock));
+      return false;
+    }
+    this->segments = segments;
+    this->segmentCapacity = capacity;
+  }
+  pthread_mutex_unlock(&(this->lock));
+
+  uint64_t first = this->sequence + 1;
+  char path[kMaxPath] = "";
+  char indexPath[kMaxPath] = "";
+  Archive_path(this, first, "log", path);
+  Archive_path(this, first, "idx", indexPath);
+  this->file = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  this->indexFile = open(indexPath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+  bool ready = (this->file >= 0 && this->indexFile >= 0)
+    && ftruncate(this->file, this->segmentSize) == 0;
+  if (ready) {
+    this->map = mmap(NULL, this->segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, this->file, 0);
+    ready = (this->map != MAP_FAILED);
+  }
+  if (!ready) {
+    if (this->file >= 0) close(this->file);
+    if (this->indexFile >= 0) close(this->indexFile);
+    unlink(path);
+    unlink(indexPath);
+    this->map = NULL;
+    return false;
+  }
+
+  pthread_mutex_lock(&(this->lock));
+  this->segments[this->segmentCount++] = (ArchiveSegment){ .first = first };
+  pthread_mutex_unlock(&(this->lock));
+  this->active = true;
+  return true;
+}
+
+/**
+ * Writes a frame at the end of the active segment,
+ * rolling over to a new segment if it doesn't fit
+ * @param[in] this  The archive
+ * @param[in] entry The frame to write
+ * @param[out] false if the frame can't be written
+ */
+static bool Archive_write(Archive *this, const ArchiveEntry *entry) {
+  size_t roomLength = strlen(entry->room);
+  size_t size = Archive_recordSize(roomLength, entry->frame->binaryLength);
+  if (size > this->segmentSize) return false;
+  ArchiveSegment *segment = this->active ? &(this->segments[this->segmentCount - 1]) : NULL;
+  if (segment == NULL || segment->length + size > this->segmentSize) {
+    if (!Archive_roll(this)) return false;
+    segment = &(this->segments[this->segmentCount - 1]);
+  }
+
+  // The space after the records is still zeroed, so the padding is too
+  size_t offset = segment->length;
+  ArchiveRecord *record = (ArchiveRecord *)(this->map + offset);
+  char *payload = (char *)(record + 1);
+  memcpy(payload, entry->room, roomLength);
+  memcpy(payload + roomLength, entry->frame->binary, entry->frame->binaryLength);
+  *record = (ArchiveRecord){
+    .sequence = this->sequence + 1,
+    .timestamp = entry->timestamp,
+    .length = entry->frame->binaryLength,
+    .checksum = crc32(0L, (const Bytef *)payload, roomLength + entry->frame->binaryLength),
+    .roomLength = roomLength
+  };
+
+  pthread_mutex_lock(&(this->lock));
+  ArchiveIndexEntry *indexed = Archive_index(segment, record, offset);
+  this->sequence = segment->last = record->sequence;
+  segment->lastTime = record->timestamp;
+  segment->length += size;
+  this->size += size;
+  pthread_mutex_unlock(&(this->lock));
+  if (indexed != NULL && !this->indexStale) {
+    // The whole index is saved again when the segment is closed
+    this->indexStale = (write(this->indexFile, indexed, sizeof(ArchiveIndexEntry)) != sizeof(ArchiveIndexEntry));
+  }
+  return true;
+}
+
+/**
+ * Removes the oldest segments while the archive is too large or they
+ * are too old, the active segment is never removed
+ * @param[in] this The archive
+ */
+static void Archive_expire(Archive *this) {
+  int64_t limit = (this->maxAge > 0) ? Archive_now() - this->maxAge : INT64_MIN;
+  pthread_mutex_lock(&(this->lock));
+  size_t removable = this->segmentCount - (this->active ? 1 : 0);
+  size_t removed = 0;
+  while (removed < removable) {
+    ArchiveSegment *segment = &(this->segments[removed]);
+    if (this->size <= this->maxSize && segment->lastTime >= limit) break;
+    this->size -= segment->length;
+    Archive_deleteSegment(this, segment);
+    removed++;
+  }
+  if (removed > 0) {
+    this->segmentCount -= removed;
+    memmove(this->segments, this->segments + removed, this->segmentCount * sizeof(ArchiveSegment));
+  }
+  Stats_set(kStatArchiveBytes, this->size);
+  pthread_mutex_unlock(&(this->lock));
+}
+
+/**
+ * Writes a batch of queued frames and flushes them with a single sync
+ * @param[in] this  The archive
+ * @param[in] items The queued frames, freed by the function
+ */
+static void Archive_writeBatch(Archive *this, Queue *items) {
+  QueueData *item = NULL;
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  while ((item = Queue_dequeue(items)) != NULL) {
+    ArchiveEntry *entry = (ArchiveEntry *)item->content;
+    if (Archive_write(this, entry)) {
+      written++;
+    } else {
+      dropped++;
+    }
+    Frame_release(&(entry->frame));
+    QueueData_free(&item);
+    atomic_fetch_sub(&(this->pending), 1);
+  }
+  Queue_free(&items);
+  // Records that can't be flushed now are retried with the next batch
+  Archive_commit(this);
+  Stats_add(kStatArchivedMessages, written);
+  Stats_add(kStatArchiveDropped, dropped);
+}
+
+/**
+ * Waits for queued frames and writes them in batches, the segments
+ * are checked against the limits after every batch and once per second
+ * @param[in] data The archive
+ */
+static void *Archive_run(void *data) {
+  Archive *this = (Archive *)data;
+  while (!atomic_load(&(this->stop))) {
+    if (CQueue_wait(this->queue, 1000)) {
+      Archive_writeBatch(this, CQueue_popAll(this->queue));
+    }
+    Archive_expire(this);
+  }
+  // Write what is left before closing
+  Queue *items = CQueue_popAll(this->queue);
+  if (items != NULL) Archive_writeBatch(this, items);
+  Archive_finish(this);
+  return NULL;
+}
+
+/**
+ * Opens an archive, the segments left by a previous run are checked
+ * and new records are written to a new segment
+ * @param[in] path        The directory of the segment files, created if missing
+ * @param[in] maxSize     Max size of all the segments
+ * @param[in] segmentSize Size of each segment, at least kArchiveMinSegmentSize
+ * @param[in] maxAge      Seconds after which a segment is removed, 0 = never
+ * @param[out] The archive or NULL on failure
+ */
+Archive *Archive_open(const char *path, size_t maxSize, size_t segmentSize, unsigned int maxAge) {
+  if (strlen(path) >= kMaxPath - kArchiveFileNameSize || !TouchDir(path, 0700)) return NULL;
+  Archive *this = calloc(1, sizeof(Archive));
+  if (this == NULL) return NULL;
+  snprintf(this->path, sizeof(this->path), "%s", path);
+  this->maxSize = maxSize;
+  this->segmentSize = (segmentSize > kArchiveMinSegmentSize) ? segmentSize : kArchiveMinSegmentSize;
+  this->maxAge = (int64_t)maxAge * 1000;
+  this->file = this->indexFile = -1;
+  pthread_mutex_init(&(this->lock), NULL);
+  this->queue = CQueue_new();
+  if (this->queue == NULL || !Archive_recover(this)) {
+    Archive_close(&this);
+    return NULL;
+  }
+  Stats_set(kStatArchiveBytes, this->size);
+  if (pthread_create(&(this->writer), NULL, Archive_run, this) != 0) {
+    this->writer = 0;
+    Archive_close(&this);
+    return NULL;
+  }
+  return this;
+}
+
+/**
+ * Stops the writer thread once the queued frames are written,
+ * then closes the archive
+ * @param[in] this Double pointer to the archive
+ */
+void Archive_close(Archive **this) {
+  if (this == NULL || *this == NULL) return;
+  Archive *archive = *this;
+  if (archive->writer) {
+    atomic_store(&(archive->stop), true);
+    pthread_join(archive->writer, NULL);
+  }
+  if (archive->queue != NULL) {
+    QueueData *item = NULL;
+    while ((item = CQueue_tryPop(archive->queue)) != NULL) {
+      Frame_release(&(((ArchiveEntry *)item->content)->frame));
+      QueueData_free(&item);
+    }
+    CQueue_free(&(archive->queue));
+  }
+  for (size_t i = 0; i < archive->segmentCount; i++) free(archive->segments[i].index);
+  free(archive->segments);
+  pthread_mutex_destroy(&(archive->lock));
+  free(archive);
+  *this = NULL;
+}
+
+/**
+ * Queues a frame for the writer thread, the frame gets its
+ * sequence number when it's written, in queue order
+ * @param[in] this  The archive
+ * @param[in] frame The frame to archive, the archive takes a new reference
+ * @param[in] room  The name of the room that received the frame
+ * @param[out] false if the frame is dropped because the writer is too far behind
+ */
+bool Archive_append(Archive *this, Frame *frame, const char *room) {
+  if (atomic_fetch_add(&(this->pending), 1) >= kArchiveMaxPending) {
+    atomic_fetch_sub(&(this->pending), 1);
+    Stats_add(kStatArchiveDropped, 1);
+    return false;
+  }
+  ArchiveEntry entry = { .frame = Frame_retain(frame), .timestamp = Archive_now() };
+  snprintf(entry.room, sizeof(entry.room), "%s", room);
+  if (!CQueue_push(this->queue, &entry, sizeof(ArchiveEntry))) {
+    Frame_release(&(entry.frame));
+    atomic_fetch_sub(&(this->pending), 1);
+    Stats_add(kStatArchiveDropped, 1);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Finds the block of records that holds a sequence number,
+ * by binary search over the segments and then over the sparse index.
+ * If the record is in a gap left by a segment that couldn't be loaded,
+ * the block of the last record before the gap is returned.
+ * @param[in]  this     The archive
+ * @param[in]  sequence The sequence number
+ * @param[out] block    Receives the block
+ * @param[out] false if there are no records up to the sequence number
+ */
+static bool Archive_locate(Archive *this, uint64_t sequence, ArchiveBlock *block) {
+  pthread_mutex_lock(&(this->lock));
+  // The last segment starting at or before the record
+  size_t low = 0;
+  size_t high = this->segmentCount;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (this->segments[middle].first <= sequence) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  // The active segment has no records right after it's created
+  while (low > 0 && this->segments[low - 1].length == 0) low--;
+  bool found = (low > 0);
+  if (found) {
+    const ArchiveSegment *segment = &(this->segments[low - 1]);
+    if (sequence > segment->last) sequence = segment->last;
+    // The last index entry at or before the record
+    size_t entry = 0;
+    high = segment->indexLength;
+    while (entry < high) {
+      size_t middle = entry + (high - entry) / 2;
+      if (segment->index[middle].sequence <= sequence) {
+        entry = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    *block = (ArchiveBlock){ .segment = segment->first, .sequence = segment->first };
+    if (entry > 0) {
+      block->sequence = segment->index[entry - 1].sequence;
+      block->start = segment->index[entry - 1].offset;
+    }
+    block->end = (entry < segment->indexLength) ? segment->index[entry].offset : segment->length;
+  }
+  pthread_mutex_unlock(&(this->lock));
+  return found;
+}
+
+/**
+ * Finds the block of records that holds the first record archived at or
+ * after a time, by binary search over the time of the last record of the
+ * segments and then over the sparse index. Records are written in queue
+ * order, so their timestamps grow with their sequence numbers.
+ * @param[in]  this      The archive
+ * @param[in]  timestamp Milliseconds since the Epoch
+ * @param[out] block     Receives the block, the record is either in the
+ *                       block or the first one after it
+ * @param[out] false if all the records are older
+ */
+static bool Archive_locateTime(Archive *this, int64_t timestamp, ArchiveBlock *block) {
+  pthread_mutex_lock(&(this->lock));
+  // The first segment ending at or after the time
+  size_t low = 0;
+  size_t high = this->segmentCount;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (this->segments[middle].lastTime < timestamp) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  bool found = (low < this->segmentCount && this->segments[low].length > 0);
+  if (found) {
+    const ArchiveSegment *segment = &(this->segments[low]);
+    // The first index entry at or after the time
+    size_t entry = 0;
+    high = segment->indexLength;
+    while (entry < high) {
+      size_t middle = entry + (high - entry) / 2;
+      if (segment->index[middle].timestamp < timestamp) {
+        entry = middle + 1;
+      } else {
+        high = middle;
+      }
+    }
+    *block = (ArchiveBlock){ .segment = segment->first, .sequence = segment->first };
+    if (entry > 0) {
+      block->sequence = segment->index[entry - 1].sequence;
+      block->start = segment->index[entry - 1].offset;
+    }
+    block->end = (entry < segment->indexLength) ? segment->index[entry].offset : segment->length;
+  }
+  pthread_mutex_unlock(&(this->lock));
+  return found;
+}
+
+/**
+ * Maps the segment file of a block read-only, the mappings
+ * are kept until the end of the read
+ * @param[in] this     The archive
+ * @param[in] mappings The segments already mapped by the reader
+ * @param[in] count    The number of mappings
+ * @param[in] block    The block to read
+ * @param[out] The segment content, or NULL if it can't be mapped
+ */
+static const char *Archive_map(
+  const Archive *this, ArchiveMapping **mappings, size_t *count, const ArchiveBlock *block
+) {
+  for (size_t i = *count; i > 0; i--) {
+    const ArchiveMapping *mapping = &((*mappings)[i - 1]);
+    if (mapping->first == block->segment) {
+      return (block->end <= mapping->size) ? mapping->data : NULL;
+    }
+  }
+  ArchiveMapping *grown = realloc(*mappings, (*count + 1) * sizeof(ArchiveMapping));
+  if (grown == NULL) return NULL;
+  *mappings = grown;
+
+  // A segment removed in the meantime ends the read
+  char path[kMaxPath] = "";
+  Archive_path(this, block->segment, "log", path);
+  int file = open(path, O_RDONLY);
+  if (file < 0) return NULL;
+  struct stat info = {};
+  char *data = MAP_FAILED;
+  if (fstat(file, &info) == 0 && (size_t)info.st_size >= block->end) {
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, file, 0);
+  }
+  close(file);
+  if (data == MAP_FAILED) return NULL;
+  grown[(*count)++] = (ArchiveMapping){
+    .first = block->segment, .data = data, .size = (size_t)info.st_size
+  };
+  return data;
+}
+
+/**
+ * Scans a block for the records of a room before a sequence number
+ * @param[in] data       The segment content
+ * @param[in] block      The block
+ * @param[in] before     Records from this sequence number are ignored
+ * @param[in] room       The room name
+ * @param[in] roomLength The size of the room name
+ * @param[in] skip       The number of matching records to skip
+ * @param[in] records    Receives the other matching records, NULL to count them
+ * @param[out] The number of matching records, skipped ones included
+ */
+static size_t Archive_scan(
+  const char *data, const ArchiveBlock *block, uint64_t before, const char *room,
+  size_t roomLength, size_t skip, const ArchiveRecord **records
+) {
+  size_t matches = 0;
+  size_t offset = block->start;
+  while (offset + sizeof(ArchiveRecord) <= block->end) {
+    const ArchiveRecord *record = (const ArchiveRecord *)(data + offset);
+    size_t size = Archive_recordSize(record->roomLength, record->length);
+    if (record->sequence >= before || offset + size > block->end) break;
+    if (record->roomLength == roomLength && memcmp(record + 1, room, roomLength) == 0) {
+      if (records != NULL && matches >= skip) records[matches - skip] = record;
+      matches++;
+    }
+    offset += size;
+  }
+  return matches;
+}
+
+/**
+ * Reads the last records of a room sent before a sequence number,
+ * walking the blocks of the sparse index backwards from the one that
+ * holds the sequence number. Only the records flushed to disk are
+ * read, and a read stops after kArchiveMaxScan bytes of records.
+ * @param[in] this    The archive
+ * @param[in] room    The room name
+ * @param[in] before  Only records before this sequence number are read, 0 = all
+ * @param[in] count   Max number of records
+ * @param[in] visitor Called for each record, oldest first
+ * @param[in] context Passed to the visitor
+ * @param[out] The sequence number to read the older records from, 0 if there are none
+ */
+uint64_t Archive_read(
+  Archive *this, const char *room, uint64_t before, size_t count,
+  ArchiveVisitor visitor, void *context
+) {
+  uint64_t last = Archive_last(this);
+  if (before == 0 || before > last + 1) before = last + 1;
+  const ArchiveRecord **records = (count > 0) ? calloc(count, sizeof(ArchiveRecord *)) : NULL;
+  if (records == NULL) return 0;
+
+  ArchiveMapping *mappings = NULL;
+  size_t mappingCount = 0;
+  size_t roomLength = strlen(room);
+  size_t found = 0;
+  size_t scanned = 0;
+  uint64_t cursor = before;
+  ArchiveBlock block = {};
+  while (found < count && cursor > 1 && Archive_locate(this, cursor - 1, &block)) {
+    const char *data = Archive_map(this, &mappings, &mappingCount, &block);
+    if (data == NULL) {
+      cursor = 1;
+      break;
+    }
+    // Records are stored oldest first, only the newest matches of the block are kept
+    size_t matches = Archive_scan(data, &block, cursor, room, roomLength, 0, NULL);
+    size_t kept = (matches < count - found) ? matches : count - found;
+    found += kept;
+    Archive_scan(data, &block, cursor, room, roomLength, matches - kept, records + count - found);
+    cursor = block.sequence;
+    scanned += block.end - block.start;
+    if (scanned >= kArchiveMaxScan) break;
+  }
+
+  for (size_t i = count - found; i < count; i++) {
+    const ArchiveRecord *record = records[i];
+    visitor(record, (const char *)(record + 1) + record->roomLength, context);
+  }
+  uint64_t next = 0;
+  if (found == count) {
+    next = records[0]->sequence;
+  } else if (scanned >= kArchiveMaxScan) {
+    next = cursor;
+  }
+  for (size_t i = 0; i < mappingCount; i++) munmap(mappings[i].data, mappings[i].size);
+  free(mappings);
+  free(records);
+  return (next > 1) ? next : 0;
+}
+
+/**
+ * Finds the first record archived at or after a time, only the records
+ * flushed to disk are considered
+ * @param[in] this      The archive
+ * @param[in] timestamp Milliseconds since the Epoch
+ * @param[out] The sequence number of the record, 0 if there are none
+ */
+uint64_t Archive_seek(Archive *this, int64_t timestamp) {
+  ArchiveBlock block = {};
+  if (!Archive_locateTime(this, timestamp, &block)) return 0;
+  ArchiveMapping *mappings = NULL;
+  size_t mappingCount = 0;
+  const char *data = Archive_map(this, &mappings, &mappingCount, &block);
+  uint64_t sequence = 0;
+  if (data != NULL) {
+    // The block ends before an indexed record at or after the time
+    sequence = block.sequence;
+    size_t offset = block.start;
+    while (offset + sizeof(ArchiveRecord) <= block.end) {
+      const ArchiveRecord *record = (const ArchiveRecord *)(data + offset);
+      if (record->timestamp >= timestamp) break;
+      offset += Archive_recordSize(record->roomLength, record->length);
+      sequence = record->sequence + 1;
+    }
+  }
+  for (size_t i = 0; i < mappingCount; i++) munmap(mappings[i].data, mappings[i].size);
+  free(mappings);
+  return (sequence <= Archive_last(this)) ? sequence : 0;
+}
+
+/**
+ * Returns the sequence number of the last record flushed to disk
+ * @param[in] this The archive
+ */
+uint64_t Archive_last(Archive *this) {
+  return atomic_load(&(this->committed));
+}
+
+/**
+ * Returns the number of segment files
+ * @param[in] this The archive
+ */
+size_t Archive_segments(Archive *this) {
+  pthread_mutex_lock(&(this->lock));
+  size_t count = this->segmentCount;
+  pthread_mutex_unlock(&(this->lock));
+  return count;
+}
+
+/**
+ * Returns the size of the records in all the segments
+ * @param[in] this The archive
+ */
+size_t Archive_size(Archive *this) {
+  pthread_mutex_lock(&(this->lock));
+  size_t size = this->size;
+  pthread_mutex_unlock(&(this->lock));
+  return size;
+}
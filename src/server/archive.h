@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  #include "frame.h"
+
+  enum {
+    /// Bytes of records between two entries of the sparse index
+    kArchiveIndexInterval = 4096,
+    /// Min size of a segment file
+    kArchiveMinSegmentSize = 64 * 1024,
+    /// Max frames waiting for the writer thread, the others are dropped
+    kArchiveMaxPending = 64 * 1024,
+    /// Max bytes of records scanned by a single read
+    kArchiveMaxScan = 1024 * 1024
+  };
+
+  /**
+   * Header of a record in a segment file, followed by the room name,
+   * the binary encoding of the frame and the padding to 8 bytes
+   */
+  typedef struct {
+    uint64_t sequence; ///< Position of the record in the whole archive, starting from 1
+    int64_t timestamp; ///< Milliseconds since the Epoch when the frame was archived
+    uint32_t length; ///< Size of the binary encoding
+    uint32_t checksum; ///< CRC-32 of the room name and the binary encoding
+    uint8_t roomLength; ///< Size of the room name, without the NULL terminator
+    uint8_t reserved[7]; ///< Padding, always 0
+  } ArchiveRecord;
+
+  /// Entry of the sparse index of a segment, stored in its .idx file
+  typedef struct {
+    uint64_t sequence; ///< Sequence number of the indexed record
+    int64_t timestamp; ///< Timestamp of the indexed record
+    uint64_t offset; ///< Position of the record in the segment file
+  } ArchiveIndexEntry;
+
+  /**
+   * Append-only store of the broadcast frames, split in segment files
+   * named after the sequence number of their first record. The active
+   * segment is preallocated and memory-mapped. Frames are written by a
+   * dedicated thread, and each batch is flushed to disk with a single
+   * sync (group commit). Every segment has a sparse index, with one
+   * entry every kArchiveIndexInterval bytes of records. The oldest
+   * segments are removed when the archive exceeds its size or age limit.
+   * Readers find records by sequence number or by time, with a binary
+   * search over the segments and their index, and only map the segment
+   * files they need.
+   */
+  typedef struct Archive Archive;
+
+  /// Function called for each record read, with the binary encoding of its frame
+  typedef void (*ArchiveVisitor)(const ArchiveRecord *record, const char *frame, void *context);
+
+  // Opens the archive in the given directory, creating it if needed, and starts the writer
+  Archive *Archive_open(const char *path, size_t maxSize, size_t segmentSize, unsigned int maxAge);
+
+  // Writes the pending frames, stops the writer and closes the archive
+  void Archive_close(Archive **this);
+
+  // Queues a frame sent to the given room for the writer, without blocking
+  bool Archive_append(Archive *this, Frame *frame, const char *room);
+
+  // Reads the last records of a room before a sequence number, oldest first, returns where to continue
+  uint64_t Archive_read(
+    Archive *this, const char *room, uint64_t before, size_t count,
+    ArchiveVisitor visitor, void *context
+  );
+
+  // Returns the sequence number of the first record archived at or after a time, 0 if none
+  uint64_t Archive_seek(Archive *this, int64_t timestamp);
+
+  // Returns the sequence number of the last record flushed to disk
+  uint64_t Archive_last(Archive *this);
+
+  // Returns the number of segment files
+  size_t Archive_segments(Archive *this);
+
+  // Returns the size of the records in all the segments
+  size_t Archive_size(Archive *this);
+
+#endif
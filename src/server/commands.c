@@ -25,9 +25,11 @@
 #include <sys/stat.h>
 #include <locale.h>
 #include <libgen.h> // for basename() and dirname()
+#include <inttypes.h>
 
 #include "encrypt/encrypt.h"
 #include "fsutil/fsutil.h"
+#include "stats.h"
 
 char *currentLogFilePath = NULL;
 char *currentPIDFilePath = NULL;
@@ -41,6 +43,9 @@ const int kMaxCommandSize = 10;
 /// Shared memory handle that stores the configuration data
 char sharedMemPath[16] = {};
 
+/// Shared memory handle that stores the activity counters
+char statsMemPath[32] = {};
+
 /// Size of the shared memory
 const size_t kServerSharedMemSize = sizeof(ServerConfigInfo);
 
@@ -63,6 +68,11 @@ void initSharedMemPath();
  */
 void clean();
 
+/**
+ * Prints the activity counters of the running server
+ */
+void printStats();
+
 /**
  * Clean facility called by STATUS and STOP commands
  * to clean the leftovers
@@ -323,6 +333,11 @@ int CMD_runStart(ServerConfigInfo *settings) {
     settings->pid, settings->maxConnections
   );
 
+  // Publish the activity counters for the status command
+  if (!Stats_init(statsMemPath)) {
+    Warn("Unable to share activity counters: %s", strerror(errno));
+  }
+
   // Start the chat server (infinite loop until SIGTERM)
   Server_start(server);
 
@@ -503,8 +518,45 @@ int CMD_runStatus() {
       printf("     SSL key: %s\n", settings.sslKeyFilePath);
       printf("      Locale: %s\n", settings.locale);
       printf(" Max Clients: %d\n", settings.maxConnections);
+      printf("        Mode: %s\n", SERVER_MODE_NAME(settings.mode));
+      if (settings.mode == kServerModeEvent) {
+        printf("     Workers: %d\n", settings.workers);
+      }
+      printf("Batch Window: %d ms\n", settings.batchWindow);
+      printf("      Outbox: %d messages (%s)\n", settings.outboxSize, OUTBOX_POLICY_NAME(settings.outboxPolicy));
+      if (settings.compressionThreshold > 0) {
+        printf(" Compression: %d bytes or more\n", settings.compressionThreshold);
+      } else {
+        printf(" Compression: disabled\n");
+      }
+      if (settings.ticketLifetime > 0) {
+        printf("     Tickets: rotated every %d seconds\n", settings.ticketLifetime);
+      } else {
+        printf("     Tickets: disabled\n");
+      }
+      char messageRate[16] = "unlimited";
+      char byteRate[16] = "unlimited";
+      if (settings.rateMessages > 0) snprintf(messageRate, sizeof(messageRate), "%u", settings.rateMessages);
+      if (settings.rateBytes > 0) snprintf(byteRate, sizeof(byteRate), "%u", settings.rateBytes);
+      printf("  Rate Limit: %s messages, %s bytes per second\n", messageRate, byteRate);
+      if (settings.historySize > 0) {
+        printf("     History: %d bytes\n", settings.historySize);
+      } else {
+        printf("     History: disabled\n");
+      }
+      if (settings.archiveSize > 0) {
+        printf(
+          "     Archive: %d MB in %d MB segments, kept for %d seconds\n",
+          settings.archiveSize, settings.archiveSegmentSize, settings.archiveAge
+        );
+      } else {
+        printf("     Archive: disabled\n");
+      }
+      printf("  Kernel TLS: %s\n", KERNEL_TLS_MODE_NAME(settings.kernelTLS));
+      printf("   Nicknames: %s\n", NICKNAME_VALIDATOR_NAME(settings.nicknameValidator));
       printf(" Working Dir: %s\n", settings.workingDirPath);
       printf("\n");
+      printStats();
       result = EXIT_SUCCESS;
     break;
 
@@ -550,6 +602,7 @@ void clean() {
     if (!Config_clean(sharedMemPath)) {
       Error("Unable to clean configuration: %s", strerror(errno));
     }
+    Stats_clean(statsMemPath);
   }
 }
 
@@ -568,6 +621,50 @@ void cleanup() {
   if (!Config_clean(sharedMemPath)) {
     fprintf(stderr, "Unable to clean configuration: %s", strerror(errno));
   }
+  Stats_clean(statsMemPath);
+}
+
+/**
+ * Prints the activity counters of the running server
+ */
+void printStats() {
+  uint64_t stats[kStatCount] = {};
+  if (!Stats_load(statsMemPath, stats)) return;
+  printf("Activity:\n");
+  printf("      Writes: %" PRIu64 " (%" PRIu64 " bytes)\n", stats[kStatWrites], stats[kStatBytesWritten]);
+  printf("      Frames: %" PRIu64 " (%.2f per write)\n",
+    stats[kStatFramesWritten],
+    stats[kStatWrites] > 0 ? (double)stats[kStatFramesWritten] / stats[kStatWrites] : 0.0
+  );
+  printf("    Timeouts: %" PRIu64 " (peak %" PRIu64 " per second)\n", stats[kStatTimeouts], stats[kStatTimeoutPeak]);
+  printf("    Messages: %" PRIu64 " allocations, %" PRIu64 " pooled\n",
+    stats[kStatMessageAllocations], stats[kStatMessageCapacity]
+  );
+  printf("       Nodes: %" PRIu64 " allocations, %" PRIu64 " pooled (%" PRIu64 " pool locks)\n",
+    stats[kStatNodeAllocations], stats[kStatNodeCapacity], stats[kStatPoolLocks]
+  );
+  printf("  Compressed: %" PRIu64 " frames (%.1f%% of %" PRIu64 " bytes), %" PRIu64 " bytes saved\n",
+    stats[kStatCompressedFrames],
+    stats[kStatCompressionInput] > 0
+      ? 100.0 * stats[kStatCompressionOutput] / stats[kStatCompressionInput] : 0.0,
+    stats[kStatCompressionInput], stats[kStatCompressionSaved]
+  );
+  printf("  Handshakes: %" PRIu64 " (%" PRIu64 " resumed, %.1f%%)\n",
+    stats[kStatHandshakes], stats[kStatHandshakesResumed],
+    stats[kStatHandshakes] > 0
+      ? 100.0 * stats[kStatHandshakesResumed] / stats[kStatHandshakes] : 0.0
+  );
+  printf("   Throttled: %" PRIu64 " messages rejected\n", stats[kStatRateLimited]);
+  printf("       Rooms: %" PRIu64 " open\n", stats[kStatRooms]);
+  printf("      Direct: %" PRIu64 " messages\n", stats[kStatDirectMessages]);
+  printf(
+    "    Archived: %" PRIu64 " messages, %" PRIu64 " bytes on disk, %" PRIu64 " dropped\n",
+    stats[kStatArchivedMessages], stats[kStatArchiveBytes], stats[kStatArchiveDropped]
+  );
+  printf("  Kernel TLS: %" PRIu64 " send, %" PRIu64 " receive offloads\n",
+    stats[kStatKernelTLSSend], stats[kStatKernelTLSReceive]
+  );
+  printf("\n");
 }
 
 /**
@@ -580,5 +677,6 @@ void initSharedMemPath() {
   } else { // running as normal user, use /<app>-uid
     snprintf(sharedMemPath, sizeof(sharedMemPath), "/%s-%d", APPNAME, uid);
   }
+  snprintf(statsMemPath, sizeof(statsMemPath), "%s-stats", sharedMemPath);
 }
 
@@ -0,0 +1,133 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file frame.c
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "stats.h"
+
+/**
+ * Encodes a message into a new frame, the caller owns the
+ * first reference and needs to release it. Messages are compressed
+ * here, once, and the compressed encoding is shared by all the
+ * clients that support it.
+ * @param[in] message   The message to encode
+ * @param[in] threshold Min size of the binary encoding to compress, 0 to disable compression
+ * @param[out] The new frame, or NULL on failure
+ */
+Frame *Frame_new(const C2HMessage *message, size_t threshold) {
+  if (message == NULL) return NULL;
+  char buffer[kBufferSize] = {};
+  size_t length = C2HMessage_format(message, buffer, sizeof(buffer));
+  size_t binaryLength = C2HMessage_binarySize(message);
+  bool compress = (threshold > 0 && binaryLength >= threshold);
+  size_t bound = compress ? C2HMessage_deflateBound(binaryLength) : 0;
+
+  Frame *this = malloc(sizeof(Frame) + length + binaryLength + bound);
+  if (this == NULL) return NULL;
+  atomic_init(&(this->references), 1);
+  this->length = length;
+  memcpy(this->data, buffer, length);
+  this->binary = this->data + length;
+  this->binaryLength = C2HMessage_encode(message, this->binary, binaryLength);
+  if (this->binaryLength == 0) {
+    free(this);
+    return NULL;
+  }
+  this->compressed = NULL;
+  this->compressedLength = 0;
+  if (compress) {
+    char *compressed = this->binary + this->binaryLength;
+    this->compressedLength = C2HMessage_deflate(
+      this->binary, this->binaryLength, compressed, bound
+    );
+    if (this->compressedLength > 0) {
+      Stats_add(kStatCompressedFrames, 1);
+      Stats_add(kStatCompressionInput, this->binaryLength);
+      Stats_add(kStatCompressionOutput, this->compressedLength);
+    }
+    // Give back the unused part of the deflate bound, so the frame
+    // takes exactly the memory reported by Frame_size()
+    Frame *shrunk = realloc(this, Frame_size(this));
+    if (shrunk != NULL) this = shrunk;
+    this->binary = this->data + length;
+    if (this->compressedLength > 0) {
+      this->compressed = this->binary + this->binaryLength;
+    }
+  }
+  return this;
+}
+
+/**
+ * Returns the encoded message for clients that use the given protocol,
+ * compressed clients get the binary encoding if the frame is not compressed
+ * @param[in]  this     The frame
+ * @param[in]  protocol The protocol of the recipient
+ * @param[out] length   The size of the encoded message
+ * @param[out] Pointer to the encoded message
+ */
+const char *Frame_encoding(const Frame *this, MessageProtocol protocol, size_t *length) {
+  if (protocol == kMessageProtocolCompressed && this->compressed != NULL) {
+    *length = this->compressedLength;
+    return this->compressed;
+  }
+  if (protocol != kMessageProtocolText) {
+    *length = this->binaryLength;
+    return this->binary;
+  }
+  *length = this->length;
+  return this->data;
+}
+
+/**
+ * Returns the memory used by a frame, including all its encodings
+ * @param[in] this The frame
+ * @param[out] The size in bytes
+ */
+size_t Frame_size(const Frame *this) {
+  return sizeof(Frame) + this->length + this->binaryLength + this->compressedLength;
+}
+
+/**
+ * Adds a reference to a frame
+ * @param[in] this The frame to share
+ * @param[out] The same frame
+ */
+Frame *Frame_retain(Frame *this) {
+  atomic_fetch_add_explicit(&(this->references), 1, memory_order_relaxed);
+  return this;
+}
+
+/**
+ * Drops a reference to a frame, the frame is freed when
+ * the last holder releases it
+ * @param[in] this Double pointer to the frame
+ */
+void Frame_release(Frame **this) {
+  if (this != NULL && *this != NULL) {
+    if (atomic_fetch_sub_explicit(&((*this)->references), 1, memory_order_acq_rel) == 1) {
+      free(*this);
+    }
+    *this = NULL;
+  }
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+  #include <stddef.h>
+  #include <stdatomic.h>
+
+  #include "message/message.h"
+
+  /**
+   * A message encoded in wire format, ready to be written to any
+   * number of clients. Frames are reference counted and shared by all
+   * the outboxes and queues that hold them, and freed with the last
+   * reference. Each frame holds the text encoding, truncated
+   * to kBufferSize, the binary encoding and, for large messages,
+   * the compressed binary encoding, in the same block.
+   */
+  typedef struct {
+    atomic_uint references; ///< Number of holders of the frame
+    size_t length; ///< Size of the text encoding, including the NULL terminator
+    size_t binaryLength; ///< Size of the binary encoding
+    char *binary; ///< Binary encoding, stored after the text one
+    size_t compressedLength; ///< Size of the compressed encoding, 0 if not compressed
+    char *compressed; ///< Compressed encoding, stored after the binary one, or NULL
+    char data[]; ///< Text encoding
+  } Frame;
+
+  // Encodes a message into a new frame with one reference,
+  // compressing it if the binary encoding reaches the threshold (0 = never)
+  Frame *Frame_new(const C2HMessage *message, size_t threshold);
+
+  // Returns the encoding of a frame for the given protocol
+  const char *Frame_encoding(const Frame *this, MessageProtocol protocol, size_t *length);
+
+  // Returns the memory used by a frame and its encodings
+  size_t Frame_size(const Frame *this);
+
+  // Adds a reference to a frame and returns it
+  Frame *Frame_retain(Frame *this);
+
+  // Drops a reference to a frame, freeing it with the last one
+  void Frame_release(Frame **this);
+
+#endif
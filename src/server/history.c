@@ -0,0 +1,168 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file history.c
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+/// A stored frame
+typedef struct {
+  Frame *frame; ///< The encoded message, one reference is owned by the history
+  uint64_t sequence; ///< Position of the frame in the whole history
+  size_t size; ///< Memory used by the frame
+  char room[kMaxRoomNameSize]; ///< Name of the room that received the frame
+} HistoryEntry;
+
+struct History {
+  pthread_mutex_t lock; ///< Serialises the writer and the readers
+  HistoryEntry *entries; ///< The ring of slots
+  size_t slots; ///< Number of slots in the ring
+  size_t first; ///< Slot of the oldest frame
+  size_t length; ///< Number of stored frames
+  size_t size; ///< Memory used by the stored frames
+  size_t capacity; ///< Max memory used by the stored frames
+  uint64_t sequence; ///< Sequence number of the last added frame
+};
+
+/**
+ * Creates an empty history, the ring has one slot every
+ * kHistoryMinFrameSize bytes, so it is allocated once
+ * @param[in] capacity Max bytes of frames to keep
+ * @param[out] The new history or NULL on failure
+ */
+History *History_new(size_t capacity) {
+  History *this = calloc(1, sizeof(History));
+  if (this == NULL) return NULL;
+  this->slots = (capacity > kHistoryMinFrameSize) ? capacity / kHistoryMinFrameSize : 1;
+  this->entries = calloc(this->slots, sizeof(HistoryEntry));
+  if (this->entries == NULL) {
+    free(this);
+    return NULL;
+  }
+  this->capacity = capacity;
+  pthread_mutex_init(&(this->lock), NULL);
+  return this;
+}
+
+/**
+ * Destroys a history and releases its frames
+ * @param[in] this Double pointer to the history
+ */
+void History_free(History **this) {
+  if (this == NULL || *this == NULL) return;
+  for (size_t i = 0; i < (*this)->length; i++) {
+    Frame_release(&((*this)->entries[((*this)->first + i) % (*this)->slots].frame));
+  }
+  pthread_mutex_destroy(&((*this)->lock));
+  free((*this)->entries);
+  free(*this);
+  *this = NULL;
+}
+
+/**
+ * Releases the oldest frame, must be called while holding the lock
+ * @param[in] this A history with at least one frame
+ */
+static void History_evict(History *this) {
+  HistoryEntry *entry = &(this->entries[this->first]);
+  this->size -= entry->size;
+  Frame_release(&(entry->frame));
+  this->first = (this->first + 1) % this->slots;
+  this->length--;
+}
+
+/**
+ * Adds a frame to the history, releasing the oldest frames
+ * until the new one fits. Frames larger than the whole
+ * history are not stored.
+ * @param[in] this  The history
+ * @param[in] frame The frame to store, the history takes a new reference
+ * @param[in] room  The name of the room that received the frame
+ * @param[out] The sequence number of the frame, 0 if it was not stored
+ */
+uint64_t History_add(History *this, Frame *frame, const char *room) {
+  size_t size = Frame_size(frame);
+  if (size > this->capacity) return 0;
+  pthread_mutex_lock(&(this->lock));
+  while (this->length == this->slots || this->size + size > this->capacity) {
+    History_evict(this);
+  }
+  HistoryEntry *entry = &(this->entries[(this->first + this->length) % this->slots]);
+  entry->frame = Frame_retain(frame);
+  entry->sequence = ++this->sequence;
+  entry->size = size;
+  snprintf(entry->room, sizeof(entry->room), "%s", room);
+  this->length++;
+  this->size += size;
+  uint64_t sequence = this->sequence;
+  pthread_mutex_unlock(&(this->lock));
+  return sequence;
+}
+
+/**
+ * Copies the most recent frames sent to a room, the ones with
+ * a higher sequence number than last are skipped
+ * @param[in]  this   The history
+ * @param[in]  room   The name of the room
+ * @param[in]  last   The sequence number of the last frame to copy
+ * @param[out] frames Receives new references to the frames, oldest first
+ * @param[in]  max    The max number of frames to copy
+ * @param[out] The number of copied frames
+ */
+size_t History_collect(History *this, const char *room, uint64_t last, Frame **frames, size_t max) {
+  size_t count = 0;
+  pthread_mutex_lock(&(this->lock));
+  // Walk back from the newest frame and fill the array from the end
+  for (size_t i = this->length; i-- > 0 && count < max;) {
+    HistoryEntry *entry = &(this->entries[(this->first + i) % this->slots]);
+    if (entry->sequence > last || strcmp(entry->room, room) != 0) continue;
+    frames[max - ++count] = Frame_retain(entry->frame);
+  }
+  pthread_mutex_unlock(&(this->lock));
+  if (count < max) memmove(frames, frames + max - count, count * sizeof(Frame *));
+  return count;
+}
+
+/**
+ * Returns the number of frames in the history
+ * @param[in] this The history
+ */
+size_t History_length(History *this) {
+  pthread_mutex_lock(&(this->lock));
+  size_t length = this->length;
+  pthread_mutex_unlock(&(this->lock));
+  return length;
+}
+
+/**
+ * Returns the memory used by the frames in the history
+ * @param[in] this The history
+ */
+size_t History_size(History *this) {
+  pthread_mutex_lock(&(this->lock));
+  size_t size = this->size;
+  pthread_mutex_unlock(&(this->lock));
+  return size;
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  #include "frame.h"
+  #include "rooms.h"
+
+  enum {
+    /// Expected min size of a stored frame, used to size the ring
+    kHistoryMinFrameSize = 128
+  };
+
+  /**
+   * The most recent broadcast frames, kept already encoded so that
+   * they can be replayed to the clients that join a room. The ring
+   * has a fixed number of slots and a max size in bytes, counting the
+   * memory of the frames: when either is exceeded, the oldest frames
+   * are released. Each frame gets an increasing sequence number.
+   * The history is thread safe.
+   */
+  typedef struct History History;
+
+  // Creates an empty history that holds at most capacity bytes of frames
+  History *History_new(size_t capacity);
+
+  // Destroys a history, the frames held by other owners survive
+  void History_free(History **this);
+
+  // Adds a frame sent to the given room, returns its sequence number or 0 if not stored
+  uint64_t History_add(History *this, Frame *frame, const char *room);
+
+  // Copies up to max frames of a room, oldest first, up to the given sequence number
+  size_t History_collect(History *this, const char *room, uint64_t last, Frame **frames, size_t max);
+
+  // Returns the number of stored frames
+  size_t History_length(History *this);
+
+  // Returns the memory used by the stored frames
+  size_t History_size(History *this);
+
+#endif
@@ -30,6 +30,33 @@ static const char *kC2HatServerVersion = "1.0";
 /// Default connection limit
 const int kDefaultMaxClients = 5;
 
+/// Default number of messages queued for each client
+const int kDefaultOutboxSize = 64;
+
+/// Default min size of the frames compressed for the clients that support it
+const int kDefaultCompressionThreshold = 256;
+
+/// Default lifetime of the session ticket keys, in seconds
+const int kDefaultTicketLifetime = 3600;
+
+/// Default max messages per second from each client
+const int kDefaultRateMessages = 10;
+
+/// Default max bytes of content per second from each client
+const int kDefaultRateBytes = 64 * 1024;
+
+/// Default max bytes of broadcast messages kept for the clients that join
+const int kDefaultHistorySize = 64 * 1024;
+
+/// Default max megabytes of archived messages
+const int kDefaultArchiveSize = 256;
+
+/// Default megabytes of each archive segment
+const int kDefaultArchiveSegmentSize = 16;
+
+/// Default seconds after which an archive segment is removed (30 days)
+const int kDefaultArchiveAge = 30 * 24 * 3600;
+
 /// Default server port
 const int kDefaultServerPort = 10000;
 
@@ -58,6 +85,15 @@ int main(int argc, ARGV argv) {
       .host = kDefaultServerHost,
       .port = kDefaultServerPort,
       .maxConnections = kDefaultMaxClients,
+      .outboxSize = kDefaultOutboxSize,
+      .compressionThreshold = kDefaultCompressionThreshold,
+      .ticketLifetime = kDefaultTicketLifetime,
+      .rateMessages = kDefaultRateMessages,
+      .rateBytes = kDefaultRateBytes,
+      .historySize = kDefaultHistorySize,
+      .archiveSize = kDefaultArchiveSize,
+      .archiveSegmentSize = kDefaultArchiveSegmentSize,
+      .archiveAge = kDefaultArchiveAge,
       .logLevel = LOG_INFO
     };
     if (parseOptions(argc, argv, &settings)) {
@@ -0,0 +1,256 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file outbox.c
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "list/list.h"
+#include "outbox.h"
+#include "stats.h"
+
+enum {
+  /// Max size of a coalesced write, matches the max TLS record payload
+  kOutboxBatchSize = 16 * 1024
+};
+
+struct Outbox {
+  List *frames; ///< Frame pointers waiting to be written, in delivery order
+  char *batch; ///< Frames coalesced into a single write
+  size_t batchSize; ///< Capacity of the batch buffer
+  size_t batchLength; ///< Bytes in the batch
+  size_t batchOffset; ///< Bytes of the batch already written
+  size_t batchFrames; ///< Number of frames in the batch
+  size_t limit; ///< Max number of queued messages
+  OutboxPolicy policy; ///< What to do when the outbox is full
+  MessageProtocol protocol; ///< Wire format of the client
+  bool overflow; ///< The outbox is full and the client must be disconnected
+  size_t dropped; ///< Number of messages discarded with the drop policy
+  pthread_mutex_t lock; ///< Messages can be pushed and flushed by different threads
+};
+
+/**
+ * Creates a new outbox
+ * @param[in] limit  Max number of messages that can be queued
+ * @param[in] policy What to do when the limit is reached
+ * @param[out] The new outbox, or NULL on failure
+ */
+Outbox *Outbox_new(size_t limit, OutboxPolicy policy) {
+  Outbox *this = calloc(1, sizeof(Outbox));
+  if (this == NULL) return NULL;
+  this->frames = List_new();
+  this->batch = malloc(kOutboxBatchSize);
+  if (this->frames == NULL || this->batch == NULL || pthread_mutex_init(&(this->lock), NULL)) {
+    if (this->frames != NULL) List_free(&(this->frames));
+    free(this->batch);
+    free(this);
+    return NULL;
+  }
+  this->batchSize = kOutboxBatchSize;
+  this->limit = (limit > 0) ? limit : 1;
+  this->policy = policy;
+  return this;
+}
+
+/**
+ * Removes a frame from the outbox and releases its reference
+ * @param[in] this     The outbox
+ * @param[in] position The position of the frame in the outbox
+ */
+static bool Outbox_delete(Outbox *this, int position) {
+  Frame **frame = (Frame **)List_item(this->frames, position);
+  if (frame == NULL) return false;
+  Frame_release(frame);
+  return List_delete(this->frames, position);
+}
+
+/**
+ * Destroys an outbox and releases the frames still queued
+ * @param[in] this Double pointer to an outbox
+ */
+void Outbox_free(Outbox **this) {
+  if (this != NULL && *this != NULL) {
+    while (Outbox_delete(*this, 0)) {}
+    List_free(&((*this)->frames));
+    free((*this)->batch);
+    pthread_mutex_destroy(&((*this)->lock));
+    memset(*this, 0, sizeof(Outbox));
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Sets the encoding of the frames written by the outbox,
+ * new outboxes use the text protocol
+ * @param[in] this     The outbox
+ * @param[in] protocol The protocol negotiated by the client
+ */
+void Outbox_setProtocol(Outbox *this, MessageProtocol protocol) {
+  pthread_mutex_lock(&(this->lock));
+  this->protocol = protocol;
+  pthread_mutex_unlock(&(this->lock));
+}
+
+/**
+ * Adds a frame at the end of the outbox, the outbox holds its own
+ * reference until the frame is copied into a write batch. When the
+ * outbox is full, either the oldest frame is discarded, or the outbox
+ * is marked as overflowed, depending on the policy.
+ * @param[in] this  The outbox
+ * @param[in] frame The frame to queue
+ * @param[out] false if the client needs to be disconnected
+ */
+bool Outbox_push(Outbox *this, Frame *frame) {
+  pthread_mutex_lock(&(this->lock));
+  if (this->overflow) {
+    pthread_mutex_unlock(&(this->lock));
+    return false;
+  }
+  if ((size_t)this->frames->length >= this->limit) {
+    if (this->policy == kOutboxPolicyDisconnect) {
+      this->overflow = true;
+      pthread_mutex_unlock(&(this->lock));
+      return false;
+    }
+    // The batch being written is never affected
+    if (Outbox_delete(this, 0)) this->dropped++;
+  }
+  Frame *shared = Frame_retain(frame);
+  bool success = List_append(this->frames, &shared, sizeof(Frame *));
+  if (!success) Frame_release(&shared);
+  pthread_mutex_unlock(&(this->lock));
+  return success;
+}
+
+/**
+ * Moves as many queued frames as possible into the write batch,
+ * up to kOutboxBatchSize bytes
+ * @param[in] this The outbox, with an empty batch
+ * @param[out] false if there are no frames to write
+ */
+static bool Outbox_fillBatch(Outbox *this) {
+  this->batchLength = this->batchOffset = this->batchFrames = 0;
+  while (this->frames->first != NULL) {
+    Frame *frame = *(Frame **)this->frames->first->data;
+    size_t length = 0;
+    const char *data = Frame_encoding(frame, this->protocol, &length);
+    if (this->batchLength + length > this->batchSize) {
+      if (this->batchFrames > 0) break;
+      // A single frame larger than the batch buffer
+      char *batch = realloc(this->batch, length);
+      if (batch == NULL) break;
+      this->batch = batch;
+      this->batchSize = length;
+    }
+    memcpy(this->batch + this->batchLength, data, length);
+    this->batchLength += length;
+    if (data == frame->compressed) {
+      Stats_add(kStatCompressionSaved, frame->binaryLength - frame->compressedLength);
+    }
+    this->batchFrames++;
+    Outbox_delete(this, 0);
+  }
+  return this->batchFrames > 0;
+}
+
+/**
+ * Writes the queued messages to the TLS connection until the
+ * outbox is empty or the socket would block. Consecutive frames
+ * are coalesced so that each SSL_write sends a full TLS record.
+ * @param[in] this The outbox
+ * @param[in] ssl  The non-blocking TLS connection
+ * @param[out] The outbox status after the flush
+ */
+OutboxStatus Outbox_flush(Outbox *this, SSL *ssl) {
+  OutboxStatus status = kOutboxEmpty;
+  pthread_mutex_lock(&(this->lock));
+  while (this->batchOffset < this->batchLength || Outbox_fillBatch(this)) {
+    // After a WANT_WRITE, OpenSSL requires the same data to be written again,
+    // the batch is not changed until it's fully written
+    int sent = SSL_write(
+      ssl,
+      this->batch + this->batchOffset,
+      this->batchLength - this->batchOffset
+    );
+    if (sent <= 0) {
+      int sslError = SSL_get_error(ssl, sent);
+      bool retry = (sslError == SSL_ERROR_WANT_WRITE || sslError == SSL_ERROR_WANT_READ);
+      status = retry ? kOutboxPending : kOutboxError;
+      break;
+    }
+    Stats_add(kStatWrites, 1);
+    Stats_add(kStatBytesWritten, sent);
+    this->batchOffset += sent;
+    if (this->batchOffset == this->batchLength) {
+      Stats_add(kStatFramesWritten, this->batchFrames);
+      this->batchLength = this->batchOffset = this->batchFrames = 0;
+    }
+  }
+  pthread_mutex_unlock(&(this->lock));
+  return status;
+}
+
+/**
+ * Checks if there is data waiting to be written
+ * @param[in] this The outbox
+ */
+bool Outbox_pending(Outbox *this) {
+  pthread_mutex_lock(&(this->lock));
+  bool pending = this->frames->first != NULL || this->batchOffset < this->batchLength;
+  pthread_mutex_unlock(&(this->lock));
+  return pending;
+}
+
+/**
+ * Checks if the outbox has reached its limit, the next push
+ * will either discard a message or overflow
+ * @param[in] this The outbox
+ */
+bool Outbox_full(Outbox *this) {
+  pthread_mutex_lock(&(this->lock));
+  bool full = (size_t)this->frames->length >= this->limit;
+  pthread_mutex_unlock(&(this->lock));
+  return full;
+}
+
+/**
+ * Checks if the outbox is full and the client must be disconnected
+ * @param[in] this The outbox
+ */
+bool Outbox_overflow(Outbox *this) {
+  pthread_mutex_lock(&(this->lock));
+  bool overflow = this->overflow;
+  pthread_mutex_unlock(&(this->lock));
+  return overflow;
+}
+
+/**
+ * Returns the number of messages discarded because the outbox was full
+ * @param[in] this The outbox
+ */
+size_t Outbox_dropped(Outbox *this) {
+  pthread_mutex_lock(&(this->lock));
+  size_t dropped = this->dropped;
+  pthread_mutex_unlock(&(this->lock));
+  return dropped;
+}
@@ -0,0 +1,77 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <openssl/ssl.h>
+
+  #include "frame.h"
+
+  /// What happens when a client's outbox is full
+  typedef enum {
+    kOutboxPolicyDrop = 0, ///< Discard the oldest queued message (default)
+    kOutboxPolicyDisconnect ///< Disconnect the client
+  } OutboxPolicy;
+
+  /// Returns a printable name for the given outbox policy
+  #define OUTBOX_POLICY_NAME(policy) ((policy) == kOutboxPolicyDisconnect ? "disconnect" : "drop")
+
+  /// Outcome of a flush
+  typedef enum {
+    kOutboxEmpty = 0, ///< All the queued data has been written
+    kOutboxPending, ///< The socket is not writable, try again later
+    kOutboxError ///< The connection is broken
+  } OutboxStatus;
+
+  /// Bounded queue of frames waiting to be written to a client
+  typedef struct Outbox Outbox;
+
+  // Creates an outbox that holds at most limit messages
+  Outbox *Outbox_new(size_t limit, OutboxPolicy policy);
+
+  // Destroys an outbox and the messages still queued
+  void Outbox_free(Outbox **this);
+
+  // Sets the wire format used to write the frames
+  void Outbox_setProtocol(Outbox *this, MessageProtocol protocol);
+
+  // Queues a shared frame, returns false if the client needs to be disconnected
+  bool Outbox_push(Outbox *this, Frame *frame);
+
+  // Writes as much queued data as possible without blocking
+  OutboxStatus Outbox_flush(Outbox *this, SSL *ssl);
+
+  // Checks if there is data waiting to be written
+  bool Outbox_pending(Outbox *this);
+
+  // Checks if the outbox has reached its limit
+  bool Outbox_full(Outbox *this);
+
+  // Checks if the outbox has overflowed with the disconnect policy
+  bool Outbox_overflow(Outbox *this);
+
+  // Returns the number of messages discarded with the drop policy
+  size_t Outbox_dropped(Outbox *this);
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file ratelimit.c
+#include "ratelimit.h"
+
+/**
+ * Initialises a full token bucket
+ * @param[in] this     The bucket
+ * @param[in] rate     Tokens added per second, 0 disables the limit
+ * @param[in] capacity Max tokens available at once
+ * @param[in] now      Current time in milliseconds
+ */
+void TokenBucket_init(TokenBucket *this, double rate, double capacity, uint64_t now) {
+  this->rate = rate;
+  this->capacity = capacity;
+  this->tokens = capacity;
+  this->updated = now;
+}
+
+/**
+ * Adds the tokens accumulated since the last refill, up to the capacity
+ * @param[in] this The bucket
+ * @param[in] now  Current time in milliseconds
+ */
+void TokenBucket_refill(TokenBucket *this, uint64_t now) {
+  if (now <= this->updated) return;
+  this->tokens += this->rate * (double)(now - this->updated) / 1000.0;
+  if (this->tokens > this->capacity) this->tokens = this->capacity;
+  this->updated = now;
+}
+
+/**
+ * Takes the given tokens if available, nothing is taken otherwise
+ * @param[in] this The bucket
+ * @param[in] cost Tokens needed
+ * @param[in] now  Current time in milliseconds
+ * @param[out] true if the tokens were available or the bucket is unlimited
+ */
+bool TokenBucket_take(TokenBucket *this, double cost, uint64_t now) {
+  if (this->rate <= 0) return true;
+  TokenBucket_refill(this, now);
+  if (this->tokens < cost) return false;
+  this->tokens -= cost;
+  return true;
+}
+
+/**
+ * Initialises the limits of a client, both buckets allow a burst of one
+ * second of traffic, the byte bucket can always hold the largest message
+ * @param[in] this              The client limits
+ * @param[in] messagesPerSecond Max messages per second, 0 = unlimited
+ * @param[in] bytesPerSecond    Max bytes of content per second, 0 = unlimited
+ * @param[in] maxMessageSize    Size of the largest message that can be received
+ * @param[in] now               Current time in milliseconds
+ */
+void RateLimit_init(
+  RateLimit *this, unsigned int messagesPerSecond, unsigned int bytesPerSecond,
+  size_t maxMessageSize, uint64_t now
+) {
+  TokenBucket_init(&(this->messages), messagesPerSecond, messagesPerSecond, now);
+  double capacity = (bytesPerSecond > maxMessageSize) ? bytesPerSecond : maxMessageSize;
+  TokenBucket_init(&(this->bytes), bytesPerSecond, capacity, now);
+}
+
+/**
+ * Accounts for a message if both the message and byte limits allow it,
+ * rejected messages don't take any token
+ * @param[in] this  The client limits
+ * @param[in] bytes Size of the message content
+ * @param[in] now   Current time in milliseconds
+ * @param[out] true if the message can be processed
+ */
+bool RateLimit_allow(RateLimit *this, size_t bytes, uint64_t now) {
+  TokenBucket_refill(&(this->messages), now);
+  TokenBucket_refill(&(this->bytes), now);
+  bool messageAllowed = this->messages.rate <= 0 || this->messages.tokens >= 1;
+  bool bytesAllowed = this->bytes.rate <= 0 || this->bytes.tokens >= (double)bytes;
+  if (!messageAllowed || !bytesAllowed) return false;
+  TokenBucket_take(&(this->messages), 1, now);
+  TokenBucket_take(&(this->bytes), (double)bytes, now);
+  return true;
+}
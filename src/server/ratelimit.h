@@ -0,0 +1,62 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  /**
+   * A token bucket: tokens are added at a constant rate up to the
+   * capacity, and every action takes as many tokens as it costs.
+   * Time is measured in milliseconds from any monotonic origin.
+   */
+  typedef struct {
+    double tokens; ///< Tokens currently available
+    double capacity; ///< Max tokens, i.e. the largest burst allowed
+    double rate; ///< Tokens added per second, 0 = unlimited
+    uint64_t updated; ///< Last refill time, in milliseconds
+  } TokenBucket;
+
+  /// Limits the messages and bytes sent by a client
+  typedef struct {
+    TokenBucket messages; ///< One token per message
+    TokenBucket bytes; ///< One token per byte of content
+  } RateLimit;
+
+  // Initialises a full bucket, a zero rate disables the limit
+  void TokenBucket_init(TokenBucket *this, double rate, double capacity, uint64_t now);
+
+  // Adds the tokens accumulated since the last refill
+  void TokenBucket_refill(TokenBucket *this, uint64_t now);
+
+  // Takes the given tokens if available
+  bool TokenBucket_take(TokenBucket *this, double cost, uint64_t now);
+
+  // Initialises the limits of a client, a zero rate disables the related limit
+  void RateLimit_init(RateLimit *this, unsigned int messagesPerSecond, unsigned int bytesPerSecond, size_t maxMessageSize, uint64_t now);
+
+  // Accounts for a message of the given size if both limits allow it
+  bool RateLimit_allow(RateLimit *this, size_t bytes, uint64_t now);
+
+#endif
@@ -0,0 +1,381 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file registry.c
+#include <stdlib.h>
+#include <string.h>
+
+#include "registry.h"
+
+enum {
+  /// Initial number of buckets of each index, must be a power of 2
+  kRegistryMinBuckets = 64
+};
+
+struct Registry {
+  RegistryEntry *first; ///< Oldest connection
+  RegistryEntry *last; ///< Newest connection
+  size_t length; ///< Number of connections
+  size_t buckets; ///< Number of buckets of each index
+  RegistryEntry **byID; ///< Index by connection ID
+  RegistryEntry **bySocket; ///< Index by socket
+  RegistryEntry **byNickname; ///< Index by nickname
+};
+
+/// Offsets of the chain pointers for each index
+static const size_t kChainID = offsetof(RegistryEntry, nextByID);
+static const size_t kChainSocket = offsetof(RegistryEntry, nextBySocket);
+static const size_t kChainNickname = offsetof(RegistryEntry, nextByNickname);
+
+/**
+ * Mixes the bits of a numeric key (splitmix64 finalizer)
+ * @param[in] key The key to hash
+ */
+static uint64_t Registry_hashNumber(uint64_t key) {
+  key ^= key >> 30;
+  key *= 0xbf58476d1ce4e5b9ULL;
+  key ^= key >> 27;
+  key *= 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  return key;
+}
+
+/**
+ * Hashes a NULL terminated string (FNV-1a)
+ * @param[in] key The key to hash
+ */
+static uint64_t Registry_hashString(const char *key) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+    hash ^= *c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Returns the chain pointer of an entry for the given index
+ * @param[in] entry The registry entry
+ * @param[in] chain The offset of the chain pointer
+ */
+static RegistryEntry **Registry_chain(RegistryEntry *entry, size_t chain) {
+  return (RegistryEntry **)((char *)entry + chain);
+}
+
+/**
+ * Inserts an entry at the head of a bucket
+ * @param[in] bucket The bucket of the index
+ * @param[in] entry  The entry to insert
+ * @param[in] chain  The offset of the chain pointer for the index
+ */
+static void Registry_link(RegistryEntry **bucket, RegistryEntry *entry, size_t chain) {
+  *Registry_chain(entry, chain) = *bucket;
+  *bucket = entry;
+}
+
+/**
+ * Removes an entry from a bucket
+ * @param[in] bucket The bucket of the index
+ * @param[in] entry  The entry to remove
+ * @param[in] chain  The offset of the chain pointer for the index
+ */
+static void Registry_unlink(RegistryEntry **bucket, RegistryEntry *entry, size_t chain) {
+  for (RegistryEntry **link = bucket; *link != NULL; link = Registry_chain(*link, chain)) {
+    if (*link == entry) {
+      *link = *Registry_chain(entry, chain);
+      *Registry_chain(entry, chain) = NULL;
+      return;
+    }
+  }
+}
+
+/**
+ * Adds an entry to all the indexes it belongs to
+ * @param[in] this  The registry
+ * @param[in] entry The entry to index
+ */
+static void Registry_index(Registry *this, RegistryEntry *entry) {
+  size_t mask = this->buckets - 1;
+  Registry_link(&(this->byID[Registry_hashNumber(entry->id) & mask]), entry, kChainID);
+  Registry_link(&(this->bySocket[Registry_hashNumber(entry->socket) & mask]), entry, kChainSocket);
+  if (entry->nickname != NULL) {
+    Registry_link(
+      &(this->byNickname[Registry_hashString(entry->nickname) & mask]), entry, kChainNickname
+    );
+  }
+}
+
+/**
+ * Allocates the bucket arrays and indexes all the entries
+ * @param[in] this    The registry
+ * @param[in] buckets The new number of buckets, a power of 2
+ * @param[out] true on success, on failure the old indexes are kept
+ */
+static bool Registry_resize(Registry *this, size_t buckets) {
+  RegistryEntry **byID = calloc(buckets, sizeof(RegistryEntry *));
+  RegistryEntry **bySocket = calloc(buckets, sizeof(RegistryEntry *));
+  RegistryEntry **byNickname = calloc(buckets, sizeof(RegistryEntry *));
+  if (byID == NULL || bySocket == NULL || byNickname == NULL) {
+    free(byID);
+    free(bySocket);
+    free(byNickname);
+    return false;
+  }
+  free(this->byID);
+  free(this->bySocket);
+  free(this->byNickname);
+  this->byID = byID;
+  this->bySocket = bySocket;
+  this->byNickname = byNickname;
+  this->buckets = buckets;
+  for (RegistryEntry *entry = this->first; entry != NULL; entry = entry->next) {
+    Registry_index(this, entry);
+  }
+  return true;
+}
+
+/**
+ * Finds the entry for a connection ID
+ * @param[in] this The registry
+ * @param[in] id   The connection ID
+ */
+static RegistryEntry *Registry_find(const Registry *this, ConnectionID id) {
+  RegistryEntry *entry = this->byID[Registry_hashNumber(id) & (this->buckets - 1)];
+  while (entry != NULL && entry->id != id) entry = entry->nextByID;
+  return entry;
+}
+
+/**
+ * Finds the entry for a socket
+ * @param[in] this   The registry
+ * @param[in] socket The connection socket
+ */
+static RegistryEntry *Registry_findBySocket(const Registry *this, SOCKET socket) {
+  RegistryEntry *entry = this->bySocket[Registry_hashNumber(socket) & (this->buckets - 1)];
+  while (entry != NULL && entry->socket != socket) entry = entry->nextBySocket;
+  return entry;
+}
+
+/**
+ * Finds the entry for a nickname
+ * @param[in] this     The registry
+ * @param[in] nickname The user nickname
+ */
+static RegistryEntry *Registry_findByNickname(const Registry *this, const char *nickname) {
+  RegistryEntry *entry = this->byNickname[Registry_hashString(nickname) & (this->buckets - 1)];
+  while (entry != NULL && strcmp(entry->nickname, nickname) != 0) entry = entry->nextByNickname;
+  return entry;
+}
+
+/**
+ * Creates a new empty registry
+ * @param[out] The new registry, or NULL on failure
+ */
+Registry *Registry_new() {
+  Registry *this = calloc(1, sizeof(Registry));
+  if (this == NULL) return NULL;
+  if (!Registry_resize(this, kRegistryMinBuckets)) {
+    free(this);
+    return NULL;
+  }
+  return this;
+}
+
+/**
+ * Destroys a registry and its entries, the registered items
+ * are owned by the caller and are not freed
+ * @param[in] this Double pointer to a registry
+ */
+void Registry_free(Registry **this) {
+  if (this != NULL && *this != NULL) {
+    RegistryEntry *entry = (*this)->first;
+    while (entry != NULL) {
+      RegistryEntry *next = entry->next;
+      free(entry->nickname);
+      free(entry);
+      entry = next;
+    }
+    free((*this)->byID);
+    free((*this)->bySocket);
+    free((*this)->byNickname);
+    memset(*this, 0, sizeof(Registry));
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Adds a connection to the registry
+ * @param[in] this   The registry
+ * @param[in] item   The connection data, its address must not change
+ * @param[in] id     The connection ID
+ * @param[in] socket The connection socket
+ * @param[out] false if the ID or the socket are already registered, or on failure
+ */
+bool Registry_add(Registry *this, void *item, ConnectionID id, SOCKET socket) {
+  if (Registry_find(this, id) != NULL || Registry_findBySocket(this, socket) != NULL) {
+    return false;
+  }
+  RegistryEntry *entry = calloc(1, sizeof(RegistryEntry));
+  if (entry == NULL) return false;
+  entry->item = item;
+  entry->id = id;
+  entry->socket = socket;
+
+  // Append in connection order
+  entry->prev = this->last;
+  if (this->last != NULL) this->last->next = entry;
+  this->last = entry;
+  if (this->first == NULL) this->first = entry;
+  this->length++;
+
+  // Keep the load factor below 1, a failed resize only makes the chains longer
+  if (this->length > this->buckets && Registry_resize(this, this->buckets * 2)) {
+    return true;
+  }
+  Registry_index(this, entry);
+  return true;
+}
+
+/**
+ * Removes a connection from the registry
+ * @param[in] this The registry
+ * @param[in] id   The connection ID
+ * @param[out] The registered item, or NULL if the ID is not registered
+ */
+void *Registry_remove(Registry *this, ConnectionID id) {
+  RegistryEntry *entry = Registry_find(this, id);
+  if (entry == NULL) return NULL;
+
+  size_t mask = this->buckets - 1;
+  Registry_unlink(&(this->byID[Registry_hashNumber(entry->id) & mask]), entry, kChainID);
+  Registry_unlink(&(this->bySocket[Registry_hashNumber(entry->socket) & mask]), entry, kChainSocket);
+  if (entry->nickname != NULL) {
+    Registry_unlink(
+      &(this->byNickname[Registry_hashString(entry->nickname) & mask]), entry, kChainNickname
+    );
+  }
+
+  if (entry->prev != NULL) entry->prev->next = entry->next;
+  if (entry->next != NULL) entry->next->prev = entry->prev;
+  if (this->first == entry) this->first = entry->next;
+  if (this->last == entry) this->last = entry->prev;
+  this->length--;
+
+  void *item = entry->item;
+  free(entry->nickname);
+  free(entry);
+  return item;
+}
+
+/**
+ * Assigns a nickname to a connection, the check and the update
+ * are a single operation so two connections can't take the same name
+ * @param[in] this     The registry
+ * @param[in] id       The connection ID
+ * @param[in] nickname The user nickname
+ * @param[out] false if the nickname is taken by another connection, or on failure
+ */
+bool Registry_setNickname(Registry *this, ConnectionID id, const char *nickname) {
+  RegistryEntry *entry = Registry_find(this, id);
+  if (entry == NULL) return false;
+  RegistryEntry *owner = Registry_findByNickname(this, nickname);
+  if (owner != NULL) return owner == entry;
+
+  char *copy = strdup(nickname);
+  if (copy == NULL) return false;
+  size_t mask = this->buckets - 1;
+  if (entry->nickname != NULL) {
+    Registry_unlink(
+      &(this->byNickname[Registry_hashString(entry->nickname) & mask]), entry, kChainNickname
+    );
+    free(entry->nickname);
+  }
+  entry->nickname = copy;
+  Registry_link(&(this->byNickname[Registry_hashString(copy) & mask]), entry, kChainNickname);
+  return true;
+}
+
+/**
+ * Releases the nickname of a connection, which stays registered
+ * @param[in] this The registry
+ * @param[in] id   The connection ID
+ */
+void Registry_unsetNickname(Registry *this, ConnectionID id) {
+  RegistryEntry *entry = Registry_find(this, id);
+  if (entry == NULL || entry->nickname == NULL) return;
+  Registry_unlink(
+    &(this->byNickname[Registry_hashString(entry->nickname) & (this->buckets - 1)]),
+    entry, kChainNickname
+  );
+  free(entry->nickname);
+  entry->nickname = NULL;
+}
+
+/**
+ * Finds a connection by ID
+ * @param[in] this The registry
+ * @param[in] id   The connection ID
+ * @param[out] The registered item or NULL
+ */
+void *Registry_get(const Registry *this, ConnectionID id) {
+  RegistryEntry *entry = Registry_find(this, id);
+  return (entry != NULL) ? entry->item : NULL;
+}
+
+/**
+ * Finds a connection by socket
+ * @param[in] this   The registry
+ * @param[in] socket The connection socket
+ * @param[out] The registered item or NULL
+ */
+void *Registry_getBySocket(const Registry *this, SOCKET socket) {
+  RegistryEntry *entry = Registry_findBySocket(this, socket);
+  return (entry != NULL) ? entry->item : NULL;
+}
+
+/**
+ * Finds a connection by nickname
+ * @param[in] this     The registry
+ * @param[in] nickname The user nickname
+ * @param[out] The registered item or NULL
+ */
+void *Registry_getByNickname(const Registry *this, const char *nickname) {
+  RegistryEntry *entry = Registry_findByNickname(this, nickname);
+  return (entry != NULL) ? entry->item : NULL;
+}
+
+/**
+ * Returns the number of registered connections
+ * @param[in] this The registry
+ */
+size_t Registry_length(const Registry *this) {
+  return this->length;
+}
+
+/**
+ * Returns the oldest registered connection
+ * @param[in] this The registry
+ * @param[out] The first entry, or NULL if the registry is empty
+ */
+RegistryEntry *Registry_first(const Registry *this) {
+  return this->first;
+}
@@ -0,0 +1,88 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  #include "socket/socket.h"
+
+  /// Unique identifier of a connection, never reused while the server runs
+  typedef uint64_t ConnectionID;
+
+  typedef struct RegistryEntry RegistryEntry;
+
+  /**
+   * A registered connection. The registry doesn't own the item, which
+   * must keep the same address until it's removed from the registry.
+   */
+  struct RegistryEntry {
+    RegistryEntry *prev; ///< Previous entry in connection order
+    RegistryEntry *next; ///< Next entry in connection order
+    void *item; ///< The connection data, usually a Client
+    ConnectionID id; ///< Connection ID
+    SOCKET socket; ///< Connection socket
+    char *nickname; ///< Nickname of the user, NULL until authenticated
+    RegistryEntry *nextByID; ///< Next entry in the same ID bucket
+    RegistryEntry *nextBySocket; ///< Next entry in the same socket bucket
+    RegistryEntry *nextByNickname; ///< Next entry in the same nickname bucket
+  };
+
+  /**
+   * A set of connections indexed by ID, socket and nickname.
+   * The registry is not thread safe, concurrent access must be
+   * serialised by the caller.
+   */
+  typedef struct Registry Registry;
+
+  // Creates a new empty registry
+  Registry *Registry_new();
+
+  // Destroys a registry, the registered items are not freed
+  void Registry_free(Registry **this);
+
+  // Adds a connection, fails if the ID or the socket are already registered
+  bool Registry_add(Registry *this, void *item, ConnectionID id, SOCKET socket);
+
+  // Removes a connection and returns its item
+  void *Registry_remove(Registry *this, ConnectionID id);
+
+  // Assigns a nickname to a connection, fails if it's taken by another one
+  bool Registry_setNickname(Registry *this, ConnectionID id, const char *nickname);
+
+  // Releases the nickname of a connection, if any
+  void Registry_unsetNickname(Registry *this, ConnectionID id);
+
+  // Lookup functions, return the registered item or NULL
+  void *Registry_get(const Registry *this, ConnectionID id);
+  void *Registry_getBySocket(const Registry *this, SOCKET socket);
+  void *Registry_getByNickname(const Registry *this, const char *nickname);
+
+  // Returns the number of registered connections
+  size_t Registry_length(const Registry *this);
+
+  // Returns the oldest connection, use entry->next to walk the registry
+  RegistryEntry *Registry_first(const Registry *this);
+
+#endif
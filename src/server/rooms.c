@@ -0,0 +1,303 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file rooms.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "rooms.h"
+
+enum {
+  /// Initial number of buckets, must be a power of 2
+  kRoomsMinBuckets = 16,
+  /// Initial number of slots of a member set
+  kMemberSetMinCapacity = 8
+};
+
+struct Rooms {
+  size_t length; ///< Number of rooms
+  size_t buckets; ///< Number of buckets of the index
+  Room **byName; ///< Index by name
+  unsigned int shards; ///< Number of member shards of each room
+};
+
+/**
+ * Hashes a NULL terminated string (FNV-1a)
+ * @param[in] key The key to hash
+ */
+static uint64_t Rooms_hash(const char *key) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+    hash ^= *c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/**
+ * Checks that a room name is not empty, fits kMaxRoomNameSize and only
+ * contains latin letters, digits, '-' and '_'
+ * @param[in] name The name to check
+ * @param[out] true if the name is valid
+ */
+bool Room_nameIsValid(const char *name) {
+  if (name == NULL) return false;
+  size_t length = strspn(
+    name, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_"
+  );
+  return length > 0 && length < kMaxRoomNameSize && name[length] == '\0';
+}
+
+/**
+ * Creates a new room with one reference and no members
+ * @param[in] name   The room name, must be valid
+ * @param[in] shards The number of member shards
+ * @param[out] The new room or NULL on failure
+ */
+static Room *Room_new(const char *name, unsigned int shards) {
+  Room *this = calloc(1, sizeof(Room));
+  if (this == NULL) return NULL;
+  this->shards = calloc(shards, sizeof(MemberSet));
+  this->subscribers = SnapshotCell_new();
+  if (this->shards == NULL || this->subscribers == NULL) {
+    free(this->shards);
+    SnapshotCell_free(&(this->subscribers));
+    free(this);
+    return NULL;
+  }
+  atomic_init(&(this->references), 1);
+  this->shardCount = shards;
+  snprintf(this->name, kMaxRoomNameSize, "%s", name);
+  return this;
+}
+
+/**
+ * Adds a member to a shard of the room
+ * @param[in]  this  The room
+ * @param[in]  shard The shard of the member
+ * @param[in]  item  The member, usually a Client
+ * @param[out] slot  The position of the member in the shard
+ * @param[out] false if there's no memory for the new member
+ */
+bool Room_add(Room *this, unsigned int shard, void *item, size_t *slot) {
+  if (shard >= this->shardCount) return false;
+  MemberSet *set = &(this->shards[shard]);
+  if (set->length == set->capacity) {
+    size_t capacity = (set->capacity > 0) ? set->capacity * 2 : kMemberSetMinCapacity;
+    void **items = realloc(set->items, capacity * sizeof(void *));
+    if (items == NULL) return false;
+    set->items = items;
+    set->capacity = capacity;
+  }
+  *slot = set->length;
+  set->items[set->length++] = item;
+  this->length++;
+  return true;
+}
+
+/**
+ * Removes a member from a shard of the room, the last member
+ * of the shard is moved into the free slot
+ * @param[in] this  The room
+ * @param[in] shard The shard of the member
+ * @param[in] slot  The position of the member in the shard
+ * @param[out] The member that now occupies the slot, or NULL if none was moved
+ */
+void *Room_remove(Room *this, unsigned int shard, size_t slot) {
+  if (shard >= this->shardCount) return NULL;
+  MemberSet *set = &(this->shards[shard]);
+  if (slot >= set->length) return NULL;
+  set->length--;
+  this->length--;
+  if (slot == set->length) return NULL;
+  set->items[slot] = set->items[set->length];
+  return set->items[slot];
+}
+
+/**
+ * Publishes the members of the first shard as a new subscribers
+ * snapshot. When it returns, the removed members are not visible
+ * to the snapshot readers anymore.
+ * @param[in] this The room
+ * @param[out] false if the snapshot can't be created
+ */
+bool Room_publish(Room *this) {
+  MemberSet *set = &(this->shards[0]);
+  return SnapshotCell_publish(this->subscribers, (void * const *)set->items, set->length);
+}
+
+/**
+ * Adds a reference to a room
+ * @param[in] this The room to share
+ * @param[out] The same room
+ */
+Room *Room_retain(Room *this) {
+  atomic_fetch_add_explicit(&(this->references), 1, memory_order_relaxed);
+  return this;
+}
+
+/**
+ * Drops a reference to a room, the room is freed when
+ * the last holder releases it
+ * @param[in] this Double pointer to the room
+ */
+void Room_release(Room **this) {
+  if (this != NULL && *this != NULL) {
+    Room *room = *this;
+    if (atomic_fetch_sub_explicit(&(room->references), 1, memory_order_acq_rel) == 1) {
+      for (unsigned int i = 0; i < room->shardCount; i++) {
+        free(room->shards[i].items);
+      }
+      free(room->shards);
+      SnapshotCell_free(&(room->subscribers));
+      free(room);
+    }
+    *this = NULL;
+  }
+}
+
+/**
+ * Creates a new empty list of rooms
+ * @param[in] shards The number of member shards of each room, at least 1
+ * @param[out] The new list or NULL on failure
+ */
+Rooms *Rooms_new(unsigned int shards) {
+  if (shards == 0) return NULL;
+  Rooms *this = calloc(1, sizeof(Rooms));
+  if (this == NULL) return NULL;
+  this->byName = calloc(kRoomsMinBuckets, sizeof(Room *));
+  if (this->byName == NULL) {
+    free(this);
+    return NULL;
+  }
+  this->buckets = kRoomsMinBuckets;
+  this->shards = shards;
+  return this;
+}
+
+/**
+ * Destroys a list of rooms and releases its references,
+ * the rooms themselves survive until their last holder releases them
+ * @param[in] this Double pointer to the list
+ */
+void Rooms_free(Rooms **this) {
+  if (this == NULL || *this == NULL) return;
+  for (size_t i = 0; i < (*this)->buckets; i++) {
+    Room *room = (*this)->byName[i];
+    while (room != NULL) {
+      Room *next = room->next;
+      Room_release(&room);
+      room = next;
+    }
+  }
+  free((*this)->byName);
+  free(*this);
+  *this = NULL;
+}
+
+/**
+ * Doubles the number of buckets and moves the rooms into them,
+ * on failure the old index is kept
+ * @param[in] this The list of rooms
+ */
+static void Rooms_grow(Rooms *this) {
+  size_t buckets = this->buckets * 2;
+  Room **byName = calloc(buckets, sizeof(Room *));
+  if (byName == NULL) return;
+  for (size_t i = 0; i < this->buckets; i++) {
+    Room *room = this->byName[i];
+    while (room != NULL) {
+      Room *next = room->next;
+      Room **bucket = &(byName[Rooms_hash(room->name) & (buckets - 1)]);
+      room->next = *bucket;
+      *bucket = room;
+      room = next;
+    }
+  }
+  free(this->byName);
+  this->byName = byName;
+  this->buckets = buckets;
+}
+
+/**
+ * Returns the room with the given name or NULL
+ * @param[in] this The list of rooms
+ * @param[in] name The room name
+ */
+Room *Rooms_get(const Rooms *this, const char *name) {
+  Room *room = this->byName[Rooms_hash(name) & (this->buckets - 1)];
+  while (room != NULL && strcmp(room->name, name) != 0) room = room->next;
+  return room;
+}
+
+/**
+ * Returns the room with the given name, a new room is created and
+ * added to the list if needed. The list owns the returned room,
+ * which is valid until Rooms_close() removes it.
+ * @param[in] this The list of rooms
+ * @param[in] name The room name
+ * @param[out] The room or NULL if the name is not valid or there's no memory
+ */
+Room *Rooms_open(Rooms *this, const char *name) {
+  if (!Room_nameIsValid(name)) return NULL;
+  Room *room = Rooms_get(this, name);
+  if (room != NULL) return room;
+
+  room = Room_new(name, this->shards);
+  if (room == NULL) return NULL;
+  if (this->length >= this->buckets) Rooms_grow(this);
+  Room **bucket = &(this->byName[Rooms_hash(name) & (this->buckets - 1)]);
+  room->next = *bucket;
+  *bucket = room;
+  this->length++;
+  return room;
+}
+
+/**
+ * Removes a room from the list and drops the list reference, if the
+ * room has no members left. The room must not be used after this call
+ * unless the caller holds its own reference.
+ * @param[in] this The list of rooms
+ * @param[in] room A room of the list
+ */
+void Rooms_close(Rooms *this, Room *room) {
+  if (room == NULL || room->length > 0) return;
+  for (Room **link = &(this->byName[Rooms_hash(room->name) & (this->buckets - 1)]);
+    *link != NULL; link = &((*link)->next)) {
+    if (*link == room) {
+      *link = room->next;
+      room->next = NULL;
+      this->length--;
+      Room_release(&room);
+      return;
+    }
+  }
+}
+
+/**
+ * Returns the number of rooms in the list
+ * @param[in] this The list of rooms
+ */
+size_t Rooms_length(const Rooms *this) {
+  return this->length;
+}
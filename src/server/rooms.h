@@ -0,0 +1,111 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROOMS_H
+#define ROOMS_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdatomic.h>
+
+  #include "snapshot.h"
+
+  enum {
+    /// Max size of a room name, including the NULL terminator
+    kMaxRoomNameSize = 32
+  };
+
+  /**
+   * A compact set of members stored in a dense array. Each member is
+   * identified by its slot, and removing a member moves the last one
+   * into the free slot, so both operations take constant time.
+   */
+  typedef struct {
+    void **items; ///< The members, without gaps
+    size_t length; ///< Number of members
+    size_t capacity; ///< Allocated slots
+  } MemberSet;
+
+  typedef struct Room Room;
+
+  /**
+   * A named group of clients that receive the same broadcast messages.
+   * The members are split in shards, so each event loop only touches
+   * the shard of its own clients. Threaded servers use one shard and
+   * publish it as a snapshot for the broadcast thread.
+   * Rooms are reference counted: the room list holds one reference
+   * while the room has members, and the queued broadcast messages
+   * hold one reference each.
+   */
+  struct Room {
+    atomic_uint references; ///< Number of holders of the room
+    char name[kMaxRoomNameSize]; ///< Room name
+    size_t length; ///< Number of members in all shards
+    unsigned int shardCount; ///< Number of member shards
+    MemberSet *shards; ///< Members, by shard
+    SnapshotCell *subscribers; ///< Published members of the first shard
+    Room *next; ///< Next room in the same bucket
+  };
+
+  /**
+   * The rooms with at least one member, indexed by name.
+   * The list is not thread safe, concurrent access and membership
+   * changes must be serialised by the caller.
+   */
+  typedef struct Rooms Rooms;
+
+  // Checks that a room name is 1-31 letters, digits, '-' or '_'
+  bool Room_nameIsValid(const char *name);
+
+  // Adds a member to a shard and returns its slot
+  bool Room_add(Room *this, unsigned int shard, void *item, size_t *slot);
+
+  // Removes the member in the given slot, returns the member moved into the slot or NULL
+  void *Room_remove(Room *this, unsigned int shard, size_t slot);
+
+  // Publishes the members of the first shard to the subscribers snapshot
+  bool Room_publish(Room *this);
+
+  // Adds a reference to a room and returns it
+  Room *Room_retain(Room *this);
+
+  // Drops a reference to a room, freeing it with the last one
+  void Room_release(Room **this);
+
+  // Creates a new empty list of rooms with the given number of shards per room
+  Rooms *Rooms_new(unsigned int shards);
+
+  // Destroys a list of rooms, the rooms still referenced elsewhere survive
+  void Rooms_free(Rooms **this);
+
+  // Returns the room with the given name, creating it if it doesn't exist
+  Room *Rooms_open(Rooms *this, const char *name);
+
+  // Removes a room from the list if it has no members left
+  void Rooms_close(Rooms *this, Room *room);
+
+  // Returns the room with the given name or NULL
+  Room *Rooms_get(const Rooms *this, const char *name);
+
+  // Returns the number of rooms in the list
+  size_t Rooms_length(const Rooms *this);
+
+#endif
@@ -0,0 +1,218 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file roster.c
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "roster.h"
+
+enum {
+  /// Initial number of users the roster can hold
+  kRosterMinCapacity = 64
+};
+
+/// A listed user
+typedef struct {
+  void *item; ///< The user data, usually a Client
+  char nickname[kMaxNicknameSize]; ///< Copy of the user nickname
+} RosterEntry;
+
+struct Roster {
+  RosterEntry *entries; ///< The users, without gaps
+  size_t length; ///< Number of users
+  size_t capacity; ///< Allocated entries
+  Frame **pages; ///< Cached pages, NULL when the page needs to be encoded again
+  size_t threshold; ///< Min size of the pages to compress, 0 = never
+};
+
+/**
+ * Returns the number of pages needed for the given number of users
+ * @param[in] length The number of users
+ */
+static size_t Roster_pageCount(size_t length) {
+  return (length > 0) ? (length + kRosterPageSize - 1) / kRosterPageSize : 1;
+}
+
+/**
+ * Drops the cached frame of a page, so it's encoded again when requested
+ * @param[in] this The roster
+ * @param[in] page The page to invalidate
+ */
+static void Roster_invalidate(Roster *this, size_t page) {
+  Frame_release(&(this->pages[page]));
+}
+
+/**
+ * Creates an empty roster
+ * @param[in] threshold Min size of the pages to compress, 0 = never
+ * @param[out] The new roster or NULL on failure
+ */
+Roster *Roster_new(size_t threshold) {
+  Roster *this = calloc(1, sizeof(Roster));
+  if (this == NULL) return NULL;
+  this->entries = calloc(kRosterMinCapacity, sizeof(RosterEntry));
+  this->pages = calloc(Roster_pageCount(kRosterMinCapacity), sizeof(Frame *));
+  if (this->entries == NULL || this->pages == NULL) {
+    free(this->entries);
+    free(this->pages);
+    free(this);
+    return NULL;
+  }
+  this->capacity = kRosterMinCapacity;
+  this->threshold = threshold;
+  return this;
+}
+
+/**
+ * Destroys a roster and releases its cached pages
+ * @param[in] this Double pointer to the roster
+ */
+void Roster_free(Roster **this) {
+  if (this == NULL || *this == NULL) return;
+  for (size_t i = 0; i < Roster_pageCount((*this)->capacity); i++) {
+    Frame_release(&((*this)->pages[i]));
+  }
+  free((*this)->pages);
+  free((*this)->entries);
+  free(*this);
+  *this = NULL;
+}
+
+/**
+ * Doubles the capacity of the roster, on failure the old arrays are kept
+ * @param[in] this The roster
+ * @param[out] false if there's no memory
+ */
+static bool Roster_grow(Roster *this) {
+  size_t capacity = this->capacity * 2;
+  size_t pages = Roster_pageCount(this->capacity);
+  RosterEntry *entries = realloc(this->entries, capacity * sizeof(RosterEntry));
+  if (entries == NULL) return false;
+  this->entries = entries;
+  Frame **cache = realloc(this->pages, Roster_pageCount(capacity) * sizeof(Frame *));
+  if (cache == NULL) return false;
+  memset(cache + pages, 0, (Roster_pageCount(capacity) - pages) * sizeof(Frame *));
+  this->pages = cache;
+  this->capacity = capacity;
+  return true;
+}
+
+/**
+ * Adds a user at the end of the roster, only the last page
+ * and the one before, whose footer changes, are invalidated
+ * @param[in]  this     The roster
+ * @param[in]  item     The user data, usually a Client
+ * @param[in]  nickname The user nickname
+ * @param[out] slot     The position of the user in the roster
+ * @param[out] false if there's no memory for the new user
+ */
+bool Roster_add(Roster *this, void *item, const char *nickname, size_t *slot) {
+  if (this->length == this->capacity && !Roster_grow(this)) return false;
+  RosterEntry *entry = &(this->entries[this->length]);
+  entry->item = item;
+  snprintf(entry->nickname, kMaxNicknameSize, "%s", nickname);
+  *slot = this->length++;
+
+  size_t page = *slot / kRosterPageSize;
+  Roster_invalidate(this, page);
+  if (page > 0 && *slot % kRosterPageSize == 0) Roster_invalidate(this, page - 1);
+  return true;
+}
+
+/**
+ * Removes a user from the roster, the last user is moved into
+ * the free slot, so only the pages of the two slots and the new
+ * last page are invalidated
+ * @param[in] this The roster
+ * @param[in] slot The position of the user to remove
+ * @param[out] The user that now occupies the slot, or NULL if none was moved
+ */
+void *Roster_remove(Roster *this, size_t slot) {
+  if (slot >= this->length) return NULL;
+  size_t last = --this->length;
+  Roster_invalidate(this, slot / kRosterPageSize);
+  Roster_invalidate(this, last / kRosterPageSize);
+  if (last > 0 && last % kRosterPageSize == 0) Roster_invalidate(this, last / kRosterPageSize - 1);
+  if (slot == last) return NULL;
+  this->entries[slot] = this->entries[last];
+  return this->entries[slot].item;
+}
+
+/**
+ * Returns the number of users in the roster
+ * @param[in] this The roster
+ */
+size_t Roster_length(const Roster *this) {
+  return this->length;
+}
+
+/**
+ * Returns the number of pages of the roster
+ * @param[in] this The roster
+ */
+size_t Roster_pages(const Roster *this) {
+  return Roster_pageCount(this->length);
+}
+
+/**
+ * Encodes a page of the roster as a /list message, e.g.
+ * "Online users (page 1): Joe, Jane - more with /list 2"
+ * @param[in] this The roster
+ * @param[in] page The page to encode
+ * @param[out] The new frame or NULL on failure
+ */
+static Frame *Roster_encode(const Roster *this, size_t page) {
+  char content[kBufferSize] = "";
+  size_t first = page * kRosterPageSize;
+  size_t end = (first + kRosterPageSize < this->length) ? first + kRosterPageSize : this->length;
+  int length = snprintf(content, sizeof(content), "Online users (page %zu):", page + 1);
+  for (size_t i = first; i < end && length > 0 && (size_t)length < sizeof(content); i++) {
+    length += snprintf(
+      content + length, sizeof(content) - length, "%s %s",
+      (i > first) ? "," : "", this->entries[i].nickname
+    );
+  }
+  if (page + 1 < Roster_pageCount(this->length) && length > 0 && (size_t)length < sizeof(content)) {
+    length += snprintf(content + length, sizeof(content) - length, " - more with /list %zu", page + 2);
+  }
+  if (length < 0) return NULL;
+
+  C2HMessage *message = C2HMessage_new(kMessageTypeList, NULL, content, strlen(content));
+  if (message == NULL) return NULL;
+  Frame *frame = Frame_new(message, this->threshold);
+  C2HMessage_free(&message);
+  return frame;
+}
+
+/**
+ * Returns a page of the roster as an encoded /list frame, the page
+ * is encoded only if it changed since the last request
+ * @param[in] this The roster
+ * @param[in] page The page, starting from 0
+ * @param[out] A new reference to the frame, or NULL if the page doesn't exist
+ */
+Frame *Roster_page(Roster *this, size_t page) {
+  if (page >= Roster_pageCount(this->length)) return NULL;
+  if (this->pages[page] == NULL) this->pages[page] = Roster_encode(this, page);
+  return (this->pages[page] != NULL) ? Frame_retain(this->pages[page]) : NULL;
+}
@@ -0,0 +1,69 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ROSTER_H
+#define ROSTER_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+
+  #include "frame.h"
+
+  enum {
+    /// Room for the header and footer of a roster page
+    kRosterHeaderSize = 64,
+    /// Max users per page, a page always fits a text frame
+    kRosterPageSize = (kBufferSize - kRosterHeaderSize) / (kMaxNicknameSize + 2)
+  };
+
+  /**
+   * The authenticated users, split in pages of kRosterPageSize users.
+   * Each page is cached as an encoded /list frame, and adding or removing
+   * a user only invalidates the pages that change, so a page request is
+   * usually a frame send. Users are stored in a dense array: a removed
+   * user is replaced by the last one.
+   * The roster is not thread safe, concurrent access must be
+   * serialised by the caller.
+   */
+  typedef struct Roster Roster;
+
+  // Creates an empty roster, the pages are compressed as any other frame
+  Roster *Roster_new(size_t threshold);
+
+  // Destroys a roster, the pages held by other owners survive
+  void Roster_free(Roster **this);
+
+  // Adds a user and returns its slot
+  bool Roster_add(Roster *this, void *item, const char *nickname, size_t *slot);
+
+  // Removes the user in the given slot, returns the user moved into the slot or NULL
+  void *Roster_remove(Roster *this, size_t slot);
+
+  // Returns the number of users
+  size_t Roster_length(const Roster *this);
+
+  // Returns the number of pages, an empty roster has one empty page
+  size_t Roster_pages(const Roster *this);
+
+  // Returns a new reference to the frame of the given page, starting from 0
+  Frame *Roster_page(Roster *this, size_t page);
+
+#endif
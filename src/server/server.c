@@ -20,6 +20,16 @@
  */
 
 #include "server.h"
+#include "registry.h"
+#include "snapshot.h"
+#include "timers.h"
+#include "tickets.h"
+#include "ratelimit.h"
+#include "rooms.h"
+#include "roster.h"
+#include "history.h"
+#include "archive.h"
+#include "stats.h"
 
 #include "message/message.h"
 #include "socket/socket.h"
@@ -28,7 +38,14 @@
 #include "validate/validate.h"
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <wchar.h>
+#include <poll.h>
+
+#if defined(__linux__)
+  #include <sys/epoll.h>
+  #include <sys/eventfd.h>
+#endif
 
 #include <openssl/crypto.h>
 #include <openssl/x509.h>
@@ -38,25 +55,50 @@
 
 enum {
   kMaxClientHostLength = NI_MAXHOST,
+  kHandshakeTimeout = 10, // seconds, to complete the TLS handshake
   kAuthenticationTimeout = 30, // seconds
-  kChatTimeout = 3 * 60 // 3 minutes
+  kChatTimeout = 3 * 60, // 3 minutes
+  kSendTimeout = 5 * 1000, // milliseconds, when the socket is not writable
+  kShutdownTimeout = 2, // seconds, to wait for the client threads on exit
+  kMaxEvents = 64, // Max number of epoll events processed for each loop
+  kMessagesPerConnection = 2, // Message objects preallocated for each connection
+  kNodesPerConnection = 4, // Queue and list nodes preallocated for each connection
+  kHistoryPageSize = 20, // Archived messages sent by /history by default
+  kHistoryMaxPageSize = 100 // Max archived messages sent by /history, also limited by the outbox
 };
 
+/// Lifecycle of a client connection managed by the event loop
+typedef enum {
+  kClientStateHandshake = 0, ///< TLS handshake in progress
+  kClientStateAuth, ///< Waiting for a valid nickname
+  kClientStateChat ///< Authenticated and chatting
+} ClientState;
+
+/// Outcome of a single TLS handshake step
+typedef enum {
+  kHandshakeDone = 0, ///< The TLS session is established
+  kHandshakeWantRead, ///< Waiting for the socket to become readable
+  kHandshakeWantWrite, ///< Waiting for the socket to become writable
+  kHandshakeFailed ///< The connection must be dropped
+} HandshakeStatus;
+
 /// Regex pattern used to validate the user nickname
 static const char *kRegexNicknamePattern = "^[[:alpha:]][[:alnum:]!@#$%&]\\{1,14\\}$";
 
 /// Validation error message for invalid user names, includes the rules
 static const char *kErrorMessageInvalidUsername = "Nicknames must start with a letter and contain 2-15 latin characters and !@#$%&";
 
-/// Holds data for queued messages
-typedef struct {
-  char sender[kMaxNicknameSize + sizeof(wchar_t)]; ///< Sender's nickname
-  char content[kBufferSize]; ///< Message content
-  int  contentLength; ///< Message length
-} Message;
+/// Room joined by every client after authentication
+static const char *kLobbyRoomName = "lobby";
+
+/// Validation error message for invalid room names, includes the rules
+static const char *kErrorMessageInvalidRoom = "Room names must contain 1-31 latin letters, digits, - and _";
+
+typedef struct Reactor Reactor;
 
 /// Holds the details of connected clients
 typedef struct {
+  ConnectionID id; ///< Unique connection ID, assigned on accept
   pthread_t threadID; ///< Thread ID associated to the client
   char nickname[kMaxNicknameSize + sizeof(wchar_t)]; ///< Client name (+ NULL terminator)
   SOCKET socket; ///< Client's socket
@@ -65,36 +107,112 @@ typedef struct {
   char host[kMaxClientHostLength]; ///< IP address in pretty string format
   SSL *ssl; ///< SSL connection handle
   MessageBuffer buffer; ///< Data read from client connection
+  ClientState state; ///< Connection state (event mode only)
+  Timer timer; ///< Handshake, authentication or inactivity timeout (event mode only)
+  Reactor *reactor; ///< Event loop that owns the connection (event mode only)
+  bool watchWrite; ///< The event loop is waiting for the socket to be writable (event mode only)
+  Outbox *outbox; ///< Messages waiting to be written to the client
+  int notify[2]; ///< Pipe used to wake up the client thread (threaded mode only)
+  pthread_mutex_t *sslLock; ///< Serialises TLS calls from the client and broadcast threads (threaded mode only)
+  RateLimit limit; ///< Messages and bytes the client can still send before being throttled
+  Room *room; ///< Room that receives the client messages, NULL until authenticated
+  size_t roomSlot; ///< Position of the client in its room shard
+  size_t rosterSlot; ///< Position of the client in the roster, once authenticated
 } Client;
 
+/// A message queued for the members of a room, or for a single client
+typedef struct {
+  Frame *frame; ///< The encoded message
+  Room *room; ///< The recipients, NULL for direct messages
+  ConnectionID recipient; ///< The recipient of a direct message (event mode only)
+  bool chat; ///< The message is a chat message, which is kept in the history
+  uint64_t sequence; ///< Position of the frame in the history, 0 if not kept
+} Broadcast;
+
+/// Event loop that owns a shard of the client connections (event mode only)
+struct Reactor {
+  unsigned int id; ///< Reactor index, for logging
+  pthread_t threadID; ///< Thread running the event loop
+  int loop; ///< epoll file descriptor
+  SOCKET socket; ///< Listening socket, shared with other reactors with SO_REUSEPORT
+  int wakeup; ///< eventfd signalled when the mailbox has new items
+  CQueue *mailbox; ///< Messages to broadcast to the clients of this reactor
+  Registry *clients; ///< Clients owned by this reactor
+  TimerWheel *timers; ///< Timeouts of the clients owned by this reactor, one tick per second
+  uint64_t delivered; ///< History sequence number of the last delivered frame
+};
+
 /// This is the singleton instance for our server
 struct Server {
   char *host; ///< Inbound IP address (string)
   int port;   ///< Inbound TCP port
   int maxConnections; ///< Maximum number of connections accepted
+  ServerMode mode; ///< Connection handling model
+  unsigned int workers; ///< Number of reactors (event mode only)
+  unsigned int batchWindow; ///< Milliseconds to wait for more messages before a broadcast
+  unsigned int outboxSize; ///< Max number of messages queued for each client
+  OutboxPolicy outboxPolicy; ///< What to do with clients that exceed their outbox
+  unsigned int compressionThreshold; ///< Min size of the frames to compress, 0 = disabled
+  NicknameValidator nicknameValidator; ///< How nicknames are validated
+  Reactor *reactors; ///< Running event loops (event mode only)
+  struct addrinfo *address; ///< Bind address, used to create new listening sockets
   SOCKET socket; ///< Stores the server socket
   SSL_CTX *ssl; ///< SSL context
+  TicketKeys *tickets; ///< Session ticket keys, NULL if resumption is disabled
+  KernelTLSMode kernelTLS; ///< Offload the TLS records to the kernel if supported
+  unsigned int rateMessages; ///< Max messages per second from each client, 0 = unlimited
+  unsigned int rateBytes; ///< Max bytes of content per second from each client, 0 = unlimited
+  unsigned int historySize; ///< Max bytes of recent messages replayed to joining clients, 0 = disabled
+  char *archivePath; ///< Directory of the archive segments
+  size_t archiveSize; ///< Max bytes of archived messages, 0 = disabled
+  size_t archiveSegmentSize; ///< Bytes of each archive segment
+  unsigned int archiveAge; ///< Seconds after which archived messages are removed, 0 = never
 };
 static Server *server = NULL;
 
 /// Termination flag
 static bool terminate = false;
 
-/// Contains all active clients
-static List *clients = NULL;
+/// Contains all active clients, indexed by connection ID, socket and nickname
+static Registry *clients = NULL;
+
+/// Last assigned connection ID
+static atomic_uint_least64_t lastConnectionID = 0;
+
+/// Rooms with at least one member, indexed by name
+static Rooms *rooms = NULL;
+
+/// Authenticated clients, served to /list requests
+static Roster *roster = NULL;
+
+/// Recent chat messages, replayed to the clients that join a room
+static History *history = NULL;
+
+/// Transcript of all the messages sent to the rooms
+static Archive *archive = NULL;
 
 /// Concurrent queue of incoming messages to broadcast
 static CQueue *messages = NULL;
 
+/// Concurrent queue of /history requests, NULL if the archive is disabled
+static CQueue *historyRequests = NULL;
+
 // Mutex for client list
 pthread_mutex_t clientsLock = PTHREAD_MUTEX_INITIALIZER;
 
+// Held by the broadcast thread while it delivers a batch (threaded mode only)
+pthread_mutex_t deliveryLock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Adds a message to the broadcast queue
- * @param[in] type Type of message
+ * @param[in] room   The recipients of the message
+ * @param[in] type   Type of message
  * @param[in] format String formatted with placeholders
  */
-bool Server_broadcastMessage(C2HMessageType type, const char *format, ...);
+bool Server_broadcastMessage(Room *room, C2HMessageType type, const char *format, ...);
+
+// Adds a message object to the broadcast queue
+bool Server_broadcast(const C2HMessage *message, Room *room);
 
 // Signal handling
 int Server_catch(int sig, void (*handler)(int));
@@ -105,26 +223,89 @@ int Server_send(Client *client, const C2HMessage *message);
 bool Server_sendMessage(Client *client, C2HMessageType type, const char *format, ...);
 int Server_receive(Client *client);
 
+// Queues a shared frame for a client and tries to write it
+bool Server_sendFrame(Client *client, Frame *frame);
+
+// Writes the client's queued messages without blocking the caller's peers
+bool Server_flush(Client *client);
+
+// Writes the client's queued messages until the socket would block
+OutboxStatus Server_flushOutbox(Client *client);
+
+// Creates a new listening socket for the server address
+SOCKET Server_listen(Server *this);
+
+// Accepts a new connection on the listening socket and prepares the TLS session
+bool Server_acceptConnection(Server *this, SOCKET listener, Client *client);
+
+// Runs the TLS handshake until it would block, completes or fails
+HandshakeStatus Server_continueHandshake(Client *client);
+
+// Runs the TLS handshake to completion, within kHandshakeTimeout
+bool Server_completeHandshake(Client *client);
+
 // Manages a client's thread
 void* Server_handleClient(void* data);
 
-// Broadcast messages to all connected clients
+// Processes a chat message received from an authenticated client
+bool Server_handleMessage(Client *client, const C2HMessageView *message);
+
+// Connection handling loops for each server mode
+void Server_runThreaded(Server *this);
+#if defined(__linux__)
+  void Server_runEventLoop(Server *this);
+#endif
+
+// Broadcast messages to the members of their rooms
 void* Server_handleBroadcast(void* data);
 
+// Reads the archive pages requested with /history
+void* Server_handleHistory(void* data);
+
 // Closes a client connection and related thread
 void Server_dropClient(Client *client);
 
-// Find a Client object in the list given a nickname or a thread id
-Client *Server_getClientInfoForThread(pthread_t clientThreadID);
+// Find a Client object in the registry given a connection ID or a nickname
+Client *Server_getClientInfoForID(ConnectionID id);
 Client *Server_getClientInfoForNickname(char *clientNickname);
 
-// Comparison functions for List_search
-int Client_findByThreadID(const ListData *a, const ListData *b, size_t size);
-int Client_findByNickname(const ListData *a, const ListData *b, size_t size);
+// Validates a nickname and assigns it to the given client if unique
+bool Server_setNickname(Client *client, const char *nick);
+
+// Moves a client to the given room
+static bool Server_enterRoom(Client *client, const char *name, const char *greeting);
+
+// Removes a client from its room, the clientsLock must be held
+static bool Server_exitRoom(Client *client);
+
+// Publishes the usage counters of the object pools
+static void Server_publishPoolStats();
 
 // Authenticate a client connection using a nickname
 bool Server_authenticate(Client *client);
 
+/**
+ * Selects the wire protocol among the ones offered by a client during
+ * the TLS handshake (ALPN), compressed and binary protocols are preferred.
+ * Clients that don't offer any known protocol use the text protocol.
+ * See https://www.openssl.org/docs/man3.0/man3/SSL_CTX_set_alpn_select_cb.html
+ */
+static int Server_selectProtocol(
+  SSL *ssl, const unsigned char **out, unsigned char *outlen,
+  const unsigned char *in, unsigned int inlen, void *arg
+) {
+  (void)ssl;
+  (void)arg;
+  static const unsigned char kProtocols[] = kMessageProtocolList;
+  unsigned char *selected = NULL;
+  int result = SSL_select_next_proto(
+    &selected, outlen, kProtocols, sizeof(kProtocols) - 1, in, inlen
+  );
+  if (result != OPENSSL_NPN_NEGOTIATED) return SSL_TLSEXT_ERR_NOACK;
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+
 /**
  * Creates and initialises the server object
  * @param[in] config A valid ServerConfigInfo structure
@@ -187,6 +368,7 @@ Server *Server_init(ServerConfigInfo *config) {
   // to send a client certificate
   // See https://www.openssl.org/docs/man3.0/man3/SSL_CTX_set_verify.html
   SSL_CTX_set_verify(sslContext, SSL_VERIFY_NONE, NULL);
+  SSL_CTX_set_alpn_select_cb(sslContext, Server_selectProtocol, NULL);
   // See https://www.openssl.org/docs/man3.0/man3/SSL_CTX_set_cipher_list.html
   SSL_CTX_set_cipher_list(
     sslContext,
@@ -205,30 +387,110 @@ Server *Server_init(ServerConfigInfo *config) {
     Fatal("Private key does not match the public certificate");
   }
 
+  // Reconnecting clients resume their session with a ticket and skip
+  // the key exchange, the server doesn't need to store any session
+  SSL_CTX_set_session_cache_mode(sslContext, SSL_SESS_CACHE_OFF);
+  TicketKeys *tickets = NULL;
+  if (config->ticketLifetime > 0) {
+    tickets = TicketKeys_new(config->ticketLifetime, time(NULL));
+    if (tickets == NULL || !TicketKeys_attach(tickets, sslContext)) {
+      SSL_CTX_free(sslContext);
+      TicketKeys_free(&tickets);
+      Fatal("Unable to set up the session ticket keys");
+    }
+  } else {
+    SSL_CTX_set_options(sslContext, SSL_OP_NO_TICKET);
+  }
+
   // Create a server instance
   server = (Server *)calloc(sizeof(Server), 1);
   server->ssl = sslContext;
-  server->socket = Socket_new(bindAddress->ai_family, bindAddress->ai_socktype, bindAddress->ai_protocol);
-  Socket_unsetIPV6Only(server->socket);
-  Socket_setReusableAddress(server->socket);
-  Socket_setNonBlocking(server->socket);
+  server->tickets = tickets;
+  server->address = bindAddress;
+  server->mode = config->mode;
+  server->workers = (config->workers > 0) ? config->workers : 1;
+  server->batchWindow = config->batchWindow;
+  server->outboxSize = config->outboxSize;
+  server->outboxPolicy = config->outboxPolicy;
+  server->compressionThreshold = config->compressionThreshold;
+  server->rateMessages = config->rateMessages;
+  server->rateBytes = config->rateBytes;
+  server->historySize = config->historySize;
+  server->archiveSize = (size_t)config->archiveSize * 1024 * 1024;
+  server->archiveSegmentSize = (size_t)config->archiveSegmentSize * 1024 * 1024;
+  server->archiveAge = config->archiveAge;
+  size_t archivePathLength = strlen(config->workingDirPath) + sizeof("/archive");
+  server->archivePath = calloc(archivePathLength, 1);
+  if (server->archivePath != NULL) {
+    snprintf(server->archivePath, archivePathLength, "%s/archive", config->workingDirPath);
+  } else if (server->archiveSize > 0) {
+    Warn("Unable to allocate the archive path, messages will not be archived");
+    server->archiveSize = 0;
+  }
+  server->nicknameValidator = config->nicknameValidator;
+#if !defined(__linux__)
+  if (server->mode == kServerModeEvent) {
+    Warn("The epoll server mode is not supported on this system, using threads");
+    server->mode = kServerModeThreaded;
+  }
+#endif
+  server->kernelTLS = config->kernelTLS;
+#if defined(__linux__) && defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  // OpenSSL switches each connection to kTLS after the handshake, if the kernel
+  // supports the negotiated cipher, and keeps encrypting in user space otherwise
+  // See https://www.openssl.org/docs/man3.0/man3/SSL_CTX_set_options.html
+  if (server->kernelTLS == kKernelTLSOn) {
+    SSL_CTX_set_options(server->ssl, SSL_OP_ENABLE_KTLS);
+  }
+#else
+  if (server->kernelTLS == kKernelTLSOn) {
+    Warn("Kernel TLS is not supported on this system, records are encrypted by OpenSSL");
+    server->kernelTLS = kKernelTLSOff;
+  }
+#endif
+  server->host = strdup(config->host);
+  server->port = config->port;
+  server->maxConnections = config->maxConnections;
 
-  Socket_bind(server->socket, bindAddress->ai_addr, bindAddress->ai_addrlen);
+  // Preallocate messages and queue/list nodes before any thread starts,
+  // the pools grow if needed and are never destroyed because
+  // detached client threads may still release objects on exit
+  size_t connections = (config->maxConnections > 0) ? (size_t)config->maxConnections : 1;
+  if (!C2HMessage_initPool(connections * kMessagesPerConnection)
+    || !Queue_initPool(connections * kNodesPerConnection)
+    || !List_initPool(connections * kNodesPerConnection)) {
+    Warn("Unable to preallocate the object pools, using the heap");
+  }
 
   // Note: if the bind fails here (e.g. server is already running),
   // the memory allocated for the server and bindAddress vars will not be freed
-
-  // We don't need bindAddress anymore
-  freeaddrinfo(bindAddress);
-
-  Socket_listen(server->socket, config->maxConnections);
-  server->host = strdup(config->host);
-  server->port = config->port;
-  server->maxConnections = config->maxConnections;
+  server->socket = Server_listen(server);
 
   return server;
 }
 
+/**
+ * Creates a non-blocking socket listening on the server address
+ *
+ * In event mode every reactor has its own listening socket, bound
+ * to the same address with SO_REUSEPORT
+ * @param[in] this The server object
+ * @param[out] The listening socket
+ */
+SOCKET Server_listen(Server *this) {
+  struct addrinfo *bindAddress = this->address;
+  SOCKET listener = Socket_new(bindAddress->ai_family, bindAddress->ai_socktype, bindAddress->ai_protocol);
+  Socket_unsetIPV6Only(listener);
+  Socket_setReusableAddress(listener);
+  if (this->mode == kServerModeEvent) {
+    Socket_setReusablePort(listener);
+  }
+  Socket_setNonBlocking(listener);
+  Socket_bind(listener, bindAddress->ai_addr, bindAddress->ai_addrlen);
+  Socket_listen(listener, this->maxConnections);
+  return listener;
+}
+
 /**
  * Frees the memory allocated for the server object
  * @param[in] this Double pointer to a server structure
@@ -236,7 +498,12 @@ Server *Server_init(ServerConfigInfo *config) {
 void Server_free(Server **this) {
   if (this != NULL) {
     free((*this)->host);
+    free((*this)->archivePath);
+    freeaddrinfo((*this)->address);
     SSL_CTX_free((*this)->ssl);
+    TicketKeys_free(&((*this)->tickets));
+    // The compiled regex cache is never cleared, like the object pools,
+    // detached client threads may still be validating a nickname
     memset(*this, 0, sizeof(Server));
     free(*this);
     *this = NULL;
@@ -270,6 +537,120 @@ int Server_catch(int sig, void (*handler)(int)) {
    return sigaction (sig, &action, NULL);
 }
 
+/**
+ * Releases the messages left in a queue of broadcast messages
+ * @param[in] queue The queue to empty
+ */
+static void Server_releaseBroadcasts(CQueue *queue) {
+  QueueData *item = NULL;
+  while ((item = CQueue_tryPop(queue)) != NULL) {
+    Broadcast *broadcast = (Broadcast *)item->content;
+    Frame_release(&(broadcast->frame));
+    Room_release(&(broadcast->room));
+    QueueData_free(&item);
+  }
+}
+
+/**
+ * Moves a batch of broadcast messages from a queue into an array,
+ * the references are transferred to the array
+ * @param[in]  items A queue of broadcast messages, freed by the function
+ * @param[out] count The number of messages in the array
+ * @param[out] The array of messages, or NULL if there are none
+ */
+static Broadcast *Server_collectBroadcasts(Queue *items, size_t *count) {
+  *count = 0;
+  if (items == NULL) return NULL;
+  Broadcast *broadcasts = calloc(Queue_length(items), sizeof(Broadcast));
+  QueueData *item = NULL;
+  while ((item = Queue_dequeue(items)) != NULL) {
+    Broadcast *broadcast = (Broadcast *)item->content;
+    if (broadcasts != NULL) {
+      broadcasts[(*count)++] = *broadcast;
+    } else {
+      Frame_release(&(broadcast->frame));
+      Room_release(&(broadcast->room));
+    }
+    QueueData_free(&item);
+  }
+  Queue_free(&items);
+  if (*count == 0) {
+    free(broadcasts);
+    return NULL;
+  }
+  return broadcasts;
+}
+
+/**
+ * Queues a batch of shared frames into a client's outbox. When the
+ * outbox fills up it is flushed first, so that a large batch only
+ * discards messages for clients whose socket can't take them.
+ * @param[in] client The recipient
+ * @param[in] frames The frames to queue
+ * @param[in] count  The number of frames
+ * @param[out] false if the outbox overflowed and the client must be disconnected
+ */
+static bool Server_queueFrames(Client *client, Frame **frames, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (Outbox_full(client->outbox)) Server_flushOutbox(client);
+    if (!Outbox_push(client->outbox, frames[i])) return false;
+  }
+  return true;
+}
+
+/// Delivers a batch of frames to the members of a room
+typedef void (*RoomDelivery)(Room *room, Frame **frames, size_t count, void *context);
+
+/**
+ * Groups a batch of broadcast messages by room and delivers each group
+ * with one call, so every member gets all of its messages at once and
+ * in order. Direct messages are skipped. The messages are released
+ * and the array is freed.
+ * @param[in] broadcasts The messages to deliver
+ * @param[in] count      The number of messages
+ * @param[in] deliver    Writes the frames of a room to its members
+ * @param[in] context    Passed to the delivery function
+ */
+static void Server_deliverBroadcasts(
+  Broadcast *broadcasts, size_t count, RoomDelivery deliver, void *context
+) {
+  Frame **frames = calloc(count, sizeof(Frame *));
+  for (size_t i = 0; frames != NULL && i < count; i++) {
+    // Rooms are released once their group has been delivered
+    Room *room = broadcasts[i].room;
+    if (room == NULL) continue;
+    size_t length = 0;
+    for (size_t j = i; j < count; j++) {
+      if (broadcasts[j].room != room) continue;
+      frames[length++] = broadcasts[j].frame;
+      if (j > i) Room_release(&(broadcasts[j].room));
+    }
+    deliver(room, frames, length, context);
+  }
+  for (size_t i = 0; i < count; i++) {
+    Frame_release(&(broadcasts[i].frame));
+    Room_release(&(broadcasts[i].room));
+  }
+  free(frames);
+  free(broadcasts);
+}
+
+/**
+ * Adds the chat messages of a batch to the history and all the
+ * messages to the archive, in the same order they are delivered.
+ * The archive writes them from its own thread.
+ * @param[in] broadcasts The messages to record
+ * @param[in] count      The number of messages
+ */
+static void Server_recordBroadcasts(Broadcast *broadcasts, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (broadcasts[i].room == NULL) continue;
+    if (archive != NULL) Archive_append(archive, broadcasts[i].frame, broadcasts[i].room->name);
+    if (history == NULL || !broadcasts[i].chat) continue;
+    broadcasts[i].sequence = History_add(history, broadcasts[i].frame, broadcasts[i].room->name);
+  }
+}
+
 /**
  * Starts the server instance with the given configuration
  * @param[in] this The server object to start
@@ -288,13 +669,43 @@ void Server_start(Server *this) {
   // Ignoring SIGPIPE (= sending data to a closed socket)
   Server_catch(SIGPIPE, SIG_IGN);
 
-  // Create a thread for broadcast messages
-  pthread_t broadcastThreadID = 0;
-  pthread_create(&broadcastThreadID, NULL, Server_handleBroadcast, NULL);
-
-  clients = List_new();
+  clients = Registry_new();
   if (clients == NULL) {
-    Fatal("Unable to initialise clients list");
+    Fatal("Unable to initialise clients registry");
+  }
+
+  // Event loops keep the room members of their own clients
+  rooms = Rooms_new((this->mode == kServerModeEvent) ? this->workers : 1);
+  if (rooms == NULL) {
+    Fatal("Unable to initialise the rooms");
+  }
+
+  roster = Roster_new(this->compressionThreshold);
+  if (roster == NULL) {
+    Fatal("Unable to initialise the roster");
+  }
+
+  if (this->historySize > 0) {
+    history = History_new(this->historySize);
+    if (history == NULL) {
+      Fatal("Unable to initialise the message history");
+    }
+  }
+
+  if (this->archiveSize > 0) {
+    archive = Archive_open(
+      this->archivePath, this->archiveSize, this->archiveSegmentSize, this->archiveAge
+    );
+    // The chat works without the archive, only /history is unavailable
+    if (archive == NULL) {
+      Warn("Unable to open the message archive in %s, messages will not be archived", this->archivePath);
+    } else {
+      Info("Archiving messages in %s, last message: %" PRIu64, this->archivePath, Archive_last(archive));
+      historyRequests = CQueue_new();
+      if (historyRequests == NULL) {
+        Fatal("Unable to initialise the history request queue");
+      }
+    }
   }
 
   messages = CQueue_new();
@@ -302,6 +713,179 @@ void Server_start(Server *this) {
     Fatal("Unable to initialise message queue");
   }
 
+  Info("Using %s connection handling", SERVER_MODE_NAME(this->mode));
+#if defined(__linux__)
+  if (this->mode == kServerModeEvent) {
+    Server_runEventLoop(this);
+  } else {
+    Server_runThreaded(this);
+  }
+#else
+  Server_runThreaded(this);
+#endif
+
+  // Destroy client registry
+  Registry_free(&clients);
+  Rooms_free(&rooms);
+  Roster_free(&roster);
+  History_free(&history);
+  Archive_close(&archive);
+  Server_releaseBroadcasts(messages);
+  CQueue_free(&messages);
+  if (historyRequests != NULL) CQueue_free(&historyRequests);
+
+  // Cleanup socket and server
+  SOCKET_close(this->socket);
+  Server_free(&server);
+}
+
+/**
+ * Returns the current time in milliseconds, from a clock
+ * that is not affected by system time changes
+ */
+static uint64_t Server_currentMillis() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/**
+ * Accepts a pending connection from the listening socket and
+ * prepares the TLS session. The socket is left in non-blocking mode
+ * and the handshake is performed later by the thread or event
+ * loop that owns the client, so that a slow client cannot
+ * stall the accept loop.
+ * @param[in] this     The server object
+ * @param[in] listener The listening socket
+ * @param[in] client Client object to initialise with the connection details
+ * @param[out] true if the client is connected, false otherwise
+ */
+bool Server_acceptConnection(Server *this, SOCKET listener, Client *client) {
+  client->length = sizeof(client->address);
+  client->socket = accept(listener, (struct sockaddr*) &(client)->address, &(client)->length);
+  if (!SOCKET_isValid(client->socket)) {
+    if (EINTR == SOCKET_getErrorNumber()) {
+      Info("%s", strerror(SOCKET_getErrorNumber()));
+    } else if (EWOULDBLOCK != SOCKET_getErrorNumber()) {
+      Error("accept() failed (%d): %s", SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber()));
+    }
+    return false;
+  }
+  Socket_setNonBlocking(client->socket);
+  client->id = atomic_fetch_add(&lastConnectionID, 1) + 1;
+
+  // Prepare an SSL connection
+  client->ssl = SSL_new(this->ssl);
+  if (!client->ssl) {
+    Error("SSL_new() failed: cannot open an SSL client connection");
+    SOCKET_close(client->socket);
+    return false;
+  }
+  SSL_set_fd(client->ssl, client->socket);
+
+  // A client has connected, log the client info
+  getnameinfo(
+    (struct sockaddr*)&(client)->address,
+    client->length, client->host, kMaxClientHostLength,
+    0, 0,
+    NI_NUMERICHOST
+  );
+  RateLimit_init(
+    &(client->limit), this->rateMessages, this->rateBytes,
+    kMaxContentSize, Server_currentMillis()
+  );
+  Info("New connection from %s", client->host);
+  return true;
+}
+
+/**
+ * Applies the wire protocol selected during the TLS handshake
+ * to the client's input buffer and outbox
+ * @param[in] client The client connection, with a completed handshake
+ */
+static void Server_setProtocol(Client *client) {
+  const unsigned char *selected = NULL;
+  unsigned int length = 0;
+  SSL_get0_alpn_selected(client->ssl, &selected, &length);
+  MessageProtocol protocol = MessageProtocol_parse(selected, length);
+  MessageBuffer_setProtocol(&(client->buffer), protocol);
+  Outbox_setProtocol(client->outbox, protocol);
+  Info("Using protocol %s", MESSAGE_PROTOCOL_NAME(protocol));
+}
+
+/**
+ * Reports whether the TLS records of a client connection are
+ * encrypted and decrypted by the kernel
+ * @param[in] client The client connection, with a completed handshake
+ */
+static void Server_reportKernelTLS(Client *client) {
+  if (server->kernelTLS != kKernelTLSOn) return;
+#if !defined(OPENSSL_NO_KTLS)
+  bool send = BIO_get_ktls_send(SSL_get_wbio(client->ssl));
+  bool receive = BIO_get_ktls_recv(SSL_get_rbio(client->ssl));
+#else
+  bool send = false;
+  bool receive = false;
+#endif
+  if (send) Stats_add(kStatKernelTLSSend, 1);
+  if (receive) Stats_add(kStatKernelTLSReceive, 1);
+  Info(
+    "Kernel TLS for %s: send %s, receive %s", client->host,
+    send ? "kernel" : "OpenSSL", receive ? "kernel" : "OpenSSL"
+  );
+}
+
+/**
+ * Advances the TLS handshake of a non-blocking client connection
+ * as far as possible without waiting
+ * @param[in] client The client connection
+ * @param[out] The outcome of the handshake step
+ */
+HandshakeStatus Server_continueHandshake(Client *client) {
+  int accepted = SSL_accept(client->ssl);
+  if (accepted == 1) {
+    bool resumed = SSL_session_reused(client->ssl);
+    Stats_add(kStatHandshakes, 1);
+    if (resumed) Stats_add(kStatHandshakesResumed, 1);
+    Info("SSL connection using %s%s", SSL_get_cipher(client->ssl), resumed ? " (resumed)" : "");
+    Server_setProtocol(client);
+    Server_reportKernelTLS(client);
+    return kHandshakeDone;
+  }
+  if (accepted == 0) {
+    Error("SSL_accept(): connection closed clean");
+    return kHandshakeFailed;
+  }
+  switch(SSL_get_error(client->ssl, accepted)) {
+    case SSL_ERROR_WANT_READ:
+      return kHandshakeWantRead;
+    case SSL_ERROR_WANT_WRITE:
+      return kHandshakeWantWrite;
+    default:
+      {
+        char error[256] = {};
+        ERR_error_string_n(ERR_get_error(), error, sizeof(error));
+        Error("SSL_accept() failed: %s", error);
+      }
+  }
+  return kHandshakeFailed;
+}
+
+/**
+ * Accepts connections and spawns a new thread for each client
+ * @param[in] this The server object
+ */
+void Server_runThreaded(Server *this) {
+  // Create a thread for broadcast messages
+  pthread_t broadcastThreadID = 0;
+  pthread_create(&broadcastThreadID, NULL, Server_handleBroadcast, NULL);
+
+  // Create a thread that reads the archive for /history
+  pthread_t historyThreadID = 0;
+  if (historyRequests != NULL) {
+    pthread_create(&historyThreadID, NULL, Server_handleHistory, NULL);
+  }
+
   fd_set reads;
   fd_set errors;
   FD_ZERO(&reads);
@@ -325,88 +909,50 @@ void Server_start(Server *this) {
     // Main socket is ready to read
     if (FD_ISSET(this->socket, &reads)) {
 
-      // Initialise a temporary client variable
-      Client client = {};
-      client.length = sizeof(client.address);
-      client.socket = accept(this->socket, (struct sockaddr*) &(client).address, &(client).length);
-      if (!SOCKET_isValid(client.socket)) {
-        if (EINTR == SOCKET_getErrorNumber()) {
-          Info("%s", strerror(SOCKET_getErrorNumber()));
-        } else if (EWOULDBLOCK != SOCKET_getErrorNumber()) {
-          Error("accept() failed (%d): %s", SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber()));
-        }
+      // The client object keeps the same address until it's disconnected
+      Client *client = calloc(1, sizeof(Client));
+      if (client == NULL) {
+        Error("Unable to allocate a new client");
+        continue;
+      }
+      if (!Server_acceptConnection(this, this->socket, client)) {
+        free(client);
         continue;
       }
 
-      // Try to start an SSL connection
-      client.ssl = SSL_new(server->ssl);
-      if (!client.ssl) {
-        Error("SSL_new() failed: cannot open an SSL client connection");
+      // Refuse the connection without spending a thread on the handshake
+      pthread_mutex_lock(&clientsLock);
+      bool registered = Registry_length(clients) < (size_t)server->maxConnections
+        && Registry_add(clients, client, client->id, client->socket);
+      pthread_mutex_unlock(&clientsLock);
+      if (!registered) {
+        Info("Connection limits reached");
+        Server_dropClient(client);
         continue;
       }
-      SSL_set_fd(client.ssl, client.socket);
-      int accepted;
-      while (true) {
-        accepted = SSL_accept(client.ssl);
-        if (accepted != 1) {
-          if (accepted == 0) {
-            Error("SSL_accept(): connection closed clean");
-            Server_dropClient(&client);
-            break; // out of the SSL_accept() loop
-          }
-          switch(SSL_get_error(client.ssl, accepted)) {
-            case SSL_ERROR_WANT_READ:
-            case SSL_ERROR_WANT_WRITE:
-              continue; // the SSL_accept() loop
-            default:
-              {
-                char error[256] = {};
-                ERR_error_string_n(ERR_get_error(), error, sizeof(error));
-                Error("SSL_accept() failed: %s", error);
-                Server_dropClient(&client);
-              }
-            }
-          break; // out of the SSL_accept() loop
-        }
-        // If we are here, the connection has been accepted
-        break; // out of the SSL_accept() loop
+
+      // The broadcast thread queues messages in the outbox
+      // and wakes up the client thread to write them
+      client->outbox = Outbox_new(this->outboxSize, this->outboxPolicy);
+      client->sslLock = calloc(1, sizeof(pthread_mutex_t));
+      if (client->outbox == NULL || client->sslLock == NULL
+        || pthread_mutex_init(client->sslLock, NULL) || pipe(client->notify) < 0) {
+        Error("Unable to initialise the client outbox");
+        free(client->sslLock);
+        client->sslLock = NULL;
+        Server_dropClient(client);
+        continue;
       }
-      // Couldn't accept the connection, try again and fail later
-      // (or a SEGFAULT will happen)
-      if (accepted != 1) continue;
-
-      // A client has connected, log the client info
-      getnameinfo(
-        (struct sockaddr*)&(client).address,
-        client.length, client.host, kMaxClientHostLength,
-        0, 0,
-        NI_NUMERICHOST
-      );
-      Info("New connection from %s", client.host);
-      Info("SSL connection using %s", SSL_get_cipher(client.ssl));
+      Socket_setNonBlocking(client->notify[0]);
+      Socket_setNonBlocking(client->notify[1]);
 
+      // The TLS handshake is performed by the client thread
       pthread_t clientThreadID = 0;
-      if (clients->length < server->maxConnections) {
-
-        // Add client to the list (the client is cloned)
-        pthread_mutex_lock(&clientsLock);
-        List_append(clients, &client, sizeof(Client));
-
-        // Get pointer to a copy of the inserted client,
-        // because the temporary client var will be overridden
-        // at the beginning of the next cycle
-        Client *last = (Client *)List_last(clients);
-
-        // Start client thread
-        pthread_create(&clientThreadID, NULL, Server_handleClient, last);
-        last->threadID = clientThreadID; // Update client list item
-        pthread_mutex_unlock(&clientsLock);
-        pthread_detach(clientThreadID);
-      } else {
-        Server_sendMessage(&client, kMessageTypeErr, "connection limits reached");
-        Info("Connection limits reached");
-        Server_dropClient(&client);
-      }
+      pthread_mutex_lock(&clientsLock);
+      pthread_create(&clientThreadID, NULL, Server_handleClient, client);
+      client->threadID = clientThreadID;
+      pthread_mutex_unlock(&clientsLock);
+      pthread_detach(clientThreadID);
     }
 
     // Main socket has an error
@@ -420,203 +966,388 @@ void Server_start(Server *this) {
 
   Info("Terminating...");
 
-  // Wait for all client threads to exit
-  Client *client;
-  while ((client = (Client *)List_next(clients)) != NULL) {
-    pthread_join(client->threadID, NULL);
+  // Wait for the client threads to exit, they are detached and
+  // they unregister themselves once they see the termination flag
+  struct timespec pause = { .tv_sec = 0, .tv_nsec = 100 * 1000000L };
+  for (int i = 0; i < kShutdownTimeout * 10; i++) {
+    pthread_mutex_lock(&clientsLock);
+    size_t connected = Registry_length(clients);
+    pthread_mutex_unlock(&clientsLock);
+    if (connected == 0) break;
+    nanosleep(&pause, NULL);
   }
-  // Destroy client list
-  List_free(&clients);
 
-  // Close broadcast thread
+  // Close broadcast and history threads
   pthread_join(broadcastThreadID, NULL);
-  CQueue_free(&messages);
+  if (historyRequests != NULL) pthread_join(historyThreadID, NULL);
 
-  // Cleanup socket and server
-  SOCKET_close(this->socket);
   FD_CLR(this->socket, &reads);
   FD_CLR(this->socket, &errors);
-  Server_free(&server);
 }
 
 /**
- * Sends data to a socket using a loop to ensure all data is sent
+ * Waits for a socket to become readable or writable
+ * @param[in] socket  The socket to check
+ * @param[in] events  POLLIN or POLLOUT
+ * @param[in] timeout Max time to wait in milliseconds
+ * @param[out] true if the socket is ready
+ */
+static bool Server_waitForSocket(SOCKET socket, short events, int timeout) {
+  struct pollfd item = { .fd = socket, .events = events };
+  return poll(&item, 1, timeout) > 0;
+}
+
+/**
+ * Performs the TLS handshake on the client's own thread.
+ * The handshake fails if it's not completed within kHandshakeTimeout seconds.
+ * @param[in] client The client connection
+ * @param[out] true if the TLS session is established
+ */
+bool Server_completeHandshake(Client *client) {
+  time_t deadline = time(NULL) + kHandshakeTimeout;
+  HandshakeStatus status;
+  while ((status = Server_continueHandshake(client)) != kHandshakeDone) {
+    if (status == kHandshakeFailed) return false;
+    int timeout = (int)(deadline - time(NULL)) * 1000;
+    short events = (status == kHandshakeWantWrite) ? POLLOUT : POLLIN;
+    if (timeout <= 0 || !Server_waitForSocket(client->socket, events, timeout)) {
+      Info("TLS handshake timeout expired for %s", client->host);
+      Stats_add(kStatTimeouts, 1);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Encodes a message for a single client, queues it in the
+ * client's outbox and tries to write it
  * @param[in] client The Client object containing a valid socket
  * @param[in] message The C2HMessage object to send
+ * @param[out] The size of the encoded message, or -1 on failure
  */
 int Server_send(Client *client, const C2HMessage *message) {
-  if (client == NULL) {
-    Error("Invalid client instance");
-    return -1;
-  }
   if (message == NULL) {
     Error("Invalid message");
     return -1;
   }
-  size_t sentTotal = 0;
-  char buffer[kBufferSize] = {};
-  size_t length = C2HMessage_format(message, buffer, sizeof(buffer));
-
-  char *data = (char*)buffer; // points to the beginning of the message
-  do {
-    if (!SOCKET_isValid(client->socket)) return -1;
-    int sent = SSL_write(client->ssl, data, length - sentTotal);
-    if (sent < 0) {
-      if (0 != SOCKET_getErrorNumber()) Error(
-        "send() failed: (%d): %s",
-        SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
-      );
-      return -1;
+  Frame *frame = Frame_new(message, server->compressionThreshold);
+  if (frame == NULL) {
+    Error("Unable to encode message");
+    return -1;
+  }
+  int length = (int)frame->length;
+  bool sent = Server_sendFrame(client, frame);
+  Frame_release(&frame);
+  return sent ? length : -1;
+}
+
+/**
+ * Queues a frame in the client's outbox and tries to write it,
+ * the frame can be shared with other clients
+ * @param[in] client The Client object containing a valid socket
+ * @param[in] frame  The encoded message
+ * @param[out] false if the client needs to be disconnected
+ */
+bool Server_sendFrame(Client *client, Frame *frame) {
+  if (client == NULL || client->outbox == NULL) {
+    Error("Invalid client instance");
+    return false;
+  }
+  if (!SOCKET_isValid(client->socket)) return false;
+  if (!Outbox_push(client->outbox, frame)) {
+    Info("Outbox full for client %d, disconnecting", client->socket);
+    return false;
+  }
+  return Server_flush(client);
+}
+
+/**
+ * Writes the client's outbox to the socket.
+ * Event driven clients are never blocked: if the socket is not
+ * writable, the event loop will resume the flush later. Threaded
+ * clients are flushed by their own thread, which can wait for the
+ * socket for up to kSendTimeout.
+ * @param[in] client The client to flush
+ * @param[out] false if the connection is broken
+ */
+bool Server_flush(Client *client) {
+  OutboxStatus status = Server_flushOutbox(client);
+#if defined(__linux__)
+  if (client->reactor != NULL) {
+    if (status == kOutboxError) return false;
+    bool watchWrite = (status == kOutboxPending);
+    if (watchWrite == client->watchWrite) return true;
+    uint32_t events = EPOLLIN | EPOLLRDHUP | (watchWrite ? EPOLLOUT : 0);
+    struct epoll_event event = { .events = events, .data.ptr = client };
+    if (epoll_ctl(client->reactor->loop, EPOLL_CTL_MOD, client->socket, &event) < 0) {
+      Error("epoll_ctl() failed (%d): %s", errno, strerror(errno));
+      return false;
     }
-    data += sent; // points to the remaining data to be sent
-    sentTotal += sent;
-  } while (sentTotal < length);
-  return sentTotal;
+    client->watchWrite = watchWrite;
+    return true;
+  }
+#endif
+  while (status == kOutboxPending) {
+    if (!Server_waitForSocket(client->socket, POLLOUT, kSendTimeout)) break;
+    status = Server_flushOutbox(client);
+  }
+  if (status != kOutboxEmpty) {
+    if (0 != SOCKET_getErrorNumber()) Error(
+      "send() failed: (%d): %s",
+      SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
+    );
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Writes the client's outbox until the socket would block.
+ * In threaded mode the TLS connection is shared between the client
+ * thread and the broadcast thread, so the calls are serialised.
+ * @param[in] client The client to flush
+ * @param[out] The outbox status after the flush
+ */
+OutboxStatus Server_flushOutbox(Client *client) {
+  if (client->sslLock != NULL) pthread_mutex_lock(client->sslLock);
+  OutboxStatus status = Outbox_flush(client->outbox, client->ssl);
+  if (client->sslLock != NULL) pthread_mutex_unlock(client->sslLock);
+  return status;
+}
+
+/**
+ * Removes an authenticated client from the roster,
+ * must be called while holding the clientsLock
+ * @param[in] client The client to remove
+ */
+static void Server_unlist(Client *client) {
+  if (strlen(client->nickname) == 0) return;
+  Client *moved = Roster_remove(roster, client->rosterSlot);
+  if (moved != NULL) moved->rosterSlot = client->rosterSlot;
+}
+
+/**
+ * Removes a client from its room, the room is closed when its last
+ * member leaves. Must be called while holding the clientsLock, by
+ * the thread that owns the client. When it returns, the broadcast
+ * thread can't see the client anymore.
+ * @param[in] client The client to remove
+ * @param[out] false if the room members can't be published
+ */
+static bool Server_exitRoom(Client *client) {
+  Room *room = client->room;
+  if (room == NULL) return true;
+  unsigned int shard = (client->reactor != NULL) ? client->reactor->id : 0;
+  Client *moved = Room_remove(room, shard, client->roomSlot);
+  if (moved != NULL) moved->roomSlot = client->roomSlot;
+  client->room = NULL;
+  // Event loops only deliver to their own clients, so they don't use the snapshot
+  bool published = (server->mode != kServerModeThreaded) || Room_publish(room);
+  Rooms_close(rooms, room);
+  Stats_set(kStatRooms, Rooms_length(rooms));
+  return published;
+}
+
+/**
+ * Moves a client to a room, which is created if it doesn't exist,
+ * and removes it from its current room
+ * @param[in] client The authenticated client
+ * @param[in] name   The name of the room to join
+ * @param[out] false if the client can't join the room, it stays in the current one
+ */
+static bool Server_joinRoom(Client *client, const char *name) {
+  unsigned int shard = (client->reactor != NULL) ? client->reactor->id : 0;
+  pthread_mutex_lock(&clientsLock);
+  Room *room = Rooms_open(rooms, name);
+  if (room == NULL || room == client->room) {
+    pthread_mutex_unlock(&clientsLock);
+    return (room != NULL);
+  }
+  size_t slot = 0;
+  if (!Room_add(room, shard, client, &slot)) {
+    Rooms_close(rooms, room);
+    pthread_mutex_unlock(&clientsLock);
+    return false;
+  }
+  // From now on the client receives the room messages
+  if (server->mode == kServerModeThreaded && !Room_publish(room)) {
+    Room_remove(room, shard, slot); // The last slot, nothing is moved
+    Rooms_close(rooms, room);
+    pthread_mutex_unlock(&clientsLock);
+    return false;
+  }
+  bool released = Server_exitRoom(client);
+  client->room = room;
+  client->roomSlot = slot;
+  Stats_set(kStatRooms, Rooms_length(rooms));
+  pthread_mutex_unlock(&clientsLock);
+  if (!released) Error("Unable to remove %s from the previous room", client->nickname);
+  return true;
 }
 
 /**
- * Comparison function to lookup a client by its ThreadID
- * @param[in] a Pointer to a Client struct object
- * @param[in] b Pointer to a Thread ID
- * @param[in] size (Unused) Size of the data to compare
- * @param[out] 0 on equal Thread IDs, non-zero otherwise
+ * Queues a confirmation for a client that has just joined a room,
+ * followed by the recent messages of the room that were delivered
+ * before it joined, at most one outbox of them
+ * @param[in] client   The client that has just joined the room
+ * @param[in] greeting The content of the /ok confirmation
+ * @param[in] last     The sequence number of the last message the client missed
  */
-int Client_findByThreadID(const ListData *a, const ListData *b, size_t size) {
-  Client *client = (Client *)a;
-  (void)size; // Avoids the 'unused parameter' error at compile time
-  pthread_t *threadB = (pthread_t *)b;
-  return (unsigned long)client->threadID - (unsigned long)*threadB;
+static void Server_replayHistory(Client *client, const char *greeting, uint64_t last) {
+  C2HMessage *message = C2HMessage_create(kMessageTypeOk, "%s", greeting);
+  Frame *frame = Frame_new(message, server->compressionThreshold);
+  C2HMessage_free(&message);
+  if (frame == NULL || !Outbox_push(client->outbox, frame)) {
+    Error("Unable to confirm that %s joined %s", client->nickname, client->room->name);
+  }
+  Frame_release(&frame);
+  if (history == NULL) return;
+  size_t max = (server->outboxSize > 0) ? server->outboxSize : 1;
+  Frame **frames = calloc(max, sizeof(Frame *));
+  if (frames == NULL) return;
+  size_t count = History_collect(history, client->room->name, last, frames, max);
+  if (!Server_queueFrames(client, frames, count)) {
+    Info("Outbox full for client %d while replaying the history", client->socket);
+  }
+  for (size_t i = 0; i < count; i++) Frame_release(&frames[i]);
+  free(frames);
 }
 
 /**
- * Comparison function to lookup a client by its Nickname
- * @param[in] a Pointer to a Client struct object
- * @param[in] b Char pointer, with the nickname to compare
- * @param[in] size (Unused) Size of the data to compare
- * @param[out] 0 on equal nicknames, non-zero otherwise
+ * Moves a client to a room, then sends it a confirmation and replays
+ * the recent messages of the room with a single flush. Must be called
+ * by the thread that owns the client. Threaded clients join while no
+ * batch is being delivered, and event driven clients while their event
+ * loop is not delivering, so they get each message either from the
+ * history or live, once.
+ * @param[in] client   The authenticated client
+ * @param[in] name     The name of the room to join
+ * @param[in] greeting The content of the /ok confirmation
+ * @param[out] false if the client can't join the room, it stays in the current one
  */
-int Client_findByNickname(const ListData *a, const ListData *b, size_t size) {
-  Client *client = (Client *)a;
-  char *nickname = (char *)b;
-  (void)size;
-  return strncmp(client->nickname, nickname, kMaxNicknameSize);
+static bool Server_enterRoom(Client *client, const char *name, const char *greeting) {
+  Reactor *reactor = client->reactor;
+  if (reactor == NULL) pthread_mutex_lock(&deliveryLock);
+  bool joined = Server_joinRoom(client, name);
+  if (joined) {
+    // Reactors deliver the history in order, up to the frames still in the mailbox
+    Server_replayHistory(client, greeting, (reactor != NULL) ? reactor->delivered : UINT64_MAX);
+  }
+  if (reactor == NULL) pthread_mutex_unlock(&deliveryLock);
+  if (joined && Outbox_pending(client->outbox) && !Server_flush(client)) {
+    Info("Unable to replay the history to client %d", client->socket);
+  }
+  return joined;
 }
 
 /**
- * Removes a client object from the list of connected clients
- * and closes the connection
+ * Removes a client object from the registry of connected clients,
+ * closes the connection and frees the client
  * @param[in] client The client structure that contains the socket
  */
 void Server_dropClient(Client *client) {
+  pthread_mutex_lock(&clientsLock);
+  Registry_remove(clients, client->id);
+  Server_unlist(client);
+  // Wait until the broadcast thread can't see the client anymore
+  bool released = Server_exitRoom(client);
+  pthread_mutex_unlock(&clientsLock);
+  if (!released) {
+    // The broadcast thread may still write to the client, so it must stay
+    // valid and its resources are leaked. The connection is shut down but
+    // the descriptor stays open, so it can't be reused by another client.
+    Error("Unable to release client %lu", client->threadID);
+    if (client->sslLock != NULL) pthread_mutex_lock(client->sslLock);
+    if (SSL_is_init_finished(client->ssl)) SSL_shutdown(client->ssl);
+    shutdown(client->socket, SHUT_RDWR);
+    if (client->sslLock != NULL) pthread_mutex_unlock(client->sslLock);
+    // Only the client's own thread can end here, the accept thread goes on
+    if (client->threadID && pthread_equal(client->threadID, pthread_self())) {
+      Info("Closing client thread %lu", client->threadID);
+      pthread_exit(NULL);
+    }
+    return;
+  }
+
   if (!client->threadID) {
     // The client doesn't have a thread, which means
     //  - the SSL connection was denied by some error
     //  - there are no available connections
     Info("Dropping threadless client");
-    SSL_shutdown(client->ssl);
+    if (SSL_is_init_finished(client->ssl)) SSL_shutdown(client->ssl);
     SOCKET_close(client->socket);
     SSL_free(client->ssl);
+    MessageBuffer_clear(&(client->buffer));
+    Outbox_free(&(client->outbox));
+    free(client);
     return;
   }
 
   // The client is a regularly authenticated client
   pthread_t clientThreadID = client->threadID;
 
-  // Drop client from the clients list
-  // We need to pass sizeof(Client) as size or the item will not be compared
-  pthread_mutex_lock(&clientsLock);
-  int index = List_search(clients, &clientThreadID, sizeof(Client), Client_findByThreadID);
-  if (index >= 0) {
-    // Close client socket here, or it will hang during broadcast
-    // with a bad file descriptor error
-    SSL_shutdown(client->ssl);
-    SOCKET_close(client->socket);
-    SSL_free(client->ssl);
-    if (!List_delete(clients, index)) {
-      Warn("Unable to drop client %d with thread ID %lu", index, clientThreadID);
-    }
-  } else {
-    Warn("Unable to find client with thread ID %lu", clientThreadID);
+  // The client is not visible to the broadcast thread anymore,
+  // so its connection can be closed without holding the lock
+  if (SSL_is_init_finished(client->ssl)) SSL_shutdown(client->ssl);
+  SOCKET_close(client->socket);
+  SSL_free(client->ssl);
+  close(client->notify[0]);
+  close(client->notify[1]);
+  pthread_mutex_destroy(client->sslLock);
+  free(client->sslLock);
+  if (Outbox_dropped(client->outbox) > 0) {
+    Info("%zu messages dropped for %s", Outbox_dropped(client->outbox), client->nickname);
   }
-  pthread_mutex_unlock(&clientsLock);
+  MessageBuffer_clear(&(client->buffer));
+  Outbox_free(&(client->outbox));
+  free(client);
   Info("Closing client thread %lu", clientThreadID);
   pthread_exit(NULL);
 }
 
 /**
- * Lookup a Client in the list by its thread ID
- * @param[in] clientThreadID Thread ID to lookup
+ * Lookup a Client in the registry by its connection ID
+ * @param[in] id Connection ID to lookup
  * @param[out] A pointer to a Client structure or NULL
  */
-Client *Server_getClientInfoForThread(pthread_t clientThreadID) {
-  Client *client = NULL;
+Client *Server_getClientInfoForID(ConnectionID id) {
   pthread_mutex_lock(&clientsLock);
-  int index = List_search(clients, &clientThreadID, sizeof(Client), Client_findByThreadID);
-  if (index >= 0) {
-    client = (Client *)List_item(clients, index);
-  }
+  Client *client = (Client *)Registry_get(clients, id);
   pthread_mutex_unlock(&clientsLock);
   return client;
 }
 
 /**
- * Lookup a Client in the list by its nickname
+ * Lookup a Client in the registry by its nickname
  * @param[in] clientNickname Nickname to lookup
  * @param[out] A pointer to a Client structure or NULL
  */
 Client *Server_getClientInfoForNickname(char *clientNickname) {
-  Client *client = NULL;
   pthread_mutex_lock(&clientsLock);
-  int index = List_search(clients, clientNickname, sizeof(Client), Client_findByNickname);
-  if (index >= 0) {
-    client = (Client *)List_item(clients, index);
-  }
+  Client *client = (Client *)Registry_getByNickname(clients, clientNickname);
   pthread_mutex_unlock(&clientsLock);
   return client;
 }
 
 /**
- * Receives a message from a connected client until
- * the buffer is full
+ * Receives data from a connected client into
+ * the free space of its message buffer
  * @param[in] client Client struct containing the socket to receive from
  * @param[out] The number of bytes received
  */
 int Server_receive(Client *client) {
-  // Max length of data we can read into the buffer
-  size_t length = sizeof(client->buffer.data);
-  Debug("Server_receive - max buffer size: %zu", length);
-
-  // Pointer to the end of the buffer, to prevent overflow
-  char *eob = client->buffer.data + length -1;
-
-  // Manage buffer status
-  if (client->buffer.start != client->buffer.data && *eob != 0) {
-      // There is leftover data from a previous read
-      size_t remainingTextSize = eob - client->buffer.start + 1;
-      // Move the leftover data at the beginning of the buffer...
-      memcpy(client->buffer.data, client->buffer.start, remainingTextSize);
-      // ...and pad the rest with NULL terminators
-      for (size_t i = length; i >= remainingTextSize; i--) {
-        *(client->buffer.data + i) = 0;
-      }
-      // Set the buffer to start reading at the end of the leftover data
-      client->buffer.start = client->buffer.data + remainingTextSize + 1;
-      length = eob - client->buffer.start + 1; // new buffer start
-      Debug("Server_receive - remaining text size: %zu", remainingTextSize);
-      Debug("Server_receive - rew max buffer size: %zu", length);
-  } else {
-    // buffer.start != NULL: all data has been already read, no leftover
-    // buffer.start == NULL: newly created buffer
-    // In either case, reset everything
-    client->buffer.start = client->buffer.data;
-    memset(client->buffer.data, 0, length);
-  }
+  // Read into the free space of the ring buffer, without moving the leftover data
+  size_t length = 0;
+  char *space = MessageBuffer_reserve(&(client->buffer), &length);
+  Debug("Server_receive - max read size: %zu", length);
 
-  Debug("Server_receive - starting at: %zu", client->buffer.start - client->buffer.data);
   while(true) {
-    int bytesReceived = SSL_read(client->ssl, client->buffer.start, length);
+    if (client->sslLock != NULL) pthread_mutex_lock(client->sslLock);
+    int bytesReceived = SSL_read(client->ssl, space, length);
+    if (client->sslLock != NULL) pthread_mutex_unlock(client->sslLock);
 
-    Debug("Server_receive - received (%d bytes): %.*s", bytesReceived, bytesReceived, client->buffer.start);
+    Debug("Server_receive - received (%d bytes): %.*s", bytesReceived, bytesReceived, space);
 
     // The remote client closed the connection
     if (bytesReceived == 0) {
@@ -625,27 +1356,33 @@ int Server_receive(Client *client) {
 
     // There has been an error somewhere
     if (bytesReceived < 0 ) {
-      // The socket is non-blocking
-      if (EAGAIN == SOCKET_getErrorNumber() || EWOULDBLOCK == SOCKET_getErrorNumber()) {
-        continue;
-      } else {
-        return 0;
+      // The socket is non-blocking and there is no more data to read
+      int sslError = SSL_get_error(client->ssl, bytesReceived);
+      if (sslError == SSL_ERROR_WANT_READ || sslError == SSL_ERROR_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
       }
+      return 0;
     }
 
     // Got data
     if (bytesReceived > 0 ) {
+      MessageBuffer_commit(&(client->buffer), bytesReceived);
       return bytesReceived;
     }
   }
 }
 
 /**
- * Validates a username with a pre-defined regex
+ * Validates a username with a pre-defined regex or the equivalent
+ * state machine, depending on the server configuration
  * @param[in]  username
  * @param[out] success/failure
  */
 bool Client_nicknameIsValid(const char *username) {
+  if (server != NULL && server->nicknameValidator == kNicknameValidatorFast) {
+    return Validate_nickname(username);
+  }
   char error[512] = {};
   int valid = Regex_match(username, kRegexNicknamePattern, error, sizeof(error));
   if (valid) return true;
@@ -657,6 +1394,61 @@ bool Client_nicknameIsValid(const char *username) {
   return false;
 }
 
+/**
+ * Validates the nickname sent by a client and assigns it
+ * to the client if no other user has already taken it
+ * @param[in] client Client object to authenticate
+ * @param[in] nick   The requested nickname
+ * @param[out] Success or failure
+ */
+bool Server_setNickname(Client *client, const char *nick) {
+  // User name validation
+  if (!Client_nicknameIsValid(nick)) {
+    Server_sendMessage(client, kMessageTypeErr, kErrorMessageInvalidUsername);
+    return false;
+  }
+
+  // The nickname is reserved only if no other client is logged with it,
+  // the lookup and the update are atomic
+  pthread_mutex_lock(&clientsLock);
+  if (!Registry_setNickname(clients, client->id, nick)) {
+    pthread_mutex_unlock(&clientsLock);
+    Info("Client with nick '%s' is already logged in", nick);
+    return false;
+  }
+  int res = snprintf(client->nickname, kMaxNicknameSize, "%s", nick);
+  // Clients with a nickname are always listed
+  bool listed = (res >= 0) && Roster_add(roster, client, nick, &(client->rosterSlot));
+  if (!listed) {
+    // An unlisted client is not authenticated and can't be reached by nickname
+    Registry_unsetNickname(clients, client->id);
+    client->nickname[0] = '\0';
+  }
+  pthread_mutex_unlock(&clientsLock);
+  if (res < 0) {
+    Error("Authentication: unable to read client nickname");
+    return false;
+  }
+  if (!listed) {
+    Error("Authentication: unable to add the client to the roster");
+    return false;
+  }
+
+  // From now on the client receives the lobby messages,
+  // after the greeting and the recent ones
+  char greeting[kBufferSize] = "";
+  snprintf(greeting, sizeof(greeting), "Hello %s!", client->nickname);
+  if (!Server_enterRoom(client, kLobbyRoomName, greeting)) {
+    Error("Authentication: unable to join the lobby");
+    return false;
+  }
+  Info(
+    "User %s (%d bytes) authenticated successfully!",
+    client->nickname, strlen(client->nickname)
+  );
+  return true;
+}
+
 /**
  * Authenticates a client connection
  * Currently it only ensures that another client is not already connected
@@ -700,6 +1492,7 @@ bool Server_authenticate(Client *client) {
     // Timeout expired
     if (rc == 0) {
       Server_sendMessage(client, kMessageTypeErr, "Authentication timeout expired!");
+      Stats_add(kStatTimeouts, 1);
       break;
     }
 
@@ -707,51 +1500,21 @@ bool Server_authenticate(Client *client) {
     if (FD_ISSET(client->socket, &reads)) {
       int received = Server_receive(client);
       if (received > 0) {
-        C2HMessage *message = C2HMessage_get(&(client->buffer));
-        if (!message) break;
-
-        if (kMessageTypeNick == message->type) {
-          char *nick = message->content;
-
-          // User name validation
-          if (!Client_nicknameIsValid(nick)) {
-            Server_sendMessage(client, kMessageTypeErr, kErrorMessageInvalidUsername);
-            C2HMessage_free(&message);
-            break;
-          }
-
-          Client *clientInfo = NULL;
-          // Lookup if a client is already logged with the provided nickname
-          clientInfo = Server_getClientInfoForNickname(nick);
-          if (clientInfo == NULL) {
-            // The user's nickname is unique
-            // Lookup client by thread
-            clientInfo = Server_getClientInfoForThread(pthread_self());
-            if (clientInfo != NULL && clientInfo == client) {
-              // Update client entry
-              int res = snprintf(clientInfo->nickname, kMaxNicknameSize, "%s", nick);
-              if (res < 0) {
-                Error("Authentication: unable to read client nickname");
-                C2HMessage_free(&message);
-                return false;
-              }
-              Info(
-                "User %s (%d bytes) authenticated successfully!",
-                clientInfo->nickname, strlen(clientInfo->nickname)
-              );
-              C2HMessage_free(&message);
-              return true;
-            }
+        // Partial messages are completed by the next reads
+        C2HMessageView message = {};
+        while (C2HMessage_next(&(client->buffer), &message)) {
+          if (kMessageTypeNick != message.type) continue;
+
+          // Lookup client by connection
+          Client *clientInfo = Server_getClientInfoForID(client->id);
+          if (clientInfo == NULL || clientInfo != client) {
             Error(
               "Authentication: client info not found for client %lu",
               pthread_self()
             );
-            C2HMessage_free(&message);
             return false;
           }
-          Info("Client with nick '%s' is already logged in", nick);
-          C2HMessage_free(&message);
-          return false;
+          return Server_setNickname(client, message.content);
         }
       }
       if (received == 0) {
@@ -792,6 +1555,10 @@ void* Server_handleClient(void* data) {
 
   Info("Starting new client thread %lu", client->threadID);
 
+  if (!Server_completeHandshake(client)) {
+    Server_dropClient(client);
+  }
+
   // Send a welcome message
   if (!Server_sendMessage(client, kMessageTypeOk, "Welcome to C2hat!")) {
     Server_dropClient(client);
@@ -804,59 +1571,85 @@ void* Server_handleClient(void* data) {
     Server_dropClient(client);
   }
 
-  // Say Hello to the new user
-  if (!Server_sendMessage(client, kMessageTypeOk, "Hello %s!", client->nickname)) {
-    Server_dropClient(client);
-  }
-
   // Broadcast that a new client has joined
   Server_broadcastMessage(
-    kMessageTypeLog,
+    client->room, kMessageTypeLog,
     "[%s] just joined the chat", client->nickname
   );
 
-  fd_set reads;
-  fd_set errors;
-  FD_ZERO(&reads);
-  FD_ZERO(&errors);
-  FD_SET(client->socket, &reads);
-  FD_SET(client->socket, &errors);
-  SOCKET maxSocket = client->socket;
-  struct timeval timeout;
-  timeout.tv_sec  = kChatTimeout;
-  timeout.tv_usec = 0;
-
   // Start the chat
+  time_t deadline = time(NULL) + kChatTimeout;
   while(!terminate) {
-    int rc = select(maxSocket + 1, &reads, 0, &errors, &timeout);
+    int timeout = (int)(deadline - time(NULL)) * 1000;
+    if (timeout <= 0) {
+      Server_sendMessage(
+        client,
+        kMessageTypeErr,
+        "Connection timed out, you've been disconnected!"
+      );
+      Stats_add(kStatTimeouts, 1);
+      break;
+    }
+
+    // Wait for incoming data, for queued broadcast messages
+    // or, if the outbox is not empty, for the socket to be writable
+    struct pollfd items[] = {
+      {
+        .fd = client->socket,
+        .events = POLLIN | (Outbox_pending(client->outbox) ? POLLOUT : 0)
+      },
+      { .fd = client->notify[0], .events = POLLIN }
+    };
+    // Records already decrypted by OpenSSL don't make the socket readable,
+    // a large frame may need more than one read of the same record
+    bool buffered = SSL_pending(client->ssl) > 0;
+    // Wake up at least once per second to check the termination flag
+    int rc = poll(items, 2, buffered ? 0 : (timeout < 1000) ? timeout : 1000);
     if (rc < 0) {
       if (EINTR == SOCKET_getErrorNumber()) {
         Info("%s", strerror(SOCKET_getErrorNumber()));
       } else {
         Error(
-          "select() failed (%d): %s",
+          "poll() failed (%d): %s",
           SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
         );
       }
       continue;
     }
+    if (rc == 0 && !buffered) continue;
+    if (buffered) items[0].revents |= POLLIN;
 
-    // Timeout expired
-    if (rc == 0) {
-      Server_sendMessage(
-        client,
-        kMessageTypeErr,
-        "Connection timed out, you've been disconnected!"
+    // New messages in the outbox
+    if (items[1].revents & POLLIN) {
+      char signal[64];
+      while (read(client->notify[0], signal, sizeof(signal)) > 0) {}
+    }
+    if (Outbox_overflow(client->outbox)) {
+      Info("Client %lu is too slow, disconnecting", client->threadID);
+      break;
+    }
+    if (Outbox_pending(client->outbox)
+      && Server_flushOutbox(client) == kOutboxError) {
+      Error("Unable to write to client %lu", client->threadID);
+      break;
+    }
+
+    // Client socket has an error
+    if (items[0].revents & (POLLERR | POLLNVAL)) {
+      Error(
+        "Client socket failed (%d): %s",
+        SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
       );
       break;
     }
 
     // Main socket is ready to read
-    if (FD_ISSET(client->socket, &reads)) {
+    if (items[0].revents & (POLLIN | POLLHUP)) {
 
       // Listen for data
       int received = Server_receive(client);
       if (received < 0) {
+        if (EAGAIN == SOCKET_getErrorNumber()) continue; // Incomplete record
         if (SOCKET_getErrorNumber() == 0) {
           Info("Connection closed by remote client (1) %d", ECONNRESET);
         } else {
@@ -873,49 +1666,14 @@ void* Server_handleClient(void* data) {
         break;
       }
 
-      if (received > 0) {
-        bool quit = false;
-        C2HMessage *message = NULL;
-        // Retrieve all messages available from the client's buffer
-        do {
-          message = C2HMessage_get(&(client->buffer));
-          if (!message) break;
-
-          if (message->type == kMessageTypeQuit) {
-            C2HMessage_free(&message);
-            quit = true;
-          } else {
-            switch (message->type) {
-              case kMessageTypeMsg:
-                if (strlen(message->content) > 0) {
-
-                  // Send /ok to the client to acknowledge the correct message
-                  if (!Server_sendMessage(client, kMessageTypeOk, "")) break;
-
-                  // Broadcast the message to all clients using the format
-                  // '/msg [<20charUsername>]: ...'
-                  Server_broadcastMessage(
-                    kMessageTypeMsg,
-                    "[%s] %s", client->nickname, message->content
-                  );
-                  C2HMessage_free(&message);
-                }
-              break;
-              default:
-                ; // Ignore for now...
-            }
-          }
-        } while(message != NULL && !quit);
-        if (quit) break; // Stop listening
+      deadline = time(NULL) + kChatTimeout;
+      bool quit = false;
+      C2HMessageView message = {};
+      // Process all messages available in the client's buffer, in place
+      while (!quit && C2HMessage_next(&(client->buffer), &message)) {
+        quit = !Server_handleMessage(client, &message);
       }
-    }
-
-    // Client socket has an error
-    if (FD_ISSET(client->socket, &errors)) {
-      Error(
-        "Client socket failed (%d): %s",
-        SOCKET_getErrorNumber(), strerror(SOCKET_getErrorNumber())
-      );
+      if (quit) break; // Stop listening
     }
 
     if (!SOCKET_isValid(client->socket)) break;
@@ -923,66 +1681,965 @@ void* Server_handleClient(void* data) {
 
   // Broadcast that client has left
   Server_broadcastMessage(
-    kMessageTypeLog,
+    client->room, kMessageTypeLog,
     "[%s] just left the chat", client->nickname
   );
 
   // Close the connection
   Server_dropClient(client);
-  FD_CLR(client->socket, &reads);
-  FD_CLR(client->socket, &errors);
 
   return NULL;
 }
 
+#if defined(__linux__)
+/**
+ * Closes an event driven client connection and removes the client
+ * from the list of connected clients
+ * @param[in] reactor The event loop that owns the client
+ * @param[in] client  The client to disconnect
+ */
+static void Server_closeClient(Reactor *reactor, Client *client) {
+  if (client->state == kClientStateChat) {
+    // Broadcast that client has left
+    Server_broadcastMessage(
+      client->room, kMessageTypeLog,
+      "[%s] just left the chat", client->nickname
+    );
+  }
+  epoll_ctl(reactor->loop, EPOLL_CTL_DEL, client->socket, NULL);
+  TimerWheel_cancel(reactor->timers, &(client->timer));
+  if (SSL_is_init_finished(client->ssl)) {
+    // Last chance to deliver pending messages (e.g. timeout errors)
+    Outbox_flush(client->outbox, client->ssl);
+    SSL_shutdown(client->ssl);
+  }
+  SOCKET_close(client->socket);
+  SSL_free(client->ssl);
+  if (Outbox_dropped(client->outbox) > 0) {
+    Info("%zu messages dropped for %s", Outbox_dropped(client->outbox), client->nickname);
+  }
+  MessageBuffer_clear(&(client->buffer));
+  Outbox_free(&(client->outbox));
+
+  // Remove the client from the reactor shard, its room and the global registry
+  Registry_remove(reactor->clients, client->id);
+  pthread_mutex_lock(&clientsLock);
+  Server_unlist(client);
+  Server_exitRoom(client);
+  if (Registry_remove(clients, client->id) == NULL) {
+    Warn("Unable to drop client with socket %d", client->socket);
+  }
+  pthread_mutex_unlock(&clientsLock);
+  Info("[R%u] Closed client connection %d", reactor->id, client->socket);
+  free(client);
+}
+
+/**
+ * Accepts a new connection and registers it with the event loop,
+ * the TLS handshake is driven later by the socket readiness events
+ * @param[in] this    The server object
+ * @param[in] reactor The event loop that will own the client
+ */
+static void Server_acceptEventClient(Server *this, Reactor *reactor) {
+  // The client object keeps the same address until it's disconnected
+  Client *client = calloc(1, sizeof(Client));
+  if (client == NULL) {
+    Error("Unable to allocate a new client");
+    return;
+  }
+  if (!Server_acceptConnection(this, reactor->socket, client)) {
+    free(client);
+    return;
+  }
+
+  client->outbox = Outbox_new(this->outboxSize, this->outboxPolicy);
+  if (client->outbox == NULL) {
+    Error("Unable to initialise the client outbox");
+    Server_dropClient(client);
+    return;
+  }
+  client->state = kClientStateHandshake;
+  client->reactor = reactor;
+  client->timer.item = client;
+
+  // Register the client globally and within the reactor shard
+  pthread_mutex_lock(&clientsLock);
+  bool registered = Registry_add(clients, client, client->id, client->socket);
+  pthread_mutex_unlock(&clientsLock);
+  if (!registered || !Registry_add(reactor->clients, client, client->id, client->socket)) {
+    Error("Unable to register client %d", client->socket);
+    Server_dropClient(client);
+    return;
+  }
+
+  struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = client };
+  if (epoll_ctl(reactor->loop, EPOLL_CTL_ADD, client->socket, &event) < 0) {
+    Error("epoll_ctl() failed (%d): %s", errno, strerror(errno));
+    Server_closeClient(reactor, client);
+    return;
+  }
+  TimerWheel_schedule(reactor->timers, &(client->timer), kHandshakeTimeout);
+  Info("[R%u] Accepted client connection %d", reactor->id, client->socket);
+}
+
+/**
+ * Resumes the TLS handshake of a client when its socket is ready.
+ * Once the session is established, the client is asked for a nickname.
+ * @param[in] reactor The event loop that owns the client
+ * @param[in] client  The client in handshake state
+ * @param[out] false if the connection needs to be closed
+ */
+static bool Server_handshakeEventClient(Reactor *reactor, Client *client) {
+  HandshakeStatus status = Server_continueHandshake(client);
+  if (status == kHandshakeFailed) return false;
+
+  // Wait for the socket direction that OpenSSL needs
+  uint32_t events = (status == kHandshakeWantWrite) ? EPOLLOUT : EPOLLIN;
+  struct epoll_event event = { .events = events | EPOLLRDHUP, .data.ptr = client };
+  if (epoll_ctl(reactor->loop, EPOLL_CTL_MOD, client->socket, &event) < 0) {
+    Error("epoll_ctl() failed (%d): %s", errno, strerror(errno));
+    return false;
+  }
+  client->watchWrite = false;
+  if (status != kHandshakeDone) return true;
+
+  pthread_mutex_lock(&clientsLock);
+  size_t connected = Registry_length(clients);
+  pthread_mutex_unlock(&clientsLock);
+  if (connected > (size_t)server->maxConnections) {
+    Server_sendMessage(client, kMessageTypeErr, "connection limits reached");
+    Info("Connection limits reached");
+    return false;
+  }
+
+  // Send a welcome message and ask for a nickname
+  if (!Server_sendMessage(client, kMessageTypeOk, "Welcome to C2hat!")
+    || !Server_sendMessage(client, kMessageTypeNick, "Please enter a nickname:")) {
+    return false;
+  }
+  client->state = kClientStateAuth;
+  TimerWheel_schedule(reactor->timers, &(client->timer), kAuthenticationTimeout);
+  return true;
+}
+
+/**
+ * Processes a message received from a client, depending on the
+ * state of the connection
+ * @param[in] client  The sender
+ * @param[in] message The received message
+ * @param[out] false if the connection needs to be closed
+ */
+static bool Server_handleEventMessage(Client *client, const C2HMessageView *message) {
+  if (client->state == kClientStateChat) {
+    // Any inbound message resets the inactivity timeout
+    TimerWheel_schedule(client->reactor->timers, &(client->timer), kChatTimeout);
+    return Server_handleMessage(client, message);
+  }
+
+  // Only /nick and /quit are allowed before authentication
+  if (message->type == kMessageTypeQuit) return false;
+  if (message->type != kMessageTypeNick) return true;
+
+  if (!Server_setNickname(client, message->content)) {
+    Info("Authentication failed for client %d", client->socket);
+    Server_sendMessage(client, kMessageTypeErr, "Authentication failed");
+    return false;
+  }
+  client->state = kClientStateChat;
+  TimerWheel_schedule(client->reactor->timers, &(client->timer), kChatTimeout);
+
+  // Broadcast that a new client has joined
+  Server_broadcastMessage(
+    client->room, kMessageTypeLog,
+    "[%s] just joined the chat", client->nickname
+  );
+  return true;
+}
+
+/**
+ * Reads all the available data from a client's socket
+ * and processes the received messages
+ * @param[in] client The client ready to be read
+ * @param[out] false if the connection needs to be closed
+ */
+static bool Server_readEventClient(Client *client) {
+  while (true) {
+    int received = Server_receive(client);
+    if (received < 0 && EAGAIN == SOCKET_getErrorNumber()) {
+      return true; // No more data for now
+    }
+    if (received <= 0) {
+      Info("Connection closed by remote client %d", client->socket);
+      return false;
+    }
+    C2HMessageView message = {};
+    while (C2HMessage_next(&(client->buffer), &message)) {
+      if (!Server_handleEventMessage(client, &message)) return false;
+    }
+  }
+}
+
+/**
+ * Disconnects a client that didn't complete the handshake,
+ * didn't authenticate or didn't send data within its time limit
+ * @param[in] timer   The expired timer of the client
+ * @param[in] context The event loop that owns the client
+ */
+static void Server_expireEventClient(Timer *timer, void *context) {
+  Reactor *reactor = (Reactor *)context;
+  Client *client = (Client *)timer->item;
+  if (client->state == kClientStateHandshake) {
+    Info("TLS handshake timeout expired for %s", client->host);
+  } else if (client->state == kClientStateAuth) {
+    Server_sendMessage(client, kMessageTypeErr, "Authentication timeout expired!");
+    Server_sendMessage(client, kMessageTypeErr, "Authentication failed");
+  } else {
+    Server_sendMessage(
+      client,
+      kMessageTypeErr,
+      "Connection timed out, you've been disconnected!"
+    );
+  }
+  Server_closeClient(reactor, client);
+}
+
+/**
+ * Returns the current tick of the reactor timer wheels,
+ * from a clock that is not affected by system time changes
+ */
+static uint64_t Server_currentTick() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec;
+}
+
+/**
+ * Disconnects the clients whose timeouts have expired
+ * and updates the timeout counters
+ * @param[in] reactor The event loop that owns the clients
+ */
+static void Server_expireEventClients(Reactor *reactor) {
+  size_t expired = TimerWheel_advance(
+    reactor->timers, Server_currentTick(), Server_expireEventClient, reactor
+  );
+  if (expired > 0) {
+    Stats_add(kStatTimeouts, expired);
+    Stats_max(kStatTimeoutPeak, TimerWheel_peak(reactor->timers));
+  }
+}
+
+/**
+ * Delivers a batch of frames to the members of a room
+ * that belong to the reactor shard
+ * @param[in] room    The recipients
+ * @param[in] frames  The frames to deliver
+ * @param[in] count   The number of frames
+ * @param[in] context The event loop that owns the clients
+ */
+static void Server_deliverToShard(Room *room, Frame **frames, size_t count, void *context) {
+  Reactor *reactor = (Reactor *)context;
+  MemberSet *members = &(room->shards[reactor->id]);
+
+  // Each client gets the whole batch with as few writes as possible.
+  // Closed clients are replaced by the last member of the shard,
+  // so walking backwards visits every member once.
+  for (size_t i = members->length; i-- > 0;) {
+    Client *client = (Client *)members->items[i];
+    bool keep = Server_queueFrames(client, frames, count);
+    if (!keep) Info("Outbox full for client %d, disconnecting", client->socket);
+    if (!keep || !Server_flush(client)) Server_closeClient(reactor, client);
+  }
+}
+
+/**
+ * Delivers the messages in the reactor mailbox to the
+ * room members of the reactor shard
+ * @param[in] reactor The event loop that owns the clients
+ */
+static void Server_deliverEventBroadcast(Reactor *reactor) {
+  // Reset the eventfd counter
+  eventfd_t wakeups = 0;
+  eventfd_read(reactor->wakeup, &wakeups);
+
+  size_t count = 0;
+  Broadcast *broadcasts = Server_collectBroadcasts(CQueue_popAll(reactor->mailbox), &count);
+  if (broadcasts == NULL) return;
+
+  // Direct messages go to a single client, if it's still connected,
+  // consecutive frames for the same client (e.g. a history page) are flushed once
+  for (size_t i = 0; i < count; i++) {
+    if (broadcasts[i].room != NULL) continue;
+    Client *client = (Client *)Registry_get(reactor->clients, broadcasts[i].recipient);
+    if (client == NULL || client->state != kClientStateChat) continue;
+    if (!Server_queueFrames(client, &(broadcasts[i].frame), 1)) {
+      Info("Outbox full for client %d, disconnecting", client->socket);
+      Server_closeClient(reactor, client);
+      continue;
+    }
+    bool last = (i + 1 == count) || broadcasts[i + 1].room != NULL
+      || broadcasts[i + 1].recipient != broadcasts[i].recipient;
+    if (last && !Server_flush(client)) Server_closeClient(reactor, client);
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (broadcasts[i].sequence > reactor->delivered) reactor->delivered = broadcasts[i].sequence;
+  }
+  Server_deliverBroadcasts(broadcasts, count, Server_deliverToShard, reactor);
+}
+
+/**
+ * Posts a batch of broadcast messages to the mailbox of every reactor,
+ * each reactor is woken up once per batch
+ * @param[in] broadcasts The messages to deliver, the array is freed
+ * @param[in] count      The number of messages
+ */
+static void Server_postToReactors(Broadcast *broadcasts, size_t count) {
+  for (size_t j = 0; j < count; j++) {
+    Broadcast *broadcast = &(broadcasts[j]);
+    for (unsigned int i = 0; i < server->workers; i++) {
+      // Each mailbox holds its own references
+      Broadcast shared = *broadcast;
+      Frame_retain(shared.frame);
+      Room_retain(shared.room);
+      if (!CQueue_push(server->reactors[i].mailbox, &shared, sizeof(Broadcast))) {
+        Frame_release(&(shared.frame));
+        Room_release(&(shared.room));
+      }
+    }
+    Frame_release(&(broadcast->frame));
+    Room_release(&(broadcast->room));
+  }
+  free(broadcasts);
+  for (unsigned int i = 0; i < server->workers; i++) {
+    eventfd_write(server->reactors[i].wakeup, 1);
+  }
+}
+
+/**
+ * Initialises a reactor with its own epoll instance and mailbox
+ * @param[in] reactor  The reactor to initialise
+ * @param[in] id       The reactor index
+ * @param[in] listener The listening socket for the reactor
+ */
+static void Reactor_init(Reactor *reactor, unsigned int id, SOCKET listener) {
+  reactor->id = id;
+  reactor->socket = listener;
+  reactor->loop = epoll_create1(0);
+  if (reactor->loop < 0) {
+    Fatal("epoll_create1() failed (%d): %s", errno, strerror(errno));
+  }
+  reactor->wakeup = eventfd(0, EFD_NONBLOCK);
+  if (reactor->wakeup < 0) {
+    Fatal("eventfd() failed (%d): %s", errno, strerror(errno));
+  }
+  reactor->mailbox = CQueue_new();
+  reactor->clients = Registry_new();
+  reactor->timers = TimerWheel_new(Server_currentTick());
+  if (reactor->mailbox == NULL || reactor->clients == NULL || reactor->timers == NULL) {
+    Fatal("Unable to initialise reactor %u", id);
+  }
+
+  // The addresses of the socket and wakeup fields are used
+  // to recognise their events from the client ones
+  struct epoll_event listenerEvent = { .events = EPOLLIN, .data.ptr = &(reactor->socket) };
+  struct epoll_event wakeupEvent = { .events = EPOLLIN, .data.ptr = &(reactor->wakeup) };
+  if (epoll_ctl(reactor->loop, EPOLL_CTL_ADD, reactor->socket, &listenerEvent) < 0
+    || epoll_ctl(reactor->loop, EPOLL_CTL_ADD, reactor->wakeup, &wakeupEvent) < 0) {
+    Fatal("epoll_ctl() failed (%d): %s", errno, strerror(errno));
+  }
+}
+
+/**
+ * Closes the remaining connections and frees the reactor resources
+ * @param[in] reactor The reactor to clean
+ */
+static void Reactor_clean(Reactor *reactor) {
+  RegistryEntry *entry = Registry_first(reactor->clients);
+  while (entry != NULL) {
+    RegistryEntry *next = entry->next;
+    Client *client = (Client *)entry->item;
+    client->state = kClientStateAuth; // don't broadcast anything
+    Server_closeClient(reactor, client);
+    entry = next;
+  }
+  Registry_free(&(reactor->clients));
+  TimerWheel_free(&(reactor->timers));
+  Server_releaseBroadcasts(reactor->mailbox);
+  CQueue_free(&(reactor->mailbox));
+  close(reactor->wakeup);
+  close(reactor->loop);
+  // The first listening socket is owned by the server
+  if (reactor->socket != server->socket) SOCKET_close(reactor->socket);
+}
+
+/**
+ * Runs a single event loop that owns a shard of the client connections
+ * @param[in] data Pointer to the Reactor to run
+ */
+static void *Server_runReactor(void *data) {
+  Reactor *reactor = (Reactor *)data;
+  Info("[R%u] Starting event loop %lu", reactor->id, pthread_self());
+
+  struct epoll_event events[kMaxEvents];
+  while (!terminate) {
+    // Wake up at least once per second to check the timeouts
+    int ready = epoll_wait(reactor->loop, events, kMaxEvents, 1000);
+    if (ready < 0) {
+      if (EINTR == errno) {
+        Info("%s", strerror(errno));
+      } else {
+        Error("epoll_wait() failed (%d): %s", errno, strerror(errno));
+      }
+      continue;
+    }
+
+    bool haveMail = false;
+    for (int i = 0; i < ready; i++) {
+      if (events[i].data.ptr == &(reactor->socket)) {
+        // Main socket is ready to accept
+        Server_acceptEventClient(server, reactor);
+        continue;
+      }
+      if (events[i].data.ptr == &(reactor->wakeup)) {
+        haveMail = true;
+        continue;
+      }
+      Client *client = (Client *)events[i].data.ptr;
+      bool keep = !(events[i].events & (EPOLLERR | EPOLLHUP));
+      bool handshake = (client->state == kClientStateHandshake);
+      if (keep && handshake) {
+        keep = Server_handshakeEventClient(reactor, client);
+      } else if (keep && (events[i].events & EPOLLOUT)) {
+        // Resume writing the outbox
+        keep = Server_flush(client);
+      }
+      // Records may already be buffered when the handshake completes
+      if (keep && client->state != kClientStateHandshake
+        && (handshake || (events[i].events & (EPOLLIN | EPOLLRDHUP)))) {
+        keep = Server_readEventClient(client);
+      }
+      // epoll reports each socket once, so the client can be safely deleted
+      if (!keep) Server_closeClient(reactor, client);
+    }
+
+    // Only the timeouts due since the last tick are processed
+    Server_expireEventClients(reactor);
+    if (haveMail) Server_deliverEventBroadcast(reactor);
+  }
+  Info("[R%u] Closing event loop %lu", reactor->id, pthread_self());
+  return NULL;
+}
+
+/**
+ * Runs the server with a pool of event loops (reactors), each owning
+ * a shard of the client connections. The kernel balances new
+ * connections between the reactors' listening sockets.
+ * @param[in] this The server object
+ */
+void Server_runEventLoop(Server *this) {
+  this->reactors = calloc(this->workers, sizeof(Reactor));
+  if (this->reactors == NULL) {
+    Fatal("Unable to initialise the reactors");
+  }
+  for (unsigned int i = 0; i < this->workers; i++) {
+    SOCKET listener = (i == 0) ? this->socket : Server_listen(this);
+    Reactor_init(&(this->reactors[i]), i, listener);
+  }
+
+  // Create a thread for broadcast messages
+  pthread_t broadcastThreadID = 0;
+  pthread_create(&broadcastThreadID, NULL, Server_handleBroadcast, NULL);
+
+  // Create a thread that reads the archive for /history,
+  // the pages are delivered through the reactor mailboxes
+  pthread_t historyThreadID = 0;
+  if (historyRequests != NULL) {
+    pthread_create(&historyThreadID, NULL, Server_handleHistory, NULL);
+  }
+
+  // The first reactor runs on the main thread
+  for (unsigned int i = 1; i < this->workers; i++) {
+    pthread_create(&(this->reactors[i].threadID), NULL, Server_runReactor, &(this->reactors[i]));
+  }
+  Server_runReactor(&(this->reactors[0]));
+
+  Info("Terminating...");
+  for (unsigned int i = 1; i < this->workers; i++) {
+    pthread_join(this->reactors[i].threadID, NULL);
+  }
+
+  // Close broadcast and history threads before the mailboxes
+  pthread_join(broadcastThreadID, NULL);
+  if (historyRequests != NULL) pthread_join(historyThreadID, NULL);
+
+  for (unsigned int i = 0; i < this->workers; i++) {
+    Reactor_clean(&(this->reactors[i]));
+  }
+  free(this->reactors);
+  this->reactors = NULL;
+}
+#endif
+
+/**
+ * Accounts for a message received from a client and rejects it
+ * if the client exceeded its rate limit
+ * @param[in] client The sender
+ * @param[in] length The size of the message content
+ * @param[out] false if the message must be discarded
+ */
+static bool Server_throttle(Client *client, size_t length) {
+  if (RateLimit_allow(&(client->limit), length, Server_currentMillis())) return true;
+  Stats_add(kStatRateLimited, 1);
+  Server_sendMessage(client, kMessageTypeErr, "You are sending messages too fast, slow down!");
+  return false;
+}
+
+/**
+ * Moves a client to another room, the members of both
+ * rooms are told that the client has moved
+ * @param[in] client The authenticated client
+ * @param[in] name   The name of the room to join
+ */
+static void Server_changeRoom(Client *client, const char *name) {
+  if (!Room_nameIsValid(name)) {
+    Server_sendMessage(client, kMessageTypeErr, kErrorMessageInvalidRoom);
+    return;
+  }
+  if (strcmp(client->room->name, name) == 0) {
+    Server_sendMessage(client, kMessageTypeErr, "You are already in %s", name);
+    return;
+  }
+
+  // The previous room may be closed by the move, the reference keeps it valid
+  Room *previous = Room_retain(client->room);
+  char greeting[kBufferSize] = "";
+  snprintf(greeting, sizeof(greeting), "You are now in %s", name);
+  if (!Server_enterRoom(client, name, greeting)) {
+    Room_release(&previous);
+    Server_sendMessage(client, kMessageTypeErr, "Unable to join %s", name);
+    return;
+  }
+  Server_broadcastMessage(previous, kMessageTypeLog, "[%s] left the room", client->nickname);
+  Room_release(&previous);
+
+  Server_broadcastMessage(
+    client->room, kMessageTypeLog,
+    "[%s] joined the room", client->nickname
+  );
+}
+
+/**
+ * Sends a message to a single client, found with the nickname index.
+ * The frame skips the broadcast queue: threaded clients get it in
+ * their outbox right away, event driven clients through the mailbox
+ * of their own event loop, which is the only one that can write to them.
+ * @param[in] sender   The authenticated sender
+ * @param[in] nickname The nickname of the recipient
+ * @param[in] text     The message content
+ * @param[in] length   The length of the content
+ * @param[out] false if the recipient is not connected or the message can't be sent
+ */
+static bool Server_sendDirect(Client *sender, const char *nickname, const char *text, size_t length) {
+  C2HMessage *relay = C2HMessage_new(kMessageTypeDirect, sender->nickname, text, length);
+  Frame *frame = (relay != NULL) ? Frame_new(relay, server->compressionThreshold) : NULL;
+  C2HMessage_free(&relay);
+  if (frame == NULL) {
+    Error("Unable to encode message");
+    return false;
+  }
+
+  // The recipient can't be destroyed while the lock is held
+  pthread_mutex_lock(&clientsLock);
+  Client *recipient = (Client *)Registry_getByNickname(clients, nickname);
+  bool sent = (recipient != NULL);
+  if (sent && recipient->reactor != NULL) {
+#if defined(__linux__)
+    Broadcast direct = { .frame = Frame_retain(frame), .recipient = recipient->id };
+    sent = CQueue_push(recipient->reactor->mailbox, &direct, sizeof(Broadcast));
+    if (sent) {
+      eventfd_write(recipient->reactor->wakeup, 1);
+    } else {
+      Frame_release(&(direct.frame));
+    }
+#endif
+  } else if (sent) {
+    // Overflowing clients are disconnected by their own thread
+    sent = Outbox_push(recipient->outbox, frame);
+    if (sent && write(recipient->notify[1], "", 1) < 0 && EAGAIN != errno) {
+      Warn("Unable to notify client %lu", recipient->threadID);
+    }
+  }
+  pthread_mutex_unlock(&clientsLock);
+  Frame_release(&frame);
+  if (sent) Stats_add(kStatDirectMessages, 1);
+  return sent;
+}
+
+/// A page of archived messages being read for a client
+typedef struct {
+  Frame **frames; ///< The header, the messages and the footer of the page
+  size_t count; ///< Number of frames
+} HistoryPage;
+
+/**
+ * Encodes a message read from the archive for the page, called
+ * by the archive for each message in order
+ * @param[in] record  The archive record
+ * @param[in] data    The binary encoding of the message
+ * @param[in] context The page
+ */
+static void Server_collectArchived(const ArchiveRecord *record, const char *data, void *context) {
+  HistoryPage *page = (HistoryPage *)context;
+  C2HMessage *message = C2HMessage_decode(data, record->length);
+  Frame *frame = (message != NULL) ? Frame_new(message, server->compressionThreshold) : NULL;
+  C2HMessage_free(&message);
+  if (frame != NULL) page->frames[page->count++] = frame;
+}
+
+/**
+ * Adds an /ok line to a page of archived messages
+ * @param[in] page   The page
+ * @param[in] format The content of the line
+ */
+static void Server_addHistoryLine(HistoryPage *page, const char *format, ...) {
+  char content[kBufferSize] = "";
+  va_list args;
+  va_start(args, format);
+  vsnprintf(content, sizeof(content), format, args);
+  va_end(args);
+  C2HMessage *message = C2HMessage_create(kMessageTypeOk, "%s", content);
+  Frame *frame = (message != NULL) ? Frame_new(message, server->compressionThreshold) : NULL;
+  C2HMessage_free(&message);
+  if (frame != NULL) page->frames[page->count++] = frame;
+}
+
+/// A /history request, served by the history thread
+typedef struct {
+  ConnectionID client; ///< The requesting client
+  Reactor *reactor; ///< Event loop that owns the client, NULL in threaded mode
+  char room[kMaxRoomNameSize]; ///< Room of the client when the request was made
+  uint64_t cursor; ///< Only messages before it are sent, 0 = the latest
+  size_t count; ///< Max number of messages in the page
+} HistoryRequest;
+
+/**
+ * Queues a request for a page of the archived messages of the client's
+ * room. The page is read by the history thread, so the client's event
+ * loop or thread never waits for the disk.
+ * @param[in] client    The authenticated client
+ * @param[in] arguments The cursor, only messages before it are sent (0 = the latest),
+ *                      and the number of messages, both optional
+ */
+static void Server_sendHistory(Client *client, const char *arguments) {
+  if (historyRequests == NULL) {
+    Server_sendMessage(client, kMessageTypeErr, "The message archive is disabled");
+    return;
+  }
+  unsigned long long cursor = 0;
+  unsigned long count = kHistoryPageSize;
+  if (arguments[strspn(arguments, "0123456789 ")] != '\0'
+    || (*arguments != '\0' && sscanf(arguments, "%llu %lu", &cursor, &count) < 1) || count == 0) {
+    Server_sendMessage(client, kMessageTypeErr, "Usage: /history [cursor] [count]");
+    return;
+  }
+  // The whole page must fit in the outbox, with its header and footer
+  size_t max = (server->outboxSize > 2) ? server->outboxSize - 2 : 1;
+  if (max > kHistoryMaxPageSize) max = kHistoryMaxPageSize;
+  if (count > max) count = max;
+
+  HistoryRequest request = {
+    .client = client->id, .reactor = client->reactor, .cursor = cursor, .count = count
+  };
+  snprintf(request.room, sizeof(request.room), "%s", client->room->name);
+  if (!CQueue_push(historyRequests, &request, sizeof(HistoryRequest))) {
+    Server_sendMessage(client, kMessageTypeErr, "Unable to read the message archive");
+  }
+}
+
+/**
+ * Delivers a page of archived messages to the client that requested it,
+ * if it's still connected. Like direct messages, event driven clients
+ * get the page through the mailbox of their own event loop, threaded
+ * clients in their outbox right away.
+ * @param[in] request The request
+ * @param[in] frames  The frames of the page, in order
+ * @param[in] count   The number of frames
+ */
+static void Server_deliverHistory(const HistoryRequest *request, Frame **frames, size_t count) {
+#if defined(__linux__)
+  if (request->reactor != NULL) {
+    for (size_t i = 0; i < count; i++) {
+      Broadcast direct = { .frame = Frame_retain(frames[i]), .recipient = request->client };
+      if (!CQueue_push(request->reactor->mailbox, &direct, sizeof(Broadcast))) {
+        Frame_release(&(direct.frame));
+        Error("Unable to deliver the archive to client %" PRIu64, request->client);
+        break;
+      }
+    }
+    eventfd_write(request->reactor->wakeup, 1);
+    return;
+  }
+#endif
+  // The recipient can't be destroyed while the lock is held
+  pthread_mutex_lock(&clientsLock);
+  Client *client = (Client *)Registry_get(clients, request->client);
+  if (client != NULL) {
+    // Overflowing clients are disconnected by their own thread
+    if (!Server_queueFrames(client, frames, count)) {
+      Info("Outbox full for client %d while sending the archive", client->socket);
+    }
+    if (write(client->notify[1], "", 1) < 0 && EAGAIN != errno) {
+      Warn("Unable to notify client %lu", client->threadID);
+    }
+  }
+  pthread_mutex_unlock(&clientsLock);
+}
+
+/**
+ * Reads a page of archived messages, oldest first, between two /ok
+ * lines. The last line tells the command that gets the previous page.
+ * The archive finds the page by binary search, and the whole page
+ * is delivered at once.
+ * @param[in] request The request to serve
+ */
+static void Server_readHistory(const HistoryRequest *request) {
+  HistoryPage page = { .frames = calloc(request->count + 2, sizeof(Frame *)) };
+  if (page.frames == NULL) {
+    Error("Unable to allocate the history page");
+    return;
+  }
+  Server_addHistoryLine(&page, "Archived messages of %s:", request->room);
+  size_t header = page.count;
+  uint64_t next = Archive_read(
+    archive, request->room, request->cursor, request->count, Server_collectArchived, &page
+  );
+  if (page.count == header) {
+    for (size_t i = 0; i < page.count; i++) Frame_release(&page.frames[i]);
+    page.count = 0;
+    Server_addHistoryLine(&page, "No archived messages in %s", request->room);
+  }
+  if (next > 0) {
+    Server_addHistoryLine(&page, "More with /history %" PRIu64 " %zu", next, request->count);
+  }
+
+  Server_deliverHistory(request, page.frames, page.count);
+  for (size_t i = 0; i < page.count; i++) Frame_release(&page.frames[i]);
+  free(page.frames);
+}
+
+/**
+ * Processes a message received from an authenticated client
+ * @param[in] client  The sender
+ * @param[in] message The received message
+ * @param[out] false if the client wants to quit, true otherwise
+ */
+bool Server_handleMessage(Client *client, const C2HMessageView *message) {
+  switch (message->type) {
+    case kMessageTypeQuit:
+      return false;
+    case kMessageTypeJoin:
+    case kMessageTypeLeave:
+      // Moves are announced to two rooms, so they count as messages
+      if (!Server_throttle(client, message->length)) break;
+      Server_changeRoom(
+        client, (message->type == kMessageTypeJoin) ? message->content : kLobbyRoomName
+      );
+    break;
+    case kMessageTypeDirect: {
+      if (!Server_throttle(client, message->length)) break;
+
+      // The content starts with the recipient nickname
+      size_t nicknameLength = strcspn(message->content, " ");
+      const char *text = message->content + nicknameLength;
+      text += strspn(text, " ");
+      size_t length = message->length - (size_t)(text - message->content);
+      if (nicknameLength == 0 || nicknameLength >= kMaxNicknameSize || length == 0) {
+        Server_sendMessage(client, kMessageTypeErr, "Usage: /dm <nickname> <message>");
+        break;
+      }
+      char nickname[kMaxNicknameSize] = "";
+      memcpy(nickname, message->content, nicknameLength);
+      if (!Server_sendDirect(client, nickname, text, length)) {
+        Server_sendMessage(client, kMessageTypeErr, "%s is not connected", nickname);
+        break;
+      }
+      Server_sendMessage(client, kMessageTypeOk, "Sent to %s", nickname);
+    }
+    break;
+    case kMessageTypeList: {
+      // Pages are numbered from 1, the cached page frame is shared
+      size_t page = (message->length > 0) ? strtoul(message->content, NULL, 10) : 1;
+      pthread_mutex_lock(&clientsLock);
+      size_t pages = Roster_pages(roster);
+      Frame *frame = (page > 0 && page <= pages) ? Roster_page(roster, page - 1) : NULL;
+      pthread_mutex_unlock(&clientsLock);
+      if (frame == NULL) {
+        Server_sendMessage(client, kMessageTypeErr, "Page not found, the list has %zu pages", pages);
+        break;
+      }
+      Server_sendFrame(client, frame);
+      Frame_release(&frame);
+    }
+    break;
+    case kMessageTypeHistory:
+      // Pages are read from disk, so they count as messages
+      if (!Server_throttle(client, message->length)) break;
+      Server_sendHistory(client, message->content);
+    break;
+    case kMessageTypeMsg:
+      if (message->length > 0) {
+
+        // Throttle the client before its message is amplified by the broadcast
+        if (!Server_throttle(client, message->length)) break;
+
+        // Send /ok to the client to acknowledge the correct message
+        if (!Server_sendMessage(client, kMessageTypeOk, "")) break;
+
+        // Broadcast the message to the sender's room, the content is not
+        // formatted so binary clients can receive it in full
+        C2HMessage *relay = C2HMessage_new(
+          kMessageTypeMsg, client->nickname, message->content, message->length
+        );
+        if (relay == NULL) {
+          Error("Unable to build message");
+          break;
+        }
+        Server_broadcast(relay, client->room);
+        C2HMessage_free(&relay);
+      }
+    break;
+    default:
+      ; // Ignore for now...
+  }
+  return true;
+}
+
+/**
+ * Copies the counters of the message and node pools to the server
+ * stats, called periodically by the broadcast thread
+ */
+static void Server_publishPoolStats() {
+  PoolCounters counters = {};
+  uint64_t locks = 0;
+  Pool *messagePool = C2HMessage_pool();
+  if (messagePool != NULL) {
+    Pool_getCounters(messagePool, &counters);
+    Stats_set(kStatMessageAllocations, counters.allocations);
+    Stats_set(kStatMessageCapacity, counters.capacity);
+    locks += counters.refills + counters.flushes;
+  }
+  uint64_t allocations = 0;
+  uint64_t capacity = 0;
+  Pool *nodePools[] = {Queue_pool(), List_pool()};
+  for (size_t i = 0; i < sizeof(nodePools) / sizeof(nodePools[0]); i++) {
+    if (nodePools[i] == NULL) continue;
+    Pool_getCounters(nodePools[i], &counters);
+    allocations += counters.allocations;
+    capacity += counters.capacity;
+    locks += counters.refills + counters.flushes;
+  }
+  Stats_set(kStatNodeAllocations, allocations);
+  Stats_set(kStatNodeCapacity, capacity);
+  Stats_set(kStatPoolLocks, locks);
+}
+
+/**
+ * Delivers a batch of frames to the published members of a room.
+ * Messages are written without blocking, whatever the socket can't
+ * take stays in the client's outbox and is written by the client thread.
+ * The members are not destroyed until the read-side section ends.
+ * @param[in] room    The recipients
+ * @param[in] frames  The frames to deliver
+ * @param[in] count   The number of frames
+ * @param[in] context Unused, set it to NULL
+ */
+static void Server_deliverToSubscribers(Room *room, Frame **frames, size_t count, void *context) {
+  (void)context;
+  unsigned int ticket = 0;
+  const Snapshot *snapshot = SnapshotCell_enter(room->subscribers, &ticket);
+  for (size_t i = 0; i < snapshot->length; i++) {
+    Client *client = (Client *)snapshot->items[i];
+
+    // Overflowing clients are disconnected by their own thread
+    bool overflow = !Server_queueFrames(client, frames, count);
+    if (overflow || Server_flushOutbox(client) != kOutboxEmpty) {
+      if (write(client->notify[1], "", 1) < 0 && EAGAIN != errno) {
+        Warn("Unable to notify client %lu", client->threadID);
+      }
+    }
+  }
+  SnapshotCell_leave(room->subscribers, ticket);
+}
+
 /**
- * Retrieves a message from the broadcast queue and sends it
- * to every client
+ * Waits for messages in the broadcast queue and sends them to the
+ * members of their rooms. The thread wakes up as soon as a message is pushed, then
+ * optionally waits for the batching window to collect more messages,
+ * and drains the whole queue in one go.
  * @param[in] data Unused data pointer, set it to NULL
  */
 void* Server_handleBroadcast(void* data) {
   pthread_t me = pthread_self();
 
-  // Define a sleep interval in milliseconds
-  int msec = 200;
-  struct timespec ts = {
+  // Define the batching window in milliseconds
+  unsigned int msec = server->batchWindow;
+  struct timespec window = {
     .tv_sec = msec / 1000,
     .tv_nsec = (msec % 1000) * 1000000
   };
 
   Info("Starting broadcast thread %lu", me);
-  do {
-    QueueData *item = CQueue_tryPop(messages);
-    if (item != NULL) {
-
-      List_rewind(clients);
-      while (!terminate) {
-        // Lock the list for just the time needed to get the client handle
-        pthread_mutex_lock(&clientsLock);
-        Client *client = (Client *)List_next(clients);
-        pthread_mutex_unlock(&clientsLock);
-        if (client == NULL) break;
-
-        // Don't broadcast messages to non-authenticated clients
-        if (strlen(client->nickname) == 0) continue;
-
-        // The client may have been disconnected with a /quit message
-        // the server will hang if tries to send a message
-        if (SOCKET_isValid(client->socket)) {
-          int sent = Server_send(client, (C2HMessage*)item->content);
-          if (sent <= 0) Server_dropClient(client);
-        }
-      }
-
-      QueueData_free(&item);
+  while (!terminate) {
+    Server_publishPoolStats();
+    // Wake up at least once per second to check the termination flag
+    if (!CQueue_wait(messages, 1000)) continue;
+    if (msec > 0) nanosleep(&window, NULL);
+
+    size_t count = 0;
+    Broadcast *broadcasts = Server_collectBroadcasts(CQueue_popAll(messages), &count);
+    if (broadcasts == NULL) continue;
+#if defined(__linux__)
+    if (server->mode == kServerModeEvent) {
+      // Each reactor delivers the messages to its own clients,
+      // after the ones that are already in the history
+      Server_recordBroadcasts(broadcasts, count);
+      Server_postToReactors(broadcasts, count);
+      continue;
     }
-    nanosleep(&ts, NULL);
-  } while (!terminate);
+#endif
+    pthread_mutex_lock(&deliveryLock);
+    Server_recordBroadcasts(broadcasts, count);
+    Server_deliverBroadcasts(broadcasts, count, Server_deliverToSubscribers, NULL);
+    pthread_mutex_unlock(&deliveryLock);
+  }
 
   Info("Closing broadcast thread %lu", me);
   pthread_exit(data);
 }
 
+/**
+ * Waits for /history requests and serves them in order, reading
+ * the archive from disk away from the clients' threads and event loops
+ * @param[in] data Unused data pointer, set it to NULL
+ */
+void* Server_handleHistory(void* data) {
+  pthread_t me = pthread_self();
+  Info("Starting history thread %lu", me);
+  while (!terminate) {
+    // Wake up at least once per second to check the termination flag
+    if (!CQueue_wait(historyRequests, 1000)) continue;
+    Queue *requests = CQueue_popAll(historyRequests);
+    if (requests == NULL) continue;
+    QueueData *item = NULL;
+    while ((item = Queue_dequeue(requests)) != NULL) {
+      Server_readHistory((HistoryRequest *)item->content);
+      QueueData_free(&item);
+    }
+    Queue_free(&requests);
+  }
+  Info("Closing history thread %lu", me);
+  pthread_exit(data);
+}
+
 bool Server_sendMessage(Client *client, C2HMessageType type, const char *format, ...) {
   // We cannot transfer the arguments directly, we need to pre-parse
   va_list args;
@@ -991,7 +2648,7 @@ bool Server_sendMessage(Client *client, C2HMessageType type, const char *format,
   vsnprintf(buffer, kBufferSize, format, args);
   va_end(args);
 
-  C2HMessage *message = C2HMessage_create(type, buffer);
+  C2HMessage *message = C2HMessage_create(type, "%s", buffer);
   if (NULL == message) {
     Error("Unable to build message");
     return false;
@@ -1001,20 +2658,48 @@ bool Server_sendMessage(Client *client, C2HMessageType type, const char *format,
   return res > 0;
 }
 
-bool Server_broadcastMessage(C2HMessageType type, const char *format, ...) {
+bool Server_broadcastMessage(Room *room, C2HMessageType type, const char *format, ...) {
   va_list args;
   va_start(args, format);
   char buffer[kBufferSize] = {};
   vsnprintf(buffer, kBufferSize, format, args);
   va_end(args);
 
-  C2HMessage *message = C2HMessage_create(type, buffer);
+  C2HMessage *message = C2HMessage_create(type, "%s", buffer);
   if (NULL == message) {
     Error("Unable to build message");
     return false;
   }
-  bool res = CQueue_push(messages, message, sizeof(C2HMessage));
-  // Message is copied to be enqueued so it's safe to free
+  bool res = Server_broadcast(message, room);
   C2HMessage_free(&message);
   return res;
 }
+
+/**
+ * Encodes a message once and adds the frame to the broadcast queue
+ * @param[in] message The message to send to the room members
+ * @param[in] room    The recipients, e.g. the room of the sender
+ * @param[out] true if the message has been queued
+ */
+bool Server_broadcast(const C2HMessage *message, Room *room) {
+  if (room == NULL) return false;
+  // The message is encoded once and the frame is shared by all recipients
+  Frame *frame = Frame_new(message, server->compressionThreshold);
+  if (NULL == frame) {
+    Error("Unable to encode message");
+    return false;
+  }
+  // The queue holds the references until the frame is delivered,
+  // so the room outlives its members if they all leave meanwhile
+  Broadcast broadcast = {
+    .frame = frame,
+    .room = Room_retain(room),
+    .chat = (message->type == kMessageTypeMsg)
+  };
+  bool res = CQueue_push(messages, &broadcast, sizeof(Broadcast));
+  if (!res) {
+    Frame_release(&(broadcast.frame));
+    Room_release(&(broadcast.room));
+  }
+  return res;
+}
@@ -25,9 +25,37 @@
   #include <unistd.h>
   #include <stdbool.h>
   #include "../c2hat.h"
+  #include "outbox.h"
 
   typedef struct Server Server;
 
+  /// Connection handling models available to the server
+  typedef enum {
+    kServerModeThreaded = 0, ///< One thread per client (default)
+    kServerModeEvent = 1 ///< Event loop based on epoll (Linux only)
+  } ServerMode;
+
+  /// Returns a printable name for the given server mode
+  #define SERVER_MODE_NAME(mode) ((mode) == kServerModeEvent ? "epoll" : "threaded")
+
+  /// Where TLS records are encrypted and decrypted
+  typedef enum {
+    kKernelTLSOff = 0, ///< By OpenSSL in user space (default)
+    kKernelTLSOn = 1 ///< By the kernel when supported (kTLS, Linux only), OpenSSL otherwise
+  } KernelTLSMode;
+
+  /// Returns a printable name for the given kernel TLS mode
+  #define KERNEL_TLS_MODE_NAME(mode) ((mode) == kKernelTLSOn ? "on" : "off")
+
+  /// Implementations of the nickname rules
+  typedef enum {
+    kNicknameValidatorRegex = 0, ///< POSIX regular expression (default)
+    kNicknameValidatorFast = 1 ///< Hand-written state machine, ASCII only
+  } NicknameValidator;
+
+  /// Returns a printable name for the given nickname validator
+  #define NICKNAME_VALIDATOR_NAME(validator) ((validator) == kNicknameValidatorFast ? "fast" : "regex")
+
   /// Contains the server's active configuration
   typedef struct {
     pid_t pid; ///< PID for the currently running server
@@ -41,6 +69,21 @@
     char locale[kMaxLocaleLength]; ///< Server locale
     unsigned int port; ///< Listening TCP port
     unsigned int maxConnections; ///< Max connections
+    ServerMode mode; ///< Connection handling model
+    unsigned int workers; ///< Number of event loop threads (epoll mode only)
+    unsigned int batchWindow; ///< Milliseconds to wait for more messages before a broadcast
+    unsigned int outboxSize; ///< Max number of messages queued for each client
+    OutboxPolicy outboxPolicy; ///< What to do with clients that exceed their outbox
+    unsigned int compressionThreshold; ///< Min size of the frames to compress, 0 = disabled
+    unsigned int ticketLifetime; ///< Seconds between session ticket key rotations, 0 = disabled
+    KernelTLSMode kernelTLS; ///< Offload the TLS records to the kernel if supported
+    unsigned int rateMessages; ///< Max messages per second from each client, 0 = unlimited
+    unsigned int rateBytes; ///< Max bytes of content per second from each client, 0 = unlimited
+    unsigned int historySize; ///< Max bytes of recent messages replayed to joining clients, 0 = disabled
+    unsigned int archiveSize; ///< Max megabytes of archived messages, 0 = disabled
+    unsigned int archiveSegmentSize; ///< Megabytes of each archive segment
+    unsigned int archiveAge; ///< Seconds after which archived messages are removed, 0 = never
+    NicknameValidator nicknameValidator; ///< How nicknames are validated
     bool foreground; ///< Foreground or background service flag
     char workingDirPath[kMaxPath]; ///< Server work directory
   } ServerConfigInfo;
@@ -116,6 +116,15 @@ char *GetWorkingDirectory(char *dirPath, size_t length) {
   return dirPath;
 }
 
+/**
+ * Returns the default number of event loop threads,
+ * one for each online CPU
+ */
+unsigned int GetDefaultWorkers() {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return (cpus > 0) ? (unsigned int)cpus : 1;
+}
+
 /**
  * Returns the path for the Log file
  *
@@ -237,6 +246,36 @@ int handler(
     settings->port = atoi(value);
   } else if (MATCH("server", "max_connections")) {
     settings->maxConnections = atoi(value);
+  } else if (MATCH("server", "mode")) {
+    SERVER_MODE(settings->mode, value);
+  } else if (MATCH("server", "workers")) {
+    settings->workers = atoi(value);
+  } else if (MATCH("server", "batch_window")) {
+    settings->batchWindow = atoi(value);
+  } else if (MATCH("server", "outbox_size")) {
+    settings->outboxSize = atoi(value);
+  } else if (MATCH("server", "outbox_policy")) {
+    OUTBOX_POLICY(settings->outboxPolicy, value);
+  } else if (MATCH("server", "compression_threshold")) {
+    settings->compressionThreshold = atoi(value);
+  } else if (MATCH("server", "ticket_lifetime")) {
+    settings->ticketLifetime = atoi(value);
+  } else if (MATCH("server", "rate_messages")) {
+    settings->rateMessages = atoi(value);
+  } else if (MATCH("server", "rate_bytes")) {
+    settings->rateBytes = atoi(value);
+  } else if (MATCH("server", "history_size")) {
+    settings->historySize = atoi(value);
+  } else if (MATCH("server", "archive_size")) {
+    settings->archiveSize = atoi(value);
+  } else if (MATCH("server", "archive_segment_size")) {
+    settings->archiveSegmentSize = atoi(value);
+  } else if (MATCH("server", "archive_age")) {
+    settings->archiveAge = atoi(value);
+  } else if (MATCH("server", "ktls")) {
+    KERNEL_TLS_MODE(settings->kernelTLS, value);
+  } else if (MATCH("server", "nickname_validator")) {
+    NICKNAME_VALIDATOR(settings->nicknameValidator, value);
   } else if (MATCH("server", "pid_file_path")) {
     memcpy(settings->pidFilePath, value, sizeof(settings->pidFilePath) -1);
   } else if (MATCH("tls", "cert_file")) {
@@ -357,6 +396,9 @@ int parseOptions(int argc, ARGV argv, ServerConfigInfo *settings) {
   if (maxConnections > 0) {
     settings->maxConnections = maxConnections;
   }
+  if (settings->workers == 0) {
+    settings->workers = GetDefaultWorkers();
+  }
   if (strlen(sslCertFilePath) > 0) {
     memset(settings->sslCertFilePath, 0, sizeof(settings->sslCertFilePath));
     memcpy(settings->sslCertFilePath, sslCertFilePath, sizeof(settings->sslCertFilePath) -1);
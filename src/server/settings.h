@@ -46,6 +46,42 @@
     } \
   }
 
+  // Server mode conversion utilities
+  #define SERVER_MODE(mode, value) { \
+    if (strcasecmp(value, "epoll") == 0 || strcasecmp(value, "event") == 0) { \
+      mode = kServerModeEvent; \
+    } else { \
+      mode = kServerModeThreaded; \
+    } \
+  }
+
+  // Outbox policy conversion utilities
+  #define OUTBOX_POLICY(policy, value) { \
+    if (strcasecmp(value, "disconnect") == 0) { \
+      policy = kOutboxPolicyDisconnect; \
+    } else { \
+      policy = kOutboxPolicyDrop; \
+    } \
+  }
+
+  // Kernel TLS mode conversion utilities
+  #define KERNEL_TLS_MODE(mode, value) { \
+    if (strcasecmp(value, "on") == 0 || strcasecmp(value, "true") == 0) { \
+      mode = kKernelTLSOn; \
+    } else { \
+      mode = kKernelTLSOff; \
+    } \
+  }
+
+  // Nickname validator conversion utilities
+  #define NICKNAME_VALIDATOR(validator, value) { \
+    if (strcasecmp(value, "fast") == 0) { \
+      validator = kNicknameValidatorFast; \
+    } else { \
+      validator = kNicknameValidatorRegex; \
+    } \
+  }
+
   char *GetConfigFilePath(char *filePath, size_t length);
 
   char *GetDefaultPidFilePath(char *filePath, size_t length);
@@ -59,6 +95,8 @@
 
   char *GetWorkingDirectory(char *dirPath, size_t length);
 
+  unsigned int GetDefaultWorkers();
+
   /// ARGV wrapper for options parsing
   typedef char * const * ARGV;
   int parseOptions(int argc, ARGV argv, ServerConfigInfo *settings);
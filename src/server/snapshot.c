@@ -0,0 +1,153 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file snapshot.c
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "snapshot.h"
+
+/**
+ * Readers are counted in one of two groups, selected by the parity of
+ * the current phase. A writer flips the phase, so that new readers join
+ * the other group, and waits for the old group to drain.
+ */
+struct SnapshotCell {
+  _Atomic(Snapshot *) current; ///< The published snapshot
+  atomic_uint phase; ///< The parity selects the group of new readers
+  atomic_uint readers[2]; ///< Number of active readers in each group
+  pthread_mutex_t lock; ///< Serialises the writers
+};
+
+/**
+ * Allocates a snapshot with a copy of the given items
+ * @param[in] version The snapshot version
+ * @param[in] items   The items to copy
+ * @param[in] length  The number of items
+ * @param[out] The new snapshot or NULL on failure
+ */
+static Snapshot *Snapshot_new(uint64_t version, void * const *items, size_t length) {
+  Snapshot *this = malloc(sizeof(Snapshot) + length * sizeof(void *));
+  if (this == NULL) return NULL;
+  this->version = version;
+  this->length = length;
+  if (length > 0) memcpy(this->items, items, length * sizeof(void *));
+  return this;
+}
+
+/**
+ * Creates a new cell with an empty snapshot
+ * @param[out] The new cell, or NULL on failure
+ */
+SnapshotCell *SnapshotCell_new() {
+  SnapshotCell *this = calloc(1, sizeof(SnapshotCell));
+  if (this == NULL) return NULL;
+  Snapshot *empty = Snapshot_new(0, NULL, 0);
+  if (empty == NULL || pthread_mutex_init(&(this->lock), NULL)) {
+    free(empty);
+    free(this);
+    return NULL;
+  }
+  atomic_init(&(this->current), empty);
+  return this;
+}
+
+/**
+ * Destroys a cell and its current snapshot
+ * @param[in] this Double pointer to a cell without active readers
+ */
+void SnapshotCell_free(SnapshotCell **this) {
+  if (this != NULL && *this != NULL) {
+    free(atomic_load(&((*this)->current)));
+    pthread_mutex_destroy(&((*this)->lock));
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Starts a read-side section. The returned snapshot and the items it
+ * contains stay valid until SnapshotCell_leave() is called.
+ * @param[in]  this   The cell
+ * @param[out] ticket Identifies the section, to pass to SnapshotCell_leave()
+ * @param[out] The current snapshot
+ */
+const Snapshot *SnapshotCell_enter(SnapshotCell *this, unsigned int *ticket) {
+  while (true) {
+    unsigned int group = atomic_load(&(this->phase)) & 1;
+    atomic_fetch_add(&(this->readers[group]), 1);
+    // If a writer flipped the phase in the meantime, it may not wait
+    // for this group anymore, so join the new one
+    if ((atomic_load(&(this->phase)) & 1) == group) {
+      *ticket = group;
+      return atomic_load(&(this->current));
+    }
+    atomic_fetch_sub(&(this->readers[group]), 1);
+  }
+}
+
+/**
+ * Ends a read-side section
+ * @param[in] this   The cell
+ * @param[in] ticket The value returned by SnapshotCell_enter()
+ */
+void SnapshotCell_leave(SnapshotCell *this, unsigned int ticket) {
+  atomic_fetch_sub(&(this->readers[ticket & 1]), 1);
+}
+
+/**
+ * Waits for the readers that may still use the previous snapshot,
+ * must be called by a writer holding the lock
+ * @param[in] this The cell
+ */
+static void SnapshotCell_synchronize(SnapshotCell *this) {
+  unsigned int group = atomic_fetch_add(&(this->phase), 1) & 1;
+  while (atomic_load(&(this->readers[group])) > 0) {
+    sched_yield();
+  }
+}
+
+/**
+ * Publishes a new snapshot. The previous one is freed after the
+ * readers that could access it have left, so when the function
+ * returns the items that were removed can be safely destroyed.
+ * @param[in] this   The cell
+ * @param[in] items  The items of the new snapshot, they are copied
+ * @param[in] length The number of items
+ * @param[out] false if the new snapshot can't be allocated
+ */
+bool SnapshotCell_publish(SnapshotCell *this, void * const *items, size_t length) {
+  pthread_mutex_lock(&(this->lock));
+  Snapshot *previous = atomic_load(&(this->current));
+  Snapshot *next = Snapshot_new(previous->version + 1, items, length);
+  if (next == NULL) {
+    pthread_mutex_unlock(&(this->lock));
+    return false;
+  }
+  atomic_store(&(this->current), next);
+  SnapshotCell_synchronize(this);
+  free(previous);
+  pthread_mutex_unlock(&(this->lock));
+  return true;
+}
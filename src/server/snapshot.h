@@ -0,0 +1,63 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  /**
+   * An immutable set of items, e.g. the clients that receive broadcast
+   * messages. A snapshot never changes after it's published, writers
+   * replace it with a new version instead.
+   */
+  typedef struct {
+    uint64_t version; ///< Incremented with every published snapshot
+    size_t length; ///< Number of items
+    void *items[]; ///< The items, in publishing order
+  } Snapshot;
+
+  /**
+   * Holds the current snapshot. Readers never block and never take
+   * a lock, writers wait until the readers of the previous snapshot
+   * are done before reclaiming it (read-copy-update).
+   */
+  typedef struct SnapshotCell SnapshotCell;
+
+  // Creates a new cell with an empty snapshot
+  SnapshotCell *SnapshotCell_new();
+
+  // Destroys a cell and its snapshot, there must be no active readers
+  void SnapshotCell_free(SnapshotCell **this);
+
+  // Starts a read-side section and returns the current snapshot
+  const Snapshot *SnapshotCell_enter(SnapshotCell *this, unsigned int *ticket);
+
+  // Ends a read-side section, the snapshot must not be used anymore
+  void SnapshotCell_leave(SnapshotCell *this, unsigned int ticket);
+
+  // Publishes a new snapshot and reclaims the previous one, once it returns
+  // no reader can access the items that are not in the new snapshot
+  bool SnapshotCell_publish(SnapshotCell *this, void * const *items, size_t length);
+
+#endif
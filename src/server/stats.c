@@ -0,0 +1,135 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file stats.c
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "stats.h"
+
+/// Counters shared between the server and the status command
+typedef struct {
+  atomic_uint_least64_t counters[kStatCount];
+} ServerStats;
+
+/// Counters used until (or if) shared memory is available
+static ServerStats localStats = {};
+
+/// The active counters
+static ServerStats *stats = &localStats;
+
+/**
+ * Moves the counters to a shared memory location, so that the
+ * status command can read them while the server is running.
+ * On failure the counters are kept in private memory.
+ * @param[in] path The name of the shared memory location, starting with '/'
+ * @param[out] true on success
+ */
+bool Stats_init(const char *path) {
+  int fd = shm_open(path, O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if (fd < 0) return false;
+  if (ftruncate(fd, sizeof(ServerStats)) < 0) {
+    close(fd);
+    return false;
+  }
+  void *map = mmap(0, sizeof(ServerStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  // The new memory is zero filled
+  stats = (ServerStats *)map;
+  for (int i = 0; i < kStatCount; i++) {
+    atomic_fetch_add(&(stats->counters[i]), atomic_load(&(localStats.counters[i])));
+  }
+  return true;
+}
+
+/**
+ * Adds a value to a counter, it's safe to call from any thread
+ * @param[in] counter The counter to update
+ * @param[in] value   The value to add
+ */
+void Stats_add(StatCounter counter, uint64_t value) {
+  atomic_fetch_add_explicit(&(stats->counters[counter]), value, memory_order_relaxed);
+}
+
+/**
+ * Raises a counter to the given value if it's lower,
+ * it's safe to call from any thread
+ * @param[in] counter The counter to update
+ * @param[in] value   The candidate maximum
+ */
+void Stats_max(StatCounter counter, uint64_t value) {
+  uint64_t current = atomic_load_explicit(&(stats->counters[counter]), memory_order_relaxed);
+  while (current < value && !atomic_compare_exchange_weak_explicit(
+    &(stats->counters[counter]), &current, value, memory_order_relaxed, memory_order_relaxed
+  ));
+}
+
+/**
+ * Sets a counter to the given value, used for values sampled
+ * by a single thread
+ * @param[in] counter The counter to update
+ * @param[in] value   The new value
+ */
+void Stats_set(StatCounter counter, uint64_t value) {
+  atomic_store_explicit(&(stats->counters[counter]), value, memory_order_relaxed);
+}
+
+/**
+ * Returns the current value of a counter
+ * @param[in] counter The counter to read
+ */
+uint64_t Stats_get(StatCounter counter) {
+  return atomic_load_explicit(&(stats->counters[counter]), memory_order_relaxed);
+}
+
+/**
+ * Reads the counters of a running server
+ * @param[in]  path   The name of the shared memory location, starting with '/'
+ * @param[out] values The counter values
+ * @param[out] true on success
+ */
+bool Stats_load(const char *path, uint64_t values[kStatCount]) {
+  int fd = shm_open(path, O_RDONLY, 0600);
+  if (fd < 0) return false;
+  void *map = mmap(0, sizeof(ServerStats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  ServerStats *shared = (ServerStats *)map;
+  for (int i = 0; i < kStatCount; i++) {
+    values[i] = atomic_load(&(shared->counters[i]));
+  }
+  munmap(map, sizeof(ServerStats));
+  return true;
+}
+
+/**
+ * Removes the shared memory location, the mapping is kept until
+ * the process exits because other threads may still update it
+ * @param[in] path The name of the shared memory location, starting with '/'
+ */
+void Stats_clean(const char *path) {
+  shm_unlink(path);
+}
@@ -0,0 +1,78 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+  #include <stdbool.h>
+  #include <stdint.h>
+
+  /// Server activity counters
+  typedef enum {
+    kStatWrites = 0, ///< Successful SSL_write calls
+    kStatFramesWritten, ///< Frames delivered to clients
+    kStatBytesWritten, ///< Bytes delivered to clients
+    kStatTimeouts, ///< Connections closed by a handshake, authentication or inactivity timeout
+    kStatTimeoutPeak, ///< Most timeouts expired within a single timer tick (event mode only)
+    kStatMessageAllocations, ///< Message objects taken from the message pool
+    kStatMessageCapacity, ///< Message objects allocated by the message pool
+    kStatNodeAllocations, ///< Queue and list nodes taken from the node pools
+    kStatNodeCapacity, ///< Queue and list nodes allocated by the node pools
+    kStatPoolLocks, ///< Batches moved between the thread caches and the shared pools
+    kStatCompressedFrames, ///< Frames compressed for clients that support compression
+    kStatCompressionInput, ///< Size of the compressed frames before compression
+    kStatCompressionOutput, ///< Size of the compressed frames after compression
+    kStatCompressionSaved, ///< Bytes not written to clients thanks to compression
+    kStatHandshakes, ///< Completed TLS handshakes
+    kStatHandshakesResumed, ///< Completed TLS handshakes that resumed a session from a ticket
+    kStatKernelTLSSend, ///< Connections whose sent records are encrypted by the kernel
+    kStatKernelTLSReceive, ///< Connections whose received records are decrypted by the kernel
+    kStatRateLimited, ///< Messages rejected because the sender exceeded its rate limit
+    kStatRooms, ///< Rooms with at least one member
+    kStatDirectMessages, ///< Messages sent to a single client
+    kStatArchivedMessages, ///< Broadcast messages written to the archive
+    kStatArchiveBytes, ///< Size of the records in the archive segments
+    kStatArchiveDropped, ///< Broadcast messages that couldn't be archived
+    kStatCount ///< Number of counters, keep last
+  } StatCounter;
+
+  // Maps the counters to a shared memory location readable by other processes
+  bool Stats_init(const char *path);
+
+  // Adds a value to a counter
+  void Stats_add(StatCounter counter, uint64_t value);
+
+  // Raises a counter to the given value, if it's lower
+  void Stats_max(StatCounter counter, uint64_t value);
+
+  // Sets a counter to the given value
+  void Stats_set(StatCounter counter, uint64_t value);
+
+  // Returns the current value of a counter
+  uint64_t Stats_get(StatCounter counter);
+
+  // Copies the counters of a running server from shared memory
+  bool Stats_load(const char *path, uint64_t values[kStatCount]);
+
+  // Removes the shared memory location
+  void Stats_clean(const char *path);
+
+#endif
@@ -0,0 +1,208 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file tickets.c
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "tickets.h"
+
+struct TicketKeys {
+  pthread_mutex_t lock; ///< Serialises rotations and lookups
+  time_t lifetime; ///< How long a key is used to issue tickets, in seconds
+  TicketKey current; ///< Issues and accepts tickets
+  TicketKey previous; ///< Only accepts tickets, until it expires
+  bool hasPrevious; ///< The previous key is set and not expired
+};
+
+/**
+ * Fills a key with random data
+ * @param[in] key The key to generate
+ * @param[in] now The current time
+ * @param[out] Success or failure
+ */
+static bool TicketKey_generate(TicketKey *key, time_t now) {
+  key->created = now;
+  return RAND_bytes(key->name, sizeof(key->name)) == 1
+    && RAND_priv_bytes(key->aesKey, sizeof(key->aesKey)) == 1
+    && RAND_priv_bytes(key->hmacKey, sizeof(key->hmacKey)) == 1;
+}
+
+/**
+ * Creates a new key ring
+ * @param[in] lifetime How long a key is used to issue tickets, in seconds
+ * @param[in] now      The current time
+ * @param[out] The new key ring, or NULL on failure
+ */
+TicketKeys *TicketKeys_new(unsigned int lifetime, time_t now) {
+  TicketKeys *this = calloc(sizeof(TicketKeys), 1);
+  if (this == NULL) return NULL;
+  this->lifetime = (lifetime > 0) ? lifetime : 1;
+  if (!TicketKey_generate(&(this->current), now)) {
+    free(this);
+    return NULL;
+  }
+  pthread_mutex_init(&(this->lock), NULL);
+  return this;
+}
+
+/**
+ * Destroys a key ring, there must be no SSL context using it
+ * @param[in] this Double pointer to the key ring
+ */
+void TicketKeys_free(TicketKeys **this) {
+  if (this != NULL && *this != NULL) {
+    pthread_mutex_destroy(&((*this)->lock));
+    OPENSSL_cleanse(*this, sizeof(TicketKeys));
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Replaces the current key when its lifetime is over, and drops
+ * the previous one after another lifetime. Must be called with the lock.
+ * @param[in] this The key ring
+ * @param[in] now  The current time
+ * @param[out] false if a new key cannot be generated
+ */
+static bool TicketKeys_rotate(TicketKeys *this, time_t now) {
+  if (this->hasPrevious && now >= this->previous.created + 2 * this->lifetime) {
+    OPENSSL_cleanse(&(this->previous), sizeof(TicketKey));
+    this->hasPrevious = false;
+  }
+  if (now < this->current.created + this->lifetime) return true;
+
+  TicketKey next = {};
+  if (!TicketKey_generate(&next, now)) return false;
+  // If the server was idle for long, the current key may be already expired
+  this->previous = this->current;
+  this->hasPrevious = (now < this->current.created + 2 * this->lifetime);
+  this->current = next;
+  OPENSSL_cleanse(&next, sizeof(TicketKey));
+  return true;
+}
+
+/**
+ * Copies the key that issues new tickets
+ * @param[in]  this The key ring
+ * @param[in]  now  The current time
+ * @param[out] key  A copy of the current key
+ * @param[out] Success or failure
+ */
+bool TicketKeys_current(TicketKeys *this, time_t now, TicketKey *key) {
+  pthread_mutex_lock(&(this->lock));
+  bool result = TicketKeys_rotate(this, now);
+  if (result) *key = this->current;
+  pthread_mutex_unlock(&(this->lock));
+  return result;
+}
+
+/**
+ * Looks up the key that issued a ticket
+ * @param[in]  this The key ring
+ * @param[in]  name The key name stored in the ticket
+ * @param[in]  now  The current time
+ * @param[out] key  A copy of the matching key, if any
+ * @param[out] Whether the ticket can be accepted and should be renewed
+ */
+TicketKeyStatus TicketKeys_find(TicketKeys *this, const unsigned char *name, time_t now, TicketKey *key) {
+  TicketKeyStatus status = kTicketKeyUnknown;
+  pthread_mutex_lock(&(this->lock));
+  // A failed rotation keeps the current key a little longer
+  TicketKeys_rotate(this, now);
+  if (memcmp(name, this->current.name, kTicketKeyNameSize) == 0) {
+    *key = this->current;
+    status = kTicketKeyCurrent;
+  } else if (this->hasPrevious && memcmp(name, this->previous.name, kTicketKeyNameSize) == 0) {
+    *key = this->previous;
+    status = kTicketKeyRenew;
+  }
+  pthread_mutex_unlock(&(this->lock));
+  return status;
+}
+
+/**
+ * Encrypts or decrypts a session ticket with the keys of the ring
+ * attached to the SSL context
+ * See https://www.openssl.org/docs/man3.0/man3/SSL_CTX_set_tlsext_ticket_key_evp_cb.html
+ * @param[in] ssl     The client connection
+ * @param[in] name    The key name, written when encrypting
+ * @param[in] iv      The initialisation vector, written when encrypting
+ * @param[in] cipher  The cipher context to initialise
+ * @param[in] mac     The HMAC context to initialise
+ * @param[in] encrypt 1 when issuing a ticket, 0 when receiving one
+ * @param[out] 1 on success, 2 to renew the ticket, 0 for a full handshake, -1 on error
+ */
+static int TicketKeys_callback(
+  SSL *ssl, unsigned char *name, unsigned char *iv,
+  EVP_CIPHER_CTX *cipher, EVP_MAC_CTX *mac, int encrypt
+) {
+  TicketKeys *this = (TicketKeys *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  TicketKey key = {};
+  int result = 1;
+  if (encrypt) {
+    if (!TicketKeys_current(this, time(NULL), &key)
+      || RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1
+      || !EVP_EncryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aesKey, iv)) {
+      result = -1;
+    }
+    memcpy(name, key.name, kTicketKeyNameSize);
+  } else {
+    TicketKeyStatus status = TicketKeys_find(this, name, time(NULL), &key);
+    if (status == kTicketKeyUnknown) return 0;
+    if (!EVP_DecryptInit_ex(cipher, EVP_aes_256_cbc(), NULL, key.aesKey, iv)) result = -1;
+    if (status == kTicketKeyRenew) result = 2;
+  }
+  if (result > 0) {
+    OSSL_PARAM params[] = {
+      OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmacKey, sizeof(key.hmacKey)),
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0),
+      OSSL_PARAM_construct_end()
+    };
+    if (!EVP_MAC_CTX_set_params(mac, params)) result = -1;
+  }
+  OPENSSL_cleanse(&key, sizeof(TicketKey));
+  return result;
+}
+
+/**
+ * Enables stateless session tickets on an SSL context: the server
+ * doesn't keep any session, the clients store them encrypted with
+ * the keys of the ring. The ring must outlive the context.
+ * @param[in] this    The key ring
+ * @param[in] context The server SSL context
+ * @param[out] Success or failure
+ */
+bool TicketKeys_attach(TicketKeys *this, SSL_CTX *context) {
+  // A key accepts tickets for at least a lifetime after issuing its last one
+  SSL_CTX_set_timeout(context, this->lifetime);
+  // One ticket per handshake is enough, the default is two with TLS 1.3
+  SSL_CTX_set_num_tickets(context, 1);
+  SSL_CTX_clear_options(context, SSL_OP_NO_TICKET);
+  return SSL_CTX_set_app_data(context, this)
+    && SSL_CTX_set_tlsext_ticket_key_evp_cb(context, TicketKeys_callback);
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TICKETS_H
+#define TICKETS_H
+
+  #include <stdbool.h>
+  #include <time.h>
+
+  #include <openssl/ssl.h>
+
+  enum {
+    kTicketKeyNameSize = 16, ///< Size of the key name stored in the tickets
+    kTicketKeySize = 32 ///< Size of the encryption and HMAC keys
+  };
+
+  /// A key used to encrypt and authenticate TLS session tickets
+  typedef struct {
+    unsigned char name[kTicketKeyNameSize]; ///< Random name, identifies the key in a ticket
+    unsigned char aesKey[kTicketKeySize]; ///< AES-256-CBC encryption key
+    unsigned char hmacKey[kTicketKeySize]; ///< HMAC-SHA256 key
+    time_t created; ///< When the key started being used to issue tickets
+  } TicketKey;
+
+  /// Outcome of a ticket key lookup
+  typedef enum {
+    kTicketKeyUnknown = 0, ///< The key is unknown or expired, a full handshake is needed
+    kTicketKeyCurrent, ///< The ticket was issued with the current key
+    kTicketKeyRenew ///< The ticket was issued with the previous key and should be renewed
+  } TicketKeyStatus;
+
+  /**
+   * Rotating keys for stateless TLS session tickets. New tickets
+   * are always issued with the current key, which is replaced after
+   * the given lifetime. The previous key is kept for another lifetime,
+   * so tickets are valid for at least one lifetime. Thread safe.
+   */
+  typedef struct TicketKeys TicketKeys;
+
+  // Creates a new key ring with a random current key
+  TicketKeys *TicketKeys_new(unsigned int lifetime, time_t now);
+
+  // Destroys a key ring and erases its keys
+  void TicketKeys_free(TicketKeys **this);
+
+  // Copies the key used to issue new tickets, rotating the keys if needed
+  bool TicketKeys_current(TicketKeys *this, time_t now, TicketKey *key);
+
+  // Looks up the key that issued a ticket, rotating the keys if needed
+  TicketKeyStatus TicketKeys_find(TicketKeys *this, const unsigned char *name, time_t now, TicketKey *key);
+
+  // Enables stateless session tickets protected by the key ring on an SSL context
+  bool TicketKeys_attach(TicketKeys *this, SSL_CTX *context);
+
+#endif
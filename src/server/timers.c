@@ -0,0 +1,255 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/// @file timers.c
+#include <stdlib.h>
+#include <string.h>
+
+#include "timers.h"
+
+enum {
+  kTimerWheelBits = 6, ///< Each level has 2^6 slots
+  kTimerWheelSlots = 1 << kTimerWheelBits,
+  kTimerWheelLevels = 4 ///< Covers 2^24 ticks, longer delays are clamped
+};
+
+/// Longest delay that can be scheduled, in ticks
+static const uint64_t kTimerWheelMaxDelay = (1ULL << (kTimerWheelBits * kTimerWheelLevels)) - 1;
+
+struct TimerWheel {
+  uint64_t now; ///< Last processed tick
+  size_t length; ///< Number of scheduled timers
+  size_t peak; ///< Most timers expired within a single tick
+  Timer slots[kTimerWheelLevels][kTimerWheelSlots]; ///< Circular lists, the slot is the list head
+};
+
+/**
+ * Initialises an empty circular list
+ * @param[in] head The list head
+ */
+static void Timer_initList(Timer *head) {
+  head->prev = head;
+  head->next = head;
+}
+
+/**
+ * Appends a timer to a circular list
+ * @param[in] head  The list head
+ * @param[in] timer The timer to append
+ */
+static void Timer_append(Timer *head, Timer *timer) {
+  timer->prev = head->prev;
+  timer->next = head;
+  head->prev->next = timer;
+  head->prev = timer;
+}
+
+/**
+ * Removes a timer from the list it belongs to
+ * @param[in] timer The timer to remove
+ */
+static void Timer_unlink(Timer *timer) {
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = NULL;
+  timer->next = NULL;
+}
+
+/**
+ * Moves all the timers of a list to an empty list
+ * @param[in] from The source list head
+ * @param[in] to   The destination list head
+ */
+static void Timer_moveList(Timer *from, Timer *to) {
+  if (from->next == from) return;
+  to->next = from->next;
+  to->prev = from->prev;
+  to->next->prev = to;
+  to->prev->next = to;
+  Timer_initList(from);
+}
+
+/**
+ * Inserts a timer in the slot that matches its expiration tick
+ * @param[in] this  The timer wheel
+ * @param[in] timer The timer to insert, not linked to any list
+ */
+static void TimerWheel_insert(TimerWheel *this, Timer *timer) {
+  uint64_t delta = timer->expires - this->now;
+  int level = 0;
+  while (level < kTimerWheelLevels - 1 && delta >= (1ULL << (kTimerWheelBits * (level + 1)))) {
+    level++;
+  }
+  size_t slot = (timer->expires >> (kTimerWheelBits * level)) & (kTimerWheelSlots - 1);
+  Timer_append(&(this->slots[level][slot]), timer);
+}
+
+/**
+ * Redistributes the timers of a higher level slot to the lower levels
+ * @param[in] this  The timer wheel
+ * @param[in] level The level to cascade, greater than 0
+ */
+static void TimerWheel_cascade(TimerWheel *this, int level) {
+  size_t slot = (this->now >> (kTimerWheelBits * level)) & (kTimerWheelSlots - 1);
+  Timer list;
+  Timer_initList(&list);
+  Timer_moveList(&(this->slots[level][slot]), &list);
+  while (list.next != &list) {
+    Timer *timer = list.next;
+    Timer_unlink(timer);
+    TimerWheel_insert(this, timer);
+  }
+}
+
+/**
+ * Creates a new empty timer wheel
+ * @param[in] now The current tick
+ * @param[out] The new timer wheel, or NULL on failure
+ */
+TimerWheel *TimerWheel_new(uint64_t now) {
+  TimerWheel *this = calloc(1, sizeof(TimerWheel));
+  if (this == NULL) return NULL;
+  this->now = now;
+  for (int level = 0; level < kTimerWheelLevels; level++) {
+    for (int slot = 0; slot < kTimerWheelSlots; slot++) {
+      Timer_initList(&(this->slots[level][slot]));
+    }
+  }
+  return this;
+}
+
+/**
+ * Destroys a timer wheel, the scheduled timers are
+ * owned by the caller and are only cancelled
+ * @param[in] this Double pointer to a timer wheel
+ */
+void TimerWheel_free(TimerWheel **this) {
+  if (this != NULL && *this != NULL) {
+    for (int level = 0; level < kTimerWheelLevels; level++) {
+      for (int slot = 0; slot < kTimerWheelSlots; slot++) {
+        Timer *head = &((*this)->slots[level][slot]);
+        while (head->next != head) Timer_unlink(head->next);
+      }
+    }
+    memset(*this, 0, sizeof(TimerWheel));
+    free(*this);
+    *this = NULL;
+  }
+}
+
+/**
+ * Schedules a timer, if the timer is already scheduled its
+ * expiration is moved (e.g. to reset an inactivity timeout)
+ * @param[in] this  The timer wheel
+ * @param[in] timer The timer to schedule
+ * @param[in] delay Number of ticks from now, at least 1
+ */
+void TimerWheel_schedule(TimerWheel *this, Timer *timer, uint64_t delay) {
+  if (delay < 1) delay = 1;
+  if (delay > kTimerWheelMaxDelay) delay = kTimerWheelMaxDelay;
+  if (Timer_pending(timer)) {
+    Timer_unlink(timer);
+  } else {
+    this->length++;
+  }
+  timer->expires = this->now + delay;
+  TimerWheel_insert(this, timer);
+}
+
+/**
+ * Cancels a scheduled timer
+ * @param[in] this  The timer wheel
+ * @param[in] timer The timer to cancel
+ */
+void TimerWheel_cancel(TimerWheel *this, Timer *timer) {
+  if (!Timer_pending(timer)) return;
+  Timer_unlink(timer);
+  this->length--;
+}
+
+/**
+ * Checks if a timer is scheduled
+ * @param[in] timer The timer to check
+ */
+bool Timer_pending(const Timer *timer) {
+  return timer->next != NULL;
+}
+
+/**
+ * Processes all the ticks up to the current one. The expired timers
+ * are removed from the wheel before calling the callback.
+ * @param[in] this    The timer wheel
+ * @param[in] now     The current tick
+ * @param[in] expire  Function called for each expired timer
+ * @param[in] context Data passed to the callback
+ * @param[out] The number of expired timers
+ */
+size_t TimerWheel_advance(TimerWheel *this, uint64_t now, TimerCallback expire, void *context) {
+  size_t total = 0;
+  while (this->now < now) {
+    // Nothing to expire, jump straight to the current tick
+    if (this->length == 0) {
+      this->now = now;
+      break;
+    }
+    this->now++;
+
+    // Every 2^6 ticks the next slot of the upper level is due
+    for (int level = 1; level < kTimerWheelLevels; level++) {
+      uint64_t mask = (1ULL << (kTimerWheelBits * level)) - 1;
+      if ((this->now & mask) != 0) break;
+      TimerWheel_cascade(this, level);
+    }
+
+    // The callbacks may schedule or cancel other timers,
+    // so expired timers are taken from a private list
+    Timer expired;
+    Timer_initList(&expired);
+    Timer_moveList(&(this->slots[0][this->now & (kTimerWheelSlots - 1)]), &expired);
+    size_t count = 0;
+    while (expired.next != &expired) {
+      Timer *timer = expired.next;
+      Timer_unlink(timer);
+      this->length--;
+      count++;
+      expire(timer, context);
+    }
+    if (count > this->peak) this->peak = count;
+    total += count;
+  }
+  return total;
+}
+
+/**
+ * Returns the number of scheduled timers
+ * @param[in] this The timer wheel
+ */
+size_t TimerWheel_length(const TimerWheel *this) {
+  return this->length;
+}
+
+/**
+ * Returns the largest number of timers that expired within a single tick
+ * @param[in] this The timer wheel
+ */
+size_t TimerWheel_peak(const TimerWheel *this) {
+  return this->peak;
+}
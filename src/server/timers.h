@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMERS_H
+#define TIMERS_H
+
+  #include <stdbool.h>
+  #include <stddef.h>
+  #include <stdint.h>
+
+  typedef struct Timer Timer;
+
+  /**
+   * A deadline tracked by a timer wheel, usually embedded in the
+   * object it belongs to. A zero-filled timer is valid and not scheduled.
+   */
+  struct Timer {
+    Timer *prev; ///< Previous timer in the same slot
+    Timer *next; ///< Next timer in the same slot, NULL if not scheduled
+    uint64_t expires; ///< Tick at which the timer expires
+    void *item; ///< The object that owns the timer
+  };
+
+  /**
+   * A hierarchical timer wheel, the time unit (tick) is chosen by the caller.
+   * Scheduling, rescheduling and cancelling a timer are O(1). The wheel
+   * is not thread safe, concurrent access must be serialised by the caller.
+   */
+  typedef struct TimerWheel TimerWheel;
+
+  /// Function called for each expired timer, the timer may be rescheduled or freed
+  typedef void (*TimerCallback)(Timer *timer, void *context);
+
+  // Creates a new empty timer wheel starting at the given tick
+  TimerWheel *TimerWheel_new(uint64_t now);
+
+  // Destroys a timer wheel, the scheduled timers are cancelled but not freed
+  void TimerWheel_free(TimerWheel **this);
+
+  // Schedules or reschedules a timer to expire after the given number of ticks
+  void TimerWheel_schedule(TimerWheel *this, Timer *timer, uint64_t delay);
+
+  // Cancels a timer, nothing happens if it's not scheduled
+  void TimerWheel_cancel(TimerWheel *this, Timer *timer);
+
+  // Checks if a timer is scheduled
+  bool Timer_pending(const Timer *timer);
+
+  // Moves the wheel forward and calls the callback for each expired timer
+  size_t TimerWheel_advance(TimerWheel *this, uint64_t now, TimerCallback expire, void *context);
+
+  // Returns the number of scheduled timers
+  size_t TimerWheel_length(const TimerWheel *this);
+
+  // Returns the largest number of timers that expired within a single tick
+  size_t TimerWheel_peak(const TimerWheel *this);
+
+#endif
@@ -0,0 +1,422 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "stats.h"
+
+enum { kFrames = 2000 };
+
+/// Encodes a chat message into a new frame
+static Frame *newFrame(int i) {
+  C2HMessage *message = C2HMessage_create(kMessageTypeMsg, "[Joe] message %d", i);
+  Frame *frame = Frame_new(message, 0);
+  C2HMessage_free(&message);
+  assert(frame != NULL);
+  return frame;
+}
+
+/// Queues the given number of frames and waits until they are on disk
+static void appendFrames(Archive *archive, int count) {
+  uint64_t last = Archive_last(archive) + count;
+  for (int i = 0; i < count; i++) {
+    Frame *frame = newFrame(i);
+    assert(Archive_append(archive, frame, (i % 2) ? "lobby" : "games"));
+    Frame_release(&frame);
+  }
+  struct timespec pause = { .tv_nsec = 10000000 };
+  for (int i = 0; i < 500 && Archive_last(archive) < last; i++) nanosleep(&pause, NULL);
+  assert(Archive_last(archive) == last);
+}
+
+/// Waits up to 3 seconds for the writer thread to remove old segments
+static void waitForSegments(Archive *archive, size_t segments) {
+  struct timespec pause = { .tv_nsec = 10000000 };
+  for (int i = 0; i < 300 && Archive_segments(archive) > segments; i++) nanosleep(&pause, NULL);
+}
+
+/// Counts the files with the given extension in a directory
+static size_t countFiles(const char *path, const char *extension) {
+  DIR *directory = opendir(path);
+  assert(directory != NULL);
+  size_t count = 0;
+  struct dirent *item = NULL;
+  while ((item = readdir(directory)) != NULL) {
+    char *dot = strrchr(item->d_name, '.');
+    if (dot != NULL && strcmp(dot + 1, extension) == 0) count++;
+  }
+  closedir(directory);
+  return count;
+}
+
+/// Reads a whole file into a new buffer
+static char *readFile(const char *path, size_t *size) {
+  int file = open(path, O_RDONLY);
+  assert(file >= 0);
+  struct stat info = {};
+  assert(fstat(file, &info) == 0);
+  *size = (size_t)info.st_size;
+  char *data = malloc(*size + 1);
+  assert(data != NULL && read(file, data, *size) == (ssize_t)*size);
+  close(file);
+  return data;
+}
+
+/// Records read from the archive
+typedef struct {
+  uint64_t sequences[kFrames];
+  size_t count;
+} Page;
+
+/// Checks a record read from the archive and collects its sequence number
+static void collectRecord(const ArchiveRecord *record, const char *frame, void *context) {
+  Page *page = (Page *)context;
+  assert(strncmp((const char *)(record + 1), "lobby", record->roomLength) == 0);
+  C2HMessage *message = C2HMessage_decode(frame, record->length);
+  assert(message != NULL && message->type == kMessageTypeMsg);
+  char content[64] = "";
+  snprintf(content, sizeof(content), "message %" PRIu64, record->sequence - 1);
+  assert(strcmp(message->user, "Joe") == 0 && strcmp(message->content, content) == 0);
+  C2HMessage_free(&message);
+  page->sequences[page->count++] = record->sequence;
+}
+
+/// Returns the first sequence numbers of the segment files in a directory, in order
+static size_t listSegments(const char *path, uint64_t *firsts, size_t max) {
+  DIR *directory = opendir(path);
+  assert(directory != NULL);
+  size_t count = 0;
+  struct dirent *item = NULL;
+  while ((item = readdir(directory)) != NULL) {
+    char *dot = strrchr(item->d_name, '.');
+    if (dot == NULL || strcmp(dot + 1, "log") != 0) continue;
+    assert(count < max);
+    uint64_t first = strtoull(item->d_name, NULL, 10);
+    size_t i = count++;
+    for (; i > 0 && firsts[i - 1] > first; i--) firsts[i] = firsts[i - 1];
+    firsts[i] = first;
+  }
+  closedir(directory);
+  return count;
+}
+
+/// Flips a byte in the payload of a record of a segment file
+static void corruptRecord(const char *path, uint64_t first, uint64_t sequence) {
+  char file[1024] = "";
+  snprintf(file, sizeof(file), "%s/%020" PRIu64 ".log", path, first);
+  size_t length = 0;
+  char *data = readFile(file, &length);
+  size_t offset = 0;
+  const ArchiveRecord *record = (const ArchiveRecord *)data;
+  while (record->sequence != sequence) {
+    offset += (sizeof(ArchiveRecord) + record->roomLength + record->length + 7) & ~(size_t)7;
+    assert(offset < length);
+    record = (const ArchiveRecord *)(data + offset);
+  }
+  offset += sizeof(ArchiveRecord) + record->roomLength;
+  free(data);
+  int descriptor = open(file, O_WRONLY);
+  char flipped = 'x';
+  assert(descriptor >= 0 && pwrite(descriptor, &flipped, 1, (off_t)offset) == 1);
+  close(descriptor);
+}
+
+/// Reads all the records of the lobby, oldest first
+static void readAll(Archive *archive, Page *all) {
+  Page page = {};
+  uint64_t cursor = 0;
+  all->count = 0;
+  do {
+    page.count = 0;
+    cursor = Archive_read(archive, "lobby", cursor, 7, collectRecord, &page);
+    memmove(all->sequences + page.count, all->sequences, all->count * sizeof(uint64_t));
+    memcpy(all->sequences, page.sequences, page.count * sizeof(uint64_t));
+    all->count += page.count;
+  } while (cursor != 0);
+}
+
+/// Returns the current time in milliseconds since the Epoch, after a short pause
+static int64_t pauseAndNow() {
+  struct timespec pause = { .tv_nsec = 5000000 };
+  nanosleep(&pause, NULL);
+  struct timespec now = {};
+  clock_gettime(CLOCK_REALTIME, &now);
+  nanosleep(&pause, NULL);
+  return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/// Removes the archive files and directory
+static void removeArchive(const char *path) {
+  DIR *directory = opendir(path);
+  struct dirent *item = NULL;
+  char file[1024] = "";
+  while ((item = readdir(directory)) != NULL) {
+    if (item->d_name[0] == '.') continue;
+    snprintf(file, sizeof(file), "%s/%s", path, item->d_name);
+    unlink(file);
+  }
+  closedir(directory);
+  rmdir(path);
+}
+
+int main() {
+  char path[] = "/tmp/c2hat-archive-XXXXXX";
+  assert(mkdtemp(path) != NULL);
+  char file[1024] = "";
+
+  // Frames are written in order and split in segments
+  Archive *archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  assert(Archive_last(archive) == 0 && Archive_segments(archive) == 0);
+  appendFrames(archive, kFrames);
+  size_t segments = Archive_segments(archive);
+  size_t size = Archive_size(archive);
+  assert(segments > 1 && size > (size_t)kFrames * sizeof(ArchiveRecord));
+  assert(Stats_get(kStatArchivedMessages) == kFrames);
+  Archive_close(&archive);
+  assert(archive == NULL);
+  assert(countFiles(path, "log") == segments && countFiles(path, "idx") == segments);
+  printf(".");
+
+  // Each record is checksummed and holds the binary encoding of its frame
+  snprintf(file, sizeof(file), "%s/%020d.log", path, 1);
+  size_t length = 0;
+  char *data = readFile(file, &length);
+  assert(length <= kArchiveMinSegmentSize);
+  size_t offset = 0;
+  uint64_t sequence = 1;
+  while (offset < length) {
+    ArchiveRecord *record = (ArchiveRecord *)(data + offset);
+    assert(record->sequence == sequence++);
+    char *room = (char *)(record + 1);
+    assert(strncmp(room, (record->sequence % 2) ? "games" : "lobby", record->roomLength) == 0);
+    MessageBuffer *buffer = calloc(1, sizeof(MessageBuffer));
+    buffer->protocol = kMessageProtocolBinary;
+    size_t space = 0;
+    memcpy(MessageBuffer_reserve(buffer, &space), room + record->roomLength, record->length);
+    MessageBuffer_commit(buffer, record->length);
+    C2HMessageView view = {};
+    assert(C2HMessage_next(buffer, &view) && view.type == kMessageTypeMsg);
+    assert(strncmp(view.content, "[Joe] message", 13) != 0 || strcmp(view.user, "Joe") == 0);
+    MessageBuffer_clear(buffer);
+    free(buffer);
+    offset += (sizeof(ArchiveRecord) + record->roomLength + record->length + 7) & ~(size_t)7;
+  }
+  assert(offset == length);
+  free(data);
+  printf(".");
+
+  // The sparse index points to records far enough from each other
+  snprintf(file, sizeof(file), "%s/%020d.idx", path, 1);
+  ArchiveIndexEntry *index = (ArchiveIndexEntry *)readFile(file, &length);
+  size_t entries = length / sizeof(ArchiveIndexEntry);
+  assert(entries > 1 && index[0].sequence == 1 && index[0].offset == 0);
+  for (size_t i = 1; i < entries; i++) {
+    assert(index[i].sequence > index[i - 1].sequence);
+    assert(index[i].offset - index[i - 1].offset >= kArchiveIndexInterval);
+    assert(index[i].timestamp >= index[i - 1].timestamp);
+  }
+  free(index);
+  printf(".");
+
+  // Pages of a room are read backwards from a cursor, oldest record first
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  Page page = {};
+  assert(Archive_read(archive, "lobby", 0, 10, collectRecord, &page) == kFrames - 18);
+  assert(page.count == 10 && page.sequences[0] == kFrames - 18 && page.sequences[9] == kFrames);
+  page.count = 0;
+  assert(Archive_read(archive, "lobby", kFrames - 18, 10, collectRecord, &page) == kFrames - 38);
+  assert(page.count == 10 && page.sequences[9] == kFrames - 20);
+  printf(".");
+
+  // Paging goes through all the segments, until there are no older records
+  Page all = {};
+  uint64_t cursor = 0;
+  do {
+    page.count = 0;
+    cursor = Archive_read(archive, "lobby", cursor, 7, collectRecord, &page);
+    assert(page.count == 7 || cursor == 0);
+    memmove(all.sequences + page.count, all.sequences, all.count * sizeof(uint64_t));
+    memcpy(all.sequences, page.sequences, page.count * sizeof(uint64_t));
+    all.count += page.count;
+  } while (cursor != 0);
+  assert(all.count == kFrames / 2);
+  for (size_t i = 0; i < all.count; i++) assert(all.sequences[i] == 2 * (i + 1));
+  printf(".");
+
+  // Other rooms and cursors past the last record
+  page.count = 0;
+  assert(Archive_read(archive, "chess", 0, 10, collectRecord, &page) == 0 && page.count == 0);
+  assert(Archive_read(archive, "lobby", 5, 10, collectRecord, &page) == 0 && page.count == 2);
+  page.count = 0;
+  assert(Archive_read(archive, "lobby", kFrames * 10, 1, collectRecord, &page) == kFrames);
+  assert(page.count == 1 && page.sequences[0] == kFrames);
+  Archive_close(&archive);
+  printf(".");
+
+  // A reopened archive continues the sequence in a new segment
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  assert(Archive_last(archive) == kFrames && Archive_segments(archive) == segments);
+  assert(Archive_size(archive) == size);
+  appendFrames(archive, 1);
+  assert(Archive_segments(archive) == segments + 1);
+  Archive_close(&archive);
+  snprintf(file, sizeof(file), "%s/%020d.log", path, kFrames + 1);
+  assert(access(file, F_OK) == 0);
+  printf(".");
+
+  // Records torn by a crash and the preallocated space are discarded
+  FILE *segment = fopen(file, "a");
+  assert(segment != NULL);
+  ArchiveRecord torn = { .sequence = kFrames + 2, .length = 100, .checksum = 1 };
+  fwrite(&torn, sizeof(torn), 1, segment);
+  char zeros[256] = {};
+  fwrite(zeros, sizeof(zeros), 1, segment);
+  fclose(segment);
+  snprintf(file, sizeof(file), "%s/%020d.idx", path, kFrames + 1);
+  unlink(file);
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL && Archive_last(archive) == kFrames + 1);
+  assert(access(file, F_OK) == 0);
+  Archive_close(&archive);
+  snprintf(file, sizeof(file), "%s/%020d.log", path, kFrames + 1);
+  data = readFile(file, &length);
+  assert(length == sizeof(ArchiveRecord) + ((((ArchiveRecord *)data)->roomLength + ((ArchiveRecord *)data)->length + 7) & ~(size_t)7));
+  free(data);
+  printf(".");
+
+  // The oldest segments are removed when the archive is too large
+  archive = Archive_open(path, kArchiveMinSegmentSize, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  appendFrames(archive, 1);
+  waitForSegments(archive, 3);
+  assert(Archive_segments(archive) <= 3 && Archive_size(archive) <= kArchiveMinSegmentSize);
+  assert(Archive_last(archive) == kFrames + 2);
+  snprintf(file, sizeof(file), "%s/%020d.log", path, 1);
+  assert(access(file, F_OK) != 0);
+  Archive_close(&archive);
+  printf(".");
+
+  // And when they are too old, except the active one
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 1);
+  assert(archive != NULL);
+  sleep(1);
+  appendFrames(archive, 1);
+  waitForSegments(archive, 1);
+  assert(Archive_segments(archive) == 1 && Archive_last(archive) == kFrames + 3);
+  Archive_close(&archive);
+  assert(countFiles(path, "log") == 1);
+  printf(".");
+
+  removeArchive(path);
+
+  // A damaged record of an older segment hides the rest of that segment only
+  assert(mkdtemp(strcpy(path, "/tmp/c2hat-archive-XXXXXX")) != NULL);
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  appendFrames(archive, 2 * kFrames);
+  Archive_close(&archive);
+  uint64_t firsts[16] = {};
+  segments = listSegments(path, firsts, 16);
+  assert(segments > 2);
+  uint64_t damaged = firsts[2] - 1;
+  corruptRecord(path, firsts[1], damaged);
+  snprintf(file, sizeof(file), "%s/%020" PRIu64 ".log", path, firsts[1]);
+  free(readFile(file, &size));
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  assert(Archive_last(archive) == 2 * kFrames && Archive_segments(archive) == segments);
+  readAll(archive, &all);
+  assert(all.count == kFrames - (damaged % 2 == 0));
+  for (size_t i = 1; i < all.count; i++) {
+    assert(all.sequences[i] > all.sequences[i - 1] && all.sequences[i] != damaged);
+  }
+  Archive_close(&archive);
+  free(readFile(file, &length));
+  assert(length == size);
+  printf(".");
+
+  // A segment without valid records is kept on disk and skipped,
+  // the later ones are still read and the sequence continues after them
+  corruptRecord(path, firsts[1], firsts[1]);
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  assert(Archive_last(archive) == 2 * kFrames && Archive_segments(archive) == segments - 1);
+  readAll(archive, &all);
+  for (size_t i = 0; i < all.count; i++) {
+    assert(all.sequences[i] < firsts[1] || all.sequences[i] >= firsts[2]);
+  }
+  assert(all.sequences[all.count - 1] == 2 * kFrames);
+  size_t hidden = (firsts[2] - 1) / 2 - (firsts[1] - 1) / 2;
+  assert(all.count == kFrames - hidden);
+  appendFrames(archive, 1);
+  Archive_close(&archive);
+  assert(countFiles(path, "log") == segments + 1 && access(file, F_OK) == 0);
+  snprintf(file, sizeof(file), "%s/%020d.log", path, 2 * kFrames + 1);
+  assert(access(file, F_OK) == 0);
+  printf(".");
+
+  removeArchive(path);
+
+  // Records are found by time, also with the index loaded from disk
+  assert(mkdtemp(strcpy(path, "/tmp/c2hat-archive-XXXXXX")) != NULL);
+  archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+  assert(archive != NULL);
+  assert(Archive_seek(archive, 0) == 0);
+  int64_t times[4] = {};
+  uint64_t starts[4] = {};
+  for (size_t i = 0; i < 4; i++) {
+    times[i] = pauseAndNow();
+    starts[i] = Archive_last(archive) + 1;
+    appendFrames(archive, kFrames / 2);
+  }
+  int64_t end = pauseAndNow();
+  assert(Archive_segments(archive) > 1);
+  for (int reopen = 0; reopen < 2; reopen++) {
+    assert(Archive_seek(archive, 0) == 1);
+    for (size_t i = 0; i < 4; i++) {
+      assert(Archive_seek(archive, times[i]) == starts[i]);
+      assert(Archive_seek(archive, times[i] + 1) == starts[i]);
+    }
+    assert(Archive_seek(archive, end) == 0);
+    Archive_close(&archive);
+    archive = Archive_open(path, 16 * 1024 * 1024, kArchiveMinSegmentSize, 0);
+    assert(archive != NULL);
+  }
+  Archive_close(&archive);
+  printf(".");
+
+  removeArchive(path);
+  printf("\n");
+  return 0;
+}
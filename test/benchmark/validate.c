@@ -0,0 +1,102 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <regex.h>
+
+#include "validate/validate.h"
+
+enum {
+  kIterations = 200000
+};
+
+/// The nickname rule used by the server
+static const char *kPattern = "^[[:alpha:]][[:alnum:]!@#$%&]\\{1,14\\}$";
+
+/// A mix of valid and invalid nicknames
+static const char *kSamples[] = {
+  "Jo", "J0e$m1th99", "UsernameWith15C", "Holy!@#$%&",
+  "J", "10Endians", "No Spaces", "UsernameLongerThan15Characters"
+};
+static const size_t kSampleCount = sizeof(kSamples) / sizeof(kSamples[0]);
+
+/// Prevents the compiler from optimising the calls away
+static volatile int sink = 0;
+
+/// Returns the current time in nanoseconds
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+/// Compiles the pattern for every match, like Regex_match() used to
+static int matchUncached(const char *subject) {
+  regex_t regex;
+  if (regcomp(&regex, kPattern, REG_ICASE)) return -1;
+  int result = regexec(&regex, subject, 0, NULL, 0) == 0;
+  regfree(&regex);
+  return result;
+}
+
+/// Uses the compiled pattern cache
+static int matchCached(const char *subject) {
+  return Regex_match(subject, kPattern, NULL, 0);
+}
+
+/// Uses the hand-written validator
+static int matchFast(const char *subject) {
+  return Validate_nickname(subject);
+}
+
+/// Runs a validator on the samples and returns the nanoseconds per call
+static double run(const char *name, int (*validate)(const char *), int iterations) {
+  double start = now();
+  for (int i = 0; i < iterations; i++) {
+    sink += validate(kSamples[i % kSampleCount]);
+  }
+  double elapsed = (now() - start) / iterations;
+  printf("%-24s %10.1f ns/call\n", name, elapsed);
+  return elapsed;
+}
+
+int main() {
+  // Both implementations must agree before comparing them
+  for (size_t i = 0; i < kSampleCount; i++) {
+    if (matchCached(kSamples[i]) != matchFast(kSamples[i])) {
+      fprintf(stderr, "Validators disagree on '%s'\n", kSamples[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  double uncached = run("regcomp + regexec", matchUncached, kIterations / 10);
+  double cached = run("cached regexec", matchCached, kIterations);
+  double fast = run("hand-written validator", matchFast, kIterations);
+
+  printf("\nCached regex speedup: %.1fx\n", uncached / cached);
+  printf("Hand-written speedup: %.1fx over cached regexec, %.1fx over regcomp\n",
+    cached / fast, uncached / fast);
+
+  Regex_clearCache();
+  return EXIT_SUCCESS;
+}
@@ -183,9 +183,12 @@ void* RunBot(void* data) {
       if (received <= 0) {
         break;
       }
-      // Print up to byte_received from the server
+      // Print the complete messages received from the server
       MessageBuffer *buffer = Client_getBuffer(bot);
-      printf("[%s/server]: %.*s\n", nickname, received, buffer->start);
+      C2HMessageView view = {};
+      while (C2HMessage_next(buffer, &view)) {
+        printf("[%s/server]: %d [%s] %s\n", nickname, view.type, view.user, view.content);
+      }
     }
 
     // Throw a dice to send a message
@@ -375,12 +378,14 @@ void parseOptions(int argc, ARGV argv, BotOptions *params) {
 
   // Build the options list
   int debug = 0;
+  int binary = 0;
   struct option options[] = {
     {"num-bots", required_argument, NULL, 'n'},
     {"cacert", required_argument, NULL, 'f'},
     {"capath", required_argument, NULL, 'd'},
     {"help", no_argument, NULL, 'h'},
     {"debug", no_argument, &debug, 1},
+    {"binary", no_argument, &binary, 1},
     { NULL, 0, NULL, 0}
   };
 
@@ -422,6 +427,7 @@ void parseOptions(int argc, ARGV argv, BotOptions *params) {
       break;
       case 0:
         if (debug) clientOptions.logLevel = LOG_DEBUG;
+        if (binary) clientOptions.binaryProtocol = true;
       break;
     }
   }
@@ -458,6 +464,7 @@ void help(const char *program) {
     "                   specified, the default path will be used:\n"
     "                   $HOME/.local/share/c2hat/ssl\n"
     "   -h, --help      display this help message;\n"
+    "       --binary    use the binary protocol (v2);\n"
     "       --debug     enable verbose logging;\n"
     "\n", basename((char *)program)
   );
@@ -0,0 +1,131 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "cqueue/cqueue.h"
+#include "cqueue_tests.h"
+
+// Returns the elapsed time in milliseconds since start
+static long elapsed(struct timespec *start) {
+  struct timespec now = {};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void TestCQueue_wait() {
+  CQueue *myq = CQueue_new();
+  assert(myq != NULL);
+  printf(".");
+
+  // Waiting on an empty queue times out
+  struct timespec start = {};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  assert(!CQueue_wait(myq, 50));
+  printf(".");
+  assert(elapsed(&start) >= 40);
+  printf(".");
+
+  // Waiting on a non-empty queue returns immediately
+  assert(CQueue_push(myq, "Foo", 3));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  assert(CQueue_wait(myq, 1000));
+  printf(".");
+  assert(elapsed(&start) < 500);
+  printf(".");
+
+  CQueue_free(&myq);
+  assert(myq == NULL);
+  printf(".");
+}
+
+void TestCQueue_popAll() {
+  CQueue *myq = CQueue_new();
+
+  // Nothing to pop from an empty queue
+  assert(CQueue_popAll(myq) == NULL);
+  printf(".");
+
+  assert(CQueue_push(myq, "Foo", 3));
+  assert(CQueue_push(myq, "Bar", 3));
+  assert(CQueue_push(myq, "Baz", 3));
+
+  Queue *items = CQueue_popAll(myq);
+  assert(items != NULL);
+  printf(".");
+  assert(Queue_length(items) == 3);
+  printf(".");
+
+  // The concurrent queue is empty but still usable
+  assert(CQueue_tryPop(myq) == NULL);
+  printf(".");
+  assert(CQueue_push(myq, "Qux", 3));
+  QueueData *item = CQueue_tryPop(myq);
+  assert(item != NULL && strncmp(item->content, "Qux", item->length) == 0);
+  printf(".");
+  QueueData_free(&item);
+
+  // Items are detached in the original order
+  item = Queue_dequeue(items);
+  assert(strncmp(item->content, "Foo", item->length) == 0);
+  printf(".");
+  QueueData_free(&item);
+  item = Queue_dequeue(items);
+  assert(strncmp(item->content, "Bar", item->length) == 0);
+  printf(".");
+  QueueData_free(&item);
+
+  Queue_free(&items);
+  CQueue_free(&myq);
+}
+
+// Pushes an item after a short delay
+static void *producer(void *data) {
+  struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000000 };
+  nanosleep(&ts, NULL);
+  CQueue_push((CQueue *)data, "Foo", 3);
+  return NULL;
+}
+
+void TestCQueue_waitWithProducer() {
+  CQueue *myq = CQueue_new();
+  pthread_t producerID = 0;
+
+  struct timespec start = {};
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&producerID, NULL, producer, myq);
+
+  // The consumer wakes up as soon as data is pushed
+  assert(CQueue_wait(myq, 5000));
+  printf(".");
+  assert(elapsed(&start) < 2000);
+  printf(".");
+  pthread_join(producerID, NULL);
+
+  QueueData *item = CQueue_tryPop(myq);
+  assert(item != NULL);
+  printf(".");
+  QueueData_free(&item);
+  CQueue_free(&myq);
+}
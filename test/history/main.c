@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "history.h"
+
+static const char *kPadding = " - Lorem ipsum dolor sit amet, consectetur adipiscing elit";
+
+/// Encodes a chat message into a new frame, larger than kHistoryMinFrameSize
+static Frame *newFrame(int i) {
+  C2HMessage *message = C2HMessage_create(kMessageTypeMsg, "[Joe] message %02d%s", i, kPadding);
+  Frame *frame = Frame_new(message, 0);
+  C2HMessage_free(&message);
+  assert(frame != NULL);
+  return frame;
+}
+
+int main() {
+  Frame *frame = newFrame(0);
+  size_t size = Frame_size(frame);
+  assert(size >= kHistoryMinFrameSize);
+  Frame *frames[64] = {};
+
+  // The history holds the size of ten frames
+  History *history = History_new(size * 10);
+  assert(history != NULL);
+  assert(History_length(history) == 0 && History_size(history) == 0);
+  assert(History_collect(history, "lobby", UINT64_MAX, frames, 64) == 0);
+  printf(".");
+
+  // Frames get increasing sequence numbers and the history holds a reference
+  assert(History_add(history, frame, "lobby") == 1);
+  assert(atomic_load(&(frame->references)) == 2);
+  Frame_release(&frame);
+  for (int i = 1; i < 6; i++) {
+    frame = newFrame(i);
+    assert(History_add(history, frame, (i % 2) ? "lobby" : "games") == (uint64_t)i + 1);
+    Frame_release(&frame);
+  }
+  assert(History_length(history) == 6 && History_size(history) == size * 6);
+  printf(".");
+
+  // Frames are collected by room, oldest first
+  size_t count = History_collect(history, "lobby", UINT64_MAX, frames, 64);
+  assert(count == 4);
+  assert(strncmp(frames[0]->data, "/msg [Joe] message 00", 21) == 0);
+  assert(strncmp(frames[1]->data, "/msg [Joe] message 01", 21) == 0);
+  assert(strncmp(frames[3]->data, "/msg [Joe] message 05", 21) == 0);
+  for (size_t i = 0; i < count; i++) Frame_release(&frames[i]);
+  assert(History_collect(history, "nowhere", UINT64_MAX, frames, 64) == 0);
+  printf(".");
+
+  // Only the most recent frames are collected, up to a sequence number
+  count = History_collect(history, "lobby", 4, frames, 2);
+  assert(count == 2);
+  assert(strncmp(frames[0]->data, "/msg [Joe] message 01", 21) == 0);
+  assert(strncmp(frames[1]->data, "/msg [Joe] message 03", 21) == 0);
+  for (size_t i = 0; i < count; i++) Frame_release(&frames[i]);
+  printf(".");
+
+  // The oldest frames are released when the history is full
+  for (int i = 6; i < 25; i++) {
+    frame = newFrame(i);
+    History_add(history, frame, "lobby");
+    Frame_release(&frame);
+  }
+  assert(History_length(history) == 10 && History_size(history) <= size * 10);
+  count = History_collect(history, "lobby", UINT64_MAX, frames, 64);
+  assert(count == 10);
+  assert(strncmp(frames[0]->data, "/msg [Joe] message 15", 21) == 0);
+  assert(strncmp(frames[9]->data, "/msg [Joe] message 24", 21) == 0);
+  printf(".");
+
+  // Frames larger than the history are not stored
+  History *tiny = History_new(size / 2);
+  assert(History_add(tiny, frames[0], "lobby") == 0);
+  assert(History_length(tiny) == 0);
+  History_free(&tiny);
+  printf(".");
+
+  // Collected frames survive the history
+  History_free(&history);
+  assert(history == NULL);
+  assert(strncmp(frames[9]->data, "/msg [Joe] message 24", 21) == 0);
+  for (size_t i = 0; i < count; i++) Frame_release(&frames[i]);
+  printf(".");
+
+  printf("\n");
+  return 0;
+}
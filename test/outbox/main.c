@@ -0,0 +1,147 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "outbox.h"
+
+// Creates a frame for the given content
+static Frame *frame(const char *content) {
+  C2HMessage *message = C2HMessage_create(kMessageTypeMsg, content);
+  Frame *frame = Frame_new(message, 0);
+  C2HMessage_free(&message);
+  return frame;
+}
+
+int main() {
+  Frame *one = frame("one");
+  Frame *two = frame("two");
+  Frame *three = frame("three");
+
+  // Frames are encoded once in wire format
+  assert(one != NULL && one->length == strlen("/msg one") + 1);
+  printf(".");
+  assert(strcmp(one->data, "/msg one") == 0);
+  printf(".");
+
+  // The binary encoding is stored in the same frame
+  size_t length = 0;
+  const char *binary = Frame_encoding(one, kMessageProtocolBinary, &length);
+  assert(binary == one->data + one->length && length == kMessageHeaderSize + 1 + 4);
+  assert(memcmp(binary, "\xC2\0\0\x82\0\0\0\x05\0one\0", length) == 0);
+  assert(Frame_encoding(one, kMessageProtocolText, &length) == one->data);
+  assert(length == one->length);
+  printf(".");
+
+  // Large messages are compressed once, when the frame is created
+  char content[1024] = {};
+  memset(content, 'x', sizeof(content) - 1);
+  C2HMessage *message = C2HMessage_new(kMessageTypeMsg, "Joe", content, strlen(content));
+  Frame *large = Frame_new(message, 256);
+  Frame *small = Frame_new(message, 2048);
+  C2HMessage_free(&message);
+  assert(large->compressed != NULL && large->compressedLength < large->binaryLength);
+  assert(Frame_encoding(large, kMessageProtocolCompressed, &length) == large->compressed);
+  assert(Frame_encoding(large, kMessageProtocolBinary, &length) == large->binary);
+  // The unused deflate bound is released, the size covers all the encodings
+  assert(large->compressed == large->binary + large->binaryLength);
+  assert(Frame_size(large) == sizeof(Frame) + large->length + large->binaryLength + large->compressedLength);
+  printf(".");
+
+  // Frames below the threshold are sent uncompressed to all clients
+  assert(small->compressed == NULL);
+  assert(Frame_encoding(small, kMessageProtocolCompressed, &length) == small->binary);
+  assert(length == small->binaryLength);
+  Frame_release(&large);
+  Frame_release(&small);
+  printf(".");
+
+  // The drop policy discards the oldest messages
+  Outbox *outbox = Outbox_new(2, kOutboxPolicyDrop);
+  assert(outbox != NULL);
+  printf(".");
+
+  assert(!Outbox_pending(outbox));
+  printf(".");
+
+  assert(Outbox_push(outbox, one));
+  assert(Outbox_push(outbox, two));
+  assert(Outbox_pending(outbox));
+  printf(".");
+
+  // Each outbox holds its own reference
+  assert(atomic_load(&(one->references)) == 2);
+  printf(".");
+
+  assert(Outbox_push(outbox, three));
+  assert(Outbox_dropped(outbox) == 1);
+  printf(".");
+
+  // The dropped frame reference has been released
+  assert(atomic_load(&(one->references)) == 1);
+  printf(".");
+
+  assert(!Outbox_overflow(outbox));
+  printf(".");
+
+  Outbox_free(&outbox);
+  assert(outbox == NULL);
+  printf(".");
+
+  assert(atomic_load(&(two->references)) == 1);
+  printf(".");
+
+  // The disconnect policy refuses new messages once full
+  outbox = Outbox_new(2, kOutboxPolicyDisconnect);
+  assert(Outbox_push(outbox, one));
+  assert(Outbox_push(outbox, two));
+  assert(!Outbox_push(outbox, three));
+  printf(".");
+
+  assert(Outbox_overflow(outbox));
+  printf(".");
+
+  assert(Outbox_dropped(outbox) == 0);
+  printf(".");
+
+  // Once overflowed, the outbox stays closed
+  assert(!Outbox_push(outbox, one));
+  printf(".");
+  Outbox_free(&outbox);
+
+  // A zero limit still allows one message at a time
+  outbox = Outbox_new(0, kOutboxPolicyDisconnect);
+  assert(Outbox_push(outbox, one));
+  assert(!Outbox_push(outbox, two));
+  printf(".");
+  Outbox_free(&outbox);
+
+  Frame_release(&one);
+  assert(one == NULL);
+  printf(".");
+  Frame_release(&two);
+  Frame_release(&three);
+
+  printf("\n");
+  return 0;
+}
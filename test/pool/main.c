@@ -0,0 +1,148 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "pool/pool.h"
+
+enum {
+  kThreads = 8,
+  kRounds = 2000,
+  kBatch = 50
+};
+
+/// Allocates and releases batches of objects, checking they are not shared
+void *churn(void *data) {
+  Pool *pool = (Pool *)data;
+  uint64_t *items[kBatch] = {};
+  for (uint64_t round = 0; round < kRounds; round++) {
+    size_t count = 1 + round % kBatch;
+    for (size_t i = 0; i < count; i++) {
+      items[i] = Pool_alloc(pool);
+      assert(items[i] != NULL);
+      items[i][0] = (uintptr_t)items + i;
+      items[i][1] = round;
+    }
+    for (size_t i = 0; i < count; i++) {
+      assert(items[i][0] == (uintptr_t)items + i);
+      assert(items[i][1] == round);
+      Pool_release(pool, items[i]);
+    }
+  }
+  return NULL;
+}
+
+/// Allocates objects that are released by the main thread after the exit
+void *allocate(void *data) {
+  Pool *pool = ((Pool **)data)[0];
+  void **items = (void **)data + 1;
+  for (size_t i = 0; i < kBatch; i++) items[i] = Pool_alloc(pool);
+  return NULL;
+}
+
+int main() {
+  printf("[Pool] Running tests ");
+
+  // Objects are aligned and reused by the same thread
+  Pool *pool = Pool_new(20, 4);
+  assert(pool != NULL);
+  char *first = Pool_alloc(pool);
+  assert(first != NULL);
+  assert((uintptr_t)first % _Alignof(max_align_t) == 0);
+  Pool_release(pool, first);
+  assert(Pool_alloc(pool) == first);
+  Pool_release(pool, first);
+  printf(".");
+
+  // Zero-filled objects
+  char *item = Pool_alloc(pool);
+  memset(item, 'x', 20);
+  Pool_release(pool, item);
+  item = Pool_calloc(pool);
+  for (size_t i = 0; i < 20; i++) assert(item[i] == 0);
+  Pool_release(pool, item);
+  printf(".");
+
+  // The pool grows when all the objects are in use
+  PoolCounters counters = {};
+  Pool_getCounters(pool, &counters);
+  assert(counters.slabs == 1 && counters.capacity == 4);
+  char *items[100] = {};
+  for (size_t i = 0; i < 100; i++) {
+    items[i] = Pool_alloc(pool);
+    assert(items[i] != NULL);
+    for (size_t j = 0; j < i; j++) assert(items[i] != items[j]);
+  }
+  for (size_t i = 0; i < 100; i++) Pool_release(pool, items[i]);
+  Pool_getCounters(pool, &counters);
+  assert(counters.slabs > 1 && counters.capacity >= 100);
+  assert(counters.allocations == 104 && counters.releases == 104);
+  assert(counters.flushes > 0 && counters.refills > 0);
+  printf(".");
+  Pool_free(&pool);
+  assert(pool == NULL);
+  printf(".");
+
+  // Concurrent threads, their counters survive the exit
+  pool = Pool_new(2 * sizeof(uint64_t), 64);
+  pthread_t threads[kThreads] = {};
+  for (size_t i = 0; i < kThreads; i++) {
+    assert(pthread_create(&threads[i], NULL, churn, pool) == 0);
+  }
+  for (size_t i = 0; i < kThreads; i++) pthread_join(threads[i], NULL);
+  Pool_getCounters(pool, &counters);
+  uint64_t expected = 0;
+  for (uint64_t round = 0; round < kRounds; round++) expected += 1 + round % kBatch;
+  assert(counters.allocations == expected * kThreads);
+  assert(counters.releases == counters.allocations);
+  printf(".");
+
+  // Objects allocated by a thread can be released by another one
+  void *shared[1 + kBatch] = {pool};
+  pthread_t thread;
+  assert(pthread_create(&thread, NULL, allocate, shared) == 0);
+  pthread_join(thread, NULL);
+  for (size_t i = 1; i <= kBatch; i++) {
+    assert(shared[i] != NULL);
+    Pool_release(pool, shared[i]);
+  }
+  Pool_getCounters(pool, &counters);
+  assert(counters.releases == counters.allocations);
+  printf(".");
+
+  // A new pool doesn't inherit the cache of a destroyed one
+  Pool_free(&pool);
+  pool = Pool_new(64, 0);
+  item = Pool_alloc(pool);
+  assert(item != NULL);
+  Pool_getCounters(pool, &counters);
+  assert(counters.allocations == 1 && counters.slabs == 1);
+  Pool_release(pool, item);
+  Pool_free(&pool);
+  printf(".");
+
+  printf("\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "ratelimit.h"
+
+int main() {
+  // A full bucket allows a burst up to its capacity
+  TokenBucket bucket = {};
+  TokenBucket_init(&bucket, 5, 5, 1000);
+  for (int i = 0; i < 5; i++) {
+    assert(TokenBucket_take(&bucket, 1, 1000));
+  }
+  assert(!TokenBucket_take(&bucket, 1, 1000));
+  printf(".");
+
+  // Tokens are added at the given rate
+  assert(!TokenBucket_take(&bucket, 1, 1100));
+  assert(TokenBucket_take(&bucket, 1, 1200));
+  assert(!TokenBucket_take(&bucket, 1, 1200));
+  printf(".");
+
+  // The bucket never exceeds its capacity
+  TokenBucket_refill(&bucket, 100000);
+  assert(bucket.tokens == 5);
+  assert(!TokenBucket_take(&bucket, 6, 100000));
+  assert(bucket.tokens == 5);
+  printf(".");
+
+  // Time going backwards doesn't add tokens
+  TokenBucket_refill(&bucket, 500);
+  assert(bucket.tokens == 5);
+  assert(bucket.updated == 100000);
+  printf(".");
+
+  // A zero rate disables the limit
+  TokenBucket unlimited = {};
+  TokenBucket_init(&unlimited, 0, 0, 1000);
+  for (int i = 0; i < 1000; i++) {
+    assert(TokenBucket_take(&unlimited, 1000, 1000));
+  }
+  printf(".");
+
+  // Both the message and byte limits apply
+  RateLimit limit = {};
+  RateLimit_init(&limit, 2, 100, 10, 1000);
+  assert(RateLimit_allow(&limit, 10, 1000));
+  assert(RateLimit_allow(&limit, 10, 1000));
+  assert(!RateLimit_allow(&limit, 10, 1000));
+  assert(RateLimit_allow(&limit, 10, 1500));
+  printf(".");
+
+  // Rejected messages don't take tokens from the other bucket
+  RateLimit_init(&limit, 10, 100, 10, 1000);
+  assert(RateLimit_allow(&limit, 90, 1000));
+  assert(!RateLimit_allow(&limit, 20, 1000));
+  assert(limit.messages.tokens == 9);
+  assert(RateLimit_allow(&limit, 10, 1000));
+  printf(".");
+
+  // The byte bucket always holds the largest message
+  RateLimit_init(&limit, 0, 100, 1000, 1000);
+  assert(RateLimit_allow(&limit, 1000, 1000));
+  assert(!RateLimit_allow(&limit, 1000, 1000));
+  assert(!RateLimit_allow(&limit, 1000, 10900));
+  assert(RateLimit_allow(&limit, 1000, 11000));
+  printf(".");
+
+  // No limits at all
+  RateLimit_init(&limit, 0, 0, 1000, 1000);
+  for (int i = 0; i < 1000; i++) {
+    assert(RateLimit_allow(&limit, 1000, 1000));
+  }
+  printf(".");
+
+  printf("\n");
+  return EXIT_SUCCESS;
+}
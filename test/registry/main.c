@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+
+#include "registry.h"
+
+enum {
+  kManyConnections = 5000
+};
+
+int main() {
+  int items[kManyConnections] = {};
+
+  Registry *registry = Registry_new();
+  assert(registry != NULL);
+  assert(Registry_length(registry) == 0);
+  assert(Registry_first(registry) == NULL);
+  printf(".");
+
+  // Connections are indexed by ID and socket
+  assert(Registry_add(registry, &items[0], 1, 10));
+  assert(Registry_add(registry, &items[1], 2, 11));
+  assert(Registry_length(registry) == 2);
+  printf(".");
+
+  assert(Registry_get(registry, 1) == &items[0]);
+  assert(Registry_get(registry, 2) == &items[1]);
+  assert(Registry_get(registry, 3) == NULL);
+  printf(".");
+
+  assert(Registry_getBySocket(registry, 11) == &items[1]);
+  assert(Registry_getBySocket(registry, 12) == NULL);
+  printf(".");
+
+  // IDs and sockets are unique
+  assert(!Registry_add(registry, &items[2], 1, 12));
+  assert(!Registry_add(registry, &items[2], 3, 10));
+  assert(Registry_length(registry) == 2);
+  printf(".");
+
+  // Nicknames are unique
+  assert(Registry_getByNickname(registry, "Alice") == NULL);
+  assert(Registry_setNickname(registry, 1, "Alice"));
+  assert(!Registry_setNickname(registry, 2, "Alice"));
+  assert(Registry_setNickname(registry, 1, "Alice"));
+  assert(Registry_getByNickname(registry, "Alice") == &items[0]);
+  printf(".");
+
+  assert(!Registry_setNickname(registry, 3, "Bob"));
+  printf(".");
+
+  // A nickname can be changed and the old one becomes available
+  assert(Registry_setNickname(registry, 1, "Alicia"));
+  assert(Registry_getByNickname(registry, "Alice") == NULL);
+  assert(Registry_setNickname(registry, 2, "Alice"));
+  assert(Registry_getByNickname(registry, "Alice") == &items[1]);
+  printf(".");
+
+  // A released nickname is no longer indexed and can be taken again
+  Registry_unsetNickname(registry, 2);
+  assert(Registry_getByNickname(registry, "Alice") == NULL);
+  assert(Registry_get(registry, 2) == &items[1]);
+  Registry_unsetNickname(registry, 2);
+  assert(Registry_setNickname(registry, 2, "Alice"));
+  assert(Registry_getByNickname(registry, "Alice") == &items[1]);
+  printf(".");
+
+  // Entries are walked in connection order
+  RegistryEntry *entry = Registry_first(registry);
+  assert(entry != NULL && entry->item == &items[0]);
+  assert(entry->next != NULL && entry->next->item == &items[1]);
+  assert(entry->next->next == NULL);
+  printf(".");
+
+  // Removing a connection releases its ID, socket and nickname
+  assert(Registry_remove(registry, 1) == &items[0]);
+  assert(Registry_remove(registry, 1) == NULL);
+  assert(Registry_get(registry, 1) == NULL);
+  assert(Registry_getBySocket(registry, 10) == NULL);
+  assert(Registry_getByNickname(registry, "Alicia") == NULL);
+  assert(Registry_length(registry) == 1);
+  assert(Registry_first(registry)->item == &items[1]);
+  printf(".");
+
+  assert(Registry_add(registry, &items[0], 3, 10));
+  assert(Registry_setNickname(registry, 3, "Alicia"));
+  printf(".");
+
+  Registry_free(&registry);
+  assert(registry == NULL);
+  printf(".");
+
+  // Many connections, the indexes grow and keep working
+  registry = Registry_new();
+  char nickname[16] = {};
+  for (int i = 0; i < kManyConnections; i++) {
+    assert(Registry_add(registry, &items[i], i + 1, i + 100));
+    snprintf(nickname, sizeof(nickname), "user%d", i);
+    assert(Registry_setNickname(registry, i + 1, nickname));
+  }
+  assert(Registry_length(registry) == kManyConnections);
+  printf(".");
+
+  for (int i = 0; i < kManyConnections; i++) {
+    snprintf(nickname, sizeof(nickname), "user%d", i);
+    assert(Registry_get(registry, i + 1) == &items[i]);
+    assert(Registry_getBySocket(registry, i + 100) == &items[i]);
+    assert(Registry_getByNickname(registry, nickname) == &items[i]);
+  }
+  printf(".");
+
+  // Remove every other connection
+  for (int i = 0; i < kManyConnections; i += 2) {
+    assert(Registry_remove(registry, i + 1) == &items[i]);
+  }
+  assert(Registry_length(registry) == kManyConnections / 2);
+  for (int i = 0; i < kManyConnections; i++) {
+    snprintf(nickname, sizeof(nickname), "user%d", i);
+    void *expected = (i % 2) ? &items[i] : NULL;
+    assert(Registry_get(registry, i + 1) == expected);
+    assert(Registry_getByNickname(registry, nickname) == expected);
+  }
+  printf(".");
+
+  size_t count = 0;
+  for (entry = Registry_first(registry); entry != NULL; entry = entry->next) {
+    assert(entry->item == &items[count * 2 + 1]);
+    count++;
+  }
+  assert(count == kManyConnections / 2);
+  printf(".");
+
+  Registry_free(&registry);
+
+  printf("\n");
+  return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rooms.h"
+
+int main() {
+  // Room names are short identifiers
+  assert(Room_nameIsValid("lobby"));
+  assert(Room_nameIsValid("C2hat_dev-2"));
+  assert(!Room_nameIsValid(""));
+  assert(!Room_nameIsValid(NULL));
+  assert(!Room_nameIsValid("two words"));
+  assert(!Room_nameIsValid("#lobby"));
+  assert(Room_nameIsValid("abcdefghijklmnopqrstuvwxyz01234"));
+  assert(!Room_nameIsValid("abcdefghijklmnopqrstuvwxyz012345"));
+  printf(".");
+
+  Rooms *rooms = Rooms_new(2);
+  assert(rooms != NULL);
+  assert(Rooms_new(0) == NULL);
+
+  // Rooms are created when opened, and opening them again returns the same room
+  Room *lobby = Rooms_open(rooms, "lobby");
+  assert(lobby != NULL && strcmp(lobby->name, "lobby") == 0);
+  assert(lobby->shardCount == 2 && lobby->length == 0);
+  assert(Rooms_open(rooms, "lobby") == lobby);
+  assert(Rooms_get(rooms, "lobby") == lobby);
+  assert(Rooms_get(rooms, "books") == NULL);
+  assert(Rooms_open(rooms, "no way") == NULL);
+  assert(Rooms_length(rooms) == 1);
+  printf(".");
+
+  // Members are stored in their shard, in dense arrays
+  int members[5] = {};
+  size_t slots[5] = {};
+  for (int i = 0; i < 5; i++) {
+    assert(Room_add(lobby, i % 2, &members[i], &slots[i]));
+  }
+  assert(!Room_add(lobby, 2, &members[0], &slots[0]));
+  assert(lobby->length == 5);
+  assert(lobby->shards[0].length == 3 && lobby->shards[1].length == 2);
+  assert(slots[0] == 0 && slots[2] == 1 && slots[4] == 2);
+  assert(slots[1] == 0 && slots[3] == 1);
+  printf(".");
+
+  // Removing a member moves the last one of the shard into its slot
+  void *moved = Room_remove(lobby, 0, slots[0]);
+  assert(moved == &members[4]);
+  slots[4] = slots[0];
+  assert(lobby->shards[0].items[0] == &members[4]);
+  assert(lobby->shards[0].length == 2 && lobby->length == 4);
+  assert(Room_remove(lobby, 1, slots[3]) == NULL);
+  assert(lobby->shards[1].length == 1 && lobby->length == 3);
+  assert(Room_remove(lobby, 1, 5) == NULL && lobby->length == 3);
+  printf(".");
+
+  // A room with members can't be closed
+  Rooms_close(rooms, lobby);
+  assert(Rooms_get(rooms, "lobby") == lobby);
+  printf(".");
+
+  // The first shard is published for the snapshot readers
+  assert(Room_publish(lobby));
+  unsigned int ticket = 0;
+  const Snapshot *snapshot = SnapshotCell_enter(lobby->subscribers, &ticket);
+  assert(snapshot->length == 2);
+  assert(snapshot->items[0] == &members[4] && snapshot->items[1] == &members[2]);
+  SnapshotCell_leave(lobby->subscribers, ticket);
+  printf(".");
+
+  // A closed room survives while other holders reference it
+  Room *held = Room_retain(lobby);
+  Room_remove(lobby, 0, slots[4]);
+  Room_remove(lobby, 0, 0);
+  Room_remove(lobby, 1, slots[1]);
+  assert(lobby->length == 0);
+  Rooms_close(rooms, lobby);
+  assert(Rooms_get(rooms, "lobby") == NULL && Rooms_length(rooms) == 0);
+  assert(strcmp(held->name, "lobby") == 0);
+  Room_release(&held);
+  assert(held == NULL);
+  printf(".");
+
+  // The index grows with the number of rooms
+  char name[kMaxRoomNameSize] = "";
+  for (int i = 0; i < 100; i++) {
+    snprintf(name, sizeof(name), "room%d", i);
+    Room *room = Rooms_open(rooms, name);
+    assert(room != NULL);
+    assert(Room_add(room, 0, &members[0], &slots[0]));
+  }
+  assert(Rooms_length(rooms) == 100);
+  for (int i = 0; i < 100; i++) {
+    snprintf(name, sizeof(name), "room%d", i);
+    Room *room = Rooms_get(rooms, name);
+    assert(room != NULL && strcmp(room->name, name) == 0);
+  }
+  printf(".");
+
+  // Destroying the list frees the rooms it holds
+  Rooms_free(&rooms);
+  assert(rooms == NULL);
+  printf(".");
+
+  printf("\n");
+  return 0;
+}
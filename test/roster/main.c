@@ -0,0 +1,126 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "roster.h"
+
+enum { kUsers = 100 };
+
+int main() {
+  Roster *roster = Roster_new(0);
+  assert(roster != NULL);
+
+  // An empty roster has one empty page
+  assert(Roster_length(roster) == 0 && Roster_pages(roster) == 1);
+  Frame *page = Roster_page(roster, 0);
+  assert(page != NULL && strcmp(page->data, "/list Online users (page 1):") == 0);
+  Frame_release(&page);
+  assert(Roster_page(roster, 1) == NULL);
+  printf(".");
+
+  // Users are added in order and the pages are cached
+  int users[kUsers] = {};
+  size_t slots[kUsers] = {};
+  char nickname[kMaxNicknameSize] = "";
+  assert(Roster_add(roster, &users[0], "Joe", &slots[0]));
+  assert(Roster_add(roster, &users[1], "Jane", &slots[1]));
+  assert(slots[0] == 0 && slots[1] == 1);
+  page = Roster_page(roster, 0);
+  assert(strcmp(page->data, "/list Online users (page 1): Joe, Jane") == 0);
+  Frame *cached = Roster_page(roster, 0);
+  assert(cached == page);
+  Frame_release(&cached);
+  Frame_release(&page);
+  printf(".");
+
+  // The roster grows and is split in pages that fit a text frame
+  for (int i = 2; i < kUsers; i++) {
+    snprintf(nickname, sizeof(nickname), "User%d", i);
+    assert(Roster_add(roster, &users[i], nickname, &slots[i]));
+    assert(slots[i] == (size_t)i);
+  }
+  size_t pages = (kUsers + kRosterPageSize - 1) / kRosterPageSize;
+  assert(Roster_length(roster) == kUsers && Roster_pages(roster) == pages);
+  for (size_t i = 0; i < pages; i++) {
+    page = Roster_page(roster, i);
+    assert(page != NULL && page->length <= kBufferSize);
+    assert((strstr(page->data, "more with /list") != NULL) == (i + 1 < pages));
+    Frame_release(&page);
+  }
+  page = Roster_page(roster, 1);
+  snprintf(nickname, sizeof(nickname), "(page 2): User%d,", kRosterPageSize);
+  assert(strstr(page->data, nickname) != NULL);
+  Frame_release(&page);
+  printf(".");
+
+  // Pages that don't change are not encoded again
+  Frame *first = Roster_page(roster, 0);
+  Frame *last = Roster_page(roster, pages - 1);
+  void *moved = Roster_remove(roster, slots[kUsers - 2]);
+  assert(moved == &users[kUsers - 1]);
+  slots[kUsers - 1] = slots[kUsers - 2];
+  page = Roster_page(roster, 0);
+  assert(page == first);
+  Frame_release(&page);
+  page = Roster_page(roster, pages - 1);
+  assert(page != last && strstr(page->data, "User98") == NULL);
+  assert(strstr(page->data, "User99") != NULL);
+  Frame_release(&page);
+  Frame_release(&first);
+  Frame_release(&last);
+  printf(".");
+
+  // Removing a user moves the last one into its slot
+  moved = Roster_remove(roster, slots[0]);
+  assert(moved == &users[kUsers - 1]);
+  page = Roster_page(roster, 0);
+  assert(strncmp(page->data, "/list Online users (page 1): User99, Jane,", 42) == 0);
+  Frame_release(&page);
+  assert(Roster_remove(roster, kUsers) == NULL);
+  assert(Roster_length(roster) == kUsers - 2);
+  printf(".");
+
+  // The page count shrinks with the roster
+  while (Roster_length(roster) > (size_t)kRosterPageSize) {
+    Roster_remove(roster, Roster_length(roster) - 1);
+  }
+  assert(Roster_pages(roster) == 1);
+  page = Roster_page(roster, 0);
+  assert(strstr(page->data, "more with") == NULL);
+  Frame_release(&page);
+  assert(Roster_page(roster, 1) == NULL);
+  printf(".");
+
+  // Cached pages survive the roster while they are referenced
+  page = Roster_page(roster, 0);
+  Roster_free(&roster);
+  assert(roster == NULL);
+  assert(strncmp(page->data, "/list Online users", 18) == 0);
+  Frame_release(&page);
+  printf(".");
+
+  printf("\n");
+  return 0;
+}
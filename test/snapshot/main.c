@@ -0,0 +1,129 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "snapshot.h"
+
+enum {
+  kItems = 16,
+  kRounds = 2000,
+  kReaders = 4,
+  kAlive = 0x5a5a5a5a
+};
+
+/// An item that is destroyed after it's removed from the snapshot
+typedef struct {
+  int state;
+} Item;
+
+static SnapshotCell *cell = NULL;
+static atomic_bool done = false;
+static atomic_ulong reads = 0;
+
+// Walks the current snapshot and checks that no item has been destroyed
+static void *reader(void *data) {
+  (void)data;
+  while (!atomic_load(&done)) {
+    unsigned int ticket = 0;
+    const Snapshot *snapshot = SnapshotCell_enter(cell, &ticket);
+    for (size_t i = 0; i < snapshot->length; i++) {
+      assert(((Item *)snapshot->items[i])->state == kAlive);
+    }
+    SnapshotCell_leave(cell, ticket);
+    atomic_fetch_add(&reads, 1);
+  }
+  return NULL;
+}
+
+int main() {
+  cell = SnapshotCell_new();
+  assert(cell != NULL);
+  printf(".");
+
+  // A new cell has an empty snapshot
+  unsigned int ticket = 0;
+  const Snapshot *snapshot = SnapshotCell_enter(cell, &ticket);
+  assert(snapshot->length == 0 && snapshot->version == 0);
+  SnapshotCell_leave(cell, ticket);
+  printf(".");
+
+  // Published snapshots are versioned copies of the items
+  Item one = { kAlive }, two = { kAlive };
+  void *items[kItems] = { &one, &two };
+  assert(SnapshotCell_publish(cell, items, 2));
+  items[0] = NULL;
+  snapshot = SnapshotCell_enter(cell, &ticket);
+  assert(snapshot->version == 1 && snapshot->length == 2);
+  assert(snapshot->items[0] == &one && snapshot->items[1] == &two);
+  SnapshotCell_leave(cell, ticket);
+  printf(".");
+
+  // Writers replace items while readers walk the snapshots,
+  // a removed item is destroyed as soon as publish returns
+  assert(SnapshotCell_publish(cell, items, 0));
+  pthread_t readers[kReaders];
+  for (int i = 0; i < kReaders; i++) {
+    assert(pthread_create(&readers[i], NULL, reader, NULL) == 0);
+  }
+  while (atomic_load(&reads) < kReaders) sched_yield();
+  Item *current[kItems] = {};
+  for (int round = 0; round < kRounds; round++) {
+    size_t slot = round % kItems;
+    Item *removed = current[slot];
+    current[slot] = malloc(sizeof(Item));
+    current[slot]->state = kAlive;
+    size_t length = 0;
+    for (size_t i = 0; i < kItems; i++) {
+      if (current[i] != NULL) items[length++] = current[i];
+    }
+    assert(SnapshotCell_publish(cell, items, length));
+    if (removed != NULL) {
+      removed->state = 0;
+      free(removed);
+    }
+  }
+  atomic_store(&done, true);
+  for (int i = 0; i < kReaders; i++) {
+    pthread_join(readers[i], NULL);
+  }
+  printf(".");
+
+  snapshot = SnapshotCell_enter(cell, &ticket);
+  assert(snapshot->version == kRounds + 2 && snapshot->length == kItems);
+  SnapshotCell_leave(cell, ticket);
+  printf(".");
+
+  for (size_t i = 0; i < kItems; i++) {
+    free(current[i]);
+  }
+  SnapshotCell_free(&cell);
+  assert(cell == NULL);
+  printf(".");
+
+  printf("\n");
+  return 0;
+}
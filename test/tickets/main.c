@@ -0,0 +1,99 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "tickets.h"
+
+enum {
+  kLifetime = 100
+};
+
+int main() {
+  TicketKeys *keys = TicketKeys_new(kLifetime, 1000);
+  assert(keys != NULL);
+
+  // The current key issues and accepts tickets
+  TicketKey first = {};
+  TicketKey found = {};
+  assert(TicketKeys_current(keys, 1000, &first));
+  assert(first.created == 1000);
+  assert(TicketKeys_find(keys, first.name, 1050, &found) == kTicketKeyCurrent);
+  assert(memcmp(&first, &found, sizeof(TicketKey)) == 0);
+  TicketKey same = {};
+  assert(TicketKeys_current(keys, 1099, &same));
+  assert(memcmp(first.name, same.name, kTicketKeyNameSize) == 0);
+  printf(".");
+
+  // Unknown names are rejected
+  unsigned char unknown[kTicketKeyNameSize] = {};
+  assert(TicketKeys_find(keys, unknown, 1050, &found) == kTicketKeyUnknown);
+  printf(".");
+
+  // After its lifetime the key is replaced, its tickets are renewed
+  TicketKey second = {};
+  assert(TicketKeys_current(keys, 1100, &second));
+  assert(second.created == 1100);
+  assert(memcmp(first.name, second.name, kTicketKeyNameSize) != 0);
+  assert(memcmp(first.aesKey, second.aesKey, kTicketKeySize) != 0);
+  assert(TicketKeys_find(keys, first.name, 1150, &found) == kTicketKeyRenew);
+  assert(memcmp(first.hmacKey, found.hmacKey, kTicketKeySize) == 0);
+  assert(TicketKeys_find(keys, second.name, 1150, &found) == kTicketKeyCurrent);
+  printf(".");
+
+  // The previous key expires one lifetime after being replaced
+  assert(TicketKeys_find(keys, first.name, 1199, &found) == kTicketKeyRenew);
+  assert(TicketKeys_find(keys, first.name, 1200, &found) == kTicketKeyUnknown);
+  assert(TicketKeys_find(keys, second.name, 1200, &found) == kTicketKeyRenew);
+  TicketKey third = {};
+  assert(TicketKeys_current(keys, 1200, &third));
+  assert(third.created == 1200);
+  printf(".");
+
+  // After a long idle time all the previous tickets are rejected
+  TicketKey fourth = {};
+  assert(TicketKeys_current(keys, 1500, &fourth));
+  assert(fourth.created == 1500);
+  assert(TicketKeys_find(keys, third.name, 1500, &found) == kTicketKeyUnknown);
+  assert(TicketKeys_find(keys, fourth.name, 1500, &found) == kTicketKeyCurrent);
+  printf(".");
+
+  // The keys can protect the tickets of a server context
+  SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+  assert(context != NULL);
+  assert(TicketKeys_attach(keys, context));
+  assert(SSL_CTX_get_app_data(context) == keys);
+  assert((SSL_CTX_get_options(context) & SSL_OP_NO_TICKET) == 0);
+  assert(SSL_CTX_get_num_tickets(context) == 1);
+  SSL_CTX_free(context);
+  printf(".");
+
+  TicketKeys_free(&keys);
+  assert(keys == NULL);
+  TicketKeys_free(&keys);
+  printf(".");
+
+  printf("\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,180 @@
+/**
+ * Copyright (C) 2020-2022 Vito Tardia <https://vito.tardia.me>
+ *
+ * This file is part of C2Hat
+ *
+ * C2Hat is a simple client/server TCP chat written in C
+ *
+ * C2Hat is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * C2Hat is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with C2Hat. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "timers.h"
+
+enum {
+  kManyTimers = 5000
+};
+
+/// Records the tick at which each timer expired
+typedef struct {
+  uint64_t now; ///< Tick being processed
+  uint64_t expiredAt[kManyTimers]; ///< Expiration tick of each timer
+} Expirations;
+
+/// Stores the expiration tick in the item of the timer
+void recordExpiration(Timer *timer, void *context) {
+  Expirations *expirations = (Expirations *)context;
+  size_t index = (size_t)(uintptr_t)timer->item;
+  expirations->expiredAt[index] = expirations->now;
+}
+
+/// Reschedules the timer once, with the delay stored in the context
+void rescheduleOnce(Timer *timer, void *context) {
+  TimerWheel *wheel = (TimerWheel *)context;
+  if (timer->item == NULL) {
+    timer->item = timer;
+    TimerWheel_schedule(wheel, timer, 10);
+  }
+}
+
+/// Cancels the timer stored in the item of the expired one
+void cancelOther(Timer *timer, void *context) {
+  TimerWheel_cancel((TimerWheel *)context, (Timer *)timer->item);
+}
+
+/// Advances the wheel one tick at a time, recording expirations
+size_t advanceTo(TimerWheel *wheel, Expirations *expirations, uint64_t from, uint64_t to) {
+  size_t total = 0;
+  for (uint64_t tick = from + 1; tick <= to; tick++) {
+    expirations->now = tick;
+    total += TimerWheel_advance(wheel, tick, recordExpiration, expirations);
+  }
+  return total;
+}
+
+int main() {
+  static Expirations expirations = {};
+  static Timer timers[kManyTimers] = {};
+
+  TimerWheel *wheel = TimerWheel_new(1000);
+  assert(wheel != NULL);
+  assert(TimerWheel_length(wheel) == 0);
+  assert(TimerWheel_peak(wheel) == 0);
+  printf(".");
+
+  // A zero-filled timer is not scheduled
+  Timer timer = { .item = (void *)0 };
+  assert(!Timer_pending(&timer));
+  TimerWheel_schedule(wheel, &timer, 5);
+  assert(Timer_pending(&timer));
+  assert(TimerWheel_length(wheel) == 1);
+  printf(".");
+
+  // Timers expire on their tick and not before
+  assert(advanceTo(wheel, &expirations, 1000, 1004) == 0);
+  assert(Timer_pending(&timer));
+  assert(advanceTo(wheel, &expirations, 1004, 1005) == 1);
+  assert(expirations.expiredAt[0] == 1005);
+  assert(!Timer_pending(&timer));
+  assert(TimerWheel_length(wheel) == 0);
+  printf(".");
+
+  // Rescheduling moves the expiration
+  TimerWheel_schedule(wheel, &timer, 5);
+  assert(advanceTo(wheel, &expirations, 1005, 1008) == 0);
+  TimerWheel_schedule(wheel, &timer, 5);
+  assert(TimerWheel_length(wheel) == 1);
+  assert(advanceTo(wheel, &expirations, 1008, 1012) == 0);
+  assert(advanceTo(wheel, &expirations, 1012, 1013) == 1);
+  assert(expirations.expiredAt[0] == 1013);
+  printf(".");
+
+  // Cancelled timers never expire
+  TimerWheel_schedule(wheel, &timer, 3);
+  TimerWheel_cancel(wheel, &timer);
+  TimerWheel_cancel(wheel, &timer);
+  assert(!Timer_pending(&timer));
+  assert(TimerWheel_length(wheel) == 0);
+  assert(advanceTo(wheel, &expirations, 1013, 1020) == 0);
+  printf(".");
+
+  // Long delays cascade through the levels and expire on time
+  for (size_t i = 0; i < kManyTimers; i++) {
+    timers[i].item = (void *)(uintptr_t)i;
+    TimerWheel_schedule(wheel, &timers[i], 1 + (i * 37) % 20000);
+  }
+  assert(TimerWheel_length(wheel) == kManyTimers);
+  assert(advanceTo(wheel, &expirations, 1020, 1020 + 20000) == kManyTimers);
+  for (size_t i = 0; i < kManyTimers; i++) {
+    assert(expirations.expiredAt[i] == 1020 + 1 + (i * 37) % 20000);
+  }
+  assert(TimerWheel_length(wheel) == 0);
+  printf(".");
+
+  // Skipped ticks are processed in a single call
+  for (size_t i = 0; i < 100; i++) {
+    TimerWheel_schedule(wheel, &timers[i], 1 + i % 4);
+  }
+  expirations.now = 30000;
+  assert(TimerWheel_advance(wheel, 30000, recordExpiration, &expirations) == 100);
+  assert(TimerWheel_length(wheel) == 0);
+  printf(".");
+
+  // The peak counts the expirations of the busiest tick
+  assert(TimerWheel_peak(wheel) == 25);
+  for (size_t i = 0; i < 40; i++) {
+    TimerWheel_schedule(wheel, &timers[i], 7);
+  }
+  assert(advanceTo(wheel, &expirations, 30000, 30007) == 40);
+  assert(TimerWheel_peak(wheel) == 40);
+  printf(".");
+
+  // Callbacks can reschedule the expired timer
+  timer.item = NULL;
+  TimerWheel_schedule(wheel, &timer, 1);
+  assert(TimerWheel_advance(wheel, 30008, rescheduleOnce, wheel) == 1);
+  assert(Timer_pending(&timer));
+  assert(TimerWheel_advance(wheel, 30017, rescheduleOnce, wheel) == 0);
+  assert(TimerWheel_advance(wheel, 30018, rescheduleOnce, wheel) == 1);
+  assert(!Timer_pending(&timer));
+  printf(".");
+
+  // Callbacks can cancel timers that expire in the same tick
+  timers[0].item = &timers[1];
+  timers[1].item = &timers[0];
+  TimerWheel_schedule(wheel, &timers[0], 2);
+  TimerWheel_schedule(wheel, &timers[1], 2);
+  assert(TimerWheel_advance(wheel, 30020, cancelOther, wheel) == 1);
+  assert(!Timer_pending(&timers[0]));
+  assert(!Timer_pending(&timers[1]));
+  assert(TimerWheel_length(wheel) == 0);
+  printf(".");
+
+  // Delays beyond the wheel range are clamped
+  TimerWheel_schedule(wheel, &timer, UINT64_MAX);
+  assert(timer.expires > 30020);
+  printf(".");
+
+  // Freeing the wheel cancels the scheduled timers
+  TimerWheel_free(&wheel);
+  assert(wheel == NULL);
+  assert(!Timer_pending(&timer));
+  printf(".");
+
+  printf("\n");
+  return EXIT_SUCCESS;
+}
@@ -28,37 +28,48 @@
 #include "../../src/client/uilog.h"
 
 int main() {
-  char *buffer = NULL;
-  size_t length = 0;
+  C2HMessage *message = NULL;
   ChatLogEntry *entry = NULL;
 
   // Test a log message
-  buffer = "/log [Joe24] just left the chat";
-  // Length is the number of bytes received from the network,
-  // so it will include the NULL terminator
-  length = strlen(buffer) + 1;
-  entry = ChatLogEntry_create(buffer, length);
+  message = C2HMessage_create(kMessageTypeLog, "[Joe24] just left the chat");
+  entry = ChatLogEntry_create(message);
   assert(entry->type == kMessageTypeLog);
   printf(".");
   assert(strcmp(entry->username, "Joe24") == 0);
   printf(".");
-  assert(strcmp(entry->content, "[Joe24] just left the chat") == 0);
+  assert(strcmp(entry->content, "just left the chat") == 0);
+  assert(entry->length == strlen("just left the chat"));
   printf(".");
   ChatLogEntry_free(&entry);
+  C2HMessage_free(&message);
 
   // Test a chat message
-  buffer = "/msg [Joe24] Hello world!";
-  length = strlen(buffer) + 1;
-  entry = ChatLogEntry_create(buffer, length);
+  message = C2HMessage_create(kMessageTypeMsg, "[Joe24] Hello world!");
+  entry = ChatLogEntry_create(message);
   assert(entry->type == kMessageTypeMsg);
   printf(".");
   assert(strcmp(entry->username, "Joe24") == 0);
   printf(".");
-  assert(strcmp(entry->content, "[Joe24] Hello world!") == 0);
+  assert(strcmp(entry->content, "Hello world!") == 0);
+  printf(".");
+  ChatLogEntry_free(&entry);
+  C2HMessage_free(&message);
+
+  // Empty messages are not logged
+  message = C2HMessage_create(kMessageTypeOk, "");
+  assert(ChatLogEntry_create(message) == NULL);
+  C2HMessage_free(&message);
+  printf(".");
+
+  // Messages initialised in place
+  C2HMessage error = { .type = kMessageTypeErr, .content = "You have been disconnected" };
+  entry = ChatLogEntry_create(&error);
+  assert(strcmp(entry->content, "You have been disconnected") == 0);
+  assert(strlen(entry->username) == 0);
   printf(".");
   ChatLogEntry_free(&entry);
 
   printf("\n");
   return EXIT_SUCCESS;
 }
-
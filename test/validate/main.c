@@ -21,7 +21,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <locale.h>
 
 #include "validate/validate.h"
 
@@ -87,6 +89,79 @@ int main() {
   assert(!Regex_match("Holy\nJoeBlog", usernamePattern, NULL, 0));
   printf(".");
 
+  // Invalid patterns report an error and are not cached
+  char error[256] = {};
+  assert(Regex_match("Jo", "[[:alpha:]", error, sizeof(error)) < 0);
+  assert(strlen(error) > 0);
+  printf(".");
+
+  assert(Regex_match("Jo", "[[:alpha:]", NULL, 0) < 0);
+  printf(".");
+
+  // Patterns beyond the cache size are still compiled and executed
+  char pattern[32] = {};
+  for (int i = 0; i < 20; i++) {
+    snprintf(pattern, sizeof(pattern), "^J.\\{%d\\}$", i);
+    assert(Regex_match("Jo", pattern, NULL, 0) == (i == 1));
+  }
+  assert(Regex_match("J0e$m1th99", usernamePattern, NULL, 0));
+  printf(".");
+
+  // The hand-written validator follows the same rules
+  assert(!Validate_nickname(""));
+  assert(!Validate_nickname("J"));
+  assert(Validate_nickname("Jo"));
+  assert(!Validate_nickname("UsernameLongerThan15Characters"));
+  assert(!Validate_nickname("UsernameWith16Ch"));
+  assert(Validate_nickname("UsernameWith15C"));
+  assert(Validate_nickname("J0e$m1th99"));
+  assert(!Validate_nickname("10Endians"));
+  assert(!Validate_nickname("@SomeOne"));
+  assert(!Validate_nickname("Hallo🎃"));
+  assert(!Validate_nickname("🎃Hallo"));
+  assert(!Validate_nickname("No Spaces"));
+  assert(Validate_nickname("Holy!@#$%&"));
+  assert(!Validate_nickname("Holy!@#$%&^;"));
+  assert(!Validate_nickname("Holy\nJoeBlog"));
+  printf(".");
+
+  // Same result as the regex for every short string over a mixed alphabet
+  const char alphabet[] = "aZ09!&^ _\xc3";
+  size_t size = strlen(alphabet);
+  char subject[4] = {};
+  for (size_t a = 0; a < size; a++) {
+    for (size_t b = 0; b <= size; b++) {
+      for (size_t c = 0; c <= size; c++) {
+        subject[0] = alphabet[a];
+        subject[1] = (b < size) ? alphabet[b] : '\0';
+        subject[2] = (b < size && c < size) ? alphabet[c] : '\0';
+        assert(Validate_nickname(subject) == (Regex_match(subject, usernamePattern, NULL, 0) == 1));
+      }
+    }
+  }
+  printf(".");
+
+  // In a UTF-8 locale, like the one the server runs in, both validators
+  // accept letters of any script and count characters, not bytes
+  Regex_clearCache();
+  if (setlocale(LC_ALL, "C.UTF-8") != NULL) {
+    const char *valid[] = {"José", "Zoë", "Jé", "Ééééééééééééééé", "Søren99", "Ωmega"};
+    for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+      assert(Regex_match(valid[i], usernamePattern, NULL, 0) == 1);
+      assert(Validate_nickname(valid[i]));
+    }
+    const char *invalid[] = {
+      "É", "Éééééééééééééééé", "9José", "Hallo🎃", "🎃Hallo", "José Maria", "Jo\xc3", "Jo\xe9"
+    };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+      assert(Regex_match(invalid[i], usernamePattern, NULL, 0) != 1);
+      assert(!Validate_nickname(invalid[i]));
+    }
+    printf(".");
+  }
+
+  Regex_clearCache();
+
   printf("\n");
   return EXIT_SUCCESS;
 }